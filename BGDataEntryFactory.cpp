@@ -49,3 +49,25 @@ BGDataEntry* BGDataEntryFactory::createDataEntry(const QStringList& rawData)
 
     return bgDataEntry;
 }
+
+/*-----------------------------------------------------------------------------
+Name:     createDataEntry
+Purpose:  Fills a BGDataEntry from a binary scraper record, the same way as
+          from the text fields but without parsing.
+Receive:  const ScraperRecord& record
+Return:   BGDataEntry*
+-----------------------------------------------------------------------------*/
+BGDataEntry* BGDataEntryFactory::createDataEntry(const ScraperRecord& record)
+{
+    BGDataEntry* bgDataEntry = new BGDataEntry();
+
+    bgDataEntry->setValue(record.value);
+    bgDataEntry->setTrend(record.trend);
+    bgDataEntry->setSampleTime(record.sampleTime);
+
+    double scrapeTime = record.sampleTime + record.lag;
+    bgDataEntry->setScrapeTime(scrapeTime);
+    bgDataEntry->setDelayTime((record.sampleTime+300.0)-scrapeTime);
+
+    return bgDataEntry;
+}
@@ -24,6 +24,7 @@
 
 #include "AbstractDataEntryFactory.h"
 #include "BGDataEntry.h"
+#include "ScraperRecord.h"
 
 class BGDataEntryFactory : public AbstractDataEntryFactory
 {
@@ -32,6 +33,7 @@ public:
     BGDataEntryFactory(BGDataEntryFactory& factory);
     virtual ~BGDataEntryFactory() = default;
     virtual BGDataEntry* createDataEntry(const QStringList& rawData);
+    BGDataEntry* createDataEntry(const ScraperRecord& record);
 };
 
 #endif // BGDATAENTRYFACTORY_H
@@ -0,0 +1,169 @@
+/******************************************************************************
+** FILE: BGTableModel.cpp
+**
+** ABSTRACT:
+** Table model that shows the most recent BG readings
+** published by the control thread, one row per reading,
+** oldest first. Replaces the QTableWidget that allocated a
+** row of items per reading forever.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+**
+******************************************************************************/
+
+#include "BGTableModel.h"
+#include <QDateTime>
+#include <algorithm>
+
+/*-----------------------------------------------------------------------------
+Name:     BGTableModel
+Purpose:  Constructor. The model starts empty and is filled by the control
+          thread's snapshots.
+Receive:  int capacity most readings shown
+          QObject* parent
+Return:   N/A
+-----------------------------------------------------------------------------*/
+BGTableModel::BGTableModel(int capacity, QObject *parent) :
+    QAbstractTableModel(parent),
+    m_readings(std::max(capacity, 1))
+{
+}
+
+/*-----------------------------------------------------------------------------
+Name:     readingAt
+Purpose:  Maps a row to its slot in the ring.
+Receive:  int row, 0 <= row < m_rowCount
+Return:   const BGReading&
+-----------------------------------------------------------------------------*/
+const BGReading &BGTableModel::readingAt(int row) const
+{
+    return m_readings[(m_first+row)%m_readings.size()];
+}
+
+/*-----------------------------------------------------------------------------
+Name:     rowCount
+Purpose:  Returns the number of readings shown.
+Receive:  const QModelIndex& parent
+Return:   int
+-----------------------------------------------------------------------------*/
+int BGTableModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : m_rowCount;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     columnCount
+Purpose:  Returns the number of fields shown per reading.
+Receive:  const QModelIndex& parent
+Return:   int
+-----------------------------------------------------------------------------*/
+int BGTableModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : ColumnCount;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     data
+Purpose:  Returns the text of one cell, formatted on demand from the model's
+          own ring copy of the reading, never from the DataQueue.
+Receive:  const QModelIndex& index, int role
+Return:   QVariant
+-----------------------------------------------------------------------------*/
+QVariant BGTableModel::data(const QModelIndex &index, int role) const
+{
+    if(role!=Qt::DisplayRole || !index.isValid()){
+        return QVariant();
+    }
+    if(index.row()<0 || index.row()>=m_rowCount){
+        return QVariant();
+    }
+    const BGReading& reading = readingAt(index.row());
+    switch(index.column()){
+    case ValueColumn:
+        return reading.value;
+    case TrendColumn:
+        return reading.trend;
+    case SampleTimeColumn:
+        return QDateTime::fromMSecsSinceEpoch(
+               (qint64)(reading.sampleTime*1000.0)).toString(
+               "yyyy-MM-dd hh:mm:ss");
+    case DelayTimeColumn:
+        return reading.delayTime;
+    }
+    return QVariant();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     headerData
+Purpose:  Returns the column titles.
+Receive:  int section, Qt::Orientation orientation, int role
+Return:   QVariant
+-----------------------------------------------------------------------------*/
+QVariant BGTableModel::headerData(int section, Qt::Orientation orientation,
+                                  int role) const
+{
+    if(role!=Qt::DisplayRole || orientation!=Qt::Horizontal){
+        return QAbstractTableModel::headerData(section, orientation, role);
+    }
+    switch(section){
+    case ValueColumn:
+        return QString("BG");
+    case TrendColumn:
+        return QString("Trend");
+    case SampleTimeColumn:
+        return QString("Sample Time");
+    case DelayTimeColumn:
+        return QString("Delay");
+    }
+    return QVariant();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     appendReadings
+Purpose:  Adds readings published since the last snapshot. New readings
+          become rows appended at the bottom and readings the ring
+          overwrites are removed from the top, so a cycle costs the same
+          however long the table is. More readings than the ring holds
+          reset the model.
+Receive:  const vector<BGReading>& readings, oldest first
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void BGTableModel::appendReadings(const vector<BGReading>& readings)
+{
+    int capacity = m_readings.size();
+    int added = readings.size();
+    if(!added){
+        return;
+    }
+    if(added>=capacity){
+        beginResetModel();
+        std::copy(readings.end()-capacity, readings.end(),
+                  m_readings.begin());
+        m_first = 0;
+        m_rowCount = capacity;
+        endResetModel();
+        return;
+    }
+    int removed = m_rowCount+added-capacity;
+    if(removed>0){
+        beginRemoveRows(QModelIndex(), 0, removed-1);
+        m_first = (m_first+removed)%capacity;
+        m_rowCount -= removed;
+        endRemoveRows();
+    }
+    beginInsertRows(QModelIndex(), m_rowCount, m_rowCount+added-1);
+    for(int i=0; i<added; i++){
+        m_readings[(m_first+m_rowCount+i)%capacity] = readings[i];
+    }
+    m_rowCount += added;
+    endInsertRows();
+}
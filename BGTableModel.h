@@ -0,0 +1,68 @@
+/******************************************************************************
+** FILE: BGTableModel.h
+**
+** ABSTRACT:
+** Table model that shows the most recent BG readings
+** published by the control thread, one row per reading,
+** oldest first. Replaces the QTableWidget that allocated a
+** row of items per reading forever.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** The DataQueue belongs to the control thread, so the
+** model keeps its own fixed ring of readings sized like the
+** queue. appendReadings turns each new reading into one
+** appended row and, once the ring is full, one removed row
+** at the top, so views only repaint what changed.
+**
+******************************************************************************/
+
+#ifndef BGTABLEMODEL_H
+#define BGTABLEMODEL_H
+
+#include <QAbstractTableModel>
+#include "CycleSnapshot.h"
+
+class BGTableModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+protected:
+    //ring of the last m_readings.size() readings, row 0 at m_first
+    vector<BGReading> m_readings;
+    int m_first = 0;
+    int m_rowCount = 0;
+
+    const BGReading& readingAt(int row) const;
+
+public:
+    enum Column
+    {
+        ValueColumn,
+        TrendColumn,
+        SampleTimeColumn,
+        DelayTimeColumn,
+        ColumnCount
+    };
+
+    explicit BGTableModel(int capacity = 288, QObject* parent = nullptr);
+    ~BGTableModel() = default;
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index,
+                  int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation,
+                        int role = Qt::DisplayRole) const override;
+    void appendReadings(const vector<BGReading>& readings);
+};
+
+#endif // BGTABLEMODEL_H
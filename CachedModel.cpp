@@ -0,0 +1,249 @@
+/******************************************************************************
+** FILE: CachedModel.cpp
+**
+** ABSTRACT:
+** Wraps another model behind a ProjectionCache.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+**
+******************************************************************************/
+
+#include "CachedModel.h"
+#include <cstring>
+#include <unordered_map>
+
+namespace {
+    //kinds of key, a trajectory from predict isn't one from a projection
+    const int kPredictKind = 1;
+    const int kProjectionKind = 2;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     CachedModel
+Purpose:  Constructor.
+Receive:  Model* model, the model to cache, not owned
+          int capacity, cache entries
+Return:   N/A
+-----------------------------------------------------------------------------*/
+CachedModel::CachedModel(Model *model, int capacity) :
+    m_model(model),
+    m_cache(capacity)
+{
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getModel
+Purpose:  Returns the wrapped model.
+Receive:  N/A
+Return:   Model*
+-----------------------------------------------------------------------------*/
+Model* CachedModel::getModel() const
+{
+    return m_model;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getCache
+Purpose:  Returns the cache, for its statistics.
+Receive:  N/A
+Return:   ProjectionCache&
+-----------------------------------------------------------------------------*/
+ProjectionCache& CachedModel::getCache()
+{
+    return m_cache;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     clearCache
+Purpose:  Drops every cached trajectory. Call whenever the wrapped model's
+          parameters change.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void CachedModel::clearCache()
+{
+    m_cache.clear();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setBGInputWindow
+Purpose:  Sets which BG values the wrapped model reads: the first count
+          (the forests) or the newest count (the LSTM). Only those are
+          keyed and passed on, so longer inputs, like the MPC's fused
+          prediction, still hit. 0 passes every value.
+Receive:  int count, bool newest
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void CachedModel::setBGInputWindow(int count, bool newest)
+{
+    m_bgInputCount = count;
+    m_newestBGInputs = newest;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getBGWindow
+Purpose:  Returns the BG values the wrapped model reads.
+Receive:  const vector<double>& bgInputs
+Return:   vector<double>
+-----------------------------------------------------------------------------*/
+vector<double> CachedModel::getBGWindow(const vector<double> &bgInputs) const
+{
+    if(m_bgInputCount<=0 || bgInputs.size()<=m_bgInputCount){
+        return bgInputs;
+    }
+    if(m_newestBGInputs){
+        return vector<double>(bgInputs.end()-m_bgInputCount, bgInputs.end());
+    }
+    return vector<double>(bgInputs.begin(),
+                          bgInputs.begin()+m_bgInputCount);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     predict
+Purpose:  Returns the cached prediction for the quantised inputs, running
+          the wrapped model on them on a miss. A hit with saveFlag set is
+          saved through the wrapped model's savePrediction.
+Receive:  bgInputs and insulin inputs for the model, saveFlag to save the
+          prediction through the wrapped model
+Return:   vector<double> predictions for future BG (90 mins / 5 = 18 values)
+-----------------------------------------------------------------------------*/
+vector<double> CachedModel::predict(vector<int> bgInputs,
+                                    vector<float> insulinInputs,
+                                    bool saveFlag)
+{
+    ProjectionKey key;
+    vector<double> window = getBGWindow(vector<double>(bgInputs.begin(),
+                                                       bgInputs.end()));
+    if(!key.set(m_cache.getGeneration(), kPredictKind, 0, window,
+                insulinInputs)){
+        return m_model->predict(bgInputs, insulinInputs, saveFlag);
+    }
+    vector<double> bgPredictions;
+    if(m_cache.lookup(key, bgPredictions)){
+        if(saveFlag){
+            m_model->savePrediction(bgPredictions);
+        }
+        return bgPredictions;
+    }
+    bgPredictions = m_model->predict(bgInputs, key.getInsulinInputs(),
+                                     saveFlag);
+    m_cache.store(key, bgPredictions);
+    return bgPredictions;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     projectCorrection
+Purpose:  Returns the cached projection for the quantised inputs, running
+          the wrapped model on them on a miss.
+Receive:  bgInputs and insulin inputs for the model, sensitivity is constant
+          representing the impact of 1 unit of insulin on blood glucose.
+Return:   vector<double> predictions for future BG (90 mins / 5 = 18 values)
+-----------------------------------------------------------------------------*/
+vector<double> CachedModel::projectCorrection(vector<double> bgInputs,
+                                              vector<float> insulinInputs,
+                                              int sensitivity)
+{
+    ProjectionKey key;
+    if(!key.set(m_cache.getGeneration(), kProjectionKind, sensitivity,
+                getBGWindow(bgInputs), insulinInputs)){
+        return m_model->projectCorrection(bgInputs, insulinInputs,
+                                          sensitivity);
+    }
+    vector<double> bgPredictions;
+    if(m_cache.lookup(key, bgPredictions)){
+        return bgPredictions;
+    }
+    bgPredictions = m_model->projectCorrection(key.getBGInputs(),
+                                               key.getInsulinInputs(),
+                                               sensitivity);
+    m_cache.store(key, bgPredictions);
+    return bgPredictions;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     projectCorrections
+Purpose:  Answers what it can of a batch from the cache and runs the
+          wrapped model once over the remaining distinct candidates, so
+          models that batch keep doing so.
+Receive:  bgInputs for the model, insulinInputs holds one future insulin
+          curve per control input candidate, sensitivity is constant
+          representing the impact of 1 unit of insulin on blood glucose.
+Return:   vector<vector<double>> predictions for future BG, one trajectory
+          per candidate aligned with insulinInputs by index
+-----------------------------------------------------------------------------*/
+vector<vector<double>> CachedModel::projectCorrections(
+                                const vector<double>& bgInputs,
+                                const vector<vector<float>>& insulinInputs,
+                                int sensitivity)
+{
+    int32_t generation = m_cache.getGeneration();
+    vector<vector<double>> results(insulinInputs.size());
+    vector<ProjectionKey> missKeys;
+    vector<vector<float>> missInputs;
+    //candidate index to its entry in missKeys
+    vector<int> missIndex(insulinInputs.size(), -1);
+    std::unordered_multimap<uint64_t, int> missByHash;
+    vector<double> window = getBGWindow(bgInputs);
+    ProjectionKey key;
+    for(int i=0; i<insulinInputs.size(); i++){
+        if(!key.set(generation, kProjectionKind, sensitivity, window,
+                    insulinInputs[i])){
+            return m_model->projectCorrections(bgInputs, insulinInputs,
+                                               sensitivity);
+        }
+        if(m_cache.lookup(key, results[i])){
+            continue;
+        }
+        //candidates that quantise to the same key are run once
+        uint64_t hash = key.hash();
+        auto range = missByHash.equal_range(hash);
+        for(auto it=range.first; it!=range.second; ++it){
+            if(!std::memcmp(missKeys[it->second].values, key.values,
+                            sizeof(key.values))){
+                missIndex[i] = it->second;
+                break;
+            }
+        }
+        if(missIndex[i]<0){
+            missIndex[i] = missKeys.size();
+            missByHash.insert(std::make_pair(hash, missIndex[i]));
+            missKeys.push_back(key);
+            missInputs.push_back(key.getInsulinInputs());
+        }
+    }
+    if(missKeys.empty()){
+        return results;
+    }
+
+    vector<vector<double>> missResults = m_model->projectCorrections(
+                missKeys[0].getBGInputs(), missInputs, sensitivity);
+    for(int j=0; j<missKeys.size() && j<missResults.size(); j++){
+        m_cache.store(missKeys[j], missResults[j]);
+    }
+    for(int i=0; i<insulinInputs.size(); i++){
+        if(missIndex[i]>=0 && missIndex[i]<missResults.size()){
+            results[i] = missResults[missIndex[i]];
+        }
+    }
+    return results;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     savePrediction
+Purpose:  Saves through the wrapped model.
+Receive:  const vector<double>& bgPredictions
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void CachedModel::savePrediction(const vector<double> &bgPredictions) const
+{
+    m_model->savePrediction(bgPredictions);
+}
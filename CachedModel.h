@@ -0,0 +1,73 @@
+/******************************************************************************
+** FILE: CachedModel.h
+**
+** ABSTRACT:
+** Wraps another model behind a ProjectionCache so that
+** predict and projectCorrection calls whose inputs match
+** an earlier call at sensor and pump resolution are
+** answered from the cache instead of re-running the model.
+** Meant for the expensive fixed models (RF, LSTM).
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** The wrapped model is always run on the quantised inputs,
+** so a trajectory is the same whether it came from the
+** cache or not. Models whose parameters change online
+** (StateSpaceModel) must not be wrapped, or clearCache
+** must be called every time they change. predict with the
+** save flag set still looks up; on a hit the wrapped
+** model's savePrediction does the saving.
+** Keys hold only the BG values the wrapped model reads
+** (setBGInputWindow), so a projection from the MPC's 18
+** value fused prediction keys on the 6 the RF uses.
+**
+******************************************************************************/
+
+#ifndef CACHEDMODEL_H
+#define CACHEDMODEL_H
+
+#include "Model.h"
+#include "ProjectionCache.h"
+
+class CachedModel : public Model
+{
+protected:
+    //not owned
+    Model* m_model;
+    ProjectionCache m_cache;
+    //BG values the wrapped model reads, the first or newest ones, 0 for all
+    int m_bgInputCount = 0;
+    bool m_newestBGInputs = false;
+
+    vector<double> getBGWindow(const vector<double>& bgInputs) const;
+
+public:
+    explicit CachedModel(Model* model, int capacity = 4096);
+    virtual ~CachedModel() = default;
+
+    Model* getModel() const;
+    ProjectionCache& getCache();
+    void clearCache();
+    void setBGInputWindow(int count, bool newest);
+
+    vector<double> predict(vector<int> bgInputs, vector<float> insulinInputs,
+                           bool saveFlag);
+    vector<double> projectCorrection(vector<double> bgInputs,
+                                     vector<float> insulinInputs,
+                                     int sensitivity);
+    vector<vector<double>> projectCorrections(
+                                const vector<double>& bgInputs,
+                                const vector<vector<float>>& insulinInputs,
+                                int sensitivity);
+    void savePrediction(const vector<double>& bgPredictions) const;
+};
+
+#endif // CACHEDMODEL_H
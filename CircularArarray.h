@@ -17,6 +17,9 @@
 ** 06/24/2019
 **
 ** NOTES:
+** The backing vector is sized to the capacity on first
+** use and never shifts; index i of the array (0 oldest)
+** lives at m_data[(m_headIndex+i)%m_capacity].
 **
 ******************************************************************************/
 
@@ -52,6 +55,7 @@ public:
     Type dequeue();
     Type getFirstValue() const;
     Type getLastValue() const;
+    Type getValueAt(int i) const;
     bool isFull() const;
     bool isEmpty() const;
     vector<Type> getNValues(int n);
@@ -81,7 +85,23 @@ int CircularArray<Type>::getCapacity() const
 template <class Type>
 void CircularArray<Type>::setCapacity(const int& cap)
 {
+    if(cap<=0 || cap==m_capacity){
+        return;
+    }
+    //keep the newest entries in order, releasing any that no longer fit
+    vector<Type> data;
+    for(int i=0; i<m_size; i++){
+        data.push_back(getValueAt(i));
+    }
+    int dropped = m_size>cap ? m_size-cap : 0;
+    for(int i=0; i<dropped; i++){
+        delete data[i];
+    }
     m_capacity = cap;
+    m_data.assign(data.begin()+dropped, data.end());
+    m_size = m_data.size();
+    m_headIndex = 0;
+    m_tailIndex = m_size%m_capacity;
 }
 
 template <class Type>
@@ -111,14 +131,17 @@ void CircularArray<Type>::setTailIndex(const int& tailIndex)
 template <class Type>
 void CircularArray<Type>::enqueue(const Type& t)
 {
+    if(m_data.size()!=m_capacity){
+        m_data.resize(m_capacity, Type());
+    }
+    //a full array overwrites (and releases) its oldest entry
     if(m_size==m_capacity){
-        this->dequeue();
-        m_size -= 1;
+        delete this->dequeue();
     }
     m_tailIndex = (m_headIndex + m_size) % m_capacity;
-    m_data.insert(m_data.begin()+m_tailIndex, t);
+    m_data[m_tailIndex] = t;
     m_size+=1;
-    m_tailIndex+=1;
+    m_tailIndex = (m_tailIndex + 1) % m_capacity;
 }
 
 template <class Type>
@@ -128,7 +151,7 @@ Type CircularArray<Type>::dequeue()
         return nullptr;
     }
     Type item = m_data.at(m_headIndex);
-    m_data.erase(m_data.begin()+m_headIndex, m_data.begin()+m_headIndex+1);
+    m_data[m_headIndex] = Type();
     m_headIndex = (m_headIndex + 1) % m_capacity;
     m_size-=1;
     return item;
@@ -143,13 +166,13 @@ Type CircularArray<Type>::getFirstValue() const
 template <class Type>
 Type CircularArray<Type>::getLastValue() const
 {
-    if(m_size>1){
-        return m_data.at(m_tailIndex-1);
-    }
-    else{
-        return m_data.at(m_headIndex);
-    }
+    return m_data.at((m_headIndex + m_size + m_capacity - 1) % m_capacity);
+}
 
+template <class Type>
+Type CircularArray<Type>::getValueAt(int i) const
+{
+    return m_data.at((m_headIndex + i) % m_capacity);
 }
 
 template <class Type>
@@ -167,18 +190,19 @@ bool CircularArray<Type>::isEmpty() const
 template <class Type>
 void CircularArray<Type>::print()
 {
-    for(int i = 0; i< m_data.size();i++){
+    for(int i = 0; i< m_size;i++){
         std::cout << "Entry " << i << ": " ;
-        m_data[i]->print();
+        getValueAt(i)->print();
     }
 }
 
 template <class Type>
 vector<Type> CircularArray<Type>::getNValues(int n)
 {
+    //the n most recent values, oldest first
     vector<Type> data;
-    for(int i = 0; i< n; i++){
-        data.push_back(m_data[i]);
+    for(int i = m_size-n; i< m_size; i++){
+        data.push_back(getValueAt(i));
     }
     return data;
 }
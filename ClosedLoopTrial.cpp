@@ -0,0 +1,526 @@
+/******************************************************************************
+** FILE: ClosedLoopTrial.cpp
+**
+** ABSTRACT:
+** Runs the controller in closed loop against a population
+** of virtual patients. Every 5 minutes each patient's CGM
+** reading and insulin on board go through the same
+** DataQueue ingest path the DataScraper output does, an
+** MPC configured like the live one picks a bolus from the
+** patient's own adaptive state space model and the bolus
+** is given to the simulator.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** The simulator advances all patients together, then the
+** controllers for that cycle run across the thread pool.
+** Doses are only handed back to the simulator once every
+** controller has finished so the batch state is never
+** written from more than one thread.
+**
+******************************************************************************/
+
+#include "ClosedLoopTrial.h"
+#include "DataQueue.h"
+#include "InsulinKinetics.h"
+#include "ModelPredictiveController.h"
+#include "StateSpaceModel.h"
+#include "ThreadPool.h"
+#include <chrono>
+#include <iostream>
+#include <math.h>
+#include <random>
+
+namespace
+{
+const double kCycleMinutes = 5.0;
+const int kCyclesPerDay = 288;
+const int kBGInputs = 6;
+const int kFutureInsulinValues = 19;
+//arbitrary epoch for the simulated sample times
+const double kStartTime = 1.7e9;
+const int kMinReading = 40;
+const int kMaxReading = 400;
+//glucose the correction factor is measured from
+const double kCorrectionGlucose = 200.0;
+//hypoglycaemia treatment: grams per rescue, below this CGM reading,
+//at most this often
+const double kRescueGrams = 15.0;
+const int kRescueReading = 70;
+const double kRescueMinutes = 15.0;
+}
+
+struct ClosedLoopTrial::VirtualPatient
+{
+    DataQueue* queue = nullptr;
+    StateSpaceModel* model = nullptr;
+    std::mt19937 generator;
+    vector<double> mealTimes;
+    vector<double> mealGrams;
+    int nextMeal = 0;
+    vector<double> doseTimes;
+    vector<double> doseUnits;
+    double pendingDose = 0.0;
+    double pendingCarbs = 0.0;
+    double lastRescue = -kRescueMinutes;
+    int lastReading = 0;
+    //correction factor in mg/dl per unit
+    int sensitivity = 0;
+
+    long readings = 0;
+    double glucoseSum = 0.0;
+    long below54 = 0;
+    long below70 = 0;
+    long inRange = 0;
+    long above180 = 0;
+    double totalInsulin = 0.0;
+    double basalInsulin = 0.0;
+    double rescueCarbs = 0.0;
+};
+
+/*-----------------------------------------------------------------------------
+Name:     ~ClosedLoopTrial
+Purpose:  Releases the virtual patients' queues and models.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+ClosedLoopTrial::~ClosedLoopTrial()
+{
+    clearPatients();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     clearPatients
+Purpose:  Deletes the virtual patients of a previous run.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ClosedLoopTrial::clearPatients()
+{
+    for(int i=0; i<m_patients.size(); i++){
+        delete m_patients[i]->queue;
+        delete m_patients[i]->model;
+        delete m_patients[i];
+    }
+    m_patients.clear();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setPatientCount
+Purpose:  Sets the number of virtual patients in the trial.
+Receive:  int patientCount
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ClosedLoopTrial::setPatientCount(int patientCount)
+{
+    m_patientCount = patientCount;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setDays
+Purpose:  Sets the length of the trial in days.
+Receive:  int days
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ClosedLoopTrial::setDays(int days)
+{
+    m_days = days;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setSeed
+Purpose:  Sets the seed for the patient population, meals and sensor noise.
+Receive:  unsigned int seed
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ClosedLoopTrial::setSeed(unsigned int seed)
+{
+    m_seed = seed;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setThreadCount
+Purpose:  Sets the number of threads running controllers, 0 for one per core.
+Receive:  int threadCount
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ClosedLoopTrial::setThreadCount(int threadCount)
+{
+    m_threadCount = threadCount;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setSensorNoise
+Purpose:  Sets the standard deviation of the simulated CGM error in mg/dl.
+Receive:  double sensorNoise
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ClosedLoopTrial::setSensorNoise(double sensorNoise)
+{
+    m_sensorNoise = sensorNoise;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setTarget
+Purpose:  Sets the target BG given to every patient's MPC.
+Receive:  int target
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ClosedLoopTrial::setTarget(int target)
+{
+    m_controllerSettings.target = target;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setMaxBolus
+Purpose:  Sets the largest bolus any patient's MPC may give per cycle.
+Receive:  double maxBolus
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ClosedLoopTrial::setMaxBolus(double maxBolus)
+{
+    m_controllerSettings.maxBolus = maxBolus;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setControlMoves
+Purpose:  Sets the number of doses every patient's MPC plans per cycle.
+Receive:  int controlMoves
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ClosedLoopTrial::setControlMoves(int controlMoves)
+{
+    m_controllerSettings.controlMoves = controlMoves;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setAdaptive
+Purpose:  Sets whether every patient's state space model adapts online or
+          stays fixed, so the two can be compared on the same population.
+          Either way the MPC doses on the patient's correction factor.
+Receive:  bool adaptive
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ClosedLoopTrial::setAdaptive(bool adaptive)
+{
+    m_adaptive = adaptive;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setRescue
+Purpose:  Sets whether readings below 70 are treated with rescue carbs. Off,
+          the time below 70 is the controller's alone.
+Receive:  bool rescue
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ClosedLoopTrial::setRescue(bool rescue)
+{
+    m_rescue = rescue;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setBasalMode
+Purpose:  Sets whether every patient's MPC chooses a temporary basal with
+          the bolus through the joint search.
+Receive:  bool basalMode
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ClosedLoopTrial::setBasalMode(bool basalMode)
+{
+    m_controllerSettings.basalMode = basalMode;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setControllerSettings
+Purpose:  Sets the settings every patient's MPC is configured with, the
+          live ones by default. The sensitivity is replaced by each
+          patient's correction factor.
+Receive:  const ControllerSettings& settings
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ClosedLoopTrial::setControllerSettings(const ControllerSettings &settings)
+{
+    m_controllerSettings = settings;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     runCycle
+Purpose:  One 5 minute cycle for one patient: reads the sensor, ingests the
+          reading and IOB through the patient's DataQueue, treats a low
+          reading with rescue carbs, and once 6 readings are queued runs an
+          MPC to choose the next bolus.
+Receive:  VirtualPatient& patient, int index into the simulator
+          double minutes since the start of the trial
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ClosedLoopTrial::runCycle(VirtualPatient &patient, int index,
+                               double minutes)
+{
+    //the dose chosen last cycle was delivered since the previous reading
+    double delivered = patient.pendingDose;
+    patient.pendingDose = 0.0;
+    patient.pendingCarbs = 0.0;
+    double glucose = m_simulator.getGlucose(index);
+    patient.readings++;
+    patient.glucoseSum += glucose;
+    patient.below54 += glucose<54.0;
+    patient.below70 += glucose<70.0;
+    patient.inRange += glucose>=70.0 && glucose<=180.0;
+    patient.above180 += glucose>180.0;
+
+    std::normal_distribution<double> noise(0.0, m_sensorNoise);
+    int reading = lround(glucose+noise(patient.generator));
+    reading = std::max(kMinReading, std::min(kMaxReading, reading));
+    //dexcom trend arrows from the rate of change in mg/dl per minute
+    double rate = patient.lastReading ?
+                  (reading-patient.lastReading)/kCycleMinutes : 0.0;
+    int trend = rate>3.0 ? 1 : rate>2.0 ? 2 : rate>1.0 ? 3 :
+                rate>=-1.0 ? 4 : rate>=-2.0 ? 5 : rate>=-3.0 ? 6 : 7;
+    patient.lastReading = reading;
+    if(m_rescue && reading<kRescueReading &&
+       minutes-patient.lastRescue>=kRescueMinutes){
+        patient.pendingCarbs = kRescueGrams;
+        patient.lastRescue = minutes;
+        patient.rescueCarbs += kRescueGrams;
+    }
+    double sampleTime = kStartTime+minutes*60.0;
+
+    //drop doses that are no longer active
+    int active = 0;
+    for(int d=0; d<patient.doseTimes.size(); d++){
+        if(minutes-patient.doseTimes[d]<m_insulinDurationMinutes){
+            patient.doseTimes[active] = patient.doseTimes[d];
+            patient.doseUnits[active] = patient.doseUnits[d];
+            active++;
+        }
+    }
+    patient.doseTimes.resize(active);
+    patient.doseUnits.resize(active);
+
+    //same record DataScraper prints: value,trend,lag,time,IOB,I5..I90
+    QStringList record;
+    record << QString::number(reading) << QString::number(trend)
+           << QString::number(0) << QString::number(sampleTime, 'f', 0);
+    double insulinOnBoard = 0.0;
+    for(int k=0; k<kFutureInsulinValues; k++){
+        double iob = 0.0;
+        for(int d=0; d<active; d++){
+            iob += InsulinKinetics::insulinOnBoard(patient.doseUnits[d],
+                       minutes-patient.doseTimes[d]+k*kCycleMinutes,
+                       m_controllerSettings.peakInsulinTime,
+                       m_insulinDurationMinutes);
+        }
+        if(!k){
+            insulinOnBoard = iob;
+        }
+        record << QString::number(iob);
+    }
+    if(!patient.queue->ingestData(record)){
+        return;
+    }
+    patient.model->observe(reading, insulinOnBoard, sampleTime, delivered);
+    if(patient.queue->getQueueSize()<kBGInputs){
+        return;
+    }
+
+    ControllerSettings settings = m_controllerSettings;
+    settings.sensitivity = patient.sensitivity;
+    //the simulator's insulin is above the scheduled basal
+    settings.maxBasalRate -= settings.scheduledBasal;
+    settings.scheduledBasal = 0.0;
+    ModelPredictiveController modelPredictiveController;
+    modelPredictiveController.setModel(patient.model);
+    modelPredictiveController.setVerbose(false);
+    //no thread pool: already on a pool thread, so the scenarios and plan
+    //search run inline
+    modelPredictiveController.configure(settings);
+    const double* futureInsulin = patient.queue->getFutureInsulin();
+    for(int k=0; futureInsulin && k<patient.queue->getFutureInsulinWidth();
+        k++){
+        modelPredictiveController.addInsulinInput(futureInsulin[k]);
+    }
+    vector<int> bgEntries = patient.queue->getNBGEntries(kBGInputs);
+    for(int i=kBGInputs-1; i>-1; i--){
+        modelPredictiveController.addBGInput(bgEntries[i]);
+    }
+    modelPredictiveController.runPredictionModel();
+    modelPredictiveController.calculateControlInput();
+    patient.queue->enqueueBGPrediction(sampleTime,
+                               modelPredictiveController.getPredictions());
+    double dose = modelPredictiveController.getControlInput();
+    patient.totalInsulin += dose;
+    //a temporary basal is set again every cycle, so only its first 5
+    //minutes are delivered, as one micro dose
+    if(modelPredictiveController.getTempBasalMinutes()>0){
+        double basal = modelPredictiveController.getTempBasalRate()*
+                       kCycleMinutes/60.0;
+        patient.basalInsulin += basal;
+        dose += basal;
+    }
+    if(dose>0.0){
+        patient.doseTimes.push_back(minutes);
+        patient.doseUnits.push_back(dose);
+        patient.pendingDose = dose;
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     run
+Purpose:  Builds the patient population and runs the whole trial.
+Receive:  N/A
+Return:   bool false if the trial configuration is invalid
+-----------------------------------------------------------------------------*/
+bool ClosedLoopTrial::run()
+{
+    if(m_patientCount<=0 || m_days<=0){
+        std::cerr << "A trial needs at least one patient and one day"
+                  << std::endl;
+        return false;
+    }
+    clearPatients();
+    m_simulator = PatientSimulator();
+    m_simulator.addPatients(m_patientCount, m_seed);
+    for(int i=0; i<m_patientCount; i++){
+        VirtualPatient* patient = new VirtualPatient();
+        patient->queue = new DataQueue();
+        patient->model = new StateSpaceModel();
+        patient->sensitivity = lround(m_simulator.getCorrectionFactor(i,
+                              kCorrectionGlucose, m_insulinDurationMinutes));
+        patient->model->setInitialSensitivity(patient->sensitivity);
+        patient->model->setAdaptive(m_adaptive);
+        patient->generator.seed(m_seed*7919u+i);
+        //breakfast, lunch and dinner, unannounced
+        std::uniform_real_distribution<double> jitter(-30.0, 30.0);
+        std::uniform_real_distribution<double> grams(30.0, 80.0);
+        for(int day=0; day<m_days; day++){
+            double mealHours[3] = {7.0, 12.5, 18.5};
+            for(int meal=0; meal<3; meal++){
+                patient->mealTimes.push_back(day*1440.0+mealHours[meal]*60.0+
+                                             jitter(patient->generator));
+                patient->mealGrams.push_back(grams(patient->generator));
+            }
+        }
+        m_patients.push_back(patient);
+    }
+
+    ThreadPool pool(m_threadCount);
+    auto start = std::chrono::steady_clock::now();
+    int cycles = m_days*kCyclesPerDay;
+    for(int cycle=0; cycle<cycles; cycle++){
+        double minutes = cycle*kCycleMinutes;
+        for(int i=0; i<m_patientCount; i++){
+            VirtualPatient* patient = m_patients[i];
+            while(patient->nextMeal<patient->mealTimes.size() &&
+                  patient->mealTimes[patient->nextMeal]<minutes+kCycleMinutes){
+                m_simulator.addMeal(i, patient->mealGrams[patient->nextMeal]);
+                patient->nextMeal++;
+            }
+        }
+        m_simulator.advance(kCycleMinutes);
+        pool.parallelFor(m_patientCount, [&](int i){
+            runCycle(*m_patients[i], i, minutes+kCycleMinutes);
+        });
+        for(int i=0; i<m_patientCount; i++){
+            m_simulator.addBolus(i, m_patients[i]->pendingDose);
+            m_simulator.addMeal(i, m_patients[i]->pendingCarbs);
+        }
+    }
+    m_elapsedSeconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now()-start).count();
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     printSummary
+Purpose:  Prints population outcomes of the last run: mean glucose, time in
+          the consensus ranges, insulin and rescue carbs per patient per day
+          and prediction accuracy per horizon.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ClosedLoopTrial::printSummary() const
+{
+    long readings = 0;
+    double glucoseSum = 0.0;
+    long below54 = 0;
+    long below70 = 0;
+    long inRange = 0;
+    long above180 = 0;
+    double totalInsulin = 0.0;
+    double basalInsulin = 0.0;
+    double rescueCarbs = 0.0;
+    for(int i=0; i<m_patients.size(); i++){
+        readings += m_patients[i]->readings;
+        glucoseSum += m_patients[i]->glucoseSum;
+        below54 += m_patients[i]->below54;
+        below70 += m_patients[i]->below70;
+        inRange += m_patients[i]->inRange;
+        above180 += m_patients[i]->above180;
+        totalInsulin += m_patients[i]->totalInsulin;
+        basalInsulin += m_patients[i]->basalInsulin;
+        rescueCarbs += m_patients[i]->rescueCarbs;
+    }
+    if(!readings){
+        std::cout << "No trial has been run" << std::endl;
+        return;
+    }
+    std::cout << m_patients.size() << " patients x " << m_days << " days in "
+              << m_elapsedSeconds << " s" << std::endl;
+    //the optimizer calculateControlInput dispatches to
+    std::cout << "Controller: live settings, ";
+    if(m_controllerSettings.controlMoves>1){
+        std::cout << m_controllerSettings.controlMoves << " move plan search";
+    }
+    else if(m_controllerSettings.basalMode){
+        std::cout << "joint bolus and temp basal search";
+    }
+    else if(m_controllerSettings.scenarioMode){
+        std::cout << m_controllerSettings.scenarioCount << " scenarios";
+    }
+    else{
+        std::cout << "single curve";
+    }
+    std::cout << ", over each patient's "
+              << (m_adaptive ? "adaptive" : "fixed")
+              << " state space model only, not the live ensemble"
+              << std::endl;
+    std::cout << "Mean glucose: " << glucoseSum/readings << " mg/dl"
+              << std::endl;
+    std::cout << "Time in range 70-180: " << 100.0*inRange/readings << "%"
+              << std::endl;
+    std::cout << "Time below 70: " << 100.0*below70/readings << "%"
+              << " below 54: " << 100.0*below54/readings << "%" << std::endl;
+    std::cout << "Time above 180: " << 100.0*above180/readings << "%"
+              << std::endl;
+    std::cout << "Bolus insulin per patient per day: "
+              << totalInsulin/(m_patients.size()*m_days) << " U" << std::endl;
+    if(m_controllerSettings.basalMode){
+        std::cout << "Temp basal insulin above scheduled per patient per "
+                  << "day: " << basalInsulin/(m_patients.size()*m_days)
+                  << " U" << std::endl;
+    }
+    if(m_rescue){
+        std::cout << "Rescue carbs per patient per day: "
+                  << rescueCarbs/(m_patients.size()*m_days) << " g"
+                  << std::endl;
+    }
+    else{
+        std::cout << "No rescue carbs given" << std::endl;
+    }
+
+    //pooled accuracy of every patient's predicted trajectories
+    PredictionMetrics predictionMetrics;
+    for(int i=0; i<m_patients.size(); i++){
+        predictionMetrics.merge(
+                    m_patients[i]->queue->getPredictionMetrics());
+    }
+    predictionMetrics.print();
+}
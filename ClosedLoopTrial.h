@@ -0,0 +1,103 @@
+/******************************************************************************
+** FILE: ClosedLoopTrial.h
+**
+** ABSTRACT:
+** Runs the controller in closed loop against a population
+** of virtual patients. Every 5 minutes each patient's CGM
+** reading and insulin on board go through the same
+** DataQueue ingest path the DataScraper output does, an
+** MPC configured like the live one picks a bolus from the
+** patient's own adaptive state space model and the bolus
+** is given to the simulator.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** Meals are unannounced: three per day at jittered times,
+** 30 to 80 g each. Outcomes are reported as the usual
+** CGM consensus ranges of the true plasma glucose.
+** Each patient's correction factor is measured from the
+** simulator from 200 mg/dl, as a clinician would titrate
+** it from corrections of highs. The simulated patients
+** have no counterregulation, so like in-silico trial
+** protocols a CGM reading below 70 is treated with 15 g of
+** carbs at most every 15 minutes, and the rescue carbs
+** are reported with the outcomes. Rescue can be turned off
+** to see the controller's own lows.
+** The simulator holds each patient at basal glucose on
+** their scheduled basal and tracks only the insulin above
+** it, so in basal mode the trial's temporary basals run
+** from the scheduled rate up and never suspend.
+** The live loop's MPC runs over the ensemble, the trial's
+** over the state space model alone: the RF and LSTM need
+** history the virtual patients don't have, so the trial
+** tests the live controller settings, not the ensemble.
+**
+******************************************************************************/
+
+#ifndef CLOSEDLOOPTRIAL_H
+#define CLOSEDLOOPTRIAL_H
+
+#include <vector>
+#include "ControllerSettings.h"
+#include "PatientSimulator.h"
+using std::vector;
+
+class ClosedLoopTrial
+{
+protected:
+    int m_patientCount = 1000;
+    int m_days = 1;
+    unsigned int m_seed = 1;
+    int m_threadCount = 0;
+    double m_sensorNoise = 5.0;
+    //whether each patient's model adapts from readings
+    bool m_adaptive = true;
+    //whether low readings are treated with rescue carbs
+    bool m_rescue = true;
+    //controller configuration, the live settings applied the way
+    //ControlWorker applies them, apart from the sensitivity, which is each
+    //patient's own correction factor
+    ControllerSettings m_controllerSettings;
+    //insulin action duration used to report IOB like DataScraper's DIA
+    double m_insulinDurationMinutes = 300.0;
+
+    struct VirtualPatient;
+    PatientSimulator m_simulator;
+    vector<VirtualPatient*> m_patients;
+    double m_elapsedSeconds = 0.0;
+
+    void clearPatients();
+    void runCycle(VirtualPatient& patient, int index, double minutes);
+
+public:
+    ClosedLoopTrial() = default;
+    ~ClosedLoopTrial();
+    ClosedLoopTrial(const ClosedLoopTrial&) = delete;
+    ClosedLoopTrial& operator=(const ClosedLoopTrial&) = delete;
+
+    void setPatientCount(int patientCount);
+    void setDays(int days);
+    void setSeed(unsigned int seed);
+    void setThreadCount(int threadCount);
+    void setSensorNoise(double sensorNoise);
+    void setTarget(int target);
+    void setMaxBolus(double maxBolus);
+    void setControlMoves(int controlMoves);
+    void setAdaptive(bool adaptive);
+    void setRescue(bool rescue);
+    void setBasalMode(bool basalMode);
+    void setControllerSettings(const ControllerSettings& settings);
+
+    bool run();
+    void printSummary() const;
+};
+
+#endif // CLOSEDLOOPTRIAL_H
@@ -0,0 +1,40 @@
+/******************************************************************************
+** FILE: CompiledForest.h
+**
+** ABSTRACT:
+** Interface of CompiledForestTrees.cpp, the random forest
+** written out by ForestCompiler as straight-line C++:
+** every tree is a function of nested comparisons against
+** constant thresholds returning an offset into a constant
+** leaf table.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** The checked in CompiledForestTrees.cpp is a placeholder
+** with no trees. To build the production forest in:
+**   AGS --compile-forest RandomForest.forest
+**       CompiledForestTrees.cpp
+** then rebuild. Outputs match DecisionForest::predict on
+** the same forest bit for bit.
+**
+******************************************************************************/
+
+#ifndef COMPILEDFOREST_H
+#define COMPILEDFOREST_H
+
+extern const int kCompiledForestFeatures;
+extern const int kCompiledForestOutputs;
+extern const int kCompiledForestTrees;
+
+//features of kCompiledForestFeatures, outputs of kCompiledForestOutputs
+void compiledForestPredict(const float* features, double* outputs);
+
+#endif // COMPILEDFOREST_H
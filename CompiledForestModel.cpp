@@ -0,0 +1,130 @@
+/******************************************************************************
+** FILE: CompiledForestModel.cpp
+**
+** ABSTRACT:
+** The random forest compiled into the binary by
+** ForestCompiler.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+**
+******************************************************************************/
+
+#include "CompiledForestModel.h"
+#include "CompiledForest.h"
+#include <time.h>
+
+namespace {
+    const int kBGFeatures = 6;
+    const int kInsulinFeatures = 19;
+    const int kOutputs = 18;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     hasForest
+Purpose:  Returns whether a forest of the expected shape was compiled in.
+Receive:  N/A
+Return:   bool
+-----------------------------------------------------------------------------*/
+bool CompiledForestModel::hasForest()
+{
+    return kCompiledForestTrees>0 &&
+           kCompiledForestFeatures==kBGFeatures+kInsulinFeatures &&
+           kCompiledForestOutputs==kOutputs;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setHistoryStore
+Purpose:  Sets the store saved predictions are queued to.
+Receive:  HistoryStore* historyStore, not owned
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void CompiledForestModel::setHistoryStore(HistoryStore *historyStore)
+{
+    m_historyStore = historyStore;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     runForest
+Purpose:  Evaluates the compiled forest on 6 BG values followed by 19
+          insulin values, the same features as RandomForestModel.
+Receive:  bgInputs and insulinInputs for the model
+Return:   vector<double> predictions for future BG (90 mins / 5 = 18 values)
+-----------------------------------------------------------------------------*/
+vector<double> CompiledForestModel::runForest(
+                                    const vector<double> &bgInputs,
+                                    const vector<float> &insulinInputs) const
+{
+    float features[kBGFeatures+kInsulinFeatures];
+    for(int i=0; i<kBGFeatures; i++){
+        features[i] = i<bgInputs.size() ? bgInputs[i] : 0.0f;
+    }
+    for(int i=0; i<kInsulinFeatures; i++){
+        features[kBGFeatures+i] = i<insulinInputs.size() ?
+                                  insulinInputs[i] : 0.0f;
+    }
+    vector<double> bgPredictions(kOutputs);
+    if(hasForest()){
+        compiledForestPredict(features, bgPredictions.data());
+    }
+    return bgPredictions;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     predict
+Purpose:  Runs the prediction model once using input bg and insulin
+          data at t=0.
+Receive:  bgInputs and insulin inputs for the model, saveFlag to queue the
+          prediction on the history store
+Return:   vector<double> predictions for future BG (90 mins / 5 = 18 values)
+-----------------------------------------------------------------------------*/
+vector<double> CompiledForestModel::predict(vector<int> bgInputs,
+                                            vector<float> insulinInputs,
+                                            bool saveFlag)
+{
+    vector<double> bgPredictions = runForest(
+                vector<double>(bgInputs.begin(), bgInputs.end()),
+                insulinInputs);
+    if(saveFlag){
+        savePrediction(bgPredictions);
+    }
+    return bgPredictions;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     savePrediction
+Purpose:  Queues the prediction on the history store, if one is set.
+Receive:  const vector<double>& bgPredictions
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void CompiledForestModel::savePrediction(const vector<double> &bgPredictions)
+                                         const
+{
+    if(m_historyStore){
+        m_historyStore->addPrediction(time(nullptr), "RF", bgPredictions);
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     projectCorrection
+Purpose:  Runs the hypothetical insulin control input supplied to the model
+          and gives the projected BG output based on this input.
+Receive:  bgInputs and insulin inputs for the model, sensitivity is constant
+          representing the impact of 1 unit of insulin on blood glucose.
+Return:   vector<double> predictions for future BG (90 mins / 5 = 18 values)
+-----------------------------------------------------------------------------*/
+vector<double> CompiledForestModel::projectCorrection(
+                                    vector<double> bgInputs,
+                                    vector<float> insulinInputs,
+                                    int sensitivity)
+{
+    return runForest(bgInputs, insulinInputs);
+}
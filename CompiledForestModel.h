@@ -0,0 +1,57 @@
+/******************************************************************************
+** FILE: CompiledForestModel.h
+**
+** ABSTRACT:
+** The random forest compiled into the binary by
+** ForestCompiler. Takes the same 25 inputs as
+** RandomForestModel's native forest and needs no file at
+** start up.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** hasForest is false while CompiledForestTrees.cpp is the
+** placeholder; Main then keeps using RandomForestModel.
+**
+******************************************************************************/
+
+#ifndef COMPILEDFORESTMODEL_H
+#define COMPILEDFORESTMODEL_H
+
+#include "Model.h"
+#include "HistoryStore.h"
+#include <vector>
+using std::vector;
+
+class CompiledForestModel : public Model
+{
+protected:
+    //not owned, saved predictions are queued here
+    HistoryStore* m_historyStore = nullptr;
+
+    vector<double> runForest(const vector<double>& bgInputs,
+                             const vector<float>& insulinInputs) const;
+
+public:
+    CompiledForestModel() = default;
+    virtual ~CompiledForestModel() = default;
+
+    static bool hasForest();
+    void setHistoryStore(HistoryStore* historyStore);
+
+    vector<double> predict(vector<int> bgInputs, vector<float> insulinInputs,
+                           bool saveFlag);
+    vector<double> projectCorrection(vector<double> bgInputs,
+                                     vector<float> insulinInputs,
+                                     int sensitivity);
+    void savePrediction(const vector<double>& bgPredictions) const;
+};
+
+#endif // COMPILEDFORESTMODEL_H
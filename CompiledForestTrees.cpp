@@ -0,0 +1,23 @@
+/******************************************************************************
+** FILE: CompiledForestTrees.cpp
+**
+** ABSTRACT:
+** Placeholder with no trees, so CompiledForestModel reports
+** no forest until the production one is generated over it
+** with AGS --compile-forest.
+**
+******************************************************************************/
+
+#include "CompiledForest.h"
+
+const int kCompiledForestFeatures = 25;
+const int kCompiledForestOutputs = 18;
+const int kCompiledForestTrees = 0;
+
+void compiledForestPredict(const float* features, double* outputs)
+{
+    (void)features;
+    for(int k=0; k<kCompiledForestOutputs; k++){
+        outputs[k] = 0.0;
+    }
+}
@@ -0,0 +1,304 @@
+/******************************************************************************
+** FILE: ControlWorker.cpp
+**
+** ABSTRACT:
+** Runs ingestion and the MPC cycle on its own thread and
+** publishes each cycle's results to the GUI as an
+** immutable CycleSnapshot.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+**
+******************************************************************************/
+
+#include "ControlWorker.h"
+#include "ModelPredictiveController.h"
+#include <QMetaObject>
+#include <algorithm>
+
+namespace {
+    const int kMetricsCycles = 12;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     ControlWorker
+Purpose:  Constructor. Registers the snapshot type so it can cross threads
+          in queued signals.
+Receive:  DataQueue* dataQueue, not owned
+          QObject* parent
+Return:   N/A
+-----------------------------------------------------------------------------*/
+ControlWorker::ControlWorker(DataQueue *dataQueue, QObject *parent) :
+    QObject(parent),
+    m_dataQueue(dataQueue),
+    m_fetchPending(false)
+{
+    qRegisterMetaType<CycleSnapshotPtr>("CycleSnapshotPtr");
+    m_cycleExecutor.setConfigure(
+            [this](ModelPredictiveController& controller){
+                configureController(controller);
+            });
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setStateSpaceModel
+Purpose:  Sets the model that observes each new reading.
+Receive:  StateSpaceModel* stateSpaceModel, not owned
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ControlWorker::setStateSpaceModel(StateSpaceModel *stateSpaceModel)
+{
+    m_stateSpaceModel = stateSpaceModel;
+    m_cycleExecutor.setStateSpaceModel(stateSpaceModel);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setEnsembleModel
+Purpose:  Sets the model the MPC optimizes over. Without one the worker
+          only ingests readings.
+Receive:  EnsembleModel* ensembleModel, not owned
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ControlWorker::setEnsembleModel(EnsembleModel *ensembleModel)
+{
+    m_ensembleModel = ensembleModel;
+    m_cycleExecutor.setPrimaryModel(ensembleModel);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setScenarioPool
+Purpose:  Sets the pool the MPC's scenario evaluation runs on.
+Receive:  ThreadPool* scenarioPool, not owned
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ControlWorker::setScenarioPool(ThreadPool *scenarioPool)
+{
+    m_scenarioPool = scenarioPool;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setStateSnapshot
+Purpose:  Sets the snapshot saved after every controller cycle.
+Receive:  StateSnapshot* stateSnapshot, not owned
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ControlWorker::setStateSnapshot(StateSnapshot *stateSnapshot)
+{
+    m_stateSnapshot = stateSnapshot;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setHistoryStore
+Purpose:  Sets the store every published reading, dose and trajectory is
+          queued to.
+Receive:  HistoryStore* historyStore, not owned
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ControlWorker::setHistoryStore(HistoryStore *historyStore)
+{
+    m_historyStore = historyStore;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setControllerSettings
+Purpose:  Sets the settings every MPC of a cycle is configured with. Call
+          before the worker is moved to its thread.
+Receive:  const ControllerSettings& settings
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ControlWorker::setControllerSettings(const ControllerSettings &settings)
+{
+    m_controllerSettings = settings;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getCycleExecutor
+Purpose:  Returns the executor so budgets can be set before the worker is
+          moved to its thread.
+Receive:  N/A
+Return:   CycleExecutor&
+-----------------------------------------------------------------------------*/
+CycleExecutor& ControlWorker::getCycleExecutor()
+{
+    return m_cycleExecutor;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     configureController
+Purpose:  Applies the live controller settings to an MPC. Called by the
+          executor from the ensemble's thread as well as the worker's.
+Receive:  ModelPredictiveController& controller
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ControlWorker::configureController(ModelPredictiveController &controller)
+                                        const
+{
+    controller.configure(m_controllerSettings);
+    controller.getScenarioEvaluator()->setThreadPool(m_scenarioPool);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     requestFetch
+Purpose:  Asks for a cycle without waiting for it. Safe from any thread.
+          A request made while a cycle is queued or running is merged into
+          it.
+Receive:  N/A
+Return:   bool false if merged into a cycle already in flight
+-----------------------------------------------------------------------------*/
+bool ControlWorker::requestFetch()
+{
+    if(m_fetchPending.exchange(true)){
+        return false;
+    }
+    QMetaObject::invokeMethod(this, "runCycle", Qt::QueuedConnection);
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     runCycle
+Purpose:  Scrapes new data, runs the controller on a new reading, then
+          publishes everything added since the previous snapshot to the GUI
+          and the history store. Runs on the worker's thread.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ControlWorker::runCycle()
+{
+    std::shared_ptr<CycleSnapshot> snapshot(new CycleSnapshot());
+    m_cycleExecutor.beginStage(IngestStage);
+    bool scraped = m_dataQueue->scrapeData();
+    m_cycleExecutor.endStage(IngestStage);
+    if(scraped && m_ensembleModel){
+        runController(*snapshot);
+    }
+
+    //walk back from the newest reading to the last one published
+    int size = m_dataQueue->getQueueSize();
+    int first = size;
+    while(first>0 && m_dataQueue->getBGEntryAt(first-1)->getSampleTime()>
+          m_publishedSampleTime){
+        first--;
+    }
+    for(int i=first; i<size; i++){
+        BGDataEntry* entry = m_dataQueue->getBGEntryAt(i);
+        BGReading reading;
+        reading.sampleTime = entry->getSampleTime();
+        reading.value = entry->getValue();
+        reading.trend = entry->getTrend();
+        reading.delayTime = entry->getDelayTime();
+        snapshot->readings.push_back(reading);
+    }
+    if(snapshot->readings.size()){
+        m_publishedSampleTime = snapshot->readings.back().sampleTime;
+    }
+    const vector<DoseRecord>& doses = m_dataQueue->getDoseHistory();
+    for(int i=0; i<doses.size(); i++){
+        if(doses[i].sampleTime>m_publishedDoseTime){
+            snapshot->doses.push_back(doses[i]);
+        }
+    }
+    if(snapshot->doses.size()){
+        m_publishedDoseTime = snapshot->doses.back().sampleTime;
+    }
+
+    //queued only, the store commits in the background
+    m_cycleExecutor.beginStage(PersistStage);
+    if(m_historyStore){
+        for(int i=0; i<snapshot->readings.size(); i++){
+            const BGReading& reading = snapshot->readings[i];
+            m_historyStore->addReading(reading.sampleTime, reading.value,
+                                       reading.trend, reading.delayTime);
+        }
+        for(int i=0; i<snapshot->doses.size(); i++){
+            m_historyStore->addDose(snapshot->doses[i].sampleTime,
+                                    snapshot->doses[i].units);
+        }
+        if(snapshot->predictions.size()){
+            m_historyStore->addPrediction(snapshot->predictionTime, "MPC",
+                                          snapshot->predictions);
+        }
+    }
+    //a late ensemble run still holds the models the snapshot reads
+    if(snapshot->predictions.size() && m_stateSnapshot &&
+       !m_cycleExecutor.isPrimaryBusy()){
+        m_stateSnapshot->save();
+    }
+    m_cycleExecutor.endStage(PersistStage);
+
+    //requests from here on start a new cycle
+    m_fetchPending = false;
+    if(snapshot->readings.size() || snapshot->doses.size() ||
+       snapshot->predictions.size()){
+        emit cycleFinished(snapshot);
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     runController
+Purpose:  Chooses a bolus for the newest reading through the cycle executor,
+          with a temporary basal in basal mode.
+          The executor updates the models and falls back to cheaper ones if
+          the ensemble runs over its budgets. The bolus is only a
+          recommendation, as is the basal, so it is not recorded as a dose: the dose history
+          feeds IOB, snapshots and the history store, and only doses the
+          patient was actually given (backfill and scraper records) belong
+          there.
+Receive:  CycleSnapshot& snapshot, predictions and recommendation filled in
+Return:   bool
+-----------------------------------------------------------------------------*/
+bool ControlWorker::runController(CycleSnapshot &snapshot)
+{
+    BGDataEntry* latestBG = m_dataQueue->getLastBGEntry();
+    InsulinDataEntry* latestInsulin = m_dataQueue->getLastInsulinEntry();
+    if(!latestBG || !latestInsulin){
+        return false;
+    }
+    ControlRequest request;
+    request.latestBG = latestBG->getValue();
+    request.insulinOnBoard = latestInsulin->insulinOnBoard();
+    request.sampleTime = latestBG->getSampleTime();
+
+    //get future insulin values
+    //the curve stored with the newest reading
+    const double* futureInsulin = m_dataQueue->getFutureInsulin();
+    for(int k=0; futureInsulin && k<m_dataQueue->getFutureInsulinWidth();
+        k++){
+        request.insulinInputs.push_back(futureInsulin[k]);
+    }
+
+    //get last 6 BG readings
+    vector<int> bgEntries = m_dataQueue->getNBGEntries(6);
+    for(int i =5; i>-1;i--){
+        request.bgInputs.push_back(bgEntries[i]);
+    }
+
+    //MPC Optimization over the fused trajectories, on time
+    ControlDecision decision = m_cycleExecutor.runControl(request);
+
+    //keep the trajectory for scoring and restarts
+    snapshot.predictions = decision.predictions;
+    snapshot.predictionTime = request.sampleTime;
+    snapshot.bolus = decision.bolus;
+    snapshot.tempBasalRate = decision.tempBasalRate;
+    snapshot.tempBasalMinutes = decision.tempBasalMinutes;
+    //scored against the readings it predicts as they arrive
+    if(snapshot.predictions.size()){
+        m_dataQueue->enqueueBGPrediction(snapshot.predictionTime,
+                                         snapshot.predictions);
+    }
+
+    //live prediction accuracy and cycle timings, once an hour
+    if(++m_controllerCycles%kMetricsCycles==0){
+        m_dataQueue->getPredictionMetrics().logAccuracy();
+        m_cycleExecutor.logStats();
+    }
+    return true;
+}
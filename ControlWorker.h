@@ -0,0 +1,91 @@
+/******************************************************************************
+** FILE: ControlWorker.h
+**
+** ABSTRACT:
+** Runs ingestion and the MPC cycle on its own thread and
+** publishes each cycle's results to the GUI as an
+** immutable CycleSnapshot.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** After moveToThread the DataQueue and models are only
+** touched from the worker's thread. requestFetch may be
+** called from any thread; a request made while a cycle is
+** queued or running joins that cycle instead of starting
+** another Python scrape. Each cycle runs through a
+** CycleExecutor so a slow ensemble can't hold up the
+** recommendation.
+**
+******************************************************************************/
+
+#ifndef CONTROLWORKER_H
+#define CONTROLWORKER_H
+
+#include <QObject>
+#include <atomic>
+#include "ControllerSettings.h"
+#include "CycleExecutor.h"
+#include "CycleSnapshot.h"
+#include "DataQueue.h"
+#include "EnsembleModel.h"
+#include "HistoryStore.h"
+#include "StateSpaceModel.h"
+#include "StateSnapshot.h"
+#include "ThreadPool.h"
+
+class ControlWorker : public QObject
+{
+    Q_OBJECT
+
+protected:
+    //not owned
+    DataQueue* m_dataQueue;
+    StateSpaceModel* m_stateSpaceModel = nullptr;
+    EnsembleModel* m_ensembleModel = nullptr;
+    ThreadPool* m_scenarioPool = nullptr;
+    StateSnapshot* m_stateSnapshot = nullptr;
+    HistoryStore* m_historyStore = nullptr;
+    ControllerSettings m_controllerSettings;
+
+    std::atomic<bool> m_fetchPending;
+    //newest reading and dose already published
+    double m_publishedSampleTime = 0.0;
+    double m_publishedDoseTime = 0.0;
+    long m_controllerCycles = 0;
+    CycleExecutor m_cycleExecutor;
+
+    void configureController(ModelPredictiveController& controller) const;
+
+    bool runController(CycleSnapshot& snapshot);
+
+public:
+    explicit ControlWorker(DataQueue* dataQueue, QObject* parent = nullptr);
+    ~ControlWorker() = default;
+
+    void setStateSpaceModel(StateSpaceModel* stateSpaceModel);
+    void setEnsembleModel(EnsembleModel* ensembleModel);
+    void setScenarioPool(ThreadPool* scenarioPool);
+    void setStateSnapshot(StateSnapshot* stateSnapshot);
+    void setHistoryStore(HistoryStore* historyStore);
+    void setControllerSettings(const ControllerSettings& settings);
+    CycleExecutor& getCycleExecutor();
+
+signals:
+    void cycleFinished(CycleSnapshotPtr snapshot);
+
+public slots:
+    bool requestFetch();
+
+private slots:
+    void runCycle();
+};
+
+#endif // CONTROLWORKER_H
@@ -0,0 +1,46 @@
+/******************************************************************************
+** FILE: ControllerSettings.h
+**
+** ABSTRACT:
+** The settings an MPC runs with. The defaults are the live
+** configuration; ControlWorker and ClosedLoopTrial both
+** apply them through ModelPredictiveController::configure
+** so the trial runs the controller the live loop does.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** ControllerTuner replays candidates of the first four
+** fields only.
+**
+******************************************************************************/
+
+#ifndef CONTROLLERSETTINGS_H
+#define CONTROLLERSETTINGS_H
+
+struct ControllerSettings
+{
+    int sensitivity = 30;
+    double peakInsulinTime = 57.0;
+    int target = 110;
+    double maxBolus = 16.0;
+    double activityDurationMinutes = 90.0;
+    //pick the bolus over sampled scenarios instead of one curve
+    bool scenarioMode = true;
+    int scenarioCount = 10000;
+    //doses planned per cycle, 1 for the single bolus sweep
+    int controlMoves = 1;
+    //choose a temporary basal with the bolus, rates in U/h
+    bool basalMode = false;
+    double scheduledBasal = 0.0;
+    double maxBasalRate = 3.0;
+};
+
+#endif // CONTROLLERSETTINGS_H
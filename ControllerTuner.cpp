@@ -0,0 +1,589 @@
+/******************************************************************************
+** FILE: ControllerTuner.cpp
+**
+** ABSTRACT:
+** Offline tuning of the MPC settings on recorded history.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+**
+******************************************************************************/
+
+#include "ControllerTuner.h"
+#include "InsulinKinetics.h"
+#include "ModelPredictiveController.h"
+#include "StateSpaceModel.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <math.h>
+#include <random>
+
+namespace
+{
+const int kBGInputs = 6;
+const int kFutureInsulinValues = 19;
+const double kCycleMinutes = 5.0;
+//a gap longer than this restarts the controller's reading window
+const double kMaxGapSeconds = 900.0;
+const int kMinReading = 40;
+const int kMaxReading = 400;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     loadHistory
+Purpose:  Copies the readings and doses of a filled DataQueue, e.g. after
+          backfillFromFile, into flat arrays the replays share read only.
+Receive:  const DataQueue& dataQueue
+Return:   bool false if there are too few readings to run an MPC on
+-----------------------------------------------------------------------------*/
+bool ControllerTuner::loadHistory(const DataQueue &dataQueue)
+{
+    m_sampleTimes.clear();
+    m_values.clear();
+    m_doseTimes.clear();
+    m_doseUnits.clear();
+    for(int i=0; i<dataQueue.getQueueSize(); i++){
+        BGDataEntry* entry = dataQueue.getBGEntryAt(i);
+        m_sampleTimes.push_back(entry->getSampleTime());
+        m_values.push_back(entry->getValue());
+    }
+    const vector<DoseRecord>& doses = dataQueue.getDoseHistory();
+    for(int i=0; i<doses.size(); i++){
+        m_doseTimes.push_back(doses[i].sampleTime);
+        m_doseUnits.push_back(doses[i].units);
+    }
+    if(m_sampleTimes.size()<=kBGInputs){
+        std::cerr << "Not enough history to tune on" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getReadingCount
+Purpose:  Returns the number of recorded readings loaded.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int ControllerTuner::getReadingCount() const
+{
+    return m_sampleTimes.size();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setSensitivityRange
+Purpose:  Sets the sensitivities makeGrid and makeRandom draw from.
+Receive:  int min, int max, int step in mg/dl per unit
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ControllerTuner::setSensitivityRange(int min, int max, int step)
+{
+    m_sensitivityRange = {(double)min, (double)max, (double)step};
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setPeakInsulinTimeRange
+Purpose:  Sets the insulin peak times makeGrid and makeRandom draw from.
+Receive:  double min, double max, double step in minutes
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ControllerTuner::setPeakInsulinTimeRange(double min, double max,
+                                              double step)
+{
+    m_peakInsulinTimeRange = {min, max, step};
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setTargetRange
+Purpose:  Sets the targets makeGrid and makeRandom draw from.
+Receive:  int min, int max, int step in mg/dl
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ControllerTuner::setTargetRange(int min, int max, int step)
+{
+    m_targetRange = {(double)min, (double)max, (double)step};
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setMaxBolusRange
+Purpose:  Sets the bolus limits makeGrid and makeRandom draw from.
+Receive:  double min, double max, double step in units
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ControllerTuner::setMaxBolusRange(double min, double max, double step)
+{
+    m_maxBolusRange = {min, max, step};
+}
+
+/*-----------------------------------------------------------------------------
+Name:     rangeSize
+Purpose:  Returns the number of grid points in a range, ends included.
+Receive:  const Range& range
+Return:   int
+-----------------------------------------------------------------------------*/
+int ControllerTuner::rangeSize(const Range &range)
+{
+    if(range.step<=0.0 || range.max<=range.min){
+        return 1;
+    }
+    return (int)floor((range.max-range.min)/range.step+1e-9)+1;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     rangeValue
+Purpose:  Returns the i-th grid point of a range.
+Receive:  const Range& range, int i
+Return:   double
+-----------------------------------------------------------------------------*/
+double ControllerTuner::rangeValue(const Range &range, int i)
+{
+    return std::min(range.min+i*std::max(range.step, 0.0), range.max);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     makeGrid
+Purpose:  Adds every combination of the four ranges as a candidate.
+Receive:  N/A
+Return:   int number of candidates added
+-----------------------------------------------------------------------------*/
+int ControllerTuner::makeGrid()
+{
+    int added = 0;
+    for(int s=0; s<rangeSize(m_sensitivityRange); s++){
+        for(int p=0; p<rangeSize(m_peakInsulinTimeRange); p++){
+            for(int t=0; t<rangeSize(m_targetRange); t++){
+                for(int b=0; b<rangeSize(m_maxBolusRange); b++){
+                    ControllerSettings settings;
+                    settings.sensitivity =
+                            lround(rangeValue(m_sensitivityRange, s));
+                    settings.peakInsulinTime =
+                            rangeValue(m_peakInsulinTimeRange, p);
+                    settings.target = lround(rangeValue(m_targetRange, t));
+                    settings.maxBolus = rangeValue(m_maxBolusRange, b);
+                    m_candidates.push_back(settings);
+                    added++;
+                }
+            }
+        }
+    }
+    return added;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     makeRandom
+Purpose:  Adds candidates drawn uniformly from the four ranges, for sweeps
+          too large to grid.
+Receive:  int count, unsigned int seed
+Return:   int number of candidates added
+-----------------------------------------------------------------------------*/
+int ControllerTuner::makeRandom(int count, unsigned int seed)
+{
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    auto draw = [&](const Range& range){
+        return range.min+unit(generator)*std::max(range.max-range.min, 0.0);
+    };
+    for(int i=0; i<count; i++){
+        ControllerSettings settings;
+        settings.sensitivity = lround(draw(m_sensitivityRange));
+        settings.peakInsulinTime = draw(m_peakInsulinTimeRange);
+        settings.target = lround(draw(m_targetRange));
+        settings.maxBolus = draw(m_maxBolusRange);
+        m_candidates.push_back(settings);
+    }
+    return std::max(count, 0);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     addCandidate
+Purpose:  Adds one setting to the sweep, e.g. the live configuration as a
+          reference.
+Receive:  const ControllerSettings& settings
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ControllerTuner::addCandidate(const ControllerSettings &settings)
+{
+    m_candidates.push_back(settings);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getCandidateCount
+Purpose:  Returns the number of settings the next run will replay.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int ControllerTuner::getCandidateCount() const
+{
+    return m_candidates.size();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setReplaySensitivity
+Purpose:  Sets the patient's true sensitivity the counterfactual readings
+          are worked out with.
+Receive:  double replaySensitivity in mg/dl per unit, 0 to estimate it from
+          the history
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ControllerTuner::setReplaySensitivity(double replaySensitivity)
+{
+    m_replaySensitivity = replaySensitivity;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setGlucoseRecoveryMinutes
+Purpose:  Sets how quickly the patient's BG returns to what was recorded
+          after the replay gives more or less insulin, the inverse of the
+          glucose effectiveness.
+Receive:  double glucoseRecoveryMinutes
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ControllerTuner::setGlucoseRecoveryMinutes(double glucoseRecoveryMinutes)
+{
+    m_glucoseRecoveryMinutes = glucoseRecoveryMinutes;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setHypoWeight
+Purpose:  Sets how many points of time in range one point of LBGI costs in
+          the ranking score.
+Receive:  double hypoWeight
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ControllerTuner::setHypoWeight(double hypoWeight)
+{
+    m_hypoWeight = hypoWeight;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setThreadCount
+Purpose:  Sets the number of threads replaying candidates, 0 for one per
+          core.
+Receive:  int threadCount
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ControllerTuner::setThreadCount(int threadCount)
+{
+    m_threadCount = threadCount;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getReplaySensitivity
+Purpose:  Returns the configured replay sensitivity or the one estimated
+          from the history.
+Receive:  N/A
+Return:   double mg/dl per unit
+-----------------------------------------------------------------------------*/
+double ControllerTuner::getReplaySensitivity() const
+{
+    return m_replaySensitivity>0.0 ? m_replaySensitivity :
+                                     m_estimatedSensitivity;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     insulinOnBoard
+Purpose:  Looks up the IOB of a dose in the table run builds, interpolating
+          between whole minutes.
+Receive:  double units, double minutes since the dose
+Return:   double units on board
+-----------------------------------------------------------------------------*/
+double ControllerTuner::insulinOnBoard(double units, double minutes) const
+{
+    if(minutes<0.0 || minutes>=m_insulinOnBoard.size()-1){
+        return 0.0;
+    }
+    int i = (int)minutes;
+    double fraction = minutes-i;
+    return units*(m_insulinOnBoard[i]+
+                  fraction*(m_insulinOnBoard[i+1]-m_insulinOnBoard[i]));
+}
+
+/*-----------------------------------------------------------------------------
+Name:     replay
+Purpose:  Runs one candidate over the whole history. Recorded doses are kept
+          until the MPC has its first 6 readings; after that the MPC's doses
+          replace them and every reading is shifted by the replay
+          sensitivity times the insulin absorbed from the difference, a
+          shift that decays with the glucose recovery time.
+          Called from the pool's threads; only touches result.
+Receive:  TuningResult& result, settings in, outcomes out
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ControllerTuner::replay(TuningResult &result) const
+{
+    const ControllerSettings& settings = result.settings;
+    double replaySensitivity = getReplaySensitivity();
+    StateSpaceModel model;
+    model.setInitialSensitivity(settings.sensitivity);
+    model.setAdaptive(true);
+
+    //doses given in the replay, and replayed minus recorded doses
+    vector<double> doseTimes;
+    vector<double> doseUnits;
+    vector<double> extraTimes;
+    vector<double> extraUnits;
+    double absorbedExtra = 0.0;
+    double lastAbsorbed = 0.0;
+    double offset = 0.0;
+    //units the replay delivered since the model last observed a reading
+    double dosed = 0.0;
+    int nextDose = 0;
+    bool controlling = false;
+    vector<int> bgInputs;
+    double lastTime = 0.0;
+    float futureInsulin[kFutureInsulinValues];
+
+    for(int i=0; i<m_sampleTimes.size(); i++){
+        double sampleTime = m_sampleTimes[i];
+        while(nextDose<m_doseTimes.size() &&
+              m_doseTimes[nextDose]<=sampleTime){
+            if(controlling){
+                extraTimes.push_back(m_doseTimes[nextDose]);
+                extraUnits.push_back(-m_doseUnits[nextDose]);
+            }
+            else{
+                doseTimes.push_back(m_doseTimes[nextDose]);
+                doseUnits.push_back(m_doseUnits[nextDose]);
+                dosed += m_doseUnits[nextDose];
+                result.totalInsulin += m_doseUnits[nextDose];
+            }
+            nextDose++;
+        }
+
+        //insulin absorbed from the difference so far, retiring finished
+        //doses into one running total
+        double absorbed = absorbedExtra;
+        int active = 0;
+        for(int d=0; d<extraTimes.size(); d++){
+            double minutes = (sampleTime-extraTimes[d])/60.0;
+            if(minutes>=m_insulinDurationMinutes){
+                absorbedExtra += extraUnits[d];
+                absorbed += extraUnits[d];
+                continue;
+            }
+            absorbed += extraUnits[d]-insulinOnBoard(extraUnits[d], minutes);
+            extraTimes[active] = extraTimes[d];
+            extraUnits[active] = extraUnits[d];
+            active++;
+        }
+        extraTimes.resize(active);
+        extraUnits.resize(active);
+        //each unit absorbed lowers BG by the replay sensitivity, and the
+        //shift fades as the patient's own glucose regulation catches up
+        if(i){
+            offset *= exp(-(sampleTime-m_sampleTimes[i-1])/60.0/
+                          m_glucoseRecoveryMinutes);
+        }
+        offset += replaySensitivity*(absorbed-lastAbsorbed);
+        lastAbsorbed = absorbed;
+        int reading = lround(m_values[i]-offset);
+        reading = std::max(kMinReading, std::min(kMaxReading, reading));
+
+        result.readings++;
+        result.glucoseSum += reading;
+        result.below54 += reading<54;
+        result.below70 += reading<70;
+        result.inRange += reading>=70 && reading<=180;
+        result.above180 += reading>180;
+        double risk = 1.509*(pow(log((double)reading), 1.084)-5.381);
+        if(risk<0.0){
+            result.lowRiskSum += 10.0*risk*risk;
+        }
+
+        //IOB now and every 5 minutes ahead, as DataScraper reports it
+        active = 0;
+        for(int d=0; d<doseTimes.size(); d++){
+            if((sampleTime-doseTimes[d])/60.0<m_insulinDurationMinutes){
+                doseTimes[active] = doseTimes[d];
+                doseUnits[active] = doseUnits[d];
+                active++;
+            }
+        }
+        doseTimes.resize(active);
+        doseUnits.resize(active);
+        for(int k=0; k<kFutureInsulinValues; k++){
+            double iob = 0.0;
+            for(int d=0; d<active; d++){
+                iob += insulinOnBoard(doseUnits[d],
+                       (sampleTime-doseTimes[d])/60.0+k*kCycleMinutes);
+            }
+            futureInsulin[k] = iob;
+        }
+        model.observe(reading, futureInsulin[0], sampleTime, dosed);
+        dosed = 0.0;
+
+        if(bgInputs.size() && sampleTime-lastTime>kMaxGapSeconds){
+            bgInputs.clear();
+        }
+        lastTime = sampleTime;
+        bgInputs.push_back(reading);
+        if(bgInputs.size()>kBGInputs){
+            bgInputs.erase(bgInputs.begin());
+        }
+        if(bgInputs.size()<kBGInputs){
+            continue;
+        }
+        controlling = true;
+
+        ModelPredictiveController modelPredictiveController;
+        modelPredictiveController.setModel(&model);
+        modelPredictiveController.setVerbose(false);
+        modelPredictiveController.setSensitivity(settings.sensitivity);
+        modelPredictiveController.setPeakInsulinTime(
+                    settings.peakInsulinTime);
+        modelPredictiveController.setActivityDurationMinutes(
+                    m_activityDurationMinutes);
+        modelPredictiveController.setTarget(settings.target);
+        modelPredictiveController.setMaxBolus(settings.maxBolus);
+        for(int k=0; k<kFutureInsulinValues; k++){
+            modelPredictiveController.addInsulinInput(futureInsulin[k]);
+        }
+        for(int k=0; k<kBGInputs; k++){
+            modelPredictiveController.addBGInput(bgInputs[k]);
+        }
+        modelPredictiveController.runPredictionModel();
+        modelPredictiveController.calculateControlInput();
+        double dose = modelPredictiveController.getControlInput();
+        if(dose>0.0){
+            doseTimes.push_back(sampleTime);
+            doseUnits.push_back(dose);
+            dosed += dose;
+            extraTimes.push_back(sampleTime);
+            extraUnits.push_back(dose);
+            result.totalInsulin += dose;
+        }
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     run
+Purpose:  Replays every candidate across the thread pool and ranks them by
+          time in range minus the hypo weight times the LBGI.
+Receive:  N/A
+Return:   bool false without history or candidates
+-----------------------------------------------------------------------------*/
+bool ControllerTuner::run()
+{
+    if(m_sampleTimes.size()<=kBGInputs || m_candidates.empty()){
+        std::cerr << "Tuning needs history and at least one candidate"
+                  << std::endl;
+        return false;
+    }
+    auto start = std::chrono::steady_clock::now();
+    m_insulinOnBoard.resize((int)m_insulinDurationMinutes+2);
+    for(int m=0; m<m_insulinOnBoard.size(); m++){
+        m_insulinOnBoard[m] = InsulinKinetics::insulinOnBoard(1.0f, m,
+                              m_peakInsulinTime, m_insulinDurationMinutes);
+    }
+
+    //the patient's sensitivity, from the recorded readings and doses
+    StateSpaceModel estimator;
+    estimator.setAdaptive(true);
+    int nextDose = 0;
+    for(int i=0; i<m_sampleTimes.size(); i++){
+        double dosed = 0.0;
+        while(nextDose<m_doseTimes.size() &&
+              m_doseTimes[nextDose]<=m_sampleTimes[i]){
+            dosed += m_doseUnits[nextDose];
+            nextDose++;
+        }
+        double iob = 0.0;
+        for(int d=nextDose-1; d>=0; d--){
+            double minutes = (m_sampleTimes[i]-m_doseTimes[d])/60.0;
+            if(minutes>=m_insulinDurationMinutes){
+                break;
+            }
+            iob += insulinOnBoard(m_doseUnits[d], minutes);
+        }
+        estimator.observe(m_values[i], iob, m_sampleTimes[i], dosed);
+    }
+    m_estimatedSensitivity = estimator.isAdapted() ?
+                             estimator.getEstimatedSensitivity() :
+                             estimator.getInitialSensitivity();
+
+    m_results.assign(m_candidates.size(), TuningResult());
+    for(int i=0; i<m_candidates.size(); i++){
+        m_results[i].settings = m_candidates[i];
+    }
+    ThreadPool pool(m_threadCount);
+    pool.parallelFor(m_results.size(), [&](int i){
+        replay(m_results[i]);
+    });
+    for(int i=0; i<m_results.size(); i++){
+        TuningResult& result = m_results[i];
+        result.score = 100.0*result.inRange/result.readings-
+                       m_hypoWeight*result.lowRiskSum/result.readings;
+    }
+    std::stable_sort(m_results.begin(), m_results.end(),
+                     [](const TuningResult& a, const TuningResult& b){
+        return a.score>b.score;
+    });
+    m_elapsedSeconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now()-start).count();
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getResults
+Purpose:  Returns the last run's outcomes, best score first.
+Receive:  N/A
+Return:   const vector<TuningResult>&
+-----------------------------------------------------------------------------*/
+const vector<TuningResult> &ControllerTuner::getResults() const
+{
+    return m_results;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     printRanking
+Purpose:  Prints the best candidates of the last run with their time in
+          range, time low, LBGI, mean and daily insulin.
+Receive:  int count of candidates to print
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ControllerTuner::printRanking(int count) const
+{
+    if(m_results.empty()){
+        std::cout << "No sweep has been run" << std::endl;
+        return;
+    }
+    double days = (m_sampleTimes.back()-m_sampleTimes.front())/86400.0;
+    std::cout << m_results.size() << " settings x " << m_sampleTimes.size()
+              << " readings in " << m_elapsedSeconds << " s, replay "
+              << "sensitivity " << getReplaySensitivity() << std::endl;
+    std::cout << std::setw(5) << "Rank" << std::setw(6) << "ISF"
+              << std::setw(7) << "Peak" << std::setw(7) << "Target"
+              << std::setw(7) << "Max" << std::setw(8) << "TIR%"
+              << std::setw(8) << "<70%" << std::setw(8) << "<54%"
+              << std::setw(7) << "LBGI" << std::setw(7) << "Mean"
+              << std::setw(8) << "U/day" << std::setw(8) << "Score"
+              << std::endl;
+    for(int i=0; i<std::min(count, (int)m_results.size()); i++){
+        const TuningResult& result = m_results[i];
+        std::cout << std::fixed << std::setprecision(1)
+                  << std::setw(5) << i+1
+                  << std::setw(6) << result.settings.sensitivity
+                  << std::setw(7) << result.settings.peakInsulinTime
+                  << std::setw(7) << result.settings.target
+                  << std::setw(7) << result.settings.maxBolus
+                  << std::setw(8) << 100.0*result.inRange/result.readings
+                  << std::setw(8) << 100.0*result.below70/result.readings
+                  << std::setw(8) << 100.0*result.below54/result.readings
+                  << std::setw(7) << result.lowRiskSum/result.readings
+                  << std::setw(7) << result.glucoseSum/result.readings
+                  << std::setw(8) << (days>0.0 ? result.totalInsulin/days :
+                                                 result.totalInsulin)
+                  << std::setw(8) << result.score << std::endl;
+    }
+}
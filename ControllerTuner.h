@@ -0,0 +1,128 @@
+/******************************************************************************
+** FILE: ControllerTuner.h
+**
+** ABSTRACT:
+** Offline tuning of the MPC settings on recorded history.
+** Every candidate setting replays the whole history: at
+** each recorded reading an MPC with that setting chooses a
+** bolus, and the readings that follow are corrected for
+** the difference between its doses and the ones actually
+** given. Candidates are ranked by time in range and low
+** BG risk.
+**
+** DOCUMENTS:
+** Kovatchev et al., Symmetrization of the blood glucose
+** measurement scale (LBGI).
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** The counterfactual reading is the recorded one minus the
+** replay sensitivity times the insulin absorbed from the
+** extra (or missing) doses, using the same insulin curve
+** DataScraper reports IOB with, relaxing back towards the
+** recorded reading with the glucose recovery time. It doesn't model meals
+** differently, so it is only trustworthy for settings
+** close to the ones the history was recorded with.
+** Candidates are independent and run across a ThreadPool;
+** its shared task counter hands the next candidate to
+** whichever thread finishes first.
+**
+******************************************************************************/
+
+#ifndef CONTROLLERTUNER_H
+#define CONTROLLERTUNER_H
+
+#include <vector>
+#include "ControllerSettings.h"
+#include "DataQueue.h"
+using std::vector;
+
+struct TuningResult
+{
+    ControllerSettings settings;
+    long readings = 0;
+    double glucoseSum = 0.0;
+    long below54 = 0;
+    long below70 = 0;
+    long inRange = 0;
+    long above180 = 0;
+    //sum of the LBGI risk of every reading
+    double lowRiskSum = 0.0;
+    double totalInsulin = 0.0;
+    double score = 0.0;
+};
+
+class ControllerTuner
+{
+protected:
+    struct Range
+    {
+        double min;
+        double max;
+        double step;
+    };
+
+    Range m_sensitivityRange = {20.0, 60.0, 5.0};
+    Range m_peakInsulinTimeRange = {45.0, 75.0, 5.0};
+    Range m_targetRange = {100.0, 130.0, 10.0};
+    Range m_maxBolusRange = {2.0, 16.0, 2.0};
+    vector<ControllerSettings> m_candidates;
+    vector<TuningResult> m_results;
+
+    //recorded history, oldest first
+    vector<double> m_sampleTimes;
+    vector<int> m_values;
+    vector<double> m_doseTimes;
+    vector<double> m_doseUnits;
+
+    //0 estimates the patient's sensitivity from the history
+    double m_replaySensitivity = 0.0;
+    double m_estimatedSensitivity = 30.0;
+    //insulin curve of the patient, the one DataScraper uses
+    double m_peakInsulinTime = 57.0;
+    double m_insulinDurationMinutes = 300.0;
+    double m_activityDurationMinutes = 90.0;
+    //time constant of the return to the recorded BG after a dose change
+    double m_glucoseRecoveryMinutes = 500.0;
+    double m_hypoWeight = 5.0;
+    int m_threadCount = 0;
+    double m_elapsedSeconds = 0.0;
+    //IOB of one unit per minute since the dose
+    vector<double> m_insulinOnBoard;
+
+    static int rangeSize(const Range& range);
+    static double rangeValue(const Range& range, int i);
+    double getReplaySensitivity() const;
+    double insulinOnBoard(double units, double minutes) const;
+    void replay(TuningResult& result) const;
+
+public:
+    ControllerTuner() = default;
+    ~ControllerTuner() = default;
+
+    bool loadHistory(const DataQueue& dataQueue);
+    int getReadingCount() const;
+    void setSensitivityRange(int min, int max, int step);
+    void setPeakInsulinTimeRange(double min, double max, double step);
+    void setTargetRange(int min, int max, int step);
+    void setMaxBolusRange(double min, double max, double step);
+    int makeGrid();
+    int makeRandom(int count, unsigned int seed);
+    void addCandidate(const ControllerSettings& settings);
+    int getCandidateCount() const;
+    void setReplaySensitivity(double replaySensitivity);
+    void setGlucoseRecoveryMinutes(double glucoseRecoveryMinutes);
+    void setHypoWeight(double hypoWeight);
+    void setThreadCount(int threadCount);
+
+    bool run();
+    const vector<TuningResult>& getResults() const;
+    void printRanking(int count) const;
+};
+
+#endif // CONTROLLERTUNER_H
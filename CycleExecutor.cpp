@@ -0,0 +1,545 @@
+/******************************************************************************
+** FILE: CycleExecutor.cpp
+**
+** ABSTRACT:
+** Runs the controller cycle against per stage latency
+** budgets and falls back to cheaper models when the
+** ensemble misses them.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+**
+******************************************************************************/
+
+#include "CycleExecutor.h"
+#include "EnsembleModel.h"
+#include "ModelPredictiveController.h"
+#include "ModelRegistry.h"
+#include "Logger.h"
+#include "MetricsRegistry.h"
+#include <algorithm>
+
+namespace {
+    //the cycle timer fires every 240 seconds, these add up to 160
+    const double kDefaultBudgetMs[kCycleStages] = {60000.0, 30000.0,
+                                                   60000.0, 10000.0};
+    const char* const kStageNames[kCycleStages] = {"ingest", "predict",
+                                                   "optimise", "persist"};
+    const char* const kSourceNames[] = {"primary", "fallback", "cached"};
+    const double kSecondsPerStep = 300.0;
+
+    double elapsedMs(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now()-start).count();
+    }
+
+    std::chrono::steady_clock::time_point deadlineAfter(double ms)
+    {
+        return std::chrono::steady_clock::now()+
+               std::chrono::microseconds((long long)(ms*1000.0));
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     CycleExecutor
+Purpose:  Constructor. Starts with the default budgets.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+CycleExecutor::CycleExecutor()
+{
+    MetricsRegistry& metrics = MetricsRegistry::get();
+    for(int i=0; i<kCycleStages; i++){
+        m_stages[i].budgetMs = kDefaultBudgetMs[i];
+        string label = string("stage=\"")+kStageNames[i]+"\"";
+        m_stageLatency[i] = &metrics.histogram("ags_stage_duration_ms",
+                "Control cycle stage durations",
+                MetricsRegistry::latencyBucketsMs(), label);
+        m_stageOverruns[i] = &metrics.counter("ags_stage_overruns_total",
+                "Control cycle stages that missed their budget", label);
+    }
+    for(int i=0; i<=CachedSource; i++){
+        m_sourceCycles[i] = &metrics.counter("ags_cycles_total",
+                "Control cycles by the model that chose the bolus",
+                string("source=\"")+kSourceNames[i]+"\"");
+    }
+    m_busyMetric = &metrics.counter("ags_cycles_busy_total",
+            "Control cycles that found the ensemble still running");
+}
+
+/*-----------------------------------------------------------------------------
+Name:     ~CycleExecutor
+Purpose:  Destructor. Waits for a late ensemble run, it still uses the
+          models.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+CycleExecutor::~CycleExecutor()
+{
+    if(m_primaryThread.joinable()){
+        m_primaryThread.join();
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setPrimaryModel
+Purpose:  Sets the expensive model run against the predict and optimise
+          budgets.
+Receive:  EnsembleModel* primaryModel, not owned
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void CycleExecutor::setPrimaryModel(EnsembleModel *primaryModel)
+{
+    m_primaryModel = primaryModel;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setStateSpaceModel
+Purpose:  Sets the live StateSpaceModel. It observes each reading inside the
+          ensemble run and is copied for the fallback whenever the ensemble
+          is idle.
+Receive:  StateSpaceModel* stateSpaceModel, not owned
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void CycleExecutor::setStateSpaceModel(StateSpaceModel *stateSpaceModel)
+{
+    m_stateSpaceModel = stateSpaceModel;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setModelRegistry
+Purpose:  Sets the registry whose handles are moved to the newest model
+          versions before each ensemble run.
+Receive:  ModelRegistry* modelRegistry, not owned
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void CycleExecutor::setModelRegistry(ModelRegistry *modelRegistry)
+{
+    m_modelRegistry = modelRegistry;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setConfigure
+Purpose:  Sets the function that applies the controller settings to every
+          MPC the executor creates, primary or fallback.
+Receive:  const Configure& configure
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void CycleExecutor::setConfigure(const Configure &configure)
+{
+    m_configure = configure;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setFallbackScenarios
+Purpose:  Sets the scenario count of the fallback MPC. It runs on the
+          calling thread, the scenario pool may still be in use.
+Receive:  int fallbackScenarios
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void CycleExecutor::setFallbackScenarios(int fallbackScenarios)
+{
+    m_fallbackScenarios = std::max(1, fallbackScenarios);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getBudget
+Purpose:  Returns a stage's latency budget.
+Receive:  CycleStage stage
+Return:   double milliseconds
+-----------------------------------------------------------------------------*/
+double CycleExecutor::getBudget(CycleStage stage) const
+{
+    return m_stages[stage].budgetMs;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setBudget
+Purpose:  Sets a stage's latency budget.
+Receive:  CycleStage stage, double budgetMs
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void CycleExecutor::setBudget(CycleStage stage, double budgetMs)
+{
+    m_stages[stage].budgetMs = std::max(0.0, budgetMs);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     recordStage
+Purpose:  Adds one run of a stage to its statistics.
+Receive:  CycleStage stage, double ms, bool overrun
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void CycleExecutor::recordStage(CycleStage stage, double ms, bool overrun)
+{
+    StageStats& stats = m_stages[stage];
+    stats.lastMs = ms;
+    stats.maxMs = std::max(stats.maxMs, ms);
+    stats.totalMs += ms;
+    stats.runs++;
+    m_stageLatency[stage]->observe(ms);
+    if(overrun){
+        stats.overruns++;
+        m_stageOverruns[stage]->add();
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     beginStage
+Purpose:  Starts timing a stage the caller runs itself (ingest, persist).
+Receive:  CycleStage stage
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void CycleExecutor::beginStage(CycleStage stage)
+{
+    m_stageStart[stage] = std::chrono::steady_clock::now();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     endStage
+Purpose:  Stops timing a stage started with beginStage. These stages can't
+          be cut short, an overrun is only counted.
+Receive:  CycleStage stage
+Return:   bool false if the stage overran its budget
+-----------------------------------------------------------------------------*/
+bool CycleExecutor::endStage(CycleStage stage)
+{
+    double ms = elapsedMs(m_stageStart[stage]);
+    bool overrun = ms>m_stages[stage].budgetMs;
+    recordStage(stage, ms, overrun);
+    if(overrun){
+        LOG_WARNING("Cycle {} took {} ms, budget {} ms", kStageNames[stage],
+                    ms, m_stages[stage].budgetMs);
+    }
+    return !overrun;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     collectPrimary
+Purpose:  Joins a finished ensemble run and keeps its trajectory as the
+          cached one.
+Receive:  N/A
+Return:   bool false if an ensemble run is still going
+-----------------------------------------------------------------------------*/
+bool CycleExecutor::collectPrimary()
+{
+    if(!m_primaryRun){
+        return true;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_primaryRun->mutex);
+        if(!m_primaryRun->finished){
+            return false;
+        }
+        if(m_primaryRun->decision.predictions.size()){
+            m_cachedPredictions = m_primaryRun->decision.predictions;
+            m_cachedTime = m_primaryRun->sampleTime;
+        }
+    }
+    m_primaryThread.join();
+    m_primaryRun.reset();
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     startPrimary
+Purpose:  Starts the ensemble run for a request on its own thread. The
+          thread updates the live models with the new reading, then runs
+          the MPC over the ensemble, reporting when prediction is done.
+Receive:  const ControlRequest& request
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void CycleExecutor::startPrimary(const ControlRequest &request)
+{
+    std::shared_ptr<PrimaryRun> run(new PrimaryRun());
+    run->sampleTime = request.sampleTime;
+    m_primaryRun = run;
+    EnsembleModel* primaryModel = m_primaryModel;
+    StateSpaceModel* stateSpaceModel = m_stateSpaceModel;
+    Configure configure = m_configure;
+    m_primaryThread = std::thread([run, request, primaryModel,
+                                   stateSpaceModel, configure]()
+    {
+        auto start = std::chrono::steady_clock::now();
+        //one recursive least squares step on the new reading
+        if(stateSpaceModel){
+            stateSpaceModel->observe(request.latestBG, request.insulinOnBoard,
+                                     request.sampleTime);
+        }
+        //score the last cycle's predictions against the new reading
+        primaryModel->updateWeights(request.latestBG);
+
+        ModelPredictiveController modelPredictiveController;
+        modelPredictiveController.setModel(primaryModel);
+        if(configure){
+            configure(modelPredictiveController);
+        }
+        for(int k=0; k<request.insulinInputs.size(); k++){
+            modelPredictiveController.addInsulinInput(
+                        request.insulinInputs[k]);
+        }
+        for(int i=0; i<request.bgInputs.size(); i++){
+            modelPredictiveController.addBGInput(request.bgInputs[i]);
+        }
+        modelPredictiveController.runPredictionModel();
+        {
+            std::lock_guard<std::mutex> lock(run->mutex);
+            run->predicted = true;
+            run->predictMs = elapsedMs(start);
+        }
+        run->changed.notify_all();
+
+        start = std::chrono::steady_clock::now();
+        modelPredictiveController.calculateControlInput();
+        {
+            std::lock_guard<std::mutex> lock(run->mutex);
+            run->decision.bolus = modelPredictiveController.getControlInput();
+            run->decision.tempBasalRate =
+                    modelPredictiveController.getTempBasalRate();
+            run->decision.tempBasalMinutes =
+                    modelPredictiveController.getTempBasalMinutes();
+            run->decision.predictions =
+                    modelPredictiveController.getPredictions();
+            run->decision.source = PrimarySource;
+            run->finished = true;
+            run->optimiseMs = elapsedMs(start);
+        }
+        run->changed.notify_all();
+    });
+}
+
+/*-----------------------------------------------------------------------------
+Name:     runFallback
+Purpose:  Chooses the bolus with the executor's copy of the StateSpaceModel
+          on the calling thread, with fewer scenarios and no pool.
+Receive:  const ControlRequest& request
+Return:   ControlDecision
+-----------------------------------------------------------------------------*/
+ControlDecision CycleExecutor::runFallback(const ControlRequest &request)
+{
+    ModelPredictiveController modelPredictiveController;
+    modelPredictiveController.setModel(&m_fallbackModel);
+    if(m_configure){
+        m_configure(modelPredictiveController);
+    }
+    //the late ensemble run may still hold the shared pool
+    modelPredictiveController.setThreadPool(nullptr);
+    modelPredictiveController.getScenarioEvaluator()->setThreadPool(nullptr);
+    modelPredictiveController.getScenarioEvaluator()->
+            setScenarioCount(m_fallbackScenarios);
+    for(int k=0; k<request.insulinInputs.size(); k++){
+        modelPredictiveController.addInsulinInput(request.insulinInputs[k]);
+    }
+    for(int i=0; i<request.bgInputs.size(); i++){
+        modelPredictiveController.addBGInput(request.bgInputs[i]);
+    }
+    modelPredictiveController.runPredictionModel();
+    modelPredictiveController.calculateControlInput();
+
+    ControlDecision decision;
+    decision.bolus = modelPredictiveController.getControlInput();
+    decision.tempBasalRate = modelPredictiveController.getTempBasalRate();
+    decision.tempBasalMinutes =
+            modelPredictiveController.getTempBasalMinutes();
+    decision.predictions = modelPredictiveController.getPredictions();
+    decision.source = FallbackSource;
+    return decision;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     runCached
+Purpose:  Last resort when no model can answer in time. Recommends no bolus
+          and reports the last ensemble trajectory shifted to the request's
+          reading, or no trajectory once it is older than the horizon.
+Receive:  const ControlRequest& request
+Return:   ControlDecision
+-----------------------------------------------------------------------------*/
+ControlDecision CycleExecutor::runCached(const ControlRequest &request) const
+{
+    ControlDecision decision;
+    decision.source = CachedSource;
+    int shift = (int)((request.sampleTime-m_cachedTime)/kSecondsPerStep+0.5);
+    if(m_cachedPredictions.empty() || shift<0 ||
+       shift>=m_cachedPredictions.size()){
+        return decision;
+    }
+    decision.predictions.assign(m_cachedPredictions.begin()+shift,
+                                m_cachedPredictions.end());
+    decision.predictions.resize(m_cachedPredictions.size(),
+                                m_cachedPredictions.back());
+    return decision;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     runControl
+Purpose:  Chooses the cycle's bolus within the predict and optimise
+          budgets. The ensemble gets the predict budget to produce its
+          trajectory and the optimise budget from then on to choose the
+          bolus; if it misses either, or is still busy with an earlier
+          cycle, the fallback answers instead.
+Receive:  const ControlRequest& request, BG inputs oldest first
+Return:   ControlDecision
+-----------------------------------------------------------------------------*/
+ControlDecision CycleExecutor::runControl(const ControlRequest &request)
+{
+    m_cycles++;
+    bool idle = collectPrimary();
+    if(!idle){
+        m_busyCycles++;
+        m_busyMetric->add();
+    }
+    else if(m_stateSpaceModel){
+        m_fallbackModel = *m_stateSpaceModel;
+        m_hasFallback = true;
+    }
+    //the copy sees every reading, including the ones the live model misses
+    if(m_hasFallback){
+        m_fallbackModel.observe(request.latestBG, request.insulinOnBoard,
+                                request.sampleTime);
+    }
+
+    if(idle && m_primaryModel){
+        //nothing runs the ensemble now, so retrained models can swap in
+        if(m_modelRegistry){
+            m_modelRegistry->refreshHandles();
+        }
+        startPrimary(request);
+        std::shared_ptr<PrimaryRun> run = m_primaryRun;
+        auto start = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(run->mutex);
+        bool predicted = run->changed.wait_until(lock,
+                deadlineAfter(m_stages[PredictStage].budgetMs),
+                [&run](){return run->predicted;});
+        if(!predicted){
+            recordStage(PredictStage, elapsedMs(start), true);
+        }
+        else{
+            recordStage(PredictStage, run->predictMs,
+                        run->predictMs>m_stages[PredictStage].budgetMs);
+            start = std::chrono::steady_clock::now();
+            bool finished = run->changed.wait_until(lock,
+                    deadlineAfter(m_stages[OptimiseStage].budgetMs),
+                    [&run](){return run->finished;});
+            if(finished){
+                recordStage(OptimiseStage, run->optimiseMs,
+                            run->optimiseMs>
+                            m_stages[OptimiseStage].budgetMs);
+                ControlDecision decision = run->decision;
+                lock.unlock();
+                collectPrimary();
+                m_sourceCycles[PrimarySource]->add();
+                return decision;
+            }
+            recordStage(OptimiseStage, elapsedMs(start), true);
+        }
+        LOG_WARNING("Ensemble missed its {} budget, falling back",
+                    predicted ? "optimise" : "predict");
+    }
+
+    if(m_hasFallback){
+        m_fallbackCycles++;
+        m_sourceCycles[FallbackSource]->add();
+        return runFallback(request);
+    }
+    m_cachedCycles++;
+    m_sourceCycles[CachedSource]->add();
+    return runCached(request);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     isPrimaryBusy
+Purpose:  Whether a late ensemble run still holds the live models. Joins it
+          if it has finished.
+Receive:  N/A
+Return:   bool
+-----------------------------------------------------------------------------*/
+bool CycleExecutor::isPrimaryBusy()
+{
+    return !collectPrimary();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getStageStats
+Purpose:  Returns a stage's timings and overrun count.
+Receive:  CycleStage stage
+Return:   const StageStats&
+-----------------------------------------------------------------------------*/
+const StageStats& CycleExecutor::getStageStats(CycleStage stage) const
+{
+    return m_stages[stage];
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getCycleCount
+Purpose:  Returns how many cycles runControl has answered.
+Receive:  N/A
+Return:   long
+-----------------------------------------------------------------------------*/
+long CycleExecutor::getCycleCount() const
+{
+    return m_cycles;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getFallbackCount
+Purpose:  Returns how many cycles the StateSpaceModel copy answered.
+Receive:  N/A
+Return:   long
+-----------------------------------------------------------------------------*/
+long CycleExecutor::getFallbackCount() const
+{
+    return m_fallbackCycles;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getCachedCount
+Purpose:  Returns how many cycles answered from the cached trajectory.
+Receive:  N/A
+Return:   long
+-----------------------------------------------------------------------------*/
+long CycleExecutor::getCachedCount() const
+{
+    return m_cachedCycles;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getBusyCount
+Purpose:  Returns how many cycles found the ensemble still running an
+          earlier one.
+Receive:  N/A
+Return:   long
+-----------------------------------------------------------------------------*/
+long CycleExecutor::getBusyCount() const
+{
+    return m_busyCycles;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     logStats
+Purpose:  Logs every stage's budget, timings and overruns and how the
+          cycles were answered. Called on the control thread, so it only
+          queues log records.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void CycleExecutor::logStats() const
+{
+    for(int i=0; i<kCycleStages; i++){
+        const StageStats& stats = m_stages[i];
+        LOG_INFO("{} budget {} ms, last {} ms, mean {} ms, max {} ms, "
+                 "overruns {}/{}", kStageNames[i], stats.budgetMs,
+                 stats.lastMs, stats.runs ? stats.totalMs/stats.runs : 0.0,
+                 stats.maxMs, stats.overruns, stats.runs);
+    }
+    LOG_INFO("{} cycles, {} fallback, {} cached, {} busy", m_cycles,
+             m_fallbackCycles, m_cachedCycles, m_busyCycles);
+}
@@ -0,0 +1,186 @@
+/******************************************************************************
+** FILE: CycleExecutor.h
+**
+** ABSTRACT:
+** Runs the controller cycle against per stage latency
+** budgets (ingest, predict, optimise, persist). The
+** expensive ensemble runs on its own thread; when it
+** misses its predict or optimise budget the bolus is
+** chosen with a copy of the StateSpaceModel instead, or
+** from the last ensemble trajectory when there is none,
+** so a recommendation always comes out on time. Stage
+** times and budget overruns are counted for export.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** A late ensemble run is left to finish in the background
+** (a popen'd RF script can't be interrupted safely) and
+** its trajectory is kept as the cached one. Until it has
+** finished the ensemble and the live StateSpaceModel are
+** only touched by that run, so later cycles go straight to
+** the fallback and isPrimaryBusy tells the caller not to
+** save them. The live models' observe and weight updates
+** happen inside the run for the same reason; readings
+** that arrive while it is busy are only seen by the copy.
+** Registered models move to newly published versions only
+** when the ensemble is idle, just before a run starts.
+**
+******************************************************************************/
+
+#ifndef CYCLEEXECUTOR_H
+#define CYCLEEXECUTOR_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "StateSpaceModel.h"
+using std::vector;
+
+class EnsembleModel;
+class ModelPredictiveController;
+class ModelRegistry;
+class MetricCounter;
+class MetricHistogram;
+
+enum CycleStage
+{
+    IngestStage = 0,
+    PredictStage,
+    OptimiseStage,
+    PersistStage,
+    kCycleStages
+};
+
+//model the cycle's bolus came from
+enum ControlSource
+{
+    PrimarySource = 0,
+    FallbackSource,
+    CachedSource
+};
+
+struct StageStats
+{
+    double budgetMs = 0.0;
+    double lastMs = 0.0;
+    double maxMs = 0.0;
+    double totalMs = 0.0;
+    long runs = 0;
+    long overruns = 0;
+};
+
+struct ControlRequest
+{
+    //oldest first
+    vector<int> bgInputs;
+    vector<float> insulinInputs;
+    int latestBG = 0;
+    double insulinOnBoard = 0.0;
+    double sampleTime = 0.0;
+};
+
+struct ControlDecision
+{
+    double bolus = 0.0;
+    //0 minutes to stay on the scheduled basal
+    double tempBasalRate = 0.0;
+    int tempBasalMinutes = 0;
+    vector<double> predictions;
+    ControlSource source = CachedSource;
+};
+
+class CycleExecutor
+{
+public:
+    typedef std::function<void(ModelPredictiveController&)> Configure;
+
+protected:
+    //shared with the thread running the ensemble
+    struct PrimaryRun
+    {
+        std::mutex mutex;
+        std::condition_variable changed;
+        bool predicted = false;
+        bool finished = false;
+        double sampleTime = 0.0;
+        double predictMs = 0.0;
+        double optimiseMs = 0.0;
+        ControlDecision decision;
+    };
+
+    //not owned
+    EnsembleModel* m_primaryModel = nullptr;
+    StateSpaceModel* m_stateSpaceModel = nullptr;
+    ModelRegistry* m_modelRegistry = nullptr;
+    Configure m_configure;
+
+    //the fallback's own copy, safe to use while the ensemble is busy
+    StateSpaceModel m_fallbackModel;
+    bool m_hasFallback = false;
+    int m_fallbackScenarios = 1000;
+    std::thread m_primaryThread;
+    std::shared_ptr<PrimaryRun> m_primaryRun;
+
+    vector<double> m_cachedPredictions;
+    double m_cachedTime = 0.0;
+
+    StageStats m_stages[kCycleStages];
+    std::chrono::steady_clock::time_point m_stageStart[kCycleStages];
+    long m_cycles = 0;
+    long m_fallbackCycles = 0;
+    long m_cachedCycles = 0;
+    //cycles that found the ensemble still running the previous one
+    long m_busyCycles = 0;
+
+    //exported copies of the above, owned by MetricsRegistry
+    MetricHistogram* m_stageLatency[kCycleStages];
+    MetricCounter* m_stageOverruns[kCycleStages];
+    MetricCounter* m_sourceCycles[CachedSource+1];
+    MetricCounter* m_busyMetric;
+
+    void recordStage(CycleStage stage, double ms, bool overrun);
+    bool collectPrimary();
+    void startPrimary(const ControlRequest& request);
+    ControlDecision runFallback(const ControlRequest& request);
+    ControlDecision runCached(const ControlRequest& request) const;
+
+public:
+    CycleExecutor();
+    ~CycleExecutor();
+    CycleExecutor(const CycleExecutor&) = delete;
+    CycleExecutor& operator=(const CycleExecutor&) = delete;
+
+    void setPrimaryModel(EnsembleModel* primaryModel);
+    void setStateSpaceModel(StateSpaceModel* stateSpaceModel);
+    void setModelRegistry(ModelRegistry* modelRegistry);
+    void setConfigure(const Configure& configure);
+    void setFallbackScenarios(int fallbackScenarios);
+    double getBudget(CycleStage stage) const;
+    void setBudget(CycleStage stage, double budgetMs);
+
+    void beginStage(CycleStage stage);
+    bool endStage(CycleStage stage);
+    ControlDecision runControl(const ControlRequest& request);
+    bool isPrimaryBusy();
+
+    const StageStats& getStageStats(CycleStage stage) const;
+    long getCycleCount() const;
+    long getFallbackCount() const;
+    long getCachedCount() const;
+    long getBusyCount() const;
+    void logStats() const;
+};
+
+#endif // CYCLEEXECUTOR_H
@@ -0,0 +1,60 @@
+/******************************************************************************
+** FILE: CycleSnapshot.h
+**
+** ABSTRACT:
+** What one control cycle hands to the GUI: the readings
+** and doses added since the previous snapshot, the
+** cycle's predicted trajectory and its recommendation.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** Snapshots are built on the control thread and passed by
+** shared pointer to const through queued signals, so the
+** GUI never touches the DataQueue and no copy is made per
+** receiver.
+**
+******************************************************************************/
+
+#ifndef CYCLESNAPSHOT_H
+#define CYCLESNAPSHOT_H
+
+#include <QMetaType>
+#include <memory>
+#include <vector>
+#include "DataQueue.h"
+using std::vector;
+
+struct BGReading
+{
+    double sampleTime;
+    int value;
+    int trend;
+    double delayTime;
+};
+
+struct CycleSnapshot
+{
+    //oldest first
+    vector<BGReading> readings;
+    vector<DoseRecord> doses;
+    //empty when the cycle did not run the controller
+    vector<double> predictions;
+    double predictionTime = 0.0;
+    //recommended, not given; 0 basal minutes for the scheduled basal
+    double bolus = 0.0;
+    double tempBasalRate = 0.0;
+    int tempBasalMinutes = 0;
+};
+
+typedef std::shared_ptr<const CycleSnapshot> CycleSnapshotPtr;
+Q_DECLARE_METATYPE(CycleSnapshotPtr)
+
+#endif // CYCLESNAPSHOT_H
@@ -28,44 +28,185 @@
 #include <string>
 #include <QDir>
 #include <QString>
-#include <iostream>
 using std::string;
 #include "DataQueue.h"
+#include "InsulinKinetics.h"
+#include "Logger.h"
+#include "MetricsRegistry.h"
+#include <string.h>
+#include <algorithm>
+
+namespace
+{
+//value, trend, lag, sample time, IOB and I5..I90
+const int kRecordFields = 23;
+const int kInsulinFields = 19;
+const int kLineLength = 1024;
+
+//readings stored and the queue length they leave, for the metrics
+void countReadings(int added, int queueSize)
+{
+    static MetricCounter& readings = MetricsRegistry::get().counter(
+            "ags_readings_total", "BG readings added to the queue");
+    static MetricGauge& queued = MetricsRegistry::get().gauge(
+            "ags_queue_readings", "BG readings held in the queue");
+    readings.add(added);
+    queued.set(queueSize);
+}
+
+void countInvalidBatch()
+{
+    static MetricCounter& invalid = MetricsRegistry::get().counter(
+            "ags_scraper_invalid_batches_total",
+            "Binary scraper batches rejected as truncated or corrupt");
+    invalid.add();
+}
+}
 
 /*-----------------------------------------------------------------------------
-Name:     getFutureInsulinValues
+Name:     getFutureInsulin
 Purpose:  The DataScraper script calculates the estimated plasma insulin
           concentration in 5 minute intervals for 90 minutes after the data
-          in question is queried. This container holds those values. The MPC
-          uses it to predict future BG in the case of the state space model.
+          in question is queried. Returns that curve for the newest reading.
+          The MPC uses it to predict future BG in the case of the state space
+          model.
 Receive:  N/A
-Return:   vector<float> DataQueue
+Return:   const double*, getFutureInsulinWidth() values, nullptr if the
+          newest reading has no curve
 -----------------------------------------------------------------------------*/
-vector<float> DataQueue::getFutureInsulinValues()
+const double *DataQueue::getFutureInsulin() const
 {
-    return m_futureInsulinValues;
+    if(m_futureInsulin.isEmpty() || !m_bgDataEntries.getSize() ||
+       m_futureInsulin.getSampleTimeAt(m_futureInsulin.getSize()-1)!=
+       m_bgDataEntries.getLastValue()->getSampleTime()){
+        return nullptr;
+    }
+    return m_futureInsulin.getLastTrajectory();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getFutureInsulinAt
+Purpose:  Returns the i-th stored future insulin curve, 0 oldest. The ring
+          has the BG ring's capacity, so curve i belongs to BG entry
+          i+getQueueSize()-getFutureInsulinQueueSize().
+Receive:  int i
+Return:   const double*, getFutureInsulinWidth() values
+-----------------------------------------------------------------------------*/
+const double *DataQueue::getFutureInsulinAt(int i) const
+{
+    return m_futureInsulin.getTrajectoryAt(i);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getFutureInsulinTimeAt
+Purpose:  Returns the sample time of the reading the i-th curve belongs to.
+Receive:  int i
+Return:   double
+-----------------------------------------------------------------------------*/
+double DataQueue::getFutureInsulinTimeAt(int i) const
+{
+    return m_futureInsulin.getSampleTimeAt(i);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getFutureInsulinQueueSize
+Purpose:  Returns the number of stored future insulin curves.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int DataQueue::getFutureInsulinQueueSize() const
+{
+    return m_futureInsulin.getSize();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getFutureInsulinWidth
+Purpose:  Returns the number of values in each future insulin curve.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int DataQueue::getFutureInsulinWidth() const
+{
+    return m_futureInsulin.getWidth();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     enqueueFutureInsulin
+Purpose:  Stores the future insulin curve of a reading, overwriting the
+          oldest once the ring is full. A short curve is padded with its last
+          value and a missing one is stored as no insulin, so the ring stays
+          in step with the BG ring.
+Receive:  double sampleTime of the reading
+          const double* values, int count
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void DataQueue::enqueueFutureInsulin(double sampleTime, const double *values,
+                                     int count)
+{
+    if(count<=0){
+        double none = 0.0;
+        m_futureInsulin.append(sampleTime, &none, 1);
+        return;
+    }
+    m_futureInsulin.append(sampleTime, values,
+                           std::min(count, m_futureInsulin.getWidth()));
+}
+
+/*-----------------------------------------------------------------------------
+Name:     recordDose
+Purpose:  Keeps a bolus the patient was given, from backfill or scraper
+          dose records. Empty or negative doses are ignored. Only the last
+          capacity doses are kept.
+Receive:  double sampleTime of the reading, double units
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void DataQueue::recordDose(double sampleTime, double units)
+{
+    if(!(units>0.0)){
+        return;
+    }
+    if(m_doseHistory.size()>=getQueueCapacity()){
+        m_doseHistory.erase(m_doseHistory.begin(), m_doseHistory.begin()+
+                            (m_doseHistory.size()-getQueueCapacity()+1));
+    }
+    DoseRecord dose = {sampleTime, units};
+    m_doseHistory.push_back(dose);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getDoseHistory
+Purpose:  Returns the recorded doses, oldest first.
+Receive:  N/A
+Return:   const vector<DoseRecord>&
+-----------------------------------------------------------------------------*/
+const vector<DoseRecord> &DataQueue::getDoseHistory() const
+{
+    return m_doseHistory;
 }
 
 /*-----------------------------------------------------------------------------
 Name:     enqueueBGPrediction
-Purpose:  Add a BG prediction value to the CircularArray.
-Receive:  double* prediction
+Purpose:  Stores a cycle's predicted trajectory so the readings it
+          predicts can score it.
+Receive:  double sampleTime of the reading the cycle ran on
+          const vector<double>& trajectory, 5 minute steps
 Return:   N/A
 -----------------------------------------------------------------------------*/
-void DataQueue::enqueueBGPrediction(double* prediction)
+void DataQueue::enqueueBGPrediction(double sampleTime,
+                                    const vector<double>& trajectory)
 {
-    m_predictions.enqueue(prediction);
+    m_predictions.append(sampleTime, trajectory);
 }
 
 /*-----------------------------------------------------------------------------
-Name:     dequeueBGPrediction
-Purpose:  Remove a BG prediction value from the CircularArray.
+Name:     getPredictionMetrics
+Purpose:  Returns the running accuracy of the stored trajectories.
 Receive:  N/A
-Return:   double*
+Return:   const PredictionMetrics&
 -----------------------------------------------------------------------------*/
-double* DataQueue::dequeueBGPrediction()
+const PredictionMetrics &DataQueue::getPredictionMetrics() const
 {
-    return m_predictions.dequeue();
+    return m_predictionMetrics;
 }
 
 /*-----------------------------------------------------------------------------
@@ -135,6 +276,7 @@ void DataQueue::setQueueCapacity(const int &capacity)
     m_bgDataEntries.setCapacity(capacity);
     m_insulinDataEntries.setCapacity(capacity);
     m_predictions.setCapacity(capacity);
+    m_futureInsulin.setCapacity(capacity);
 }
 
 /*-----------------------------------------------------------------------------
@@ -148,6 +290,83 @@ int DataQueue::getQueueSize() const
     return m_bgDataEntries.getSize();
 }
 
+/*-----------------------------------------------------------------------------
+Name:     getInsulinQueueSize
+Purpose:  Wrapper to get number of objects in the insulin container.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int DataQueue::getInsulinQueueSize() const
+{
+    return m_insulinDataEntries.getSize();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getPredictionQueueSize
+Purpose:  Wrapper to get number of objects in the prediction container.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int DataQueue::getPredictionQueueSize() const
+{
+    return m_predictions.getSize();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getBGEntryAt
+Purpose:  Wrapper to get the i-th oldest BGDataEntry in the container.
+Receive:  int i, 0 for the oldest
+Return:   BGDataEntry*
+-----------------------------------------------------------------------------*/
+BGDataEntry *DataQueue::getBGEntryAt(int i) const
+{
+    return m_bgDataEntries.getValueAt(i);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getInsulinEntryAt
+Purpose:  Wrapper to get the i-th oldest InsulinDataEntry in the container.
+Receive:  int i, 0 for the oldest
+Return:   InsulinDataEntry*
+-----------------------------------------------------------------------------*/
+InsulinDataEntry *DataQueue::getInsulinEntryAt(int i) const
+{
+    return m_insulinDataEntries.getValueAt(i);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getPredictionAt
+Purpose:  Wrapper to get the i-th oldest trajectory in the container.
+Receive:  int i, 0 for the oldest
+Return:   const double*, getPredictionWidth() values
+-----------------------------------------------------------------------------*/
+const double *DataQueue::getPredictionAt(int i) const
+{
+    return m_predictions.getTrajectoryAt(i);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getPredictionTimeAt
+Purpose:  Wrapper to get the sample time of the i-th oldest trajectory.
+Receive:  int i, 0 for the oldest
+Return:   double
+-----------------------------------------------------------------------------*/
+double DataQueue::getPredictionTimeAt(int i) const
+{
+    return m_predictions.getSampleTimeAt(i);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getPredictionWidth
+Purpose:  Wrapper to get the number of values per stored trajectory.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int DataQueue::getPredictionWidth() const
+{
+    return m_predictions.getWidth();
+}
+
 /*-----------------------------------------------------------------------------
 Name:     getFirstBGEntry
 Purpose:  Wrapper to get earliest BGDataEntry in the CircularArray container.
@@ -187,42 +406,50 @@ vector<InsulinDataEntry *> DataQueue::getNInsulinEntries(int n)
         values = m_insulinDataEntries.getNValues(n);
     }
     else{
-        std::cout<<"Not enough entries in queue!"<<std::endl;
+        LOG_WARNING("Not enough entries in queue!");
     }
     return values;
 }
 
 /*-----------------------------------------------------------------------------
 Name:     getNBGEntries
-Purpose:  Returns most recent n values (not entries) stored in the BG queue.
-          Uses the QueryNEntries script to query the AGS mysql database for the
-          entries since they may not be available to the application if
-          this routine is called before the queue has n entries.
-          *NOTE: I plan to have this routine construct BGDataEntry objects
-                 in the future.
+Purpose:  Returns most recent n values (not entries) stored in the BG queue,
+          newest first. Once the queue holds n entries they come straight
+          from it. Before that the QueryNEntries script queries the AGS mysql
+          database for the entries since they are not yet available to the
+          application.
 Receive:  int number of requested entires
 Return:   vector<int>
 -----------------------------------------------------------------------------*/
 vector<int> DataQueue::getNBGEntries(int n)
 {
     vector<int> values;
+    if(m_bgDataEntries.getSize()>=n){
+        for(int i=m_bgDataEntries.getSize()-1;
+            i>=m_bgDataEntries.getSize()-n; i--){
+            values.push_back(m_bgDataEntries.getValueAt(i)->getValue());
+        }
+        return values;
+    }
     string bgData;
 
     string RFRP = "/QueryNEntries/QueryNEntries";
     string RFFQP = QDir::currentPath().toStdString()+RFRP;
 
-    std::cout << "Opening query reading pipe" << std::endl;
+    LOG_DEBUG("Opening query reading pipe");
     FILE* pipe = popen(RFFQP.c_str(), "r");
     if (!pipe)
     {
-      std::cerr << "Couldn't start command." << std::endl;
-
+      LOG_ERROR("Couldn't start command.");
+      MetricsRegistry::get().countSubprocess("query", true);
+      return values;
     }
     char line[1024];
 
     while (fgets(line, 1024, pipe))
          bgData += line;
     auto returnCode = pclose(pipe);
+    MetricsRegistry::get().countSubprocess("query", returnCode!=0);
     //get predictions and push back to prediction container
     QString stringData = QString::fromUtf8(bgData.c_str());
     QStringList formattedData = stringData.split('\n');
@@ -238,21 +465,22 @@ vector<int> DataQueue::getNBGEntries(int n)
 
 /*-----------------------------------------------------------------------------
 Name:     getNPredictionEntries
-Purpose:  Returns most recent n entries stored in the Prediction queue. Checks
-          first to make sure the queue contains at least n entries.
-          *NOTE: I plan to have this routine behave similarly to getNBGEntries
-                 in the future.
+Purpose:  Returns most recent n trajectories stored in the Prediction queue,
+          oldest first. Checks first to make sure the queue contains at least
+          n entries.
 Receive:  int number of requested entires
-Return:   vector<double *>
+Return:   vector<const double*>
 -----------------------------------------------------------------------------*/
-vector<double *> DataQueue::getNPredictionEntries(int n)
+vector<const double *> DataQueue::getNPredictionEntries(int n)
 {
-    vector<double*> values;
-    if(m_insulinDataEntries.getSize()>=n){
-        values = m_predictions.getNValues(n);
+    vector<const double*> values;
+    if(m_predictions.getSize()>=n){
+        for(int i=m_predictions.getSize()-n; i<m_predictions.getSize(); i++){
+            values.push_back(m_predictions.getTrajectoryAt(i));
+        }
     }
     else{
-        std::cout<<"Not enough entries in queue!"<<std::endl;
+        LOG_WARNING("Not enough entries in queue!");
     }
     return values;
 }
@@ -283,95 +511,405 @@ InsulinDataEntry *DataQueue::getLastInsulinEntry() const
 
 /*-----------------------------------------------------------------------------
 Name:     scrapeData
-Purpose:  Calls the DataScraper script and pipes the data into a list. From
-          there, it uses the factories to construct (x1) insulin and bg data
-          entry objects and stores them in the queue. It also stores future
-          insulin values in the respective queue.
+Purpose:  Calls the DataScraper script in binary mode and reads its record
+          from the pipe with ingestBinaryStream.
 Receive:  N/A
 Return:   bool true if data has been scraped, false if there was no new data
           available.
 -----------------------------------------------------------------------------*/
 bool DataQueue::scrapeData()
 {
-    string bgData;
     //construct the command string to execute
-    string dexcomShareServerRP = "/DataScraper/DataScraper";
+    string dexcomShareServerRP = "/DataScraper/DataScraper --binary";
     string dexcomShareServerFQP =
             QDir::currentPath().toStdString()+dexcomShareServerRP;
-    //call the script and pipe output to bdData
-    std::cout << "Opening Dexcom reading pipe" << std::endl;
+    //call the script and read its records straight from the pipe
+    LOG_DEBUG("Opening Dexcom reading pipe");
     FILE* pipe = popen(dexcomShareServerFQP.c_str(), "r");
     if (!pipe)
     {
-        std::cerr << "Couldn't start command." << std::endl;
+        LOG_ERROR("Couldn't start command.");
+        MetricsRegistry::get().countSubprocess("scraper", true);
+        return false;
     }
-    char line[512];
-    //data goes into line array, bgData records it
-    while (fgets(line, 512, pipe))
-         bgData += line;
+    int added = ingestBinaryStream(pipe);
     //close pipe
-    auto returnCode = pclose(pipe);
-    //create DataEntry objects to add to the queue
-    InsulinDataEntry* aInsulinDataEntry;
-    BGDataEntry* aBGDataEntry;
-    //if indeed data has been scraped
-    if(bgData.size()){
-        BGDataEntryFactory aBGDataEntryFactory;
-        InsulinDataEntryFactory aInsulinDataEntryFactory;
-        QString stringData = QString::fromUtf8(bgData.c_str());
-        //put data in list, comma-separated
-        QStringList formattedData = stringData.split(",");
-        //use the factory interface to create the DataEntry objects
-        aBGDataEntry = aBGDataEntryFactory.createDataEntry(formattedData);
-        aInsulinDataEntry =
-        aInsulinDataEntryFactory.createDataEntry(formattedData);
-        //figure out the sample time of the last recorded bg data entry
+    int status = pclose(pipe);
+    MetricsRegistry::get().countSubprocess("scraper", status!=0);
+    //if indeed a new reading has been scraped
+    return added>0;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     ingestData
+Purpose:  Uses the factories to construct (x1) insulin and bg data entry
+          objects from one DataScraper record and stores them in the queue
+          if the reading is newer than the last one. It also replaces the
+          future insulin values with the ones in the record. The scraper and
+          the patient simulator both feed the queue through here.
+Receive:  const QStringList& formattedData: value, trend, lag, sample time,
+          IOB and the future IOB values I5..I90
+Return:   bool true if the record was a new reading
+-----------------------------------------------------------------------------*/
+bool DataQueue::ingestData(const QStringList &formattedData)
+{
+    if(formattedData.size()<5){
+        LOG_ERROR("Incomplete data record");
+        return false;
+    }
+    BGDataEntryFactory aBGDataEntryFactory;
+    InsulinDataEntryFactory aInsulinDataEntryFactory;
+    //use the factory interface to create the DataEntry objects
+    BGDataEntry* aBGDataEntry =
+    aBGDataEntryFactory.createDataEntry(formattedData);
+    //a record without a sample time or no newer than the last recorded bg
+    //data entry is a repeat of old data, so don't add it
+    if(!aBGDataEntry->getSampleTime() ||
+       (m_bgDataEntries.getSize() &&
+        m_bgDataEntries.getLastValue()->getSampleTime()>=
+        aBGDataEntry->getSampleTime())){
         if(aBGDataEntry->getSampleTime()){
-            if(m_bgDataEntries.getSize()){
-                double lastTime = 0.00;
-                if(m_bgDataEntries.getSize()==1){                    
-                    lastTime =
-                    m_bgDataEntries.getFirstValue()->getSampleTime();
-                }
-                else{                   
-                    lastTime = m_bgDataEntries.getLastValue()->getSampleTime();
-                }
-                //if the time is less than the sample time for this entry,
-                //it is a new one
-                if( (lastTime) < (aBGDataEntry->getSampleTime()) ){
-                    //therefore, we can add it to the queue
-                    m_insulinDataEntries.enqueue(aInsulinDataEntry);
-                    m_bgDataEntries.enqueue(aBGDataEntry);
-                    //remember to store future insulin values produced by the
-                    //script
-                    for(int j=4;j<formattedData.size();j++){
-                        m_futureInsulinValues.push_back
-                        (formattedData[j].toFloat());
-                    }
-                    //tell the caller we have new data
-                    return true;
-                }
-                //otherwise this data is a repeat of old data, so
-                //don't add it and return false
-                else{                   
-                    std::cout << "Not a new reading" << std::endl;
-                    return false;
-                }
+            LOG_DEBUG("Not a new reading");
+            static MetricCounter& repeats = MetricsRegistry::get().counter(
+                    "ags_readings_repeated_total",
+                    "Scraped readings no newer than the queue's last one");
+            repeats.add();
+        }
+        delete aBGDataEntry;
+        return false;
+    }
+    //therefore, we can add it to the queue
+    m_insulinDataEntries.enqueue
+    (aInsulinDataEntryFactory.createDataEntry(formattedData));
+    m_bgDataEntries.enqueue(aBGDataEntry);
+    countReadings(1, m_bgDataEntries.getSize());
+    m_predictionMetrics.update(m_predictions, aBGDataEntry->getSampleTime(),
+                               aBGDataEntry->getValue());
+    //remember to store future insulin values produced by the script, one
+    //curve per reading so it always matches the newest entry
+    double futureInsulin[kInsulinFields];
+    int count = 0;
+    for(int j=4; j<formattedData.size() && count<kInsulinFields; j++){
+        futureInsulin[count++] = formattedData[j].toDouble();
+    }
+    enqueueFutureInsulin(aBGDataEntry->getSampleTime(), futureInsulin, count);
+    //tell the caller we have new data
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setPeakInsulinTime
+Purpose:  Sets the peak of the insulin curve used to work out IOB for
+          backfilled readings that don't carry it.
+Receive:  double peakInsulinTime in minutes
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void DataQueue::setPeakInsulinTime(double peakInsulinTime)
+{
+    m_peakInsulinTime = peakInsulinTime;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setInsulinDurationMinutes
+Purpose:  Sets the total insulin activity (DIA) used to work out IOB for
+          backfilled readings that don't carry it.
+Receive:  double insulinDurationMinutes
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void DataQueue::setInsulinDurationMinutes(double insulinDurationMinutes)
+{
+    m_insulinDurationMinutes = insulinDurationMinutes;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     doseInsulinOnBoard
+Purpose:  Works out IOB from the recorded doses for readings that arrive
+          without it.
+Receive:  double sampleTime, double minutesAhead of it
+Return:   double units
+-----------------------------------------------------------------------------*/
+double DataQueue::doseInsulinOnBoard(double sampleTime,
+                                     double minutesAhead) const
+{
+    double iob = 0.0;
+    for(int d=0; d<m_doseHistory.size(); d++){
+        iob += InsulinKinetics::insulinOnBoard(m_doseHistory[d].units,
+               (sampleTime-m_doseHistory[d].sampleTime)/60.0+minutesAhead,
+               m_peakInsulinTime, m_insulinDurationMinutes);
+    }
+    return iob;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     ingestRecords
+Purpose:  Stores a time ordered batch of binary scraper records. Doses are
+          recorded, readings no newer than the queue's last one are skipped,
+          readings without insulin values get them from the doses and the
+          future insulin values are taken from the last reading added.
+Receive:  const ScraperRecord* records, int count
+Return:   int number of readings added to the queue
+-----------------------------------------------------------------------------*/
+int DataQueue::ingestRecords(const ScraperRecord *records, int count)
+{
+    BGDataEntryFactory aBGDataEntryFactory;
+    InsulinDataEntryFactory aInsulinDataEntryFactory;
+    int added = 0;
+    double lastTime = m_bgDataEntries.getSize() ?
+                      m_bgDataEntries.getLastValue()->getSampleTime() : 0.0;
+    for(int i=0; i<count; i++){
+        const ScraperRecord& record = records[i];
+        if(record.kind==ScraperRecord::Dose){
+            recordDose(record.sampleTime, record.units);
+            continue;
+        }
+        if(record.kind!=ScraperRecord::Reading || !record.sampleTime ||
+           record.sampleTime<=lastTime){
+            continue;
+        }
+        const ScraperRecord* source = &record;
+        ScraperRecord withInsulin;
+        if(record.insulinCount<=0){
+            withInsulin = record;
+            withInsulin.insulinCount = kScraperInsulinValues;
+            for(int k=0; k<kScraperInsulinValues; k++){
+                withInsulin.insulin[k] = doseInsulinOnBoard(record.sampleTime,
+                                                            k*5);
+            }
+            source = &withInsulin;
+        }
+        BGDataEntry* bgEntry = aBGDataEntryFactory.createDataEntry(*source);
+        m_insulinDataEntries.enqueue(
+                    aInsulinDataEntryFactory.createDataEntry(*source));
+        m_bgDataEntries.enqueue(bgEntry);
+        m_predictionMetrics.update(m_predictions, source->sampleTime,
+                                   source->value);
+        double futureInsulin[kScraperInsulinValues];
+        int insulinCount = std::min(source->insulinCount,
+                                    kScraperInsulinValues);
+        std::copy(source->insulin, source->insulin+insulinCount,
+                  futureInsulin);
+        enqueueFutureInsulin(source->sampleTime, futureInsulin, insulinCount);
+        lastTime = record.sampleTime;
+        added++;
+    }
+    countReadings(added, m_bgDataEntries.getSize());
+    return added;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     ingestBinaryBuffer
+Purpose:  Stores every batch in a buffer of binary records, e.g. a shared
+          memory segment or a mapped file. Aligned records are read in place.
+          A malformed batch stops the read; it is logged and counted in the
+          invalid batch metric, and the batches before it stay stored.
+Receive:  const void* data, size_t bytes
+Return:   int number of readings added before any malformed batch
+-----------------------------------------------------------------------------*/
+int DataQueue::ingestBinaryBuffer(const void *data, size_t bytes)
+{
+    const char* cursor = static_cast<const char*>(data);
+    const char* end = cursor+bytes;
+    int added = 0;
+    while(cursor<end){
+        ScraperBatchHeader header;
+        if(end-cursor<sizeof(header)){
+            LOG_ERROR("Truncated scraper batch");
+            countInvalidBatch();
+            return added;
+        }
+        memcpy(&header, cursor, sizeof(header));
+        cursor += sizeof(header);
+        size_t recordBytes = (size_t)header.count*sizeof(ScraperRecord);
+        if(memcmp(header.magic, kScraperMagic, 4) ||
+           header.version!=kScraperVersion ||
+           header.recordSize!=sizeof(ScraperRecord) ||
+           header.count>kScraperMaxRecords ||
+           end-cursor<recordBytes ||
+           scraperChecksum(cursor, recordBytes)!=header.checksum){
+            LOG_ERROR("Invalid scraper batch");
+            countInvalidBatch();
+            return added;
+        }
+        if(reinterpret_cast<uintptr_t>(cursor)%alignof(ScraperRecord)){
+            m_recordBuffer.resize(header.count);
+            memcpy(m_recordBuffer.data(), cursor, recordBytes);
+            added += ingestRecords(m_recordBuffer.data(), header.count);
+        }
+        else{
+            added += ingestRecords(
+                     reinterpret_cast<const ScraperRecord*>(cursor),
+                     header.count);
+        }
+        cursor += recordBytes;
+    }
+    return added;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     ingestBinaryStream
+Purpose:  Reads batches of binary records from a pipe or file until it ends.
+          Each batch is read with one fread into a reused buffer and checked
+          against its header before anything is stored. The record count is
+          capped before the buffer grows, so a corrupt header can't make it
+          allocate. A malformed batch stops the read; it is logged and
+          counted in the invalid batch metric, and the batches before it
+          stay stored.
+Receive:  FILE* stream, read to the end
+Return:   int number of readings added before any malformed batch
+-----------------------------------------------------------------------------*/
+int DataQueue::ingestBinaryStream(FILE *stream)
+{
+    int added = 0;
+    ScraperBatchHeader header;
+    while(fread(&header, sizeof(header), 1, stream)==1){
+        if(memcmp(header.magic, kScraperMagic, 4) ||
+           header.version!=kScraperVersion ||
+           header.recordSize!=sizeof(ScraperRecord) ||
+           header.count>kScraperMaxRecords){
+            LOG_ERROR("Invalid scraper batch");
+            countInvalidBatch();
+            return added;
+        }
+        m_recordBuffer.resize(header.count);
+        if(fread(m_recordBuffer.data(), sizeof(ScraperRecord), header.count,
+                 stream)!=header.count ||
+           scraperChecksum(m_recordBuffer.data(),
+                           header.count*sizeof(ScraperRecord))!=
+           header.checksum){
+            LOG_ERROR("Truncated or corrupt scraper batch");
+            countInvalidBatch();
+            return added;
+        }
+        added += ingestRecords(m_recordBuffer.data(), header.count);
+    }
+    return added;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     ingestStream
+Purpose:  Bulk inserts a time ordered stream of records in one pass. Each
+          line is either a DataScraper record (value, trend, lag, sample
+          time, then optionally IOB and I5..I90) or "dose,time,units". Lines
+          are parsed in place without building strings. Readings without
+          IOB get it from the doses seen earlier in the stream, readings
+          no newer than the queue's last one are skipped, and the future
+          insulin values are taken from the last reading.
+Receive:  FILE* stream, read to the end
+Return:   int number of readings added to the queue
+-----------------------------------------------------------------------------*/
+int DataQueue::ingestStream(FILE *stream)
+{
+    char line[kLineLength];
+    double fields[kRecordFields];
+    int added = 0;
+    double lastTime = m_bgDataEntries.getSize() ?
+                      m_bgDataEntries.getLastValue()->getSampleTime() : 0.0;
+    while(fgets(line, kLineLength, stream)){
+        bool dose = !strncmp(line, "dose,", 5);
+        char* cursor = dose ? line+5 : line;
+        int count = 0;
+        while(count<kRecordFields){
+            char* end;
+            fields[count] = strtod(cursor, &end);
+            if(end!=cursor){
+                count++;
+            }
+            else if(!count){
+                break;
             }
-            //clearly new data, we can add it to the queues
             else{
-                m_insulinDataEntries.enqueue(aInsulinDataEntry);
-                m_bgDataEntries.enqueue(aBGDataEntry);
-                for(int j=4;j<formattedData.size();j++){
-                    m_futureInsulinValues.push_back
-                    (formattedData[j].toFloat());
-                }
-                return true;
+                //non numeric field (e.g. a trend name), keep its place
+                fields[count++] = 0.0;
+            }
+            cursor = strchr(end, ',');
+            if(!cursor){
+                break;
             }
+            cursor++;
         }
-        return false;
+        if(dose){
+            if(count>=2){
+                recordDose(fields[0], fields[1]);
+            }
+            continue;
+        }
+        if(count<4 || !fields[3] || fields[3]<=lastTime){
+            continue;
+        }
+        double sampleTime = fields[3];
+        if(count<4+kInsulinFields){
+            //work out IOB now and every 5 minutes ahead from the doses
+            count = 4+kInsulinFields;
+            for(int k=0; k<kInsulinFields; k++){
+                fields[4+k] = doseInsulinOnBoard(sampleTime, k*5);
+            }
+        }
+        BGDataEntry* bgEntry = new BGDataEntry();
+        bgEntry->setValue(fields[0]);
+        bgEntry->setTrend(fields[1]);
+        bgEntry->setSampleTime(sampleTime);
+        bgEntry->setScrapeTime(sampleTime+fields[2]);
+        bgEntry->setDelayTime(300.0-fields[2]);
+        InsulinDataEntry* insulinEntry = new InsulinDataEntry();
+        insulinEntry->setInsulinOnBoard(fields[4]);
+        insulinEntry->setSampleTime(sampleTime);
+        m_bgDataEntries.enqueue(bgEntry);
+        m_insulinDataEntries.enqueue(insulinEntry);
+        m_predictionMetrics.update(m_predictions, sampleTime, fields[0]);
+        enqueueFutureInsulin(sampleTime, fields+4, count-4);
+        lastTime = sampleTime;
+        added++;
+    }
+    countReadings(added, m_bgDataEntries.getSize());
+    return added;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     backfill
+Purpose:  Fills the queue with the last days of readings and doses in one
+          batched DataScraper call instead of waiting for them one at a time.
+Receive:  int days
+Return:   int number of readings added to the queue
+-----------------------------------------------------------------------------*/
+int DataQueue::backfill(int days)
+{
+    string command = QDir::currentPath().toStdString()+
+                     "/DataScraper/DataScraper --backfill "+
+                     std::to_string(days*1440)+" --binary";
+    LOG_DEBUG("Opening Dexcom backfill pipe");
+    FILE* pipe = popen(command.c_str(), "r");
+    if(!pipe){
+        LOG_ERROR("Couldn't start command.");
+        MetricsRegistry::get().countSubprocess("backfill", true);
+        return 0;
+    }
+    int added = ingestBinaryStream(pipe);
+    int status = pclose(pipe);
+    MetricsRegistry::get().countSubprocess("backfill", status!=0);
+    return added;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     backfillFromFile
+Purpose:  Fills the queue from a local export in the backfill format,
+          either binary batches or text lines.
+Receive:  const string& path
+Return:   int number of readings added to the queue
+-----------------------------------------------------------------------------*/
+int DataQueue::backfillFromFile(const string &path)
+{
+    FILE* file = fopen(path.c_str(), "r");
+    if(!file){
+        LOG_ERROR("Couldn't open {}", path);
+        return 0;
     }
-    return false;
+    //text exports start with a digit or "dose", binary with the magic
+    int first = getc(file);
+    ungetc(first, file);
+    int added = first==kScraperMagic[0] ? ingestBinaryStream(file) :
+                                          ingestStream(file);
+    fclose(file);
+    return added;
 }
 
 /*-----------------------------------------------------------------------------
@@ -27,11 +27,23 @@
 #define DATAQUEUE_H
 
 #include <QVector>
+#include <QStringList>
+#include <stdio.h>
+#include <string>
 #include "CircularArarray.h"
 #include "BGDataEntry.h"
 #include "InsulinDataEntry.h"
 #include "BGDataEntryFactory.h"
 #include "InsulinDataEntryFactory.h"
+#include "TrajectoryRing.h"
+#include "PredictionMetrics.h"
+#include "ScraperRecord.h"
+
+struct DoseRecord
+{
+    double sampleTime;
+    double units;
+};
 
 class DataQueue
 {
@@ -39,17 +51,37 @@ protected:
     CircularArray<BGDataEntry*> m_bgDataEntries;
     CircularArray<InsulinDataEntry*> m_insulinDataEntries;
     int m_capacity = 288;
-    CircularArray<double*> m_predictions;
-    vector<float> m_futureInsulinValues;
+    //one 18 point trajectory per cycle, scored as readings arrive
+    TrajectoryRing m_predictions;
+    PredictionMetrics m_predictionMetrics;
+    //one future insulin curve per reading, filled alongside the BG ring
+    TrajectoryRing m_futureInsulin{kScraperInsulinValues};
+    vector<DoseRecord> m_doseHistory;
+    //insulin curve for backfilled readings that come without IOB
+    double m_peakInsulinTime = 57.0;
+    double m_insulinDurationMinutes = 300.0;
+    //reused by the binary readers so a batch doesn't allocate
+    vector<ScraperRecord> m_recordBuffer;
+
+    double doseInsulinOnBoard(double sampleTime, double minutesAhead) const;
 
 public:
     DataQueue() = default;
     virtual ~DataQueue() = default;
     DataQueue(DataQueue& buffer) = default;
 
-    vector<float> getFutureInsulinValues();
-    void enqueueBGPrediction(double* prediction);
-    double* dequeueBGPrediction();
+    const double* getFutureInsulin() const;
+    const double* getFutureInsulinAt(int i) const;
+    double getFutureInsulinTimeAt(int i) const;
+    int getFutureInsulinQueueSize() const;
+    int getFutureInsulinWidth() const;
+    void enqueueFutureInsulin(double sampleTime, const double* values,
+                              int count);
+    void recordDose(double sampleTime, double units);
+    const vector<DoseRecord>& getDoseHistory() const;
+    void enqueueBGPrediction(double sampleTime,
+                             const vector<double>& trajectory);
+    const PredictionMetrics& getPredictionMetrics() const;
     BGDataEntry* dequeueBGEntry();
     void enqueueBGEntry(BGDataEntry* entry);
     InsulinDataEntry* dequeueInsulinEntry();
@@ -57,14 +89,30 @@ public:
     int getQueueCapacity() const;
     void setQueueCapacity(const int& capacity);
     int getQueueSize() const;
+    int getInsulinQueueSize() const;
+    int getPredictionQueueSize() const;
+    BGDataEntry* getBGEntryAt(int i) const;
+    InsulinDataEntry* getInsulinEntryAt(int i) const;
+    const double* getPredictionAt(int i) const;
+    double getPredictionTimeAt(int i) const;
+    int getPredictionWidth() const;
     BGDataEntry* getFirstBGEntry() const;
     InsulinDataEntry *getFirstInsulinEntry() const;
     InsulinDataEntry *getLastInsulinEntry() const;
     BGDataEntry* getLastBGEntry() const;
     vector<InsulinDataEntry*> getNInsulinEntries(int n);
     vector<int> getNBGEntries(int n);
-    vector<double *> getNPredictionEntries(int n);
+    vector<const double*> getNPredictionEntries(int n);
     bool scrapeData();
+    bool ingestData(const QStringList& formattedData);
+    void setPeakInsulinTime(double peakInsulinTime);
+    void setInsulinDurationMinutes(double insulinDurationMinutes);
+    int ingestStream(FILE* stream);
+    int ingestRecords(const ScraperRecord* records, int count);
+    int ingestBinaryBuffer(const void* data, size_t bytes);
+    int ingestBinaryStream(FILE* stream);
+    int backfill(int days);
+    int backfillFromFile(const std::string& path);
     void printData();
 };
 
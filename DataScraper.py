@@ -23,12 +23,15 @@
 #!/usr/bin/env python
 import mysql.connector
 from mysql.connector import errorcode
+import calendar
 import configparser
 import datetime
 from datetime import date
 import os
 import re
 import requests
+import struct
+import sys
 import time
 import json
 from math import exp
@@ -51,6 +54,8 @@ configfile:
 
 
 CHECK_INTERVAL = 60 * 2.5
+TREATMENTS_URL = \
+    'http://bgcs.herokuapp.com/api/v1/treatments.json?find[insulin][$gte]=0.1'
 AUTH_RETRY_DELAY_BASE = 2
 FAIL_RETRY_DELAY_BASE = 2
 
@@ -58,6 +63,18 @@ MAX_FETCHFAILS = 10
 RETRY_DELAY = 60 # Seconds
 LAST_READING_MAX_LAG = 60 * 15
 
+# binary record protocol read by DataQueue::ingestBinaryStream, see
+# ScraperRecord.h: a header (magic, version, record size, count, FNV-1a of
+# the records) followed by count fixed size little endian records
+RECORD_MAGIC = b'AGSR'
+RECORD_VERSION = 1
+RECORD_HEADER = '<4sHHII'
+RECORD_FORMAT = '<dddiiii19f4x'
+READING_RECORD = 0
+DOSE_RECORD = 1
+INSULIN_VALUES = 19
+RECORD_MAX_BATCH = 65536
+
 last_date = 0
 notify_timeout = 5
 notify_bg_threshold = 170
@@ -447,9 +464,10 @@ def query_dexcom(push_report=False):
     return reading
 
 
-def main():
+def main(binary=False):
     '''
     Query data, put in AGS database, send output to console.
+    :binary: write a binary record instead of the comma separated line
     '''
 
     data = query_dexcom()
@@ -554,6 +572,12 @@ def main():
         insertToDB(IOB,TIME,cnx)
 
     #console output for AGS Pipe
+    if binary:
+        write_records([pack_reading(TIME, BG, TREND, LAG,
+                       [IOB, fiveIOB, tenIOB, fifteenIOB, twentyIOB,
+                        twentyFiveIOB, thirtyIOB, I35, I40, I45, I50, I55,
+                        I60, I65, I70, I75, I80, I85, I90])])
+        return result
     result = result+","+str(IOB)+","+str(fiveIOB)+","+str(tenIOB)+","+
     str(fifteenIOB)+","+str(twentyIOB)+","+str(twentyFiveIOB)+","+
     str(thirtyIOB)+","+str(I35)+","+str(I40)+","+str(I45)+","+str(I50)+
@@ -562,6 +586,169 @@ def main():
     print(result)
     return result
 
+def trend_id(trend):
+    '''
+    Returns the numeric Dexcom trend whether the server sent an ID or a name
+    :trend: trend ID or friendly name
+    :return: trend ID, 0 if unknown
+    '''
+
+    if isinstance(trend, str):
+        return DIRECTIONS.get(trend, int(trend) if trend.isdigit() else 0)
+    return int(trend)
+
+
+def pack_reading(readingTime, bg, trend, lag, iob):
+    '''
+    Packs one reading as a binary record
+    :readingTime: sample time in seconds since epoch
+    :bg: value in mg/dl
+    :trend: trend ID or name
+    :lag: seconds between the reading and the query
+    :iob: IOB now and every 5 minutes for 90 minutes
+    :return: bytes
+    '''
+
+    values = [float(value) for value in iob[:INSULIN_VALUES]]
+    count = len(values)
+    values += [0.0] * (INSULIN_VALUES - count)
+    return struct.pack(RECORD_FORMAT, float(readingTime), float(lag), 0.0,
+                       READING_RECORD, int(bg), trend_id(trend), count,
+                       *values)
+
+
+def pack_dose(doseTime, units):
+    '''
+    Packs one dose as a binary record
+    :doseTime: seconds since epoch
+    :units: insulin units
+    :return: bytes
+    '''
+
+    return struct.pack(RECORD_FORMAT, float(doseTime), 0.0, float(units),
+                       DOSE_RECORD, 0, 0, 0, *([0.0] * INSULIN_VALUES))
+
+
+def write_records(records):
+    '''
+    Writes packed records to stdout behind a header, split into batches of
+    at most RECORD_MAX_BATCH records since readers reject larger ones
+    :records: list of bytes from pack_reading/pack_dose
+    '''
+
+    for first in range(0, max(len(records), 1), RECORD_MAX_BATCH):
+        batch = records[first:first + RECORD_MAX_BATCH]
+        payload = b''.join(batch)
+        checksum = 2166136261
+        for byte in payload:
+            checksum = ((checksum ^ byte) * 16777619) & 0xffffffff
+        sys.stdout.buffer.write(struct.pack(RECORD_HEADER, RECORD_MAGIC,
+                                            RECORD_VERSION,
+                                            struct.calcsize(RECORD_FORMAT),
+                                            len(batch), checksum) + payload)
+    sys.stdout.buffer.flush()
+
+
+def getEpoch(time):
+    '''
+    Returns the seconds since epoch of a treatment time
+    :time: the time in "%Y-%m-%dT%H:%M:%S.%fZ" format (UTC)
+    :return: seconds since epoch
+    '''
+    fmt = "%Y-%m-%dT%H:%M:%S.%fZ"
+    return calendar.timegm(datetime.datetime.strptime(time, fmt).timetuple())
+
+
+def fetch_history(opts, minutes):
+    '''
+    Fetch every reading of the last minutes from dexcom share server in one
+    request
+    :opts: authentication info
+    :minutes: how far back to go
+    :return: POST
+    '''
+
+    url = Defaults.LatestGlucose_url + '?' + "sessionID=" + opts.sessionID +\
+        "&minutes=" + str(minutes) + "&maxCount=" + str(minutes // 5)
+    body = {
+            'applicationId': 'd89443d2-327c-4a6f-89e5-496bbb0317db'
+            }
+
+    headers = {
+            'User-Agent': Defaults.agent,
+            'Content-Type': Defaults.content_type,
+            'Content-Length': "0",
+            'Accept': Defaults.accept
+            }
+
+    return requests.post(url, json=body, headers=headers)
+
+
+def backfill(minutes, binary=False):
+    '''
+    Backfill mode for AGS. Prints every reading of the last minutes oldest
+    first, one per line in the same format main prints, with a
+    "dose,time,units" line for every dose just before the first reading after
+    it. AGS streams the output straight into its queue.
+    :minutes: how far back to go
+    :binary: write the same sequence as one batch of binary records
+    '''
+
+    opts = Defaults
+    opts.accountName = os.getenv("DEXCOM_ACCOUNT_NAME", DEXCOM_ACCOUNT_NAME)
+    opts.password = os.getenv("DEXCOM_PASSWORD", DEXCOM_PASSWORD)
+    opts.sessionID = get_sessionID(opts)
+    res = fetch_history(opts, minutes)
+    if not res or res.status_code >= 400:
+        raise FetchError(res.status_code, res)
+
+    readings = []
+    for entry in res.json():
+        readingTime = int(re.search('\d+', entry['ST']).group())/1000
+        readings.append((readingTime, entry['Value'], entry['Trend']))
+    readings.sort()
+
+    doses = []
+    for treatment in json.loads(requests.get(TREATMENTS_URL).text):
+        doses.append((getEpoch(treatment['created_at']),
+                      treatment['insulin']))
+    doses.sort()
+
+    activeSeconds = float(DIA) * 3600
+    firstTime = readings[0][0] - minutes * 60 if len(readings) else 0
+    given = 0
+    records = []
+    for (readingTime, bg, trend) in readings:
+        while given < len(doses) and doses[given][0] <= readingTime:
+            if doses[given][0] >= firstTime and binary:
+                records.append(pack_dose(doses[given][0], doses[given][1]))
+            elif doses[given][0] >= firstTime:
+                print("dose," + str(doses[given][0]) + "," +
+                      str(doses[given][1]))
+            given += 1
+        #IOB now and every 5 minutes for 90 minutes, like main
+        active = [dose for dose in doses[:given]
+                  if readingTime - dose[0] < activeSeconds]
+        iob = []
+        for future in range(0, 95, 5):
+            total = 0.0
+            for (doseTime, units) in active:
+                total += calculateIOB(float(PEAK_INSULIN), float(DIA), units,
+                                      (readingTime - doseTime) / 60.0, future)
+            iob.append(total)
+        if binary:
+            records.append(pack_reading(readingTime, bg, trend, 0, iob))
+            continue
+        print(str(bg) + "," + str(trend) + ",0," + str(int(readingTime)) +
+              "," + ",".join([str(value) for value in iob]))
+    if binary:
+        write_records(records)
+
+
 if __name__ == '__main__':
 
-    main()
+    binary = '--binary' in sys.argv
+    if len(sys.argv) > 2 and sys.argv[1] == '--backfill':
+        backfill(int(sys.argv[2]), binary)
+    else:
+        main(binary)
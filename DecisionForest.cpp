@@ -0,0 +1,285 @@
+/******************************************************************************
+** FILE: DecisionForest.cpp
+**
+** ABSTRACT:
+** Native inference format for the multi-output random
+** forest. Trees are stored as one flat node table plus
+** one flat table of leaf values so the whole forest can
+** be written and read with a handful of block copies and
+** evaluated without Python.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+**
+******************************************************************************/
+
+#include "DecisionForest.h"
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+
+namespace
+{
+const char kMagic[4] = {'A', 'G', 'S', 'F'};
+const unsigned int kVersion = 1;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getFeatureCount
+Purpose:  Returns the number of input features the forest was trained on.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int DecisionForest::getFeatureCount() const
+{
+    return m_featureCount;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getOutputCount
+Purpose:  Returns the number of values predicted per sample (18 BG values).
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int DecisionForest::getOutputCount() const
+{
+    return m_outputCount;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getTreeCount
+Purpose:  Returns the number of trees in the forest.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int DecisionForest::getTreeCount() const
+{
+    return m_treeRoots.size();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getTreeRoots
+Purpose:  Returns the index of the root node of each tree.
+Receive:  N/A
+Return:   const vector<int>&
+-----------------------------------------------------------------------------*/
+const vector<int> &DecisionForest::getTreeRoots() const
+{
+    return m_treeRoots;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getNodes
+Purpose:  Returns the flat node table shared by all trees.
+Receive:  N/A
+Return:   const vector<ForestNode>&
+-----------------------------------------------------------------------------*/
+const vector<ForestNode> &DecisionForest::getNodes() const
+{
+    return m_nodes;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getLeafValues
+Purpose:  Returns the flat table of leaf values, outputCount per leaf.
+Receive:  N/A
+Return:   const vector<float>&
+-----------------------------------------------------------------------------*/
+const vector<float> &DecisionForest::getLeafValues() const
+{
+    return m_leafValues;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setShape
+Purpose:  Clears the forest and sets the number of features and outputs
+          before trees are added.
+Receive:  int featureCount, int outputCount
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void DecisionForest::setShape(int featureCount, int outputCount)
+{
+    m_featureCount = featureCount;
+    m_outputCount = outputCount;
+    m_treeRoots.clear();
+    m_nodes.clear();
+    m_leafValues.clear();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     addTree
+Purpose:  Appends one tree built with node and leaf indices local to the
+          tree, rebasing them onto the forest tables.
+Receive:  const vector<ForestNode>& nodes, root first
+          const vector<float>& leafValues
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void DecisionForest::addTree(const vector<ForestNode> &nodes,
+                             const vector<float> &leafValues)
+{
+    int nodeOffset = m_nodes.size();
+    int leafOffset = m_leafValues.size();
+    m_treeRoots.push_back(nodeOffset);
+    for(int i=0; i<nodes.size(); i++){
+        ForestNode node = nodes[i];
+        if(node.feature<0){
+            node.left += leafOffset;
+        }
+        else{
+            node.left += nodeOffset;
+            node.right += nodeOffset;
+        }
+        m_nodes.push_back(node);
+    }
+    m_leafValues.insert(m_leafValues.end(), leafValues.begin(),
+                        leafValues.end());
+}
+
+/*-----------------------------------------------------------------------------
+Name:     isValid
+Purpose:  Checks every index in the node table so a corrupt or truncated
+          file can never send predict outside the tables.
+Receive:  N/A
+Return:   bool
+-----------------------------------------------------------------------------*/
+bool DecisionForest::isValid() const
+{
+    if(m_featureCount<=0 || m_outputCount<=0 || !m_treeRoots.size()){
+        return false;
+    }
+    for(int i=0; i<m_treeRoots.size(); i++){
+        if(m_treeRoots[i]<0 || m_treeRoots[i]>=m_nodes.size()){
+            return false;
+        }
+    }
+    for(int i=0; i<m_nodes.size(); i++){
+        const ForestNode& node = m_nodes[i];
+        if(node.feature<0){
+            if(node.left<0 || node.left+m_outputCount>m_leafValues.size()){
+                return false;
+            }
+        }
+        else if(node.feature>=m_featureCount ||
+                node.left<=i || node.left>=m_nodes.size() ||
+                node.right<=i || node.right>=m_nodes.size()){
+            //children always follow their parent so there are no cycles
+            return false;
+        }
+    }
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     load
+Purpose:  Reads a forest written by save (or by the native trainer).
+Receive:  const string& path
+Return:   bool true if the file was read and validated
+-----------------------------------------------------------------------------*/
+bool DecisionForest::load(const string &path)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if(!file){
+        std::cerr << "Couldn't open forest " << path << std::endl;
+        return false;
+    }
+    char magic[4];
+    unsigned int header[6];
+    bool valid = fread(magic, 1, 4, file)==4 &&
+                 memcmp(magic, kMagic, 4)==0 &&
+                 fread(header, sizeof(unsigned int), 6, file)==6 &&
+                 header[0]==kVersion;
+    if(valid){
+        m_featureCount = header[1];
+        m_outputCount = header[2];
+        m_treeRoots.resize(header[3]);
+        m_nodes.resize(header[4]);
+        m_leafValues.resize(header[5]);
+        valid = fread(m_treeRoots.data(), sizeof(int), m_treeRoots.size(),
+                      file)==m_treeRoots.size() &&
+                fread(m_nodes.data(), sizeof(ForestNode), m_nodes.size(),
+                      file)==m_nodes.size() &&
+                fread(m_leafValues.data(), sizeof(float), m_leafValues.size(),
+                      file)==m_leafValues.size();
+    }
+    fclose(file);
+    if(!valid || !isValid()){
+        std::cerr << "Invalid forest " << path << std::endl;
+        setShape(0, 0);
+        return false;
+    }
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     save
+Purpose:  Writes the forest in the native format.
+Receive:  const string& path
+Return:   bool true if the whole file was written
+-----------------------------------------------------------------------------*/
+bool DecisionForest::save(const string &path) const
+{
+    FILE* file = fopen(path.c_str(), "wb");
+    if(!file){
+        std::cerr << "Couldn't write forest " << path << std::endl;
+        return false;
+    }
+    unsigned int header[6] = {kVersion, (unsigned int)m_featureCount,
+                              (unsigned int)m_outputCount,
+                              (unsigned int)m_treeRoots.size(),
+                              (unsigned int)m_nodes.size(),
+                              (unsigned int)m_leafValues.size()};
+    bool written = fwrite(kMagic, 1, 4, file)==4 &&
+                   fwrite(header, sizeof(unsigned int), 6, file)==6 &&
+                   fwrite(m_treeRoots.data(), sizeof(int), m_treeRoots.size(),
+                          file)==m_treeRoots.size() &&
+                   fwrite(m_nodes.data(), sizeof(ForestNode), m_nodes.size(),
+                          file)==m_nodes.size() &&
+                   fwrite(m_leafValues.data(), sizeof(float),
+                          m_leafValues.size(), file)==m_leafValues.size();
+    if(fclose(file)!=0){
+        written = false;
+    }
+    return written;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     predict
+Purpose:  Averages the leaf reached in every tree, the same as sklearn's
+          RandomForestRegressor.predict for one sample.
+Receive:  const float* features of getFeatureCount values
+          double* outputs filled with getOutputCount values
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void DecisionForest::predict(const float *features, double *outputs) const
+{
+    for(int k=0; k<m_outputCount; k++){
+        outputs[k] = 0.0;
+    }
+    if(!m_treeRoots.size()){
+        return;
+    }
+    const ForestNode* nodes = m_nodes.data();
+    for(int t=0; t<m_treeRoots.size(); t++){
+        const ForestNode* node = nodes + m_treeRoots[t];
+        while(node->feature>=0){
+            node = nodes + (features[node->feature]<=node->threshold ?
+                            node->left : node->right);
+        }
+        const float* leaf = m_leafValues.data() + node->left;
+        for(int k=0; k<m_outputCount; k++){
+            outputs[k] += leaf[k];
+        }
+    }
+    double scale = 1.0/m_treeRoots.size();
+    for(int k=0; k<m_outputCount; k++){
+        outputs[k] *= scale;
+    }
+}
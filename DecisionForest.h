@@ -0,0 +1,76 @@
+/******************************************************************************
+** FILE: DecisionForest.h
+**
+** ABSTRACT:
+** Native inference format for the multi-output random
+** forest. Trees are stored as one flat node table plus
+** one flat table of leaf values so the whole forest can
+** be written and read with a handful of block copies and
+** evaluated without Python.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** File layout (little endian, version 1):
+**   char[4] "AGSF", uint32 version, uint32 features,
+**   uint32 outputs, uint32 trees, uint32 nodes,
+**   uint32 leafValues, int32 roots[trees],
+**   ForestNode nodes[nodes], float leafValues[leafValues]
+** A node with feature -1 is a leaf and left is the index
+** of its first value in the leaf table. Otherwise samples
+** with features[feature] <= threshold go left.
+**
+******************************************************************************/
+
+#ifndef DECISIONFOREST_H
+#define DECISIONFOREST_H
+
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+struct ForestNode
+{
+    int feature;
+    float threshold;
+    int left;
+    int right;
+};
+
+class DecisionForest
+{
+protected:
+    int m_featureCount = 0;
+    int m_outputCount = 0;
+    vector<int> m_treeRoots;
+    vector<ForestNode> m_nodes;
+    vector<float> m_leafValues;
+
+public:
+    DecisionForest() = default;
+    ~DecisionForest() = default;
+
+    int getFeatureCount() const;
+    int getOutputCount() const;
+    int getTreeCount() const;
+    const vector<int>& getTreeRoots() const;
+    const vector<ForestNode>& getNodes() const;
+    const vector<float>& getLeafValues() const;
+    void setShape(int featureCount, int outputCount);
+    void addTree(const vector<ForestNode>& nodes,
+                 const vector<float>& leafValues);
+    bool isValid() const;
+    bool load(const string& path);
+    bool save(const string& path) const;
+    void predict(const float* features, double* outputs) const;
+};
+
+#endif // DECISIONFOREST_H
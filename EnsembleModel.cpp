@@ -0,0 +1,332 @@
+/******************************************************************************
+** FILE: EnsembleModel.cpp
+**
+** ABSTRACT:
+** Holds several models, runs each of them concurrently
+** over the same inputs and fuses their trajectories
+** into one weighted average. Weights are either set by
+** the caller or learned from each member's recent
+** prediction error. Lets the MPC optimize once over a
+** single trajectory set however many models are used.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** The ensemble does not own its member models.
+**
+******************************************************************************/
+
+#include "EnsembleModel.h"
+#include <thread>
+#include <iostream>
+
+/*-----------------------------------------------------------------------------
+Name:     addModel
+Purpose:  Adds a member model to the ensemble with its starting weight.
+Receive:  Model* model, double weight
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void EnsembleModel::addModel(Model *model, double weight)
+{
+    m_models.push_back(model);
+    m_weights.push_back(weight);
+    m_squaredErrors.push_back(0.0);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getModelCount
+Purpose:  Returns the number of member models.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int EnsembleModel::getModelCount() const
+{
+    return m_models.size();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getWeights
+Purpose:  Returns the weight of each member model aligned by index with the
+          order they were added.
+Receive:  N/A
+Return:   vector<double>
+-----------------------------------------------------------------------------*/
+vector<double> EnsembleModel::getWeights() const
+{
+    return m_weights;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getSquaredErrors
+Purpose:  Returns the running mean squared one step error of each member.
+Receive:  N/A
+Return:   vector<double>
+-----------------------------------------------------------------------------*/
+vector<double> EnsembleModel::getSquaredErrors() const
+{
+    return m_squaredErrors;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setSquaredErrors
+Purpose:  Restores the running errors, and the weights learned from them,
+          saved by an earlier run.
+Receive:  const vector<double>& squaredErrors aligned with the members
+Return:   bool false if the list does not match the members
+-----------------------------------------------------------------------------*/
+bool EnsembleModel::setSquaredErrors(const vector<double> &squaredErrors)
+{
+    if(squaredErrors.size()!=m_models.size()){
+        return false;
+    }
+    m_squaredErrors = squaredErrors;
+    if(m_learnWeights){
+        for(int m=0; m<m_models.size(); m++){
+            if(m_squaredErrors[m]!=0.0){
+                m_weights[m] = 1.0/(m_squaredErrors[m]+1.0);
+            }
+        }
+    }
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setWeight
+Purpose:  Sets the weight of one member model. Weights are normalized when
+          trajectories are fused so they need not sum to 1.
+Receive:  int index of the member, double weight
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void EnsembleModel::setWeight(int index, double weight)
+{
+    if(index>=0 && index<m_weights.size()){
+        m_weights[index] = weight;
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getLearnWeights
+Purpose:  Returns whether weights are learned from prediction error.
+Receive:  N/A
+Return:   bool
+-----------------------------------------------------------------------------*/
+bool EnsembleModel::getLearnWeights() const
+{
+    return m_learnWeights;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setLearnWeights
+Purpose:  Sets whether updateWeights replaces the configured weights with
+          weights learned from each member's prediction error.
+Receive:  bool learnWeights
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void EnsembleModel::setLearnWeights(bool learnWeights)
+{
+    m_learnWeights = learnWeights;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getLearningRate
+Purpose:  Returns the smoothing factor of the running squared error.
+Receive:  N/A
+Return:   double
+-----------------------------------------------------------------------------*/
+double EnsembleModel::getLearningRate() const
+{
+    return m_learningRate;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setLearningRate
+Purpose:  Sets the smoothing factor of the running squared error, between 0
+          and 1. Higher values follow recent errors more closely.
+Receive:  double learningRate
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void EnsembleModel::setLearningRate(double learningRate)
+{
+    m_learningRate = learningRate;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     updateWeights
+Purpose:  Called when a new BG reading arrives. Compares it with the first
+          value each member predicted in the last predict call and updates
+          an exponentially weighted mean squared error per member. When
+          learning is enabled the weights become the inverse of that error
+          so the members that have tracked the patient best dominate.
+Receive:  int observedBG in mg/dl
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void EnsembleModel::updateWeights(int observedBG)
+{
+    if(m_lastPredictions.size()!=m_models.size()){
+        return;
+    }
+    for(int m=0; m<m_models.size(); m++){
+        if(!m_lastPredictions[m].size()){
+            continue;
+        }
+        double error = m_lastPredictions[m][0]-observedBG;
+        if(m_squaredErrors[m]==0.0){
+            m_squaredErrors[m] = error*error;
+        }
+        else{
+            m_squaredErrors[m] = (1.0-m_learningRate)*m_squaredErrors[m] +
+                                 m_learningRate*error*error;
+        }
+        if(m_learnWeights){
+            //floor of 1 mg/dl keeps a perfect member from taking all weight
+            m_weights[m] = 1.0/(m_squaredErrors[m]+1.0);
+        }
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     fuse
+Purpose:  Combines one trajectory per member into their weighted average,
+          step by step. Each step averages only the members whose trajectory
+          reaches it, with their weights renormalized for that step, so a
+          member with a shorter horizon sharpens the early steps without
+          cutting the fused trajectory short. Members that returned nothing
+          are left out. The fused trajectory is as long as the longest
+          member trajectory.
+Receive:  const vector<vector<double>>& trajectories aligned with m_models
+Return:   vector<double>
+-----------------------------------------------------------------------------*/
+vector<double> EnsembleModel::fuse(
+                            const vector<vector<double>> &trajectories) const
+{
+    vector<double> fused;
+    int length = 0;
+    for(int m=0; m<trajectories.size(); m++){
+        if(m_weights[m]>0.0 && trajectories[m].size()>length){
+            length = trajectories[m].size();
+        }
+    }
+    if(!length){
+        return fused;
+    }
+    fused.assign(length, 0.0);
+    vector<double> totalWeight(length, 0.0);
+    for(int m=0; m<trajectories.size(); m++){
+        if(m_weights[m]<=0.0){
+            continue;
+        }
+        for(int i=0; i<trajectories[m].size(); i++){
+            fused[i] += m_weights[m]*trajectories[m][i];
+            totalWeight[i] += m_weights[m];
+        }
+    }
+    for(int i=0; i<length; i++){
+        fused[i] /= totalWeight[i];
+    }
+    return fused;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     predict
+Purpose:  Runs every member's prediction concurrently and returns the fused
+          prediction. Each member's own prediction is kept for updateWeights.
+Receive:  bgInputs and insulin inputs for the models, saveFlag is passed on
+          to the members.
+Return:   vector<double> predictions for future BG (90 mins / 5 = 18 values)
+-----------------------------------------------------------------------------*/
+vector<double> EnsembleModel::predict(vector<int> bgInputs,
+                                      vector<float> insulinInputs,
+                                      bool saveFlag)
+{
+    vector<vector<double>> predictions(m_models.size());
+    vector<std::thread> workers;
+    for(int m=1; m<m_models.size(); m++){
+        workers.push_back(std::thread([&, m](){
+            predictions[m] = m_models[m]->predict(bgInputs, insulinInputs,
+                                                  saveFlag);
+        }));
+    }
+    if(m_models.size()){
+        predictions[0] = m_models[0]->predict(bgInputs, insulinInputs,
+                                              saveFlag);
+    }
+    for(int i=0; i<workers.size(); i++){
+        workers[i].join();
+    }
+    m_lastPredictions = predictions;
+    return fuse(predictions);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     projectCorrection
+Purpose:  Runs the hypothetical insulin control input through every member
+          and gives the fused projected BG output.
+Receive:  bgInputs and insulin inputs for the models, sensitivity is constant
+          representing the impact of 1 unit of insulin on blood glucose.
+Return:   vector<double> predictions for future BG (90 mins / 5 = 18 values)
+-----------------------------------------------------------------------------*/
+vector<double> EnsembleModel::projectCorrection(vector<double> bgInputs,
+                                                vector<float> insulinInputs,
+                                                int sensitivity)
+{
+    vector<vector<float>> insulin;
+    insulin.push_back(insulinInputs);
+    vector<vector<double>> results =
+            projectCorrections(bgInputs, insulin, sensitivity);
+    if(results.size()){
+        return results[0];
+    }
+    return vector<double>();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     projectCorrections
+Purpose:  Hands the whole candidate batch to every member at the same time,
+          one thread per member, then fuses the member trajectories for each
+          candidate. The MPC sees a single trajectory set, so adding a model
+          costs one more concurrent batch rather than another optimization.
+Receive:  bgInputs for the models, insulinInputs holds one future insulin
+          curve per candidate, sensitivity is constant representing the
+          impact of 1 unit of insulin on blood glucose.
+Return:   vector<vector<double>> one fused trajectory per candidate
+-----------------------------------------------------------------------------*/
+vector<vector<double>> EnsembleModel::projectCorrections(
+                                const vector<double> &bgInputs,
+                                const vector<vector<float>> &insulinInputs,
+                                int sensitivity)
+{
+    vector<vector<vector<double>>> memberResults(m_models.size());
+    vector<std::thread> workers;
+    for(int m=1; m<m_models.size(); m++){
+        workers.push_back(std::thread([&, m](){
+            memberResults[m] = m_models[m]->projectCorrections(bgInputs,
+                                                insulinInputs, sensitivity);
+        }));
+    }
+    if(m_models.size()){
+        memberResults[0] = m_models[0]->projectCorrections(bgInputs,
+                                                insulinInputs, sensitivity);
+    }
+    for(int i=0; i<workers.size(); i++){
+        workers[i].join();
+    }
+
+    vector<vector<double>> results;
+    for(int c=0; c<insulinInputs.size(); c++){
+        vector<vector<double>> trajectories(m_models.size());
+        for(int m=0; m<m_models.size(); m++){
+            if(c<memberResults[m].size()){
+                trajectories[m] = memberResults[m][c];
+            }
+        }
+        results.push_back(fuse(trajectories));
+    }
+    return results;
+}
@@ -0,0 +1,72 @@
+/******************************************************************************
+** FILE: EnsembleModel.h
+**
+** ABSTRACT:
+** Holds several models, runs each of them concurrently
+** over the same inputs and fuses their trajectories
+** into one weighted average. Weights are either set by
+** the caller or learned from each member's recent
+** prediction error. Lets the MPC optimize once over a
+** single trajectory set however many models are used.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** The ensemble does not own its member models.
+**
+******************************************************************************/
+
+#ifndef ENSEMBLEMODEL_H
+#define ENSEMBLEMODEL_H
+
+#include "Model.h"
+#include <vector>
+using std::vector;
+
+class EnsembleModel : public Model
+{
+protected:
+    vector<Model*> m_models;
+    vector<double> m_weights;
+    vector<double> m_squaredErrors;
+    vector<vector<double>> m_lastPredictions;
+    bool m_learnWeights = false;
+    double m_learningRate = 0.1;
+
+    vector<double> fuse(const vector<vector<double>>& trajectories) const;
+
+public:
+    EnsembleModel() = default;
+    virtual ~EnsembleModel() = default;
+
+    void addModel(Model* model, double weight = 1.0);
+    int getModelCount() const;
+    vector<double> getWeights() const;
+    void setWeight(int index, double weight);
+    vector<double> getSquaredErrors() const;
+    bool setSquaredErrors(const vector<double>& squaredErrors);
+    bool getLearnWeights() const;
+    void setLearnWeights(bool learnWeights);
+    double getLearningRate() const;
+    void setLearningRate(double learningRate);
+    void updateWeights(int observedBG);
+
+    vector<double> predict(vector<int> bgInputs, vector<float> insulinInputs,
+                           bool saveFlag);
+    vector<double> projectCorrection(vector<double> bgInputs,
+                                     vector<float> insulinInputs,
+                                     int sensitivity);
+    vector<vector<double>> projectCorrections(
+                                const vector<double>& bgInputs,
+                                const vector<vector<float>>& insulinInputs,
+                                int sensitivity);
+};
+
+#endif // ENSEMBLEMODEL_H
@@ -0,0 +1,188 @@
+/******************************************************************************
+** FILE: ForestCompiler.cpp
+**
+** ABSTRACT:
+** Turns a trained DecisionForest into generated C++.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+**
+******************************************************************************/
+
+#include "ForestCompiler.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace {
+    //leaf values per line of the generated table
+    const int kValuesPerLine = 4;
+    //deep trees would otherwise be mostly indentation
+    const int kMaxIndent = 12;
+
+    //exact float literal, e.g. 0x1.8p+6f
+    string floatLiteral(float value)
+    {
+        std::ostringstream literal;
+        literal << std::hexfloat << value << "f";
+        return literal.str();
+    }
+
+    string indent(int depth)
+    {
+        return string(4*std::min(depth, kMaxIndent), ' ');
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setSource
+Purpose:  Sets the forest file name recorded in the generated header.
+Receive:  const string& source
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ForestCompiler::setSource(const string &source)
+{
+    m_source = source;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     writeNode
+Purpose:  Writes one node and everything under it: a comparison with the
+          two subtrees for a split, the leaf's table offset for a leaf.
+Receive:  std::ostream& out, int node, int depth, indentation level
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ForestCompiler::writeNode(std::ostream &out, int node, int depth) const
+{
+    const ForestNode& forestNode = m_forest->getNodes()[node];
+    if(forestNode.feature<0){
+        out << indent(depth) << "return " << forestNode.left << ";\n";
+        return;
+    }
+    out << indent(depth) << "if(x[" << forestNode.feature << "]<="
+        << floatLiteral(forestNode.threshold) << "){\n";
+    writeNode(out, forestNode.left, depth+1);
+    out << indent(depth) << "}\n";
+    out << indent(depth) << "else{\n";
+    writeNode(out, forestNode.right, depth+1);
+    out << indent(depth) << "}\n";
+}
+
+/*-----------------------------------------------------------------------------
+Name:     writeTree
+Purpose:  Writes one tree as a function returning the offset of the leaf
+          it reaches in kLeafValues.
+Receive:  std::ostream& out, int tree
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ForestCompiler::writeTree(std::ostream &out, int tree) const
+{
+    out << "    inline int tree" << tree << "(const float* x)\n"
+        << "    {\n";
+    writeNode(out, m_forest->getTreeRoots()[tree], 2);
+    out << "    }\n\n";
+}
+
+/*-----------------------------------------------------------------------------
+Name:     compile
+Purpose:  Writes the forest as CompiledForestTrees.cpp source: the shape
+          constants, the leaf table, one function per tree and
+          compiledForestPredict, which sums every tree's leaf in the same
+          order as DecisionForest::predict.
+Receive:  const DecisionForest& forest, std::ostream& out
+Return:   bool false if the forest is invalid or the write failed
+-----------------------------------------------------------------------------*/
+bool ForestCompiler::compile(const DecisionForest &forest, std::ostream &out)
+{
+    if(!forest.isValid()){
+        std::cerr << "Can't compile an invalid forest" << std::endl;
+        return false;
+    }
+    m_forest = &forest;
+    int trees = forest.getTreeCount();
+    const vector<float>& leafValues = forest.getLeafValues();
+
+    out << "/*************************************************************"
+           "*****************\n"
+        << "** FILE: CompiledForestTrees.cpp\n**\n"
+        << "** ABSTRACT:\n"
+        << "** Generated by ForestCompiler (AGS --compile-forest) from\n"
+        << "** " << (m_source.size() ? m_source : string("a forest"))
+        << ", " << trees << " trees. Do not edit.\n**\n"
+        << "*************************************************************"
+           "*****************/\n\n"
+        << "#include \"CompiledForest.h\"\n\n"
+        << "const int kCompiledForestFeatures = "
+        << forest.getFeatureCount() << ";\n"
+        << "const int kCompiledForestOutputs = "
+        << forest.getOutputCount() << ";\n"
+        << "const int kCompiledForestTrees = " << trees << ";\n\n"
+        << "namespace {\n";
+
+    out << "    constexpr float kLeafValues[] = {\n";
+    for(int i=0; i<leafValues.size(); i++){
+        if(i%kValuesPerLine==0){
+            out << "        ";
+        }
+        out << floatLiteral(leafValues[i]) << ",";
+        out << ((i+1)%kValuesPerLine==0 || i+1>=leafValues.size() ?
+                    "\n" : " ");
+    }
+    out << "    };\n\n";
+    for(int t=0; t<trees; t++){
+        writeTree(out, t);
+    }
+    out << "    void addLeaf(int offset, double* outputs)\n"
+        << "    {\n"
+        << "        const float* leaf = kLeafValues+offset;\n"
+        << "        for(int k=0; k<" << forest.getOutputCount()
+        << "; k++){\n"
+        << "            outputs[k] += leaf[k];\n"
+        << "        }\n"
+        << "    }\n"
+        << "}\n\n";
+
+    out << "void compiledForestPredict(const float* features, "
+           "double* outputs)\n"
+        << "{\n"
+        << "    for(int k=0; k<kCompiledForestOutputs; k++){\n"
+        << "        outputs[k] = 0.0;\n"
+        << "    }\n";
+    for(int t=0; t<trees; t++){
+        out << "    addLeaf(tree" << t << "(features), outputs);\n";
+    }
+    out << "    double scale = 1.0/" << trees << ";\n"
+        << "    for(int k=0; k<kCompiledForestOutputs; k++){\n"
+        << "        outputs[k] *= scale;\n"
+        << "    }\n"
+        << "}\n";
+    m_forest = nullptr;
+    return (bool)out;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     compile
+Purpose:  Writes the generated source to a file.
+Receive:  const DecisionForest& forest, const string& path
+Return:   bool false if the forest is invalid or the file wasn't written
+-----------------------------------------------------------------------------*/
+bool ForestCompiler::compile(const DecisionForest &forest, const string &path)
+{
+    std::ofstream out(path.c_str());
+    if(!out){
+        std::cerr << "Couldn't write " << path << std::endl;
+        return false;
+    }
+    bool compiled = compile(forest, out);
+    out.close();
+    return compiled && !out.fail();
+}
@@ -0,0 +1,54 @@
+/******************************************************************************
+** FILE: ForestCompiler.h
+**
+** ABSTRACT:
+** Build step that turns a trained DecisionForest into the
+** generated CompiledForestTrees.cpp behind
+** CompiledForestModel, so the production forest is
+** compiled into the binary instead of loaded and walked
+** node by node at run time.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** Thresholds and leaf values are written as hexadecimal
+** float literals so they are exactly the ones in the
+** forest. Each tree becomes one function; its branches
+** keep the node table's left/right order.
+**
+******************************************************************************/
+
+#ifndef FORESTCOMPILER_H
+#define FORESTCOMPILER_H
+
+#include <ostream>
+#include <string>
+#include "DecisionForest.h"
+using std::string;
+
+class ForestCompiler
+{
+protected:
+    const DecisionForest* m_forest = nullptr;
+    string m_source;
+
+    void writeNode(std::ostream& out, int node, int depth) const;
+    void writeTree(std::ostream& out, int tree) const;
+
+public:
+    ForestCompiler() = default;
+    ~ForestCompiler() = default;
+
+    void setSource(const string& source);
+    bool compile(const DecisionForest& forest, std::ostream& out);
+    bool compile(const DecisionForest& forest, const string& path);
+};
+
+#endif // FORESTCOMPILER_H
@@ -0,0 +1,592 @@
+/******************************************************************************
+** FILE: ForestTrainer.cpp
+**
+** ABSTRACT:
+** Native replacement for RandomForestTrain.py. Reads the
+** 43 column training file (6 BG, IOB, 18 future insulin,
+** 18 future BG), trains a multi-output random forest with
+** histogram based split finding, one tree per pool task,
+** and writes the DecisionForest format the runtime loads.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** Defaults follow sklearn's RandomForestRegressor as used
+** by RandomForestTrain.py: 100 trees, bootstrap samples,
+** every feature considered at each split, no depth limit,
+** and a 10% hold out set for the error report.
+**
+******************************************************************************/
+
+#include "ForestTrainer.h"
+#include "ThreadPool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+#include <iostream>
+#include <random>
+
+namespace
+{
+//nodes with this many rows or fewer are split by scanning sorted rows
+const int kSmallNode = 128;
+}
+
+struct ForestTrainer::BuildContext
+{
+    vector<int> rows;
+    vector<int> featureOrder;
+    std::mt19937 random;
+    vector<ForestNode> nodes;
+    vector<float> leafValues;
+};
+
+/*-----------------------------------------------------------------------------
+Name:     setTreeCount
+Purpose:  Sets the number of trees in the forest.
+Receive:  int treeCount
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ForestTrainer::setTreeCount(int treeCount)
+{
+    m_treeCount = treeCount;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setMaxDepth
+Purpose:  Sets the maximum depth of each tree, 0 for no limit.
+Receive:  int maxDepth
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ForestTrainer::setMaxDepth(int maxDepth)
+{
+    m_maxDepth = maxDepth;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setMinSamplesLeaf
+Purpose:  Sets the minimum number of samples each leaf must hold.
+Receive:  int minSamplesLeaf
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ForestTrainer::setMinSamplesLeaf(int minSamplesLeaf)
+{
+    m_minSamplesLeaf = minSamplesLeaf<1 ? 1 : minSamplesLeaf;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setMaxBins
+Purpose:  Sets the number of histogram bins per feature, 2 to 256.
+Receive:  int maxBins
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ForestTrainer::setMaxBins(int maxBins)
+{
+    m_maxBins = maxBins<2 ? 2 : (maxBins>256 ? 256 : maxBins);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setFeatureFraction
+Purpose:  Sets the fraction of features considered at each split.
+Receive:  double featureFraction in (0, 1]
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ForestTrainer::setFeatureFraction(double featureFraction)
+{
+    m_featureFraction = featureFraction;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setTestFraction
+Purpose:  Sets the fraction of rows held out for the error report.
+Receive:  double testFraction in [0, 1)
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ForestTrainer::setTestFraction(double testFraction)
+{
+    m_testFraction = testFraction;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setSeed
+Purpose:  Sets the seed for the train/test split, bootstraps and feature
+          sampling so a retrain on the same file gives the same forest.
+Receive:  unsigned int seed
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ForestTrainer::setSeed(unsigned int seed)
+{
+    m_seed = seed;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setThreadCount
+Purpose:  Sets the number of threads building trees, 0 for every core.
+Receive:  int threadCount
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ForestTrainer::setThreadCount(int threadCount)
+{
+    m_threadCount = threadCount;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getRowCount
+Purpose:  Returns the number of complete rows loaded from the training file.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int ForestTrainer::getRowCount() const
+{
+    return m_rowCount;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getFeatures
+Purpose:  Returns the input columns of the loaded rows, row major.
+Receive:  N/A
+Return:   const vector<float>&
+-----------------------------------------------------------------------------*/
+const vector<float> &ForestTrainer::getFeatures() const
+{
+    return m_features;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     loadCSV
+Purpose:  Reads the training file one line at a time. Rows without exactly
+          43 numeric columns are dropped, the same as dropna in the Python
+          trainer.
+Receive:  const string& path
+Return:   bool true if at least one row was read
+-----------------------------------------------------------------------------*/
+bool ForestTrainer::loadCSV(const string &path)
+{
+    FILE* file = fopen(path.c_str(), "r");
+    if(!file){
+        std::cerr << "Couldn't open training data " << path << std::endl;
+        return false;
+    }
+    int columns = m_featureCount+m_outputCount;
+    vector<float> row(columns);
+    char line[4096];
+    m_features.clear();
+    m_targets.clear();
+    m_rowCount = 0;
+    while(fgets(line, sizeof(line), file)){
+        char* cursor = line;
+        int column = 0;
+        bool complete = true;
+        while(column<columns){
+            char* end;
+            double value = strtod(cursor, &end);
+            if(end==cursor || isnan(value)){
+                complete = false;
+                break;
+            }
+            row[column++] = value;
+            cursor = end;
+            if(*cursor==','){
+                cursor++;
+            }
+            else{
+                break;
+            }
+        }
+        if(!complete || column!=columns){
+            continue;
+        }
+        m_features.insert(m_features.end(), row.begin(),
+                          row.begin()+m_featureCount);
+        m_targets.insert(m_targets.end(), row.begin()+m_featureCount,
+                         row.end());
+        m_rowCount++;
+    }
+    fclose(file);
+    return m_rowCount>0;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     buildBins
+Purpose:  Chooses up to m_maxBins bins per feature from the training rows.
+          Features with few distinct values get one bin per value, others
+          get quantile bins. Every bin edge sits halfway between two
+          training values, the same thresholds sklearn would pick. All rows
+          are then mapped to their bin once so splitting never looks at the
+          raw values again.
+Receive:  const vector<int>& rows used for training
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ForestTrainer::buildBins(const vector<int> &rows)
+{
+    m_binEdges.assign(m_featureCount, vector<float>());
+    m_bins.assign(size_t(m_featureCount)*m_rowCount, 0);
+    vector<float> values(rows.size());
+    for(int f=0; f<m_featureCount; f++){
+        for(int i=0; i<rows.size(); i++){
+            values[i] = m_features[size_t(rows[i])*m_featureCount+f];
+        }
+        std::sort(values.begin(), values.end());
+        vector<float> distinct;
+        for(int i=0; i<values.size(); i++){
+            if(!distinct.size() || values[i]!=distinct.back()){
+                distinct.push_back(values[i]);
+            }
+        }
+        vector<float>& edges = m_binEdges[f];
+        if(distinct.size()<=m_maxBins){
+            for(int i=0; i+1<distinct.size(); i++){
+                edges.push_back((distinct[i]+distinct[i+1])/2.0f);
+            }
+        }
+        else{
+            for(int b=1; b<m_maxBins; b++){
+                float value = values[size_t(values.size())*b/m_maxBins];
+                //place the edge between this value and the next distinct one
+                vector<float>::iterator next =
+                        std::upper_bound(distinct.begin(), distinct.end(),
+                                         value);
+                if(next==distinct.end()){
+                    break;
+                }
+                float edge = (value+*next)/2.0f;
+                if(!edges.size() || edge>edges.back()){
+                    edges.push_back(edge);
+                }
+            }
+        }
+        edges.push_back(FLT_MAX);
+        unsigned char* column = &m_bins[size_t(f)*m_rowCount];
+        for(int row=0; row<m_rowCount; row++){
+            float value = m_features[size_t(row)*m_featureCount+f];
+            column[row] = std::lower_bound(edges.begin(), edges.end(), value)
+                          - edges.begin();
+        }
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     buildHistogram
+Purpose:  Accumulates sample count and target sums per bin of every feature
+          for the rows [begin, end) of the node.
+Receive:  const BuildContext& context, int begin, int end,
+          vector<double>& histogram of features x maxBins x (1+outputs)
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ForestTrainer::buildHistogram(const BuildContext &context, int begin,
+                                   int end, vector<double> &histogram) const
+{
+    int cell = 1+m_outputCount;
+    histogram.assign(size_t(m_featureCount)*m_maxBins*cell, 0.0);
+    for(int f=0; f<m_featureCount; f++){
+        const unsigned char* column = &m_bins[size_t(f)*m_rowCount];
+        double* featureHistogram = &histogram[size_t(f)*m_maxBins*cell];
+        for(int i=begin; i<end; i++){
+            int row = context.rows[i];
+            double* bin = featureHistogram + column[row]*cell;
+            const float* target = &m_targets[size_t(row)*m_outputCount];
+            bin[0] += 1.0;
+            for(int k=0; k<m_outputCount; k++){
+                bin[1+k] += target[k];
+            }
+        }
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     buildNode
+Purpose:  Grows the subtree for rows [begin, end) in preorder, choosing the
+          split that most reduces the summed squared error over all 18
+          outputs. Large nodes scan each feature's histogram once. Only the
+          smaller child's histogram is built from rows, the larger one is
+          the parent's minus the smaller, computed in the parent's buffer.
+          Nodes of kSmallNode rows or fewer skip histograms altogether and
+          scan their rows sorted by bin, which is far cheaper than clearing
+          a full histogram near the leaves of a fully grown tree.
+Receive:  BuildContext& context, int begin, int end, int depth,
+          vector<double>& histogram of this node (empty for small nodes),
+          consumed by the call
+Return:   int index of the node in context.nodes
+-----------------------------------------------------------------------------*/
+int ForestTrainer::buildNode(BuildContext &context, int begin, int end,
+                             int depth, vector<double> &histogram) const
+{
+    int cell = 1+m_outputCount;
+    int index = context.nodes.size();
+    ForestNode node = {-1, 0.0f, 0, -1};
+    context.nodes.push_back(node);
+
+    vector<double> total(cell, 0.0);
+    if(histogram.size()){
+        //totals come from any one feature's histogram
+        for(int b=0; b<m_maxBins; b++){
+            for(int k=0; k<cell; k++){
+                total[k] += histogram[b*cell+k];
+            }
+        }
+    }
+    else{
+        for(int i=begin; i<end; i++){
+            const float* target = &m_targets[size_t(context.rows[i])*
+                                             m_outputCount];
+            total[0] += 1.0;
+            for(int k=0; k<m_outputCount; k++){
+                total[1+k] += target[k];
+            }
+        }
+    }
+    double count = total[0];
+
+    int bestFeature = -1;
+    int bestBin = -1;
+    if(count>=2*m_minSamplesLeaf && (m_maxDepth<=0 || depth<m_maxDepth)){
+        double parentScore = 0.0;
+        for(int k=1; k<cell; k++){
+            parentScore += total[k]*total[k]/count;
+        }
+        double bestScore = parentScore + 1e-9*fabs(parentScore);
+        int featuresToTry = m_featureCount;
+        if(m_featureFraction<1.0){
+            featuresToTry = int(ceil(m_featureFraction*m_featureCount));
+            for(int i=0; i<featuresToTry; i++){
+                std::uniform_int_distribution<int> pick(i, m_featureCount-1);
+                std::swap(context.featureOrder[i],
+                          context.featureOrder[pick(context.random)]);
+            }
+        }
+        vector<double> left(cell);
+        vector<int> sorted;
+        vector<int> binStarts;
+        for(int i=0; i<featuresToTry; i++){
+            int f = context.featureOrder[i];
+            const unsigned char* column = &m_bins[size_t(f)*m_rowCount];
+            std::fill(left.begin(), left.end(), 0.0);
+            int candidates;
+            const double* featureHistogram = nullptr;
+            if(histogram.size()){
+                featureHistogram = &histogram[size_t(f)*m_maxBins*cell];
+                candidates = m_binEdges[f].size()-1;
+            }
+            else{
+                //counting sort of the node's rows by bin
+                binStarts.assign(m_maxBins+1, 0);
+                for(int r=begin; r<end; r++){
+                    binStarts[column[context.rows[r]]+1]++;
+                }
+                for(int b=0; b<m_maxBins; b++){
+                    binStarts[b+1] += binStarts[b];
+                }
+                sorted.resize(end-begin);
+                for(int r=begin; r<end; r++){
+                    int row = context.rows[r];
+                    sorted[binStarts[column[row]]++] = row;
+                }
+                candidates = sorted.size()-1;
+            }
+            for(int c=0; c<candidates; c++){
+                int bin;
+                if(featureHistogram){
+                    const double* counts = featureHistogram + c*cell;
+                    if(counts[0]==0.0){
+                        continue;
+                    }
+                    for(int k=0; k<cell; k++){
+                        left[k] += counts[k];
+                    }
+                    bin = c;
+                }
+                else{
+                    const float* target = &m_targets[size_t(sorted[c])*
+                                                     m_outputCount];
+                    left[0] += 1.0;
+                    for(int k=0; k<m_outputCount; k++){
+                        left[1+k] += target[k];
+                    }
+                    bin = column[sorted[c]];
+                    //only split between rows that fall in different bins
+                    if(bin==column[sorted[c+1]]){
+                        continue;
+                    }
+                }
+                double leftCount = left[0];
+                double rightCount = count-leftCount;
+                if(leftCount<m_minSamplesLeaf){
+                    continue;
+                }
+                if(rightCount<m_minSamplesLeaf){
+                    break;
+                }
+                double leftSquares = 0.0;
+                double rightSquares = 0.0;
+                for(int k=1; k<cell; k++){
+                    double right = total[k]-left[k];
+                    leftSquares += left[k]*left[k];
+                    rightSquares += right*right;
+                }
+                double score = leftSquares/leftCount +
+                               rightSquares/rightCount;
+                if(score>bestScore){
+                    bestScore = score;
+                    bestFeature = f;
+                    bestBin = bin;
+                }
+            }
+        }
+    }
+
+    if(bestFeature<0){
+        context.nodes[index].left = context.leafValues.size();
+        for(int k=1; k<cell; k++){
+            context.leafValues.push_back(total[k]/count);
+        }
+        return index;
+    }
+
+    //partition the rows so the left child's rows come first
+    const unsigned char* column = &m_bins[size_t(bestFeature)*m_rowCount];
+    int* first = &context.rows[begin];
+    int* middle = std::partition(first, &context.rows[0]+end,
+                                 [&](int row){
+                                     return column[row]<=bestBin;
+                                 });
+    int split = begin + (middle-first);
+
+    vector<double> smaller;
+    bool leftSmaller = split-begin <= end-split;
+    if(histogram.size()){
+        if(leftSmaller){
+            buildHistogram(context, begin, split, smaller);
+        }
+        else{
+            buildHistogram(context, split, end, smaller);
+        }
+        for(size_t i=0; i<histogram.size(); i++){
+            histogram[i] -= smaller[i];
+        }
+    }
+    vector<double>& leftHistogram = leftSmaller ? smaller : histogram;
+    vector<double>& rightHistogram = leftSmaller ? histogram : smaller;
+    if(split-begin<=kSmallNode){
+        vector<double>().swap(leftHistogram);
+    }
+    if(end-split<=kSmallNode){
+        vector<double>().swap(rightHistogram);
+    }
+
+    context.nodes[index].feature = bestFeature;
+    context.nodes[index].threshold = m_binEdges[bestFeature][bestBin];
+    int leftChild = buildNode(context, begin, split, depth+1, leftHistogram);
+    int rightChild = buildNode(context, split, end, depth+1, rightHistogram);
+    context.nodes[index].left = leftChild;
+    context.nodes[index].right = rightChild;
+    return index;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     buildTree
+Purpose:  Draws a bootstrap sample of the training rows and grows one tree
+          from it. Each tree has its own random stream so trees can be
+          built in any order on any thread with the same result.
+Receive:  int tree index, const vector<int>& trainRows,
+          nodes and leafValues receive the tree with local indices
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ForestTrainer::buildTree(int tree, const vector<int> &trainRows,
+                              vector<ForestNode> &nodes,
+                              vector<float> &leafValues) const
+{
+    BuildContext context;
+    context.random.seed(m_seed*7919u + tree);
+    std::uniform_int_distribution<int> draw(0, trainRows.size()-1);
+    context.rows.resize(trainRows.size());
+    for(int i=0; i<trainRows.size(); i++){
+        context.rows[i] = trainRows[draw(context.random)];
+    }
+    for(int f=0; f<m_featureCount; f++){
+        context.featureOrder.push_back(f);
+    }
+    vector<double> histogram;
+    if(context.rows.size()>kSmallNode){
+        buildHistogram(context, 0, context.rows.size(), histogram);
+    }
+    buildNode(context, 0, context.rows.size(), 0, histogram);
+    nodes.swap(context.nodes);
+    leafValues.swap(context.leafValues);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     train
+Purpose:  Splits the loaded rows into train and hold out sets, bins the
+          features, builds every tree on the thread pool and reports the
+          hold out error the same way RandomForestTrain.py does.
+Receive:  DecisionForest& forest receives the trained trees
+Return:   bool true if a forest was trained
+-----------------------------------------------------------------------------*/
+bool ForestTrainer::train(DecisionForest &forest)
+{
+    if(m_rowCount<2 || m_treeCount<1){
+        std::cerr << "Not enough training data" << std::endl;
+        return false;
+    }
+    vector<int> order(m_rowCount);
+    for(int i=0; i<m_rowCount; i++){
+        order[i] = i;
+    }
+    std::mt19937 random(m_seed);
+    std::shuffle(order.begin(), order.end(), random);
+    int testCount = int(m_rowCount*m_testFraction);
+    if(testCount>=m_rowCount){
+        testCount = 0;
+    }
+    vector<int> testRows(order.begin(), order.begin()+testCount);
+    vector<int> trainRows(order.begin()+testCount, order.end());
+
+    buildBins(trainRows);
+
+    vector<vector<ForestNode>> treeNodes(m_treeCount);
+    vector<vector<float>> treeLeaves(m_treeCount);
+    ThreadPool pool(m_threadCount);
+    pool.parallelFor(m_treeCount, [&](int tree){
+        buildTree(tree, trainRows, treeNodes[tree], treeLeaves[tree]);
+    });
+
+    forest.setShape(m_featureCount, m_outputCount);
+    for(int t=0; t<m_treeCount; t++){
+        forest.addTree(treeNodes[t], treeLeaves[t]);
+    }
+
+    if(testRows.size()){
+        double absoluteError = 0.0;
+        double percentError = 0.0;
+        int count = 0;
+        vector<double> prediction(m_outputCount);
+        for(int i=0; i<testRows.size(); i++){
+            int row = testRows[i];
+            forest.predict(&m_features[size_t(row)*m_featureCount],
+                           prediction.data());
+            for(int k=0; k<m_outputCount; k++){
+                double actual = m_targets[size_t(row)*m_outputCount+k];
+                double error = fabs(prediction[k]-actual);
+                absoluteError += error;
+                if(actual!=0.0){
+                    percentError += 100.0*error/actual;
+                }
+                count++;
+            }
+        }
+        std::cout << "Mean Absolute Error: " << absoluteError/count
+                  << " mg/dL." << std::endl;
+        std::cout << "Accuracy: " << 100.0-percentError/count << " %."
+                  << std::endl;
+    }
+    return true;
+}
@@ -0,0 +1,89 @@
+/******************************************************************************
+** FILE: ForestTrainer.h
+**
+** ABSTRACT:
+** Native replacement for RandomForestTrain.py. Reads the
+** 43 column training file (6 BG, IOB, 18 future insulin,
+** 18 future BG), trains a multi-output random forest with
+** histogram based split finding, one tree per pool task,
+** and writes the DecisionForest format the runtime loads.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** Feature values are bucketed into at most m_maxBins
+** quantile bins once up front. Each node then builds one
+** histogram of sample count and target sums per feature
+** and the larger child's histogram is obtained by
+** subtracting the smaller child's from its parent's.
+**
+******************************************************************************/
+
+#ifndef FORESTTRAINER_H
+#define FORESTTRAINER_H
+
+#include <string>
+#include <vector>
+#include "DecisionForest.h"
+using std::string;
+using std::vector;
+
+class ForestTrainer
+{
+protected:
+    int m_featureCount = 25;
+    int m_outputCount = 18;
+    int m_treeCount = 100;
+    int m_maxDepth = 0;
+    int m_minSamplesLeaf = 1;
+    int m_maxBins = 64;
+    double m_featureFraction = 1.0;
+    double m_testFraction = 0.10;
+    unsigned int m_seed = 1;
+    int m_threadCount = 0;
+
+    //row major inputs and targets of the training file
+    vector<float> m_features;
+    vector<float> m_targets;
+    int m_rowCount = 0;
+
+    //per feature bin upper edges and feature major binned matrix
+    vector<vector<float>> m_binEdges;
+    vector<unsigned char> m_bins;
+
+    struct BuildContext;
+    void buildBins(const vector<int>& rows);
+    void buildTree(int tree, const vector<int>& trainRows,
+                   vector<ForestNode>& nodes, vector<float>& leafValues) const;
+    void buildHistogram(const BuildContext& context, int begin, int end,
+                        vector<double>& histogram) const;
+    int buildNode(BuildContext& context, int begin, int end, int depth,
+                  vector<double>& histogram) const;
+
+public:
+    ForestTrainer() = default;
+    ~ForestTrainer() = default;
+
+    void setTreeCount(int treeCount);
+    void setMaxDepth(int maxDepth);
+    void setMinSamplesLeaf(int minSamplesLeaf);
+    void setMaxBins(int maxBins);
+    void setFeatureFraction(double featureFraction);
+    void setTestFraction(double testFraction);
+    void setSeed(unsigned int seed);
+    void setThreadCount(int threadCount);
+    int getRowCount() const;
+    const vector<float>& getFeatures() const;
+
+    bool loadCSV(const string& path);
+    bool train(DecisionForest& forest);
+};
+
+#endif // FORESTTRAINER_H
@@ -0,0 +1,494 @@
+/******************************************************************************
+** FILE: GlucoseChartWidget.cpp
+**
+** ABSTRACT:
+** Real-time chart of observed BG, each cycle's predicted
+** trajectory and the chosen bolus, zoomable from 3 hours
+** to 90 days with the wheel and pannable by dragging.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+**
+******************************************************************************/
+
+#include "GlucoseChartWidget.h"
+#include <QPainter>
+#include <QPaintEvent>
+#include <QWheelEvent>
+#include <QMouseEvent>
+#include <QDateTime>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    const double kMinSpanSeconds = 3.0*3600.0;
+    const double kMaxSpanSeconds = 90.0*24.0*3600.0;
+    const double kPredictionStepSeconds = 300.0;
+    //readings further apart than this are not joined by a line
+    const double kMaxGapSeconds = 900.0;
+    const double kMinBG = 40.0;
+    const double kMaxBG = 400.0;
+    const double kLowBG = 70.0;
+    const double kHighBG = 180.0;
+    const double kMaxDoseUnits = 10.0;
+    const int kLeftMargin = 36;
+    const int kBottomMargin = 18;
+    const int kDoseHeight = 40;
+
+    /*-------------------------------------------------------------------------
+    Name:     trimSeries
+    Purpose:  Drops entries older than cutoff and rebuilds the pyramid over
+              the rest. Entries may carry width extra values each.
+    Receive:  double cutoff
+              vector<double>& times, MinMaxPyramid& values
+              vector<float>* extra, int width
+    Return:   N/A
+    -------------------------------------------------------------------------*/
+    void trimSeries(double cutoff, vector<double>& times,
+                    MinMaxPyramid& values, vector<float>* extra = nullptr,
+                    int width = 0)
+    {
+        int first = std::lower_bound(times.begin(), times.end(), cutoff)-
+                    times.begin();
+        if(!first){
+            return;
+        }
+        MinMaxPyramid kept;
+        for(int i=first; i<values.getSize(); i++){
+            kept.append(values.getValue(i));
+        }
+        values = kept;
+        times.erase(times.begin(), times.begin()+first);
+        if(extra){
+            extra->erase(extra->begin(), extra->begin()+first*width);
+        }
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     GlucoseChartWidget
+Purpose:  Constructor. Starts showing the most recent 3 hours.
+Receive:  QWidget* parent
+Return:   N/A
+-----------------------------------------------------------------------------*/
+GlucoseChartWidget::GlucoseChartWidget(QWidget *parent) :
+    QWidget(parent),
+    m_spanSeconds(kMinSpanSeconds)
+{
+    setMinimumHeight(200);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getSpanSeconds
+Purpose:  Returns the time span across the chart.
+Receive:  N/A
+Return:   double
+-----------------------------------------------------------------------------*/
+double GlucoseChartWidget::getSpanSeconds() const
+{
+    return m_spanSeconds;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setSpanSeconds
+Purpose:  Sets the time span across the chart, clamped to 3 hours-90 days.
+Receive:  double spanSeconds
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void GlucoseChartWidget::setSpanSeconds(double spanSeconds)
+{
+    m_spanSeconds = std::min(std::max(spanSeconds, kMinSpanSeconds),
+                             kMaxSpanSeconds);
+    update();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     addReading
+Purpose:  Appends an observed BG. Readings not newer than the last one are
+          ignored so the times stay sorted.
+Receive:  double sampleTime in epoch seconds, int bg
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void GlucoseChartWidget::addReading(double sampleTime, int bg)
+{
+    if(m_bgTimes.size() && sampleTime<=m_bgTimes.back()){
+        return;
+    }
+    m_bgTimes.push_back(sampleTime);
+    m_bgValues.append(bg);
+    trimHistory();
+    update();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     addPrediction
+Purpose:  Appends one cycle's predicted trajectory, its first value 5
+          minutes after sampleTime. Shorter trajectories are padded with
+          their last value.
+Receive:  double sampleTime, const vector<double>& trajectory
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void GlucoseChartWidget::addPrediction(double sampleTime,
+                                       const vector<double>& trajectory)
+{
+    if(trajectory.empty() || (m_predictionTimes.size() &&
+                              sampleTime<=m_predictionTimes.back())){
+        return;
+    }
+    m_predictionTimes.push_back(sampleTime);
+    for(int i=0; i<m_predictionLength; i++){
+        m_predictions.push_back(trajectory[std::min(i,
+                                (int)trajectory.size()-1)]);
+    }
+    m_nextPredictions.append(trajectory[0]);
+    trimHistory();
+    update();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     addDose
+Purpose:  Appends the bolus chosen for a cycle.
+Receive:  double sampleTime, double units
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void GlucoseChartWidget::addDose(double sampleTime, double units)
+{
+    if(m_doseTimes.size() && sampleTime<=m_doseTimes.back()){
+        return;
+    }
+    m_doseTimes.push_back(sampleTime);
+    m_doses.append(units);
+    trimHistory();
+    update();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     latestTime
+Purpose:  Returns the newest time of any series.
+Receive:  N/A
+Return:   double, 0 when nothing has been added
+-----------------------------------------------------------------------------*/
+double GlucoseChartWidget::latestTime() const
+{
+    double latest = 0.0;
+    if(m_bgTimes.size()){
+        latest = std::max(latest, m_bgTimes.back());
+    }
+    if(m_predictionTimes.size()){
+        latest = std::max(latest, m_predictionTimes.back());
+    }
+    if(m_doseTimes.size()){
+        latest = std::max(latest, m_doseTimes.back());
+    }
+    return latest;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     plotWidth
+Purpose:  Returns the number of pixel columns used for data.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int GlucoseChartWidget::plotWidth() const
+{
+    return std::max(width()-kLeftMargin, 1);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     trimHistory
+Purpose:  Once the oldest reading is two maximum spans old, drops everything
+          older than one span. Rebuilding is O(n) but happens once per 90
+          days of readings.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void GlucoseChartWidget::trimHistory()
+{
+    double latest = latestTime();
+    double oldest = latest;
+    if(m_bgTimes.size()){
+        oldest = std::min(oldest, m_bgTimes.front());
+    }
+    if(m_predictionTimes.size()){
+        oldest = std::min(oldest, m_predictionTimes.front());
+    }
+    if(m_doseTimes.size()){
+        oldest = std::min(oldest, m_doseTimes.front());
+    }
+    if(latest-oldest<2.0*kMaxSpanSeconds){
+        return;
+    }
+    double cutoff = latest-kMaxSpanSeconds;
+    trimSeries(cutoff, m_bgTimes, m_bgValues);
+    trimSeries(cutoff, m_predictionTimes, m_nextPredictions, &m_predictions,
+               m_predictionLength);
+    trimSeries(cutoff, m_doseTimes, m_doses);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     drawSeries
+Purpose:  Draws the part of a series between begin and end. When there are
+          fewer points than half the pixel columns the points are joined
+          by lines; otherwise each column draws a vertical line from the
+          min to the max of its time slice. Doses are drawn as bars up from
+          the bottom strip.
+Receive:  QPainter& painter
+          const vector<double>& times, const MinMaxPyramid& values
+          double begin, double end visible time range
+          bool bars true for doses
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void GlucoseChartWidget::drawSeries(QPainter &painter,
+                                    const vector<double>& times,
+                                    const MinMaxPyramid& values,
+                                    double begin, double end, bool bars) const
+{
+    int columns = plotWidth();
+    double secondsPerPixel = (end-begin)/columns;
+    double plotHeight = height()-kBottomMargin;
+    auto toY = [&](double value){
+        if(bars){
+            return plotHeight-std::min(value, kMaxDoseUnits)/
+                   kMaxDoseUnits*kDoseHeight;
+        }
+        return (kMaxBG-std::min(std::max(value, kMinBG), kMaxBG))/
+               (kMaxBG-kMinBG)*plotHeight;
+    };
+    auto toX = [&](double time){
+        return kLeftMargin+(time-begin)/secondsPerPixel;
+    };
+
+    int first = std::lower_bound(times.begin(), times.end(), begin)-
+                times.begin();
+    int last = std::upper_bound(times.begin()+first, times.end(), end)-
+               times.begin();
+    if(first>=last){
+        return;
+    }
+    if(last-first<=columns/2){
+        for(int i=first; i<last; i++){
+            double x = toX(times[i]);
+            double y = toY(values.getValue(i));
+            if(bars){
+                painter.drawLine(QLineF(x, plotHeight, x, y));
+            }
+            else if(i>first && times[i]-times[i-1]<=kMaxGapSeconds){
+                painter.drawLine(QLineF(toX(times[i-1]),
+                                        toY(values.getValue(i-1)), x, y));
+            }
+            else{
+                painter.drawPoint(QPointF(x, y));
+            }
+        }
+        return;
+    }
+    //one pyramid query per column, the index range advances monotonically
+    int sliceBegin = first;
+    for(int column=0; column<columns && sliceBegin<last; column++){
+        double sliceEnd = begin+(column+1)*secondsPerPixel;
+        int sliceLast = std::lower_bound(times.begin()+sliceBegin,
+                                         times.begin()+last, sliceEnd)-
+                        times.begin();
+        float minimum;
+        float maximum;
+        if(values.range(sliceBegin, sliceLast, minimum, maximum)){
+            double x = kLeftMargin+column+0.5;
+            if(bars){
+                painter.drawLine(QLineF(x, plotHeight, x, toY(maximum)));
+            }
+            else{
+                painter.drawLine(QLineF(x, toY(maximum), x,
+                                        toY(minimum)+1.0));
+            }
+        }
+        sliceBegin = sliceLast;
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     drawTrajectories
+Purpose:  Draws every predicted trajectory that starts in the visible range.
+          Only used when there are few enough to tell apart.
+Receive:  QPainter& painter, double begin, double end
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void GlucoseChartWidget::drawTrajectories(QPainter &painter, double begin,
+                                          double end) const
+{
+    double secondsPerPixel = (end-begin)/plotWidth();
+    double plotHeight = height()-kBottomMargin;
+    int first = std::lower_bound(m_predictionTimes.begin(),
+                                 m_predictionTimes.end(),
+                                 begin-m_predictionLength*
+                                 kPredictionStepSeconds)-
+                m_predictionTimes.begin();
+    int last = std::upper_bound(m_predictionTimes.begin()+first,
+                                m_predictionTimes.end(), end)-
+               m_predictionTimes.begin();
+    vector<QPointF> points(m_predictionLength);
+    for(int i=first; i<last; i++){
+        const float* trajectory = &m_predictions[i*m_predictionLength];
+        for(int k=0; k<m_predictionLength; k++){
+            double value = std::min(std::max((double)trajectory[k], kMinBG),
+                                    kMaxBG);
+            points[k] = QPointF(kLeftMargin+(m_predictionTimes[i]+
+                                (k+1)*kPredictionStepSeconds-begin)/
+                                secondsPerPixel,
+                                (kMaxBG-value)/(kMaxBG-kMinBG)*plotHeight);
+        }
+        painter.drawPolyline(points.data(), m_predictionLength);
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     paintEvent
+Purpose:  Draws the target band, the predictions, the readings, the doses
+          and the time axis for the visible span.
+Receive:  QPaintEvent* event
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void GlucoseChartWidget::paintEvent(QPaintEvent *event)
+{
+    Q_UNUSED(event);
+    QPainter painter(this);
+    painter.fillRect(rect(), Qt::white);
+    double end = m_following ? latestTime() : m_endTime;
+    double begin = end-m_spanSeconds;
+    double plotHeight = height()-kBottomMargin;
+    auto toY = [&](double value){
+        return (kMaxBG-value)/(kMaxBG-kMinBG)*plotHeight;
+    };
+
+    painter.fillRect(QRectF(kLeftMargin, toY(kHighBG), plotWidth(),
+                            toY(kLowBG)-toY(kHighBG)),
+                     QColor(220, 245, 220));
+    painter.setPen(Qt::gray);
+    const double labels[] = {kLowBG, kHighBG, 250.0, 350.0};
+    for(double label : labels){
+        painter.drawLine(QLineF(kLeftMargin, toY(label), width(),
+                                toY(label)));
+        painter.drawText(QPointF(2, toY(label)+4),
+                         QString::number(label, 'f', 0));
+    }
+
+    //individual trajectories only when there is room to tell them apart
+    int visiblePredictions =
+        std::upper_bound(m_predictionTimes.begin(), m_predictionTimes.end(),
+                         end)-
+        std::lower_bound(m_predictionTimes.begin(), m_predictionTimes.end(),
+                         begin);
+    painter.setPen(QPen(QColor(240, 150, 60), 1));
+    if(visiblePredictions<=plotWidth()/8){
+        drawTrajectories(painter, begin, end);
+    }
+    else{
+        drawSeries(painter, m_predictionTimes, m_nextPredictions, begin-
+                   kPredictionStepSeconds, end-kPredictionStepSeconds, false);
+    }
+
+    painter.setPen(QPen(QColor(30, 80, 200), 2));
+    drawSeries(painter, m_bgTimes, m_bgValues, begin, end, false);
+    painter.setPen(QPen(QColor(120, 40, 160), 2));
+    drawSeries(painter, m_doseTimes, m_doses, begin, end, true);
+
+    painter.setPen(Qt::black);
+    QString format = m_spanSeconds>2.0*24.0*3600.0 ? "MM-dd" : "MM-dd hh:mm";
+    painter.drawText(QPointF(kLeftMargin, height()-4),
+                     QDateTime::fromMSecsSinceEpoch(
+                     (qint64)(begin*1000.0)).toString(format));
+    painter.drawText(QPointF(width()-80, height()-4),
+                     QDateTime::fromMSecsSinceEpoch(
+                     (qint64)(end*1000.0)).toString(format));
+}
+
+/*-----------------------------------------------------------------------------
+Name:     wheelEvent
+Purpose:  Zooms by 20% per wheel step, keeping the time under the cursor
+          in place.
+Receive:  QWheelEvent* event
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void GlucoseChartWidget::wheelEvent(QWheelEvent *event)
+{
+    double end = m_following ? latestTime() : m_endTime;
+    double fraction = std::min(std::max((double)(event->pos().x()-
+                                        kLeftMargin)/plotWidth(), 0.0), 1.0);
+    double anchor = end-m_spanSeconds*(1.0-fraction);
+    double span = m_spanSeconds*std::pow(1.2,
+                                         -event->angleDelta().y()/120.0);
+    span = std::min(std::max(span, kMinSpanSeconds), kMaxSpanSeconds);
+    m_endTime = std::min(anchor+span*(1.0-fraction), latestTime());
+    m_following = m_endTime>=latestTime();
+    m_spanSeconds = span;
+    event->accept();
+    update();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     mousePressEvent
+Purpose:  Starts a pan.
+Receive:  QMouseEvent* event
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void GlucoseChartWidget::mousePressEvent(QMouseEvent *event)
+{
+    if(event->button()==Qt::LeftButton){
+        m_dragging = true;
+        m_dragX = event->pos().x();
+        m_dragEndTime = m_following ? latestTime() : m_endTime;
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     mouseMoveEvent
+Purpose:  Pans by the distance dragged. Dragging back to the newest
+          reading resumes following it.
+Receive:  QMouseEvent* event
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void GlucoseChartWidget::mouseMoveEvent(QMouseEvent *event)
+{
+    if(!m_dragging){
+        return;
+    }
+    double secondsPerPixel = m_spanSeconds/plotWidth();
+    m_endTime = std::min(m_dragEndTime-(event->pos().x()-m_dragX)*
+                         secondsPerPixel, latestTime());
+    m_following = m_endTime>=latestTime();
+    update();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     mouseReleaseEvent
+Purpose:  Ends a pan.
+Receive:  QMouseEvent* event
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void GlucoseChartWidget::mouseReleaseEvent(QMouseEvent *event)
+{
+    if(event->button()==Qt::LeftButton){
+        m_dragging = false;
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     mouseDoubleClickEvent
+Purpose:  Returns to following the newest reading over 3 hours.
+Receive:  QMouseEvent* event
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void GlucoseChartWidget::mouseDoubleClickEvent(QMouseEvent *event)
+{
+    Q_UNUSED(event);
+    m_following = true;
+    m_spanSeconds = kMinSpanSeconds;
+    update();
+}
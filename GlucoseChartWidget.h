@@ -0,0 +1,86 @@
+/******************************************************************************
+** FILE: GlucoseChartWidget.h
+**
+** ABSTRACT:
+** Real-time chart of observed BG, each cycle's predicted
+** trajectory and the chosen bolus, zoomable from 3 hours
+** to 90 days with the wheel and pannable by dragging.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** Every series is kept in a MinMaxPyramid. When a span
+** holds more points than there are pixel columns each
+** column draws the min/max of its time slice, so a repaint
+** costs about one pyramid query per pixel however much
+** history is shown. Close in, the points themselves and
+** the individual prediction trajectories are drawn.
+**
+******************************************************************************/
+
+#ifndef GLUCOSECHARTWIDGET_H
+#define GLUCOSECHARTWIDGET_H
+
+#include <QWidget>
+#include <vector>
+#include "MinMaxPyramid.h"
+using std::vector;
+
+class QPainter;
+
+class GlucoseChartWidget : public QWidget
+{
+    Q_OBJECT
+
+protected:
+    vector<double> m_bgTimes;
+    MinMaxPyramid m_bgValues;
+    //trajectories stored back to back, m_predictionLength values each
+    vector<double> m_predictionTimes;
+    vector<float> m_predictions;
+    MinMaxPyramid m_nextPredictions;
+    int m_predictionLength = 18;
+    vector<double> m_doseTimes;
+    MinMaxPyramid m_doses;
+
+    double m_spanSeconds;
+    double m_endTime = 0.0;
+    bool m_following = true;
+    bool m_dragging = false;
+    int m_dragX = 0;
+    double m_dragEndTime = 0.0;
+
+    double latestTime() const;
+    int plotWidth() const;
+    void trimHistory();
+    void drawSeries(QPainter& painter, const vector<double>& times,
+                    const MinMaxPyramid& values, double begin, double end,
+                    bool bars) const;
+    void drawTrajectories(QPainter& painter, double begin, double end) const;
+
+    void paintEvent(QPaintEvent* event) override;
+    void wheelEvent(QWheelEvent* event) override;
+    void mousePressEvent(QMouseEvent* event) override;
+    void mouseMoveEvent(QMouseEvent* event) override;
+    void mouseReleaseEvent(QMouseEvent* event) override;
+    void mouseDoubleClickEvent(QMouseEvent* event) override;
+
+public:
+    explicit GlucoseChartWidget(QWidget* parent = nullptr);
+    ~GlucoseChartWidget() = default;
+
+    double getSpanSeconds() const;
+    void setSpanSeconds(double spanSeconds);
+    void addReading(double sampleTime, int bg);
+    void addPrediction(double sampleTime, const vector<double>& trajectory);
+    void addDose(double sampleTime, double units);
+};
+
+#endif // GLUCOSECHARTWIDGET_H
@@ -0,0 +1,383 @@
+/******************************************************************************
+** FILE: HistoryStore.cpp
+**
+** ABSTRACT:
+** Write-behind persistence of readings, doses and
+** predicted trajectories to a local SQLite database.
+** Callers only append to an in-memory queue; a writer
+** thread commits whatever has built up in one transaction.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+**
+******************************************************************************/
+
+#include "HistoryStore.h"
+#include "Logger.h"
+#include <sqlite3.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+namespace {
+    const char* kSchema =
+        "PRAGMA journal_mode=WAL;"
+        "PRAGMA synchronous=NORMAL;"
+        "CREATE TABLE IF NOT EXISTS readings("
+        "sample_time REAL PRIMARY KEY, value INTEGER, trend INTEGER, "
+        "delay_time REAL);"
+        "CREATE TABLE IF NOT EXISTS doses("
+        "sample_time REAL PRIMARY KEY, units REAL);"
+        "CREATE TABLE IF NOT EXISTS predictions("
+        "sample_time REAL, source TEXT, trajectory BLOB, "
+        "PRIMARY KEY(sample_time, source));";
+}
+
+/*-----------------------------------------------------------------------------
+Name:     HistoryStore
+Purpose:  Constructor. Nothing is opened until open is called.
+Receive:  const string& path of the database file
+Return:   N/A
+-----------------------------------------------------------------------------*/
+HistoryStore::HistoryStore(const string &path) :
+    m_path(path)
+{
+}
+
+/*-----------------------------------------------------------------------------
+Name:     ~HistoryStore
+Purpose:  Destructor. Commits anything still queued.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+HistoryStore::~HistoryStore()
+{
+    close();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     open
+Purpose:  Opens or creates the database, switches it to WAL, prepares the
+          insert statements and starts the writer thread.
+Receive:  N/A
+Return:   bool
+-----------------------------------------------------------------------------*/
+bool HistoryStore::open()
+{
+    if(m_database){
+        return true;
+    }
+    char* error = nullptr;
+    if(sqlite3_open(m_path.c_str(), &m_database)!=SQLITE_OK ||
+       sqlite3_exec(m_database, kSchema, nullptr, nullptr, &error)!=
+       SQLITE_OK ||
+       sqlite3_prepare_v2(m_database, "INSERT OR REPLACE INTO readings "
+                          "VALUES(?,?,?,?)", -1, &m_insertReading,
+                          nullptr)!=SQLITE_OK ||
+       sqlite3_prepare_v2(m_database, "INSERT OR REPLACE INTO doses "
+                          "VALUES(?,?)", -1, &m_insertDose,
+                          nullptr)!=SQLITE_OK ||
+       sqlite3_prepare_v2(m_database, "INSERT OR REPLACE INTO predictions "
+                          "VALUES(?,?,?)", -1, &m_insertPrediction,
+                          nullptr)!=SQLITE_OK){
+        std::cerr << "Couldn't open history store " << m_path << ": "
+                  << (error ? error : sqlite3_errmsg(m_database))
+                  << std::endl;
+        sqlite3_free(error);
+        close();
+        return false;
+    }
+    m_stopping = false;
+    m_writer = std::thread(&HistoryStore::writerLoop, this);
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     close
+Purpose:  Stops the writer after it commits the queue, then closes the
+          database.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void HistoryStore::close()
+{
+    if(m_writer.joinable()){
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_one();
+        m_writer.join();
+    }
+    sqlite3_finalize(m_insertReading);
+    sqlite3_finalize(m_insertDose);
+    sqlite3_finalize(m_insertPrediction);
+    m_insertReading = nullptr;
+    m_insertDose = nullptr;
+    m_insertPrediction = nullptr;
+    sqlite3_close(m_database);
+    m_database = nullptr;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setBatchSize
+Purpose:  Sets how many queued rows wake the writer before the interval.
+Receive:  int batchSize
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void HistoryStore::setBatchSize(int batchSize)
+{
+    m_batchSize = std::max(batchSize, 1);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setFlushIntervalMs
+Purpose:  Sets the longest a queued row waits before it is committed.
+Receive:  int flushIntervalMs
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void HistoryStore::setFlushIntervalMs(int flushIntervalMs)
+{
+    m_flushIntervalMs = std::max(flushIntervalMs, 1);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     enqueue
+Purpose:  Moves a row onto the queue. Only takes the lock for a push, never
+          for I/O. A full queue drops its oldest row.
+Receive:  Row& row, moved from
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void HistoryStore::enqueue(Row &row)
+{
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_pending.size()>=m_maxPending){
+            m_pending.pop_front();
+            m_dropped++;
+        }
+        m_pending.push_back(std::move(row));
+        wake = m_pending.size()==m_batchSize;
+    }
+    if(wake){
+        m_wake.notify_one();
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     addReading
+Purpose:  Queues a BG reading.
+Receive:  double sampleTime, int value, int trend, double delayTime
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void HistoryStore::addReading(double sampleTime, int value, int trend,
+                              double delayTime)
+{
+    Row row;
+    row.type = ReadingRow;
+    row.sampleTime = sampleTime;
+    row.value = value;
+    row.trend = trend;
+    row.delayTime = delayTime;
+    enqueue(row);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     addDose
+Purpose:  Queues a bolus chosen by the controller.
+Receive:  double sampleTime, double units
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void HistoryStore::addDose(double sampleTime, double units)
+{
+    Row row;
+    row.type = DoseRow;
+    row.sampleTime = sampleTime;
+    row.value = units;
+    enqueue(row);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     addPrediction
+Purpose:  Queues a predicted trajectory, stored as a blob of doubles.
+Receive:  double sampleTime of the reading it was made from
+          const string& source, e.g. "RF" or "MPC"
+          const vector<double>& trajectory
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void HistoryStore::addPrediction(double sampleTime, const string &source,
+                                 const vector<double>& trajectory)
+{
+    Row row;
+    row.type = PredictionRow;
+    row.sampleTime = sampleTime;
+    row.source = source;
+    row.trajectory = trajectory;
+    enqueue(row);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     flush
+Purpose:  Blocks until everything queued so far is committed. For shutdown
+          and tests, never from the control cycle.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void HistoryStore::flush()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if(!m_writer.joinable()){
+        return;
+    }
+    m_flushRequested = true;
+    m_wake.notify_one();
+    m_flushed.wait(lock, [this](){ return m_pending.empty() && !m_busy; });
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getCommittedCount
+Purpose:  Returns the number of rows committed since open.
+Receive:  N/A
+Return:   long
+-----------------------------------------------------------------------------*/
+long HistoryStore::getCommittedCount()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_committed;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getDroppedCount
+Purpose:  Returns the number of rows dropped because the queue was full.
+Receive:  N/A
+Return:   long
+-----------------------------------------------------------------------------*/
+long HistoryStore::getDroppedCount()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_dropped;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     writerLoop
+Purpose:  Body of the writer thread. Wakes when a batch has built up, a flush
+          is requested or the interval passes, takes the whole queue and
+          commits it as one transaction. A failed batch is put back in
+          front of the queue to retry.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void HistoryStore::writerLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(true){
+        m_wake.wait_for(lock, std::chrono::milliseconds(m_flushIntervalMs),
+                        [this](){
+            return m_stopping || m_flushRequested ||
+                   m_pending.size()>=m_batchSize;
+        });
+        if(m_pending.empty()){
+            m_flushRequested = false;
+            m_flushed.notify_all();
+            if(m_stopping){
+                return;
+            }
+            continue;
+        }
+        m_writing.swap(m_pending);
+        m_busy = true;
+        lock.unlock();
+        bool committed = commit(m_writing);
+        lock.lock();
+        m_busy = false;
+        if(committed){
+            m_committed += m_writing.size();
+        }
+        else if(!m_stopping){
+            m_pending.insert(m_pending.begin(),
+                             std::make_move_iterator(m_writing.begin()),
+                             std::make_move_iterator(m_writing.end()));
+            if(m_pending.size()>m_maxPending){
+                m_dropped += m_pending.size()-m_maxPending;
+                m_pending.erase(m_pending.begin(), m_pending.begin()+
+                                (m_pending.size()-m_maxPending));
+            }
+            //don't spin on a disk that keeps failing
+            m_writing.clear();
+            m_flushed.notify_all();
+            m_wake.wait_for(lock,
+                            std::chrono::milliseconds(m_flushIntervalMs),
+                            [this](){ return m_stopping; });
+            continue;
+        }
+        else{
+            m_dropped += m_writing.size();
+        }
+        m_writing.clear();
+        m_flushed.notify_all();
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     commit
+Purpose:  Writes rows in a single transaction with the prepared statements.
+Receive:  const std::deque<Row>& rows
+Return:   bool false if the transaction was rolled back
+-----------------------------------------------------------------------------*/
+bool HistoryStore::commit(const std::deque<Row>& rows)
+{
+    if(sqlite3_exec(m_database, "BEGIN", nullptr, nullptr, nullptr)!=
+       SQLITE_OK){
+        LOG_ERROR("History store: {}", sqlite3_errmsg(m_database));
+        return false;
+    }
+    for(int i=0; i<rows.size(); i++){
+        const Row& row = rows[i];
+        sqlite3_stmt* statement;
+        if(row.type==ReadingRow){
+            statement = m_insertReading;
+            sqlite3_bind_double(statement, 1, row.sampleTime);
+            sqlite3_bind_int(statement, 2, (int)row.value);
+            sqlite3_bind_int(statement, 3, row.trend);
+            sqlite3_bind_double(statement, 4, row.delayTime);
+        }
+        else if(row.type==DoseRow){
+            statement = m_insertDose;
+            sqlite3_bind_double(statement, 1, row.sampleTime);
+            sqlite3_bind_double(statement, 2, row.value);
+        }
+        else{
+            statement = m_insertPrediction;
+            sqlite3_bind_double(statement, 1, row.sampleTime);
+            sqlite3_bind_text(statement, 2, row.source.c_str(), -1,
+                              SQLITE_STATIC);
+            sqlite3_bind_blob(statement, 3, row.trajectory.data(),
+                              row.trajectory.size()*sizeof(double),
+                              SQLITE_STATIC);
+        }
+        int result = sqlite3_step(statement);
+        sqlite3_reset(statement);
+        sqlite3_clear_bindings(statement);
+        if(result!=SQLITE_DONE){
+            LOG_ERROR("History store: {}", sqlite3_errmsg(m_database));
+            sqlite3_exec(m_database, "ROLLBACK", nullptr, nullptr, nullptr);
+            return false;
+        }
+    }
+    if(sqlite3_exec(m_database, "COMMIT", nullptr, nullptr, nullptr)!=
+       SQLITE_OK){
+        LOG_ERROR("History store: {}", sqlite3_errmsg(m_database));
+        sqlite3_exec(m_database, "ROLLBACK", nullptr, nullptr, nullptr);
+        return false;
+    }
+    return true;
+}
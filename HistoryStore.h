@@ -0,0 +1,110 @@
+/******************************************************************************
+** FILE: HistoryStore.h
+**
+** ABSTRACT:
+** Write-behind persistence of readings, doses and
+** predicted trajectories to a local SQLite database.
+** Callers only append to an in-memory queue; a writer
+** thread commits whatever has built up in one transaction.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** The database runs in WAL mode with synchronous=NORMAL,
+** so a group commit is one sequential append to the log
+** and readers (e.g. offline SQL) never block the writer.
+** The queue is bounded; if the disk stalls for long the
+** oldest unwritten rows are dropped and counted rather
+** than blocking the control cycle.
+**
+******************************************************************************/
+
+#ifndef HISTORYSTORE_H
+#define HISTORYSTORE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+using std::string;
+using std::vector;
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+class HistoryStore
+{
+protected:
+    enum RowType
+    {
+        ReadingRow,
+        DoseRow,
+        PredictionRow
+    };
+    struct Row
+    {
+        RowType type;
+        double sampleTime;
+        double value;
+        int trend;
+        double delayTime;
+        string source;
+        vector<double> trajectory;
+    };
+
+    string m_path;
+    sqlite3* m_database = nullptr;
+    sqlite3_stmt* m_insertReading = nullptr;
+    sqlite3_stmt* m_insertDose = nullptr;
+    sqlite3_stmt* m_insertPrediction = nullptr;
+
+    std::thread m_writer;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_flushed;
+    //swapped whole so the writer never holds the lock during I/O
+    std::deque<Row> m_pending;
+    std::deque<Row> m_writing;
+    int m_maxPending = 10000;
+    int m_batchSize = 64;
+    int m_flushIntervalMs = 1000;
+    bool m_stopping = false;
+    bool m_busy = false;
+    bool m_flushRequested = false;
+    long m_committed = 0;
+    long m_dropped = 0;
+
+    void enqueue(Row& row);
+    void writerLoop();
+    bool commit(const std::deque<Row>& rows);
+
+public:
+    explicit HistoryStore(const string& path);
+    ~HistoryStore();
+    HistoryStore(const HistoryStore&) = delete;
+    HistoryStore& operator=(const HistoryStore&) = delete;
+
+    bool open();
+    void close();
+    void setBatchSize(int batchSize);
+    void setFlushIntervalMs(int flushIntervalMs);
+    void addReading(double sampleTime, int value, int trend,
+                    double delayTime);
+    void addDose(double sampleTime, double units);
+    void addPrediction(double sampleTime, const string& source,
+                       const vector<double>& trajectory);
+    void flush();
+    long getCommittedCount();
+    long getDroppedCount();
+};
+
+#endif // HISTORYSTORE_H
@@ -45,3 +45,20 @@ InsulinDataEntry* InsulinDataEntryFactory::createDataEntry
 
 
 
+/*-----------------------------------------------------------------------------
+Name:     createDataEntry
+Purpose:  Fills an InsulinDataEntry from a binary scraper record. The IOB is
+          the record's first insulin value.
+Receive:  const ScraperRecord& record
+Return:   InsulinDataEntry*
+-----------------------------------------------------------------------------*/
+InsulinDataEntry* InsulinDataEntryFactory::createDataEntry
+                                           (const ScraperRecord& record)
+{
+    InsulinDataEntry* insulinDataEntry = new InsulinDataEntry();
+    insulinDataEntry->setInsulinOnBoard(record.insulinCount ?
+                                        record.insulin[0] : 0.0);
+    insulinDataEntry->setSampleTime(record.sampleTime);
+
+    return insulinDataEntry;
+}
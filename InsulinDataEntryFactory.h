@@ -23,12 +23,14 @@
 
 #include "AbstractDataEntryFactory.h"
 #include "InsulinDataEntry.h"
+#include "ScraperRecord.h"
 
 class InsulinDataEntryFactory : public AbstractDataEntryFactory
 {
 public:
     virtual ~InsulinDataEntryFactory() = default;
     virtual InsulinDataEntry* createDataEntry(const QStringList& rawData);
+    InsulinDataEntry* createDataEntry(const ScraperRecord& record);
 };
 
 #endif // INSULINDATAENTRYFACTORY_H
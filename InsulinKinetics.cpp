@@ -0,0 +1,50 @@
+/******************************************************************************
+** FILE: InsulinKinetics.cpp
+**
+** ABSTRACT:
+** The exponential insulin action curve used to turn a
+** bolus into insulin on board. Shared by the MPC, which
+** projects candidate boluses, and the patient simulator,
+** which has to report IOB the way DataScraper does.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+**
+******************************************************************************/
+
+#include "InsulinKinetics.h"
+#include <math.h>
+
+/*-----------------------------------------------------------------------------
+Name:     insulinOnBoard
+Purpose:  Returns how much of a bolus is still on board minsAgo minutes after
+          it was given. A dose not given yet or older than the activity
+          duration contributes nothing.
+Receive:  float bolus in units
+          float minsAgo since the bolus
+          double peakTime of insulin activity in minutes
+          float end, the total activity duration in minutes
+Return:   float units on board
+-----------------------------------------------------------------------------*/
+float InsulinKinetics::insulinOnBoard(float bolus, float minsAgo,
+                                      double peakTime, float end)
+{
+    if(minsAgo<0 || minsAgo>end){
+        return 0.0f;
+    }
+    float tau = peakTime*(1-peakTime/end)/(1-2*peakTime/end);
+    float a = 2*tau/end;
+    float s = 1/(1-a+(1+a)*exp(-end/tau));
+    float iobContrib = bolus * (1 - s * (1 - a) * ((pow(minsAgo, 2)
+                       / (tau * end * (1 - a)) - minsAgo / tau - 1) *
+                       exp(-minsAgo / tau) + 1));
+    return iobContrib;
+}
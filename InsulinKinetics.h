@@ -0,0 +1,36 @@
+/******************************************************************************
+** FILE: InsulinKinetics.h
+**
+** ABSTRACT:
+** The exponential insulin action curve used to turn a
+** bolus into insulin on board. Shared by the MPC, which
+** projects candidate boluses, and the patient simulator,
+** which has to report IOB the way DataScraper does.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** Same curve as calculateIOB in DataScraper.py, which
+** takes a peak time and a total activity duration in
+** minutes.
+**
+******************************************************************************/
+
+#ifndef INSULINKINETICS_H
+#define INSULINKINETICS_H
+
+class InsulinKinetics
+{
+public:
+    static float insulinOnBoard(float bolus, float minsAgo, double peakTime,
+                                float end);
+};
+
+#endif // INSULINKINETICS_H
@@ -0,0 +1,87 @@
+################################################################################
+# FILE: LSTMExport.py
+#
+# ABSTRACT:
+# Writes the weights of a trained Keras LSTM -> Dense model to the flat binary
+# file loaded by LSTMModel in AGS. The LSTM kernel and recurrent kernel are
+# fused so each gate unit is one row of [input weights, recurrent weights].
+# Can be called from LSTMTrain.py after fitting or run on a saved LSTM.h5.
+#
+# DOCUMENTS:
+#
+#
+# AUTHOR:
+# Daniel Webb
+#
+# CREATION DATE:
+# 10/19/2026
+#
+# NOTES:
+# Layout (little endian, version 1):
+#   char[4] "AGSL", uint32 version, bgFeatures, insulinFeatures, timesteps,
+#   hiddenUnits, outputs, recurrentActivation (0 sigmoid, 1 hard sigmoid),
+#   float32 bgMin, bgMax, insulinMin, insulinMax,
+#   float32 gates[4*hidden][features+hidden] (Keras order i, f, c, o),
+#   float32 gateBias[4*hidden], dense[outputs][hidden], denseBias[outputs]
+# A network exported with insulinFeatures 0 is prediction only in AGS: its
+# outputs join the ensemble prediction for the steps it covers, but it
+# projects no bolus candidates since every candidate would look the same.
+#
+################################################################################
+
+import struct
+import sys
+import numpy as np
+
+VERSION = 1
+
+
+def export_lstm(model, bg_min, bg_max, bg_features, filename,
+                insulin_features=0, insulin_min=0.0, insulin_max=0.0):
+    '''
+    Write a Sequential LSTM -> Dense model to the AGS binary weight format
+    :model: trained keras model, first layer LSTM, last layer Dense
+    :bg_min: minimum of the BG scaler (MinMaxScaler data_min_)
+    :bg_max: maximum of the BG scaler (MinMaxScaler data_max_)
+    :bg_features: number of lagged BG values in each input row
+    :filename: output path, AGS looks for LSTM/LSTM.bin
+    :insulin_features: number of future insulin values after the BG lags,
+                       0 for a prediction only network
+    :insulin_min: minimum of the insulin scaler
+    :insulin_max: maximum of the insulin scaler
+    '''
+    lstm = model.layers[0]
+    dense = model.layers[-1]
+    kernel, recurrent, bias = lstm.get_weights()
+    dense_kernel, dense_bias = dense.get_weights()
+    timesteps = lstm.input_shape[1]
+    hidden = recurrent.shape[0]
+    activation = lstm.recurrent_activation.__name__
+    hard = 1 if activation == 'hard_sigmoid' else 0
+
+    # one row per gate unit: [kernel column, recurrent kernel column]
+    gates = np.hstack([kernel.T, recurrent.T]).astype('<f4')
+    with open(filename, 'wb') as out:
+        out.write(b'AGSL')
+        out.write(struct.pack('<7I', VERSION, bg_features, insulin_features,
+                              timesteps, hidden, dense_kernel.shape[1], hard))
+        out.write(struct.pack('<4f', bg_min, bg_max, insulin_min,
+                              insulin_max))
+        out.write(gates.tobytes())
+        out.write(bias.astype('<f4').tobytes())
+        out.write(dense_kernel.T.astype('<f4').tobytes())
+        out.write(dense_bias.astype('<f4').tobytes())
+
+
+def main():
+    '''
+    Export a saved model: LSTMExport.py LSTM.h5 bgMin bgMax bgFeatures out
+    '''
+    from tensorflow.keras.models import load_model
+    model = load_model(sys.argv[1])
+    export_lstm(model, float(sys.argv[2]), float(sys.argv[3]),
+                int(sys.argv[4]), sys.argv[5])
+
+
+if __name__ == '__main__':
+    main()
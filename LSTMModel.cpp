@@ -0,0 +1,474 @@
+/******************************************************************************
+** FILE: LSTMModel.cpp
+**
+** ABSTRACT:
+** Native inference engine for the sequence model trained
+** by LSTMTrain.py. Loads the flat binary weight file
+** written by LSTMExport.py and runs the recurrent cells
+** in C++ so every bolus candidate can be projected in a
+** single batched forward pass. Provides output to the
+** MPC for optimization.
+** A network exported without insulin features only sees
+** BG, so it is prediction only: it joins the ensemble's
+** prediction but not the candidate projections.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** The gate and dense products are computed by one kernel
+** that blocks the weight rows and the batch so a block of
+** weights stays in L1 while every candidate streams
+** through it. With AVX2/FMA available the inner products
+** run 8 floats wide, otherwise a scalar loop is used.
+**
+******************************************************************************/
+
+#include "LSTMModel.h"
+#include "Logger.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+const char kMagic[4] = {'A', 'G', 'S', 'L'};
+const unsigned int kVersion = 1;
+const int kMaxDimension = 4096;
+//number of weight rows kept hot while the batch streams through them
+const int kRowBlock = 16;
+//number of batch rows processed against one block of weights
+const int kBatchBlock = 32;
+
+/*-----------------------------------------------------------------------------
+Name:     paddedStride
+Purpose:  Rounds a row length up to a multiple of 8 floats so every row
+          starts on a full AVX register and needs no remainder loop.
+Receive:  int length of the row
+Return:   int
+-----------------------------------------------------------------------------*/
+int paddedStride(int length)
+{
+    return (length + 7) & ~7;
+}
+
+#if defined(__AVX2__) && defined(__FMA__)
+/*-----------------------------------------------------------------------------
+Name:     horizontalSum
+Purpose:  Adds the 8 lanes of an AVX register together.
+Receive:  __m256 v
+Return:   float
+-----------------------------------------------------------------------------*/
+inline float horizontalSum(__m256 v)
+{
+    __m128 low = _mm256_castps256_ps128(v);
+    __m128 high = _mm256_extractf128_ps(v, 1);
+    low = _mm_add_ps(low, high);
+    low = _mm_hadd_ps(low, low);
+    low = _mm_hadd_ps(low, low);
+    return _mm_cvtss_f32(low);
+}
+#endif
+
+/*-----------------------------------------------------------------------------
+Name:     blockedMatVec
+Purpose:  Computes out[b][r] = bias[r] + dot(weights[r], inputs[b]) for every
+          batch row b and weight row r. Weight rows and input rows share the
+          same padded stride. Rows are processed 4 at a time so each input
+          load is reused across 4 dot products.
+Receive:  weights rows x stride, bias, inputs batch x stride, out batch x
+          outStride
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void blockedMatVec(const float* weights, const float* bias, int rows,
+                   int stride, const float* inputs, int batch, float* out,
+                   int outStride)
+{
+    for(int rowStart=0; rowStart<rows; rowStart+=kRowBlock){
+        int rowEnd = rowStart+kRowBlock < rows ? rowStart+kRowBlock : rows;
+        for(int batchStart=0; batchStart<batch; batchStart+=kBatchBlock){
+            int batchEnd = batchStart+kBatchBlock < batch ?
+                           batchStart+kBatchBlock : batch;
+            for(int b=batchStart; b<batchEnd; b++){
+                const float* x = inputs + b*stride;
+                float* y = out + b*outStride;
+                int r = rowStart;
+#if defined(__AVX2__) && defined(__FMA__)
+                for(; r+4<=rowEnd; r+=4){
+                    const float* w0 = weights + r*stride;
+                    const float* w1 = w0 + stride;
+                    const float* w2 = w1 + stride;
+                    const float* w3 = w2 + stride;
+                    __m256 acc0 = _mm256_setzero_ps();
+                    __m256 acc1 = _mm256_setzero_ps();
+                    __m256 acc2 = _mm256_setzero_ps();
+                    __m256 acc3 = _mm256_setzero_ps();
+                    for(int k=0; k<stride; k+=8){
+                        __m256 xv = _mm256_loadu_ps(x+k);
+                        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(w0+k), xv, acc0);
+                        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(w1+k), xv, acc1);
+                        acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(w2+k), xv, acc2);
+                        acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(w3+k), xv, acc3);
+                    }
+                    y[r] = bias[r] + horizontalSum(acc0);
+                    y[r+1] = bias[r+1] + horizontalSum(acc1);
+                    y[r+2] = bias[r+2] + horizontalSum(acc2);
+                    y[r+3] = bias[r+3] + horizontalSum(acc3);
+                }
+                for(; r<rowEnd; r++){
+                    const float* w = weights + r*stride;
+                    __m256 acc = _mm256_setzero_ps();
+                    for(int k=0; k<stride; k+=8){
+                        acc = _mm256_fmadd_ps(_mm256_loadu_ps(w+k),
+                                              _mm256_loadu_ps(x+k), acc);
+                    }
+                    y[r] = bias[r] + horizontalSum(acc);
+                }
+#else
+                for(; r<rowEnd; r++){
+                    const float* w = weights + r*stride;
+                    float acc = 0.0f;
+                    for(int k=0; k<stride; k++){
+                        acc += w[k]*x[k];
+                    }
+                    y[r] = bias[r] + acc;
+                }
+#endif
+            }
+        }
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     sigmoid
+Purpose:  Recurrent activation used by the LSTM gates. Keras models trained
+          with the older default use the piecewise linear hard sigmoid.
+Receive:  float x, bool hard
+Return:   float
+-----------------------------------------------------------------------------*/
+inline float sigmoid(float x, bool hard)
+{
+    if(hard){
+        float y = 0.2f*x + 0.5f;
+        return y < 0.0f ? 0.0f : (y > 1.0f ? 1.0f : y);
+    }
+    return 1.0f/(1.0f + expf(-x));
+}
+
+/*-----------------------------------------------------------------------------
+Name:     readBlock
+Purpose:  Reads count floats from the weight file into rows of the
+          destination, leaving the padding at the end of each row zeroed.
+Receive:  FILE* file, destination, rows, columns, stride of destination
+Return:   bool true if the whole block was read
+-----------------------------------------------------------------------------*/
+bool readBlock(FILE* file, vector<float>& destination, int rows, int columns,
+               int stride)
+{
+    destination.assign(rows*stride, 0.0f);
+    for(int r=0; r<rows; r++){
+        if(fread(&destination[r*stride], sizeof(float), columns, file)
+           != size_t(columns)){
+            return false;
+        }
+    }
+    return true;
+}
+}
+
+/*-----------------------------------------------------------------------------
+Name:     loadWeights
+Purpose:  Loads the flat binary weight file produced by LSTMExport.py. The
+          fused gate matrix is stored with each row padded to a multiple of 8
+          floats so the kernels never need a remainder loop.
+Receive:  const string& path to the weight file
+Return:   bool true if the weights were loaded and validated
+-----------------------------------------------------------------------------*/
+bool LSTMModel::loadWeights(const string &path)
+{
+    m_loaded = false;
+    FILE* file = fopen(path.c_str(), "rb");
+    if(!file){
+        LOG_ERROR("Couldn't open LSTM weights {}", path);
+        return false;
+    }
+    char magic[4];
+    unsigned int header[7];
+    float scaling[4];
+    bool valid = fread(magic, 1, 4, file)==4 &&
+                 memcmp(magic, kMagic, 4)==0 &&
+                 fread(header, sizeof(unsigned int), 7, file)==7 &&
+                 header[0]==kVersion &&
+                 fread(scaling, sizeof(float), 4, file)==4;
+    if(valid){
+        m_bgFeatures = header[1];
+        m_insulinFeatures = header[2];
+        m_timesteps = header[3];
+        m_hiddenUnits = header[4];
+        m_outputs = header[5];
+        m_recurrentActivation = header[6];
+        valid = m_timesteps>0 && m_hiddenUnits>0 && m_outputs>0 &&
+                m_hiddenUnits<kMaxDimension && m_outputs<kMaxDimension &&
+                m_bgFeatures+m_insulinFeatures>0 &&
+                m_bgFeatures+m_insulinFeatures<kMaxDimension &&
+                (m_bgFeatures+m_insulinFeatures)%m_timesteps==0;
+    }
+    if(valid){
+        m_bgMin = scaling[0];
+        m_bgMax = scaling[1];
+        m_insulinMin = scaling[2];
+        m_insulinMax = scaling[3];
+        m_stepFeatures = (m_bgFeatures+m_insulinFeatures)/m_timesteps;
+        m_gateStride = paddedStride(m_stepFeatures+m_hiddenUnits);
+        m_denseStride = paddedStride(m_hiddenUnits);
+        valid = readBlock(file, m_gateWeights, 4*m_hiddenUnits,
+                          m_stepFeatures+m_hiddenUnits, m_gateStride) &&
+                readBlock(file, m_gateBias, 1, 4*m_hiddenUnits,
+                          4*m_hiddenUnits) &&
+                readBlock(file, m_denseWeights, m_outputs, m_hiddenUnits,
+                          m_denseStride) &&
+                readBlock(file, m_denseBias, 1, m_outputs, m_outputs);
+    }
+    fclose(file);
+    if(!valid){
+        LOG_ERROR("Invalid LSTM weights {}", path);
+        return false;
+    }
+    m_loaded = true;
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     isLoaded
+Purpose:  Returns whether a valid weight file has been loaded.
+Receive:  N/A
+Return:   bool
+-----------------------------------------------------------------------------*/
+bool LSTMModel::isLoaded() const
+{
+    return m_loaded;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getOutputCount
+Purpose:  Returns the number of future BG values produced by the network.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int LSTMModel::getOutputCount() const
+{
+    return m_outputs;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getBGFeatureCount
+Purpose:  Returns the number of most recent BG values the network reads.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int LSTMModel::getBGFeatureCount() const
+{
+    return m_bgFeatures;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     buildFeatures
+Purpose:  Scales one row of network input the same way LSTMTrain.py does
+          (MinMaxScaler to [-1, 1]). The most recent bgFeatures BG values
+          come first in chronological order followed by the first
+          insulinFeatures future insulin values.
+Receive:  bgInputs, insulinInputs, float* features of timesteps*stepFeatures
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void LSTMModel::buildFeatures(const vector<double> &bgInputs,
+                              const vector<float> &insulinInputs,
+                              float *features) const
+{
+    float bgRange = m_bgMax-m_bgMin;
+    int offset = int(bgInputs.size())-m_bgFeatures;
+    for(int i=0; i<m_bgFeatures; i++){
+        double bg = 0.0;
+        if(bgInputs.size()){
+            bg = offset+i>=0 ? bgInputs[offset+i] : bgInputs[0];
+        }
+        features[i] = bgRange ? float((bg-m_bgMin)/bgRange*2.0-1.0)
+                              : float(bg);
+    }
+    float insulinRange = m_insulinMax-m_insulinMin;
+    for(int i=0; i<m_insulinFeatures; i++){
+        float insulin = i<insulinInputs.size() ? insulinInputs[i] : 0.0f;
+        features[m_bgFeatures+i] = insulinRange ?
+                    (insulin-m_insulinMin)/insulinRange*2.0f-1.0f : insulin;
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     forward
+Purpose:  Runs the LSTM and dense layer for a whole batch of input rows at
+          once. The state starts at zero as it does for a single Keras
+          predict call. Each timestep copies x_t next to h_t-1 so all four
+          gates come out of one fused matrix product.
+Receive:  features batch x (timesteps*stepFeatures), int batch,
+          outputs filled with batch x outputs BG values in mg/dl
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void LSTMModel::forward(const vector<float> &features, int batch,
+                        vector<double> &outputs) const
+{
+    int hidden = m_hiddenUnits;
+    int rowFeatures = m_timesteps*m_stepFeatures;
+    bool hard = m_recurrentActivation==1;
+    vector<float> fused(batch*m_gateStride, 0.0f);
+    vector<float> cell(batch*hidden, 0.0f);
+    vector<float> gates(batch*4*hidden);
+
+    for(int t=0; t<m_timesteps; t++){
+        for(int b=0; b<batch; b++){
+            memcpy(&fused[b*m_gateStride],
+                   &features[b*rowFeatures + t*m_stepFeatures],
+                   m_stepFeatures*sizeof(float));
+        }
+        blockedMatVec(m_gateWeights.data(), m_gateBias.data(), 4*hidden,
+                      m_gateStride, fused.data(), batch, gates.data(),
+                      4*hidden);
+        for(int b=0; b<batch; b++){
+            const float* z = &gates[b*4*hidden];
+            float* c = &cell[b*hidden];
+            float* h = &fused[b*m_gateStride + m_stepFeatures];
+            for(int j=0; j<hidden; j++){
+                float inputGate = sigmoid(z[j], hard);
+                float forgetGate = sigmoid(z[hidden+j], hard);
+                float candidate = tanhf(z[2*hidden+j]);
+                float outputGate = sigmoid(z[3*hidden+j], hard);
+                c[j] = forgetGate*c[j] + inputGate*candidate;
+                h[j] = outputGate*tanhf(c[j]);
+            }
+        }
+    }
+
+    //dense layer on the final hidden state
+    vector<float> state(batch*m_denseStride, 0.0f);
+    for(int b=0; b<batch; b++){
+        memcpy(&state[b*m_denseStride], &fused[b*m_gateStride+m_stepFeatures],
+               hidden*sizeof(float));
+    }
+    vector<float> dense(batch*m_outputs);
+    blockedMatVec(m_denseWeights.data(), m_denseBias.data(), m_outputs,
+                  m_denseStride, state.data(), batch, dense.data(), m_outputs);
+
+    //invert the [-1, 1] scaling back to mg/dl
+    outputs.resize(batch*m_outputs);
+    double bgRange = m_bgMax-m_bgMin;
+    for(int i=0; i<batch*m_outputs; i++){
+        outputs[i] = bgRange ? (dense[i]+1.0)/2.0*bgRange+m_bgMin : dense[i];
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     predict
+Purpose:  Runs the prediction model once using input bg and insulin
+          data at t=0.
+Receive:  bgInputs and insulin inputs for the model, saveFlag is unused
+          since LSTM predictions are not stored in the database.
+Return:   vector<double> predictions for future BG
+-----------------------------------------------------------------------------*/
+vector<double> LSTMModel::predict(vector<int> bgInputs,
+                                  vector<float> insulinInputs,
+                                  bool saveFlag)
+{
+    vector<double> bg(bgInputs.begin(), bgInputs.end());
+    vector<vector<float>> insulin;
+    insulin.push_back(insulinInputs);
+    vector<vector<double>> results = runBatch(bg, insulin);
+    if(results.size()){
+        return results[0];
+    }
+    return vector<double>();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     projectCorrection
+Purpose:  Runs the hypothetical insulin control input supplied to the model
+          and gives the projected BG output based on this input.
+Receive:  bgInputs and insulin inputs for the model, sensitivity is not used
+          since the network learned the insulin response from data.
+Return:   vector<double> predictions for future BG
+-----------------------------------------------------------------------------*/
+vector<double> LSTMModel::projectCorrection(vector<double> bgInputs,
+                                            vector<float> insulinInputs,
+                                            int sensitivity)
+{
+    vector<vector<float>> insulin;
+    insulin.push_back(insulinInputs);
+    vector<vector<double>> results =
+            projectCorrections(bgInputs, insulin, sensitivity);
+    if(results.size()){
+        return results[0];
+    }
+    return vector<double>();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     projectCorrections
+Purpose:  Projects every bolus candidate through the network in a single
+          batched forward pass. Only a network exported with insulin
+          features can tell the candidates apart. A BG only network would
+          give every candidate the same trajectory and drag the fused
+          projections toward no insulin effect, so it is prediction only and
+          projects nothing.
+Receive:  bgInputs for the model, insulinInputs holds one future insulin
+          curve per candidate, sensitivity is not used.
+Return:   vector<vector<double>> one trajectory per candidate, empty for a
+          BG only network
+-----------------------------------------------------------------------------*/
+vector<vector<double>> LSTMModel::projectCorrections(
+                                const vector<double> &bgInputs,
+                                const vector<vector<float>> &insulinInputs,
+                                int sensitivity)
+{
+    if(!m_insulinFeatures){
+        return vector<vector<double>>();
+    }
+    return runBatch(bgInputs, insulinInputs);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     runBatch
+Purpose:  Runs one row of network input per future insulin curve through
+          the network in a single batched forward pass.
+Receive:  bgInputs for the model, insulinInputs holds one future insulin
+          curve per row
+Return:   vector<vector<double>> one trajectory per row
+-----------------------------------------------------------------------------*/
+vector<vector<double>> LSTMModel::runBatch(
+                        const vector<double> &bgInputs,
+                        const vector<vector<float>> &insulinInputs) const
+{
+    vector<vector<double>> results;
+    if(!m_loaded){
+        LOG_ERROR("LSTM weights not loaded");
+        return results;
+    }
+    int batch = insulinInputs.size();
+    int rowFeatures = m_timesteps*m_stepFeatures;
+    vector<float> features(batch*rowFeatures);
+    for(int b=0; b<batch; b++){
+        buildFeatures(bgInputs, insulinInputs[b], &features[b*rowFeatures]);
+    }
+    vector<double> outputs;
+    forward(features, batch, outputs);
+    for(int b=0; b<batch; b++){
+        results.push_back(vector<double>(outputs.begin()+b*m_outputs,
+                                         outputs.begin()+(b+1)*m_outputs));
+    }
+    return results;
+}
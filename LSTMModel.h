@@ -0,0 +1,99 @@
+/******************************************************************************
+** FILE: LSTMModel.h
+**
+** ABSTRACT:
+** Native inference engine for the sequence model trained
+** by LSTMTrain.py. Loads the flat binary weight file
+** written by LSTMExport.py and runs the recurrent cells
+** in C++ so every bolus candidate can be projected in a
+** single batched forward pass. Provides output to the
+** MPC for optimization.
+** A network exported without insulin features only sees
+** BG, so it is prediction only: it joins the ensemble's
+** prediction but not the candidate projections.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** Weight file layout (little endian, version 1):
+**   char[4] "AGSL", uint32 version, uint32 bgFeatures,
+**   uint32 insulinFeatures, uint32 timesteps,
+**   uint32 hiddenUnits, uint32 outputs,
+**   uint32 recurrentActivation (0 sigmoid, 1 hard sigmoid),
+**   float bgMin, bgMax, insulinMin, insulinMax,
+**   float gates[4*hidden][features+hidden] (i,f,c,o),
+**   float gateBias[4*hidden],
+**   float dense[outputs][hidden], float denseBias[outputs]
+**
+******************************************************************************/
+
+#ifndef LSTMMODEL_H
+#define LSTMMODEL_H
+
+#include "Model.h"
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+class LSTMModel : public Model
+{
+protected:
+    int m_bgFeatures = 0;
+    int m_insulinFeatures = 0;
+    int m_timesteps = 0;
+    int m_stepFeatures = 0;
+    int m_hiddenUnits = 0;
+    int m_outputs = 0;
+    int m_recurrentActivation = 0;
+    float m_bgMin = 0.0f;
+    float m_bgMax = 1.0f;
+    float m_insulinMin = 0.0f;
+    float m_insulinMax = 1.0f;
+    //gate rows hold [x_t, h_t-1] fused and padded to m_gateStride
+    int m_gateStride = 0;
+    vector<float> m_gateWeights;
+    vector<float> m_gateBias;
+    //dense rows padded to m_denseStride
+    int m_denseStride = 0;
+    vector<float> m_denseWeights;
+    vector<float> m_denseBias;
+    bool m_loaded = false;
+
+    void buildFeatures(const vector<double>& bgInputs,
+                       const vector<float>& insulinInputs,
+                       float* features) const;
+    void forward(const vector<float>& features, int batch,
+                 vector<double>& outputs) const;
+    vector<vector<double>> runBatch(
+                        const vector<double>& bgInputs,
+                        const vector<vector<float>>& insulinInputs) const;
+
+public:
+    LSTMModel() = default;
+    virtual ~LSTMModel() = default;
+
+    bool loadWeights(const string& path);
+    bool isLoaded() const;
+    int getOutputCount() const;
+    int getBGFeatureCount() const;
+
+    vector<double> predict(vector<int> bgInputs, vector<float> insulinInputs,
+                           bool saveFlag);
+    vector<double> projectCorrection(vector<double> bgInputs,
+                                     vector<float> insulinInputs,
+                                     int sensitivity);
+    vector<vector<double>> projectCorrections(
+                                const vector<double>& bgInputs,
+                                const vector<vector<float>>& insulinInputs,
+                                int sensitivity);
+};
+
+#endif // LSTMMODEL_H
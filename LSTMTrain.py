@@ -25,6 +25,7 @@ from sklearn.metrics import mean_squared_error
 from sklearn.preprocessing import MinMaxScaler
 from math import sqrt
 from numpy import array
+from LSTMExport import export_lstm
 
 
 # date-time parsing function for loading the dataset
@@ -199,6 +200,12 @@ def plot_forecasts(series, forecasts, n_test):
 # load dataset
 series = read_csv("~/dev/bgps/CSVData.txt", parse_dates=[0], index_col=0, header=0, squeeze=True)
 # configure
+# CSVData.txt holds BG only, so the network is prediction only: it is
+# exported with no insulin features and AGS fuses its n_seq steps into the
+# first part of the ensemble prediction but leaves it out of the bolus
+# candidate projections, which it cannot tell apart. An insulin aware
+# network needs future insulin columns in the training data and
+# insulin_features passed to export_lstm.
 n_lag = 4
 n_seq = 6
 n_test = 1000
@@ -226,6 +233,8 @@ with open("model.json", "w") as json_file:
 # serialize weights to HDF5
 model.save_weights("model.h5")
 model.save("LSTM.h5")
+# flat binary weights for the native LSTMModel in AGS
+export_lstm(model, scaler.data_min_[0], scaler.data_max_[0], n_lag, "LSTM.bin")
 print("Saved model to disk")
 
 # list all data in history
@@ -0,0 +1,584 @@
+/******************************************************************************
+** FILE: Logger.cpp
+**
+** ABSTRACT:
+** Asynchronous structured logger for the control cycle's
+** diagnostics.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+**
+******************************************************************************/
+
+#include "Logger.h"
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+namespace {
+    const char* const kLevelNames[kLogLevels] = {
+        "TRACE", "DEBUG", "INFO", "WARN", "ERROR"
+    };
+
+    //a record waiting to be written, in time order across the rings
+    struct PendingRecord
+    {
+        int64_t timeNs;
+        int thread;
+        LogLevel level;
+        string message;
+    };
+
+    //marks the thread's ring retired when the thread exits
+    struct RingHolder
+    {
+        std::shared_ptr<Logger::Ring> ring;
+
+        ~RingHolder()
+        {
+            if(ring){
+                ring->retired = true;
+            }
+        }
+    };
+
+    thread_local RingHolder t_ringHolder;
+
+    int64_t nowNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    //copies bytes out of a ring from a position that may wrap
+    void copyOut(const Logger::Ring& ring, uint64_t position, void* target,
+                 size_t bytes)
+    {
+        size_t offset = position%Logger::kRingBytes;
+        size_t first = std::min(bytes, Logger::kRingBytes-offset);
+        std::memcpy(target, ring.bytes+offset, first);
+        std::memcpy((unsigned char*)target+first, ring.bytes, bytes-first);
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     Ring
+Purpose:  Constructor.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+Logger::Ring::Ring() :
+    head(0),
+    tail(0),
+    dropped(0),
+    retired(false)
+{
+}
+
+/*-----------------------------------------------------------------------------
+Name:     Logger
+Purpose:  Constructor.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+Logger::Logger() :
+    m_running(false),
+    m_written(0),
+    m_dropped(0),
+    m_drainRequested(false)
+{
+}
+
+/*-----------------------------------------------------------------------------
+Name:     ~Logger
+Purpose:  Destructor. Writes whatever is still queued.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+Logger::~Logger()
+{
+    close();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     get
+Purpose:  Returns the process' logger.
+Receive:  N/A
+Return:   Logger&
+-----------------------------------------------------------------------------*/
+Logger& Logger::get()
+{
+    static Logger logger;
+    return logger;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setMaxFileBytes
+Purpose:  Sets the size at which the log file is rotated.
+Receive:  long maxFileBytes
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void Logger::setMaxFileBytes(long maxFileBytes)
+{
+    m_maxFileBytes = maxFileBytes;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setMaxFiles
+Purpose:  Sets how many rotated files (path.1, path.2, ...) are kept.
+Receive:  int maxFiles
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void Logger::setMaxFiles(int maxFiles)
+{
+    m_maxFiles = maxFiles;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setFlushIntervalMs
+Purpose:  Sets how often the flusher drains the rings. Call before open.
+Receive:  int flushIntervalMs
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void Logger::setFlushIntervalMs(int flushIntervalMs)
+{
+    m_flushIntervalMs = flushIntervalMs;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setEchoLevel
+Purpose:  Sets the lowest level also printed to the console while the file
+          is open. Warnings and errors go to std::cerr.
+Receive:  LogLevel echoLevel
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void Logger::setEchoLevel(LogLevel echoLevel)
+{
+    m_echoLevel = echoLevel;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     open
+Purpose:  Opens the log file for appending and starts the flusher thread.
+Receive:  const string& path
+Return:   bool
+-----------------------------------------------------------------------------*/
+bool Logger::open(const string &path)
+{
+    if(m_running){
+        return true;
+    }
+    m_path = path;
+    m_file = fopen(path.c_str(), "a");
+    if(!m_file){
+        std::cerr << "Couldn't open log " << path << std::endl;
+        return false;
+    }
+    fseek(m_file, 0, SEEK_END);
+    m_fileBytes = ftell(m_file);
+    m_stopping = false;
+    m_running = true;
+    m_flusher = std::thread(&Logger::flusherLoop, this);
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     close
+Purpose:  Stops the flusher after it writes every queued record, then
+          closes the file. Later records are printed straight away.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void Logger::close()
+{
+    m_running = false;
+    if(m_flusher.joinable()){
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_one();
+        m_flusher.join();
+    }
+    if(m_file){
+        fclose(m_file);
+        m_file = nullptr;
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     isOpen
+Purpose:  Returns whether records are going to the log file.
+Receive:  N/A
+Return:   bool
+-----------------------------------------------------------------------------*/
+bool Logger::isOpen() const
+{
+    return m_running;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getWrittenCount
+Purpose:  Returns how many records have been written to the log file.
+Receive:  N/A
+Return:   long
+-----------------------------------------------------------------------------*/
+long Logger::getWrittenCount() const
+{
+    return m_written;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getDroppedCount
+Purpose:  Returns how many records were dropped because a ring was full.
+Receive:  N/A
+Return:   long
+-----------------------------------------------------------------------------*/
+long Logger::getDroppedCount() const
+{
+    return m_dropped;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getRing
+Purpose:  Returns the calling thread's ring, registering one on the
+          thread's first record.
+Receive:  N/A
+Return:   Ring&
+-----------------------------------------------------------------------------*/
+Logger::Ring& Logger::getRing()
+{
+    if(!t_ringHolder.ring){
+        std::shared_ptr<Ring> ring(new Ring());
+        std::lock_guard<std::mutex> lock(m_ringMutex);
+        ring->thread = ++m_nextThread;
+        m_rings.push_back(ring);
+        t_ringHolder.ring = ring;
+    }
+    return *t_ringHolder.ring;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     reserve
+Purpose:  Claims space for an argument if the record has room for it.
+Receive:  size_t& used bytes so far, size_t bytes wanted
+Return:   bool false if the argument doesn't fit and is left out
+-----------------------------------------------------------------------------*/
+bool Logger::reserve(size_t &used, size_t bytes)
+{
+    if(used+bytes>kRecordBytes){
+        return false;
+    }
+    used += bytes;
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     encode
+Purpose:  Appends a string argument to a record, truncated to fit.
+Receive:  unsigned char* record, size_t& used bytes so far,
+          const char* text
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void Logger::encode(unsigned char *record, size_t &used, const char *text)
+{
+    size_t at = used;
+    if(!reserve(used, 1+sizeof(uint16_t))){
+        return;
+    }
+    size_t length = text ? strlen(text) : 0;
+    uint16_t stored = std::min(length, kRecordBytes-used);
+    used += stored;
+    record[at] = TextArgument;
+    std::memcpy(record+at+1, &stored, sizeof(stored));
+    std::memcpy(record+at+1+sizeof(stored), text, stored);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     encode
+Purpose:  Appends a string argument to a record, truncated to fit.
+Receive:  unsigned char* record, size_t& used bytes so far,
+          const string& text
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void Logger::encode(unsigned char *record, size_t &used, const string &text)
+{
+    encode(record, used, text.c_str());
+}
+
+/*-----------------------------------------------------------------------------
+Name:     commit
+Purpose:  Stamps an encoded record and copies it into the calling thread's
+          ring, or prints it straight away when the file isn't open. The
+          ring is single producer, single consumer: only this thread moves
+          head and only the flusher moves tail.
+Receive:  LogLevel level, const char* format, unsigned char* record with
+          room for the header at the front, size_t bytes in the record
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void Logger::commit(LogLevel level, const char *format,
+                    unsigned char *record, size_t bytes)
+{
+    RecordHeader header;
+    header.bytes = bytes;
+    header.level = level;
+    header.timeNs = nowNs();
+    header.format = format;
+    std::memcpy(record, &header, sizeof(header));
+    if(!m_running.load(std::memory_order_acquire)){
+        echo(level, formatRecord(record));
+        return;
+    }
+    Ring& ring = getRing();
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    uint64_t tail = ring.tail.load(std::memory_order_acquire);
+    if(head+bytes-tail>kRingBytes){
+        ring.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    size_t offset = head%kRingBytes;
+    size_t first = std::min(bytes, kRingBytes-offset);
+    std::memcpy(ring.bytes+offset, record, first);
+    std::memcpy(ring.bytes, record+first, bytes-first);
+    ring.head.store(head+bytes, std::memory_order_release);
+    if(head+bytes-tail>kRingBytes/2 &&
+       !m_drainRequested.exchange(true, std::memory_order_relaxed)){
+        m_wake.notify_one();
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     formatRecord
+Purpose:  Decodes a record's arguments and substitutes them for the {}s of
+          its format.
+Receive:  const unsigned char* record
+Return:   string message
+-----------------------------------------------------------------------------*/
+string Logger::formatRecord(const unsigned char *record) const
+{
+    RecordHeader header;
+    std::memcpy(&header, record, sizeof(header));
+    vector<string> arguments;
+    char number[32];
+    size_t at = sizeof(header);
+    while(at<header.bytes){
+        unsigned char kind = record[at++];
+        if(kind==IntegerArgument){
+            int64_t integer;
+            std::memcpy(&integer, record+at, sizeof(integer));
+            at += sizeof(integer);
+            snprintf(number, sizeof(number), "%lld", (long long)integer);
+            arguments.push_back(number);
+        }
+        else if(kind==RealArgument){
+            double real;
+            std::memcpy(&real, record+at, sizeof(real));
+            at += sizeof(real);
+            snprintf(number, sizeof(number), "%g", real);
+            arguments.push_back(number);
+        }
+        else{
+            uint16_t count;
+            std::memcpy(&count, record+at, sizeof(count));
+            at += sizeof(count);
+            if(kind==TextArgument){
+                arguments.push_back(string((const char*)record+at, count));
+                at += count;
+                continue;
+            }
+            string values;
+            for(int i=0; i<count; i++){
+                double real;
+                std::memcpy(&real, record+at, sizeof(real));
+                at += sizeof(real);
+                snprintf(number, sizeof(number), i ? ", %g" : "%g", real);
+                values += number;
+            }
+            arguments.push_back(values);
+        }
+    }
+
+    string message;
+    int next = 0;
+    for(const char* c=header.format; *c; c++){
+        if(c[0]=='{' && c[1]=='}' && next<arguments.size()){
+            message += arguments[next++];
+            c++;
+        }
+        else{
+            message += *c;
+        }
+    }
+    return message;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     echo
+Purpose:  Prints a message to the console, warnings and errors to
+          std::cerr.
+Receive:  LogLevel level, const string& message
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void Logger::echo(LogLevel level, const string &message)
+{
+    if(level>=LogWarning){
+        std::cerr << message << std::endl;
+    }
+    else{
+        std::cout << message << '\n';
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     writeLine
+Purpose:  Writes one formatted record to the file and echoes it if it is at
+          the echo level. Flusher thread only.
+Receive:  LogLevel level, int64_t timeNs, int thread, const string& message
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void Logger::writeLine(LogLevel level, int64_t timeNs, int thread,
+                       const string &message)
+{
+    if(m_file){
+        time_t seconds = timeNs/1000000000;
+        struct tm local;
+        localtime_r(&seconds, &local);
+        char stamp[64];
+        size_t length = strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S",
+                                 &local);
+        snprintf(stamp+length, sizeof(stamp)-length, ".%03d %-5s [%d] ",
+                 (int)(timeNs/1000000%1000), kLevelNames[level], thread);
+        int written = fprintf(m_file, "%s%s\n", stamp, message.c_str());
+        if(written>0){
+            m_fileBytes += written;
+            m_written++;
+        }
+        if(m_fileBytes>=m_maxFileBytes){
+            rotate();
+        }
+    }
+    if(level>=m_echoLevel){
+        echo(level, message);
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     rotate
+Purpose:  Shifts path.1 ... path.N up by one, dropping the oldest, moves
+          the full file to path.1 and starts a new one.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void Logger::rotate()
+{
+    fclose(m_file);
+    for(int i=m_maxFiles-1; i>0; i--){
+        std::rename((m_path+"."+std::to_string(i)).c_str(),
+                    (m_path+"."+std::to_string(i+1)).c_str());
+    }
+    if(m_maxFiles>0){
+        std::rename(m_path.c_str(), (m_path+".1").c_str());
+    }
+    m_file = fopen(m_path.c_str(), "w");
+    m_fileBytes = 0;
+    if(!m_file){
+        std::cerr << "Couldn't reopen log " << m_path << std::endl;
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     drain
+Purpose:  Takes every complete record out of every ring, writes them in
+          time order and frees the rings of threads that have exited.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void Logger::drain()
+{
+    vector<std::shared_ptr<Ring>> rings;
+    {
+        std::lock_guard<std::mutex> lock(m_ringMutex);
+        rings = m_rings;
+    }
+    vector<PendingRecord> pending;
+    vector<std::shared_ptr<Ring>> finished;
+    unsigned char record[kRecordBytes];
+    long dropped = 0;
+    for(std::shared_ptr<Ring>& ring : rings){
+        //a thread retired before this drain can't add anything after it
+        bool retired = ring->retired;
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        while(tail<head){
+            RecordHeader header;
+            copyOut(*ring, tail, &header, sizeof(header));
+            copyOut(*ring, tail, record, header.bytes);
+            pending.push_back({header.timeNs, ring->thread,
+                               (LogLevel)header.level,
+                               formatRecord(record)});
+            tail += header.bytes;
+        }
+        ring->tail.store(tail, std::memory_order_release);
+        dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+        if(retired){
+            finished.push_back(ring);
+        }
+    }
+    if(!finished.empty()){
+        std::lock_guard<std::mutex> lock(m_ringMutex);
+        for(std::shared_ptr<Ring>& ring : finished){
+            m_rings.erase(std::remove(m_rings.begin(), m_rings.end(), ring),
+                          m_rings.end());
+        }
+    }
+
+    std::stable_sort(pending.begin(), pending.end(),
+                     [](const PendingRecord& a, const PendingRecord& b){
+        return a.timeNs<b.timeNs;
+    });
+    for(PendingRecord& entry : pending){
+        writeLine(entry.level, entry.timeNs, entry.thread, entry.message);
+    }
+    if(dropped){
+        m_dropped += dropped;
+        writeLine(LogWarning, nowNs(), 0, "Log rings full, dropped "+
+                  std::to_string(dropped)+" records");
+    }
+    if(m_file){
+        fflush(m_file);
+    }
+    std::cout.flush();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     flusherLoop
+Purpose:  Body of the flusher thread. Drains the rings every interval,
+          when a producer asks and once more when stopping.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void Logger::flusherLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(true){
+        m_wake.wait_for(lock, std::chrono::milliseconds(m_flushIntervalMs),
+                        [this](){ return m_stopping || m_drainRequested; });
+        m_drainRequested = false;
+        bool stopping = m_stopping;
+        lock.unlock();
+        drain();
+        lock.lock();
+        if(stopping){
+            return;
+        }
+    }
+}
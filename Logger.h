@@ -0,0 +1,274 @@
+/******************************************************************************
+** FILE: Logger.h
+**
+** ABSTRACT:
+** Asynchronous structured logger for the control cycle's
+** diagnostics. The LOG_ macros copy a record (level, time,
+** the format string's address and the arguments in binary)
+** into the calling thread's own ring buffer without locks
+** or formatting; a flusher thread drains every ring,
+** formats the records and writes them to a rotated log
+** file, echoing the more important ones to the console.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** Levels below AGS_LOG_LEVEL are compiled out entirely,
+** arguments included. The format must be a string literal,
+** only its address is stored, and each {} in it is
+** replaced by the next argument: an integer, a floating
+** point number, a string or a vector of numbers. A full
+** ring drops the record rather than block the cycle and
+** the drops are counted; a ring half full wakes the
+** flusher early. Until open is called records are
+** formatted and printed straight away, so the offline
+** tools behave as they did with std::cout.
+**
+******************************************************************************/
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+using std::string;
+using std::vector;
+
+enum LogLevel
+{
+    LogTrace = 0,
+    LogDebug,
+    LogInfo,
+    LogWarning,
+    LogError,
+    kLogLevels
+};
+
+//lowest level compiled in; trajectories are logged at trace
+#ifndef AGS_LOG_LEVEL
+#define AGS_LOG_LEVEL 0
+#endif
+
+#define AGS_LOG(level, ...) \
+    do{ \
+        if((level)>=AGS_LOG_LEVEL){ \
+            Logger::get().write((level), __VA_ARGS__); \
+        } \
+    }while(0)
+#define LOG_TRACE(...) AGS_LOG(LogTrace, __VA_ARGS__)
+#define LOG_DEBUG(...) AGS_LOG(LogDebug, __VA_ARGS__)
+#define LOG_INFO(...) AGS_LOG(LogInfo, __VA_ARGS__)
+#define LOG_WARNING(...) AGS_LOG(LogWarning, __VA_ARGS__)
+#define LOG_ERROR(...) AGS_LOG(LogError, __VA_ARGS__)
+
+class Logger
+{
+public:
+    static const size_t kRecordBytes = 1024;
+    static const size_t kRingBytes = 1<<18;
+
+    //one thread's records, written by that thread and read by the flusher
+    struct Ring
+    {
+        alignas(64) std::atomic<uint64_t> head;
+        alignas(64) std::atomic<uint64_t> tail;
+        std::atomic<long> dropped;
+        //set when the thread exits, freed once drained
+        std::atomic<bool> retired;
+        int thread = 0;
+        unsigned char bytes[kRingBytes];
+
+        Ring();
+    };
+
+protected:
+    struct RecordHeader
+    {
+        uint32_t bytes;
+        uint8_t level;
+        uint8_t reserved[3];
+        int64_t timeNs;
+        const char* format;
+    };
+
+    enum ArgumentKind
+    {
+        IntegerArgument = 0,
+        RealArgument,
+        TextArgument,
+        RealsArgument
+    };
+
+    string m_path;
+    FILE* m_file = nullptr;
+    long m_fileBytes = 0;
+    long m_maxFileBytes = 10*1024*1024;
+    int m_maxFiles = 5;
+    int m_flushIntervalMs = 100;
+    LogLevel m_echoLevel = LogInfo;
+
+    std::atomic<bool> m_running;
+    std::atomic<long> m_written;
+    std::atomic<long> m_dropped;
+    std::mutex m_ringMutex;
+    vector<std::shared_ptr<Ring>> m_rings;
+    int m_nextThread = 0;
+
+    std::thread m_flusher;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_stopping = false;
+    //set by a producer whose ring is half full, so it drains early
+    std::atomic<bool> m_drainRequested;
+
+    Logger();
+    Ring& getRing();
+    void commit(LogLevel level, const char* format, unsigned char* record,
+                size_t bytes);
+    string formatRecord(const unsigned char* record) const;
+    static void echo(LogLevel level, const string& message);
+    void writeLine(LogLevel level, int64_t timeNs, int thread,
+                   const string& message);
+    void rotate();
+    void drain();
+    void flusherLoop();
+
+    static bool reserve(size_t& used, size_t bytes);
+    template<typename T>
+    static typename std::enable_if<std::is_integral<T>::value>::type
+    encode(unsigned char* record, size_t& used, const T& value);
+    template<typename T>
+    static typename std::enable_if<std::is_floating_point<T>::value>::type
+    encode(unsigned char* record, size_t& used, const T& value);
+    template<typename T>
+    static void encode(unsigned char* record, size_t& used,
+                       const vector<T>& values);
+    static void encode(unsigned char* record, size_t& used,
+                       const char* text);
+    static void encode(unsigned char* record, size_t& used,
+                       const string& text);
+
+public:
+    ~Logger();
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    static Logger& get();
+
+    void setMaxFileBytes(long maxFileBytes);
+    void setMaxFiles(int maxFiles);
+    void setFlushIntervalMs(int flushIntervalMs);
+    void setEchoLevel(LogLevel echoLevel);
+
+    bool open(const string& path);
+    void close();
+    bool isOpen() const;
+    long getWrittenCount() const;
+    long getDroppedCount() const;
+
+    template<size_t N, typename... Args>
+    void write(LogLevel level, const char (&format)[N], const Args&... args);
+};
+
+/*-----------------------------------------------------------------------------
+Name:     encode
+Purpose:  Appends an integer argument to a record.
+Receive:  unsigned char* record, size_t& used bytes so far, const T& value
+Return:   N/A
+-----------------------------------------------------------------------------*/
+template<typename T>
+typename std::enable_if<std::is_integral<T>::value>::type
+Logger::encode(unsigned char *record, size_t &used, const T &value)
+{
+    int64_t integer = value;
+    size_t at = used;
+    if(reserve(used, 1+sizeof(integer))){
+        record[at] = IntegerArgument;
+        std::memcpy(record+at+1, &integer, sizeof(integer));
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     encode
+Purpose:  Appends a floating point argument to a record.
+Receive:  unsigned char* record, size_t& used bytes so far, const T& value
+Return:   N/A
+-----------------------------------------------------------------------------*/
+template<typename T>
+typename std::enable_if<std::is_floating_point<T>::value>::type
+Logger::encode(unsigned char *record, size_t &used, const T &value)
+{
+    double real = value;
+    size_t at = used;
+    if(reserve(used, 1+sizeof(real))){
+        record[at] = RealArgument;
+        std::memcpy(record+at+1, &real, sizeof(real));
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     encode
+Purpose:  Appends a vector of numbers to a record as doubles, as many as
+          fit.
+Receive:  unsigned char* record, size_t& used bytes so far,
+          const vector<T>& values
+Return:   N/A
+-----------------------------------------------------------------------------*/
+template<typename T>
+void Logger::encode(unsigned char *record, size_t &used,
+                    const vector<T> &values)
+{
+    size_t at = used;
+    if(!reserve(used, 1+sizeof(uint16_t))){
+        return;
+    }
+    uint16_t count = 0;
+    for(const T& value : values){
+        double real = value;
+        size_t valueAt = used;
+        if(!reserve(used, sizeof(real))){
+            break;
+        }
+        std::memcpy(record+valueAt, &real, sizeof(real));
+        count++;
+    }
+    record[at] = RealsArgument;
+    std::memcpy(record+at+1, &count, sizeof(count));
+}
+
+/*-----------------------------------------------------------------------------
+Name:     write
+Purpose:  Encodes a record into the calling thread's ring. Formatting and
+          I/O happen later on the flusher thread.
+Receive:  LogLevel level, format string literal with a {} per argument,
+          the arguments
+Return:   N/A
+-----------------------------------------------------------------------------*/
+template<size_t N, typename... Args>
+void Logger::write(LogLevel level, const char (&format)[N],
+                   const Args&... args)
+{
+    unsigned char record[kRecordBytes];
+    size_t used = sizeof(RecordHeader);
+    (encode(record, used, args), ...);
+    commit(level, format, record, used);
+}
+
+#endif // LOGGER_H
@@ -21,146 +21,430 @@
 #include "MainWindow.h"
 #include <QApplication>
 #include <iostream>
-#include <thread>
-#include <chrono>
-#include "ModelPredictiveController.h"
+#include "ControlWorker.h"
 #include "RandomForestModel.h"
 #include "StateSpaceModel.h"
+#include "LSTMModel.h"
+#include "EnsembleModel.h"
+#include "CachedModel.h"
+#include "ModelRegistry.h"
+#include "RegisteredModel.h"
+#include "ForestTrainer.h"
+#include "ForestCompiler.h"
+#include "CompiledForestModel.h"
+#include "QuantizedForest.h"
+#include "ThreadPool.h"
+#include "ClosedLoopTrial.h"
+#include "ControllerTuner.h"
+#include "StateSnapshot.h"
+#include "Logger.h"
+#include "MetricsServer.h"
+#include <string>
+using std::string;
+#include <QDir>
+#include <QThread>
+#include <QTimer>
 
 /*-----------------------------------------------------------------------------
-Name:     printCurrentTime
-Purpose:  Sends current system time to output console for debugging purposes.
-Receive:  std::chrono::system_clock::time_point timePoint
-Return:   N/A
+Name:     trainForest
+Purpose:  Offline mode that replaces RandomForestTrain.py. Trains the native
+          random forest from the 43 column training file on every core and
+          writes the file RandomForestModel loads.
+          Usage: AGS --train-forest data.csv RandomForest.forest [trees]
+Receive:  command line arguments
+Return:   int process exit code
 -----------------------------------------------------------------------------*/
-void printCurrentTime(std::chrono::system_clock::time_point timePoint)
+int trainForest(int argc, char *argv[])
 {
-    std::time_t timeStamp = std::chrono::system_clock::to_time_t(timePoint);
-    std::cout << std::ctime(&timeStamp) << std::endl;
-
+    if(argc<4){
+        std::cerr << "Usage: " << argv[0]
+                  << " --train-forest data.csv output.forest [trees]"
+                  << std::endl;
+        return 1;
+    }
+    ForestTrainer trainer;
+    if(argc>4){
+        trainer.setTreeCount(atoi(argv[4]));
+    }
+    if(!trainer.loadCSV(argv[2])){
+        return 1;
+    }
+    std::cout << "Training on " << trainer.getRowCount() << " rows"
+              << std::endl;
+    DecisionForest forest;
+    if(!trainer.train(forest) || !forest.save(argv[3])){
+        return 1;
+    }
+    std::cout << "Saved " << forest.getTreeCount() << " trees to "
+              << argv[3] << std::endl;
+    return 0;
 }
 
 /*-----------------------------------------------------------------------------
-Name:     threadFunc
-Purpose:  Commands the application thread to sleep until the specified
-          time point. 240 seconds since Dexcom creates a new reading every
-          5 minutes. This ensures we usually don't query new data when there is
-          none.
-Receive:  N/A
-Return:   N/A
+Name:     compileForest
+Purpose:  Build step that writes a trained forest as generated C++ over
+          CompiledForestTrees.cpp. The next build runs it as the
+          CompiledForestModel instead of loading the forest file.
+          Usage: AGS --compile-forest RandomForest.forest
+                 CompiledForestTrees.cpp
+Receive:  command line arguments
+Return:   int process exit code
 -----------------------------------------------------------------------------*/
-void threadFunc()
+int compileForest(int argc, char *argv[])
 {
+    if(argc<4){
+        std::cerr << "Usage: " << argv[0]
+                  << " --compile-forest input.forest CompiledForestTrees.cpp"
+                  << std::endl;
+        return 1;
+    }
+    DecisionForest forest;
+    if(!forest.load(argv[2])){
+        return 1;
+    }
+    ForestCompiler compiler;
+    compiler.setSource(argv[2]);
+    if(!compiler.compile(forest, string(argv[3]))){
+        return 1;
+    }
+    std::cout << "Compiled " << forest.getTreeCount() << " trees into "
+              << argv[3] << std::endl;
+    return 0;
+}
 
-    std::cout<<"Current Time :: ";
-    // Print Current Time
-    printCurrentTime(std::chrono::system_clock::now());
-
-    // create a time point pointing to 60 seconds in future
-    std::chrono::system_clock::time_point timePoint =
-            std::chrono::system_clock::now() + std::chrono::seconds(240);
-
-    std::cout << "Going to Sleep Until :: "; printCurrentTime(timePoint);
+/*-----------------------------------------------------------------------------
+Name:     quantizeForest
+Purpose:  Offline mode that writes a trained forest in the compact mmapped
+          format and reports its size and accuracy against the full
+          precision forest, over the rows of a training file or, without
+          one, features sampled around the forest's thresholds.
+          Usage: AGS --quantize-forest input.forest output.qforest
+                 [data.csv]
+Receive:  command line arguments
+Return:   int process exit code
+-----------------------------------------------------------------------------*/
+int quantizeForest(int argc, char *argv[])
+{
+    if(argc<4){
+        std::cerr << "Usage: " << argv[0]
+                  << " --quantize-forest input.forest output.qforest"
+                  << " [data.csv]" << std::endl;
+        return 1;
+    }
+    DecisionForest forest;
+    QuantizedForest quantized;
+    if(!forest.load(argv[2]) || !QuantizedForest::write(forest, argv[3]) ||
+       !quantized.open(argv[3])){
+        return 1;
+    }
+    vector<float> samples;
+    ForestTrainer trainer;
+    if(argc>4 && trainer.loadCSV(argv[4])){
+        samples = trainer.getFeatures();
+    }
+    else{
+        samples = QuantizedForest::sampleFeatures(forest, 10000, 1);
+    }
+    ForestAccuracy accuracy = QuantizedForest::compare(forest, quantized,
+                                                       samples);
+    std::cout << "Wrote " << accuracy.quantizedBytes << " bytes, full "
+              << "precision " << accuracy.fullBytes << " bytes" << std::endl
+              << "Over " << accuracy.samples << " samples: MAE "
+              << accuracy.meanAbsError << " mg/dL, RMSE "
+              << accuracy.rootMeanSquareError << " mg/dL, max "
+              << accuracy.maxAbsError << " mg/dL" << std::endl;
+    return 0;
+}
 
+/*-----------------------------------------------------------------------------
+Name:     simulate
+Purpose:  Offline mode that runs the controller in closed loop against a
+          population of virtual patients instead of a live Dexcom account.
+          Usage: AGS --simulate [patients] [days] [seed] [control moves]
+                 [adaptive] [rescue] [basal]
+          adaptive is 1 (default) for online adaptation of each
+          patient's model or 0 to keep it fixed. rescue is 1
+          (default) to treat readings below 70 with carbs or 0 to leave
+          the lows to the controller. basal is 1 to choose a temporary
+          basal with each bolus or 0 (default) for boluses alone.
+Receive:  command line arguments
+Return:   int process exit code
+-----------------------------------------------------------------------------*/
+int simulate(int argc, char *argv[])
+{
+    ClosedLoopTrial trial;
+    if(argc>2){
+        trial.setPatientCount(atoi(argv[2]));
+    }
+    if(argc>3){
+        trial.setDays(atoi(argv[3]));
+    }
+    if(argc>4){
+        trial.setSeed(atoi(argv[4]));
+    }
+    if(argc>5){
+        trial.setControlMoves(atoi(argv[5]));
+    }
+    if(argc>6){
+        trial.setAdaptive(atoi(argv[6])!=0);
+    }
+    if(argc>7){
+        trial.setRescue(atoi(argv[7])!=0);
+    }
+    if(argc>8){
+        trial.setBasalMode(atoi(argv[8])!=0);
+    }
+    if(!trial.run()){
+        return 1;
+    }
+    trial.printSummary();
+    return 0;
+}
 
-    // Sleep Till specified time point
-    // Accepts std::chrono::system_clock::time_point as argument
-    std::this_thread::sleep_until(timePoint);
+/*-----------------------------------------------------------------------------
+Name:     tune
+Purpose:  Offline mode that replays recorded history (a backfill export)
+          under a grid or random sample of controller settings and prints
+          the best ones. The live settings are always included.
+          Usage: AGS --tune history [random samples] [seed]
+Receive:  command line arguments
+Return:   int process exit code
+-----------------------------------------------------------------------------*/
+int tune(int argc, char *argv[])
+{
+    if(argc<3){
+        std::cerr << "Usage: " << argv[0]
+                  << " --tune history [random samples] [seed]" << std::endl;
+        return 1;
+    }
+    //up to a year of 5 minute readings
+    DataQueue dataQueue;
+    dataQueue.setQueueCapacity(366*288);
+    dataQueue.backfillFromFile(argv[2]);
+    ControllerTuner tuner;
+    if(!tuner.loadHistory(dataQueue)){
+        return 1;
+    }
+    int samples = argc>3 ? atoi(argv[3]) : 0;
+    if(samples>0){
+        tuner.makeRandom(samples, argc>4 ? atoi(argv[4]) : 1);
+    }
+    else{
+        tuner.makeGrid();
+    }
+    tuner.addCandidate(ControllerSettings());
+    std::cout << "Replaying " << tuner.getCandidateCount() << " settings over "
+              << tuner.getReadingCount() << " readings" << std::endl;
+    if(!tuner.run()){
+        return 1;
+    }
+    tuner.printRanking(20);
+    return 0;
+}
 
-    std::cout<<"Current Time :: ";
-    // Print Current Time
-    printCurrentTime(std::chrono::system_clock::now());
+/*-----------------------------------------------------------------------------
+Name:     controllerSettings
+Purpose:  The live controller settings, the defaults changed by options
+          after the Qt ones.
+          Usage: AGS [--control-moves n] [--basal-mode]
+                 [--scheduled-basal U/h] [--max-basal U/h]
+          --control-moves plans n doses 30 minutes apart each cycle and
+          gives the first (1 by default, a single bolus). --basal-mode recommends a temporary basal with each bolus, between
+          0 and the max basal (3 U/h by default) around the scheduled one.
+Receive:  command line arguments
+Return:   ControllerSettings
+-----------------------------------------------------------------------------*/
+ControllerSettings controllerSettings(int argc, char *argv[])
+{
+    ControllerSettings settings;
+    for(int i=1; i<argc; i++){
+        string option = argv[i];
+        if(option=="--control-moves" && i+1<argc){
+            settings.controlMoves = atoi(argv[++i]);
+        }
+        else if(option=="--basal-mode"){
+            settings.basalMode = true;
+        }
+        else if(option=="--scheduled-basal" && i+1<argc){
+            settings.scheduledBasal = atof(argv[++i]);
+        }
+        else if(option=="--max-basal" && i+1<argc){
+            settings.maxBasalRate = atof(argv[++i]);
+        }
+    }
+    return settings;
 }
 
 /*-----------------------------------------------------------------------------
 Name:     main
 Purpose:  Drives the AGS application on a timed thread. Maintains a DataQueue
-          which holds up to 24 hours of data, sends it to various MPC's using
-          various different Model objects and gets the optimization output.
+          which holds up to 24 hours of data and sends it to one MPC whose
+          EnsembleModel runs the SS, RF and (if trained) LSTM models
+          concurrently and fuses their trajectories before the bolus is
+          chosen by Monte Carlo scenario evaluation. Each cycle runs on a
+          ControlWorker thread and is shown in the MainWindow.
 Receive:  command line arguments
 Return:   int
 -----------------------------------------------------------------------------*/
 int main(int argc, char *argv[])
 {
+    //offline tools share the binary with the controller
+    if(argc>1 && string(argv[1])=="--train-forest"){
+        return trainForest(argc, argv);
+    }
+    if(argc>1 && string(argv[1])=="--compile-forest"){
+        return compileForest(argc, argv);
+    }
+    if(argc>1 && string(argv[1])=="--quantize-forest"){
+        return quantizeForest(argc, argv);
+    }
+    if(argc>1 && string(argv[1])=="--simulate"){
+        return simulate(argc, argv);
+    }
+    if(argc>1 && string(argv[1])=="--tune"){
+        return tune(argc, argv);
+    }
     QApplication app(argc, argv);
-    //instantiate data queue and mpc
+    //cycle diagnostics go to a rotated log, info and above also to the
+    //console; the offline tools above still print directly
+    Logger::get().open(QDir::currentPath().toStdString()+"/AGS.log");
+    //runtime metrics in the Prometheus text format, on a local socket for
+    //curl --unix-socket or socat and in a file for the textfile collector
+    MetricsServer* metricsServer = new MetricsServer();
+    metricsServer->setSocketPath(QDir::currentPath().toStdString()+
+                                 "/AGS.metrics.sock");
+    metricsServer->setDumpPath(QDir::currentPath().toStdString()+"/AGS.prom");
+    metricsServer->start();
+    //instantiate data queue
     DataQueue* dataQueue = new DataQueue();
-    vector<double> temp;
-    //main loop
-    while(true){     
-      //query new data from dexcom
-      bool successFlag = dataQueue->scrapeData();
-      if(successFlag){
-          //STATE SPACE MODEL
-           ModelPredictiveController* modelPredictiveControllerSS =
-                   new ModelPredictiveController();
-           StateSpaceModel* stateSpaceModel = new StateSpaceModel();
-           modelPredictiveControllerSS->setModel(stateSpaceModel);
-
-           //RF MODEL
-           ModelPredictiveController* modelPredictiveControllerRF =
-                   new ModelPredictiveController();
-           RandomForestModel* randomForestModel = new RandomForestModel();
-           modelPredictiveControllerRF->setModel(randomForestModel);
-
-          //configure SS MPC
-          modelPredictiveControllerSS->setSensitivity(30);
-          modelPredictiveControllerSS->setPeakInsulinTime(57.0);
-          modelPredictiveControllerSS->setActivityDurationMinutes(90.0);
-          modelPredictiveControllerSS->setTarget(110);
-          modelPredictiveControllerSS->setMaxBolus(16.0);
-
-          //configure RF MPC
-          modelPredictiveControllerRF->setSensitivity(30);
-          modelPredictiveControllerRF->setPeakInsulinTime(57.0);
-          modelPredictiveControllerRF->setActivityDurationMinutes(90.0);
-          modelPredictiveControllerRF->setTarget(110);
-          modelPredictiveControllerRF->setMaxBolus(16.0);
-
-
-          //get future insulin values
-          vector<float> futureInsulin = dataQueue->getFutureInsulinValues();
-          for(int k=0;k<futureInsulin.size();k++){
-              modelPredictiveControllerSS->addInsulinInput(futureInsulin[k]);
-              modelPredictiveControllerRF->addInsulinInput(futureInsulin[k]);
-          }
 
-          //get last 6 BG readings
-          vector<int> bgEntries = dataQueue->getNBGEntries(6);
-          for(int i =5; i>-1;i--){
-              modelPredictiveControllerSS->addBGInput(bgEntries[i]);
-              modelPredictiveControllerRF->addBGInput(bgEntries[i]);
-          }
-
-          vector<double> predictionsSS;
-          vector<double> predictionsRF;
-
-          //get base SS prediction
-          modelPredictiveControllerSS->runPredictionModel();
-          predictionsSS = modelPredictiveControllerSS->getPredictions();
-
-          //get base RF prediction
-          modelPredictiveControllerRF->runPredictionModel();
-          predictionsRF = modelPredictiveControllerRF->getPredictions();
+    //the models live for the whole run so the ensemble can learn weights
+    StateSpaceModel* stateSpaceModel = new StateSpaceModel();
+    //the estimator adapts online from each new reading; projections carry
+    //its trend while dosing keeps the configured sensitivity of 30
+    stateSpaceModel->setInitialSensitivity(30);
+    stateSpaceModel->setAdaptive(true);
+    //readings, doses and trajectories are committed in the background
+    HistoryStore* historyStore = new HistoryStore(
+            QDir::currentPath().toStdString()+"/AGS.sqlite");
+    if(!historyStore->open()){
+        delete historyStore;
+        historyStore = nullptr;
+    }
+    //retrained native RF and LSTM files are swapped in while running; each
+    //version gets its own projection cache, the state space model adapts
+    //every reading and is never cached
+    ModelRegistry* modelRegistry = new ModelRegistry();
+    modelRegistry->setHistoryStore(historyStore);
+    RandomForestModel* randomForestModel = new RandomForestModel();
+    randomForestModel->setHistoryStore(historyStore);
+    CompiledForestModel* compiledForestModel = new CompiledForestModel();
+    compiledForestModel->setHistoryStore(historyStore);
+    EnsembleModel* ensembleModel = new EnsembleModel();
+    ensembleModel->addModel(stateSpaceModel);
+    //a forest compiled into the binary needs no loading, otherwise the
+    //registry's RF handle joins whether or not a native forest has been
+    //trained yet, with the script answering for it until one loads
+    CachedModel* cachedRandomForest = nullptr;
+    if(CompiledForestModel::hasForest()){
+        cachedRandomForest = new CachedModel(compiledForestModel);
+        //the forests read only the first 6 BG values
+        cachedRandomForest->setBGInputWindow(6, false);
+        cachedRandomForest->getCache().setMetricsName("RF_compiled");
+        ensembleModel->addModel(cachedRandomForest);
+    }
+    else{
+        //the compact mapped forest is preferred when one has been written
+        string forestPath = QDir::currentPath().toStdString()+
+                            "/RandomForest/RandomForest";
+        int forestSlot = modelRegistry->addModel("RF",
+                QuantizedForest::isQuantizedFile(forestPath+".qforest") ?
+                    forestPath+".qforest" : forestPath+".forest",
+                ForestFile);
+        cachedRandomForest = new CachedModel(randomForestModel);
+        cachedRandomForest->setBGInputWindow(6, false);
+        cachedRandomForest->getCache().setMetricsName("RF");
+        modelRegistry->getHandle(forestSlot)->setFallback(cachedRandomForest);
+        ensembleModel->addModel(modelRegistry->getHandle(forestSlot));
+    }
+    //the LSTM handle returns nothing, and the fusion leaves it out, until
+    //its weights are exported
+    int lstmSlot = modelRegistry->addModel("LSTM",
+            QDir::currentPath().toStdString()+"/LSTM/LSTM.bin", LSTMFile);
+    ensembleModel->addModel(modelRegistry->getHandle(lstmSlot));
+    ensembleModel->setLearnWeights(true);
+    modelRegistry->start();
+    //shared by the MPC's Monte Carlo scenario evaluation
+    ThreadPool* scenarioPool = new ThreadPool();
 
-          //MPC SS Optimization
-          modelPredictiveControllerSS->calculateControlInput();
+    //pick up where the last run left off, saved again every cycle
+    StateSnapshot* stateSnapshot = new StateSnapshot(
+            QDir::currentPath().toStdString()+"/AGS.snapshot");
+    stateSnapshot->setDataQueue(dataQueue);
+    stateSnapshot->setStateSpaceModel(stateSpaceModel);
+    stateSnapshot->setEnsembleModel(ensembleModel);
+    if(stateSnapshot->load()){
+        LOG_INFO("Restored {} readings from snapshot",
+                 dataQueue->getQueueSize());
+    }
+    //otherwise fill the last 24 hours in one batched fetch
+    if(!dataQueue->getQueueSize()){
+        LOG_INFO("Backfilled {} readings", dataQueue->backfill(1));
+    }
 
+    //scraping and the MPC cycle run on their own thread so the window
+    //never waits on the Python scraper
+    ControlWorker* controlWorker = new ControlWorker(dataQueue);
+    controlWorker->setStateSpaceModel(stateSpaceModel);
+    controlWorker->setEnsembleModel(ensembleModel);
+    controlWorker->setScenarioPool(scenarioPool);
+    controlWorker->setStateSnapshot(stateSnapshot);
+    controlWorker->setHistoryStore(historyStore);
+    controlWorker->setControllerSettings(controllerSettings(argc, argv));
+    controlWorker->getCycleExecutor().setModelRegistry(modelRegistry);
+    QThread* controlThread = new QThread();
+    controlWorker->moveToThread(controlThread);
+    controlThread->start();
 
-          //MPC RF Optimization
-          modelPredictiveControllerRF->calculateControlInput();
+    MainWindow* mainWindow = new MainWindow(controlWorker);
+    mainWindow->show();
 
+    //240 seconds since Dexcom creates a new reading every 5 minutes. This
+    //ensures we usually don't query new data when there is none.
+    QTimer* cycleTimer = new QTimer();
+    QObject::connect(cycleTimer, SIGNAL(timeout()), controlWorker,
+                     SLOT(requestFetch()));
+    cycleTimer->start(240*1000);
+    controlWorker->requestFetch();
 
-          //delete objects
-          delete modelPredictiveControllerRF;
-          delete randomForestModel;
-          delete modelPredictiveControllerSS;
-          delete stateSpaceModel;
-      }
+    int exitCode = app.exec();
 
-      //wait 4 minutes until next bg reading is ready to rerun
-      std::thread th(&threadFunc);
-      th.join();
+    delete cycleTimer;
+    delete mainWindow;
+    controlThread->quit();
+    controlThread->wait();
+    delete controlThread;
+    delete controlWorker;
+    //no cycle runs the models any more, so the watcher can go first
+    modelRegistry->stop();
+    //commits whatever is still queued
+    delete historyStore;
+    delete stateSnapshot;
+    delete scenarioPool;
+    if(cachedRandomForest){
+        cachedRandomForest->getCache().printStats("RF");
     }
-    return 0;
+    modelRegistry->printStatus();
+    delete ensembleModel;
+    delete modelRegistry;
+    delete cachedRandomForest;
+    delete compiledForestModel;
+    delete randomForestModel;
+    delete stateSpaceModel;
+    delete dataQueue;
+    //writes the last dump, errors still reach the log
+    delete metricsServer;
+    //writes whatever is still queued
+    Logger::get().close();
+    return exitCode;
 }
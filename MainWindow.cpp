@@ -19,18 +19,58 @@
 
 #include "MainWindow.h"
 #include "ui_mainwindow.h"
+#include <QLayout>
+#include <QStatusBar>
 
-MainWindow::MainWindow(QWidget *parent) :
+/*-----------------------------------------------------------------------------
+Name:     MainWindow
+Purpose:  Constructor. The designer's bgTable is swapped for a view on a
+          BGTableModel with a fixed ring of readings, and the glucose chart
+          is placed beside it. Both are filled from the control worker's
+          snapshots, delivered on the GUI thread by a queued connection.
+Receive:  ControlWorker* controlWorker, not owned, on its own thread
+          QWidget *parent
+Return:   N/A
+-----------------------------------------------------------------------------*/
+MainWindow::MainWindow(ControlWorker *controlWorker, QWidget *parent) :
     QMainWindow(parent),
-    ui(new Ui::MainWindow)
+    ui(new Ui::MainWindow),
+    m_controlWorker(controlWorker)
 {
-    m_dataQueue = new DataQueue();
     ui->setupUi(this);
 
+    m_bgTableModel = new BGTableModel(288, this);
+    m_bgTableView = new QTableView(ui->bgTable->parentWidget());
+    m_bgTableView->setModel(m_bgTableModel);
+    QLayout* layout = ui->bgTable->parentWidget()->layout();
+    if(layout){
+        layout->replaceWidget(ui->bgTable, m_bgTableView);
+    }
+    else{
+        m_bgTableView->setGeometry(ui->bgTable->geometry());
+    }
+    m_bgTableView->show();
+
+    m_glucoseChart = new GlucoseChartWidget(ui->bgTable->parentWidget());
+    if(layout){
+        layout->addWidget(m_glucoseChart);
+    }
+    else{
+        QRect tableGeometry = ui->bgTable->geometry();
+        m_glucoseChart->setGeometry(tableGeometry.right()+8,
+                                    tableGeometry.top(), 480,
+                                    tableGeometry.height());
+    }
+    m_glucoseChart->show();
+    delete ui->bgTable;
+    ui->bgTable = nullptr;
+
     connect(ui->queryBG, SIGNAL(clicked()), ui->queryBG,
             SLOT(beenClicked()));
     connect(ui->queryBG, SIGNAL(iChanged(QObject*)), this,
             SLOT(actOnChange(QObject*)));
+    connect(m_controlWorker, SIGNAL(cycleFinished(CycleSnapshotPtr)), this,
+            SLOT(showCycle(CycleSnapshotPtr)));
 
 }
 
@@ -43,7 +83,6 @@ Return:   N/A
 MainWindow::~MainWindow()
 {
     delete ui;
-    delete m_dataQueue;
 }
 
 /*-----------------------------------------------------------------------------
@@ -56,34 +95,45 @@ Return:   N/A
 void MainWindow::actOnChange(QObject * obj)
 {
     if(obj==ui->queryBG){
-          m_dataQueue->scrapeData();
-
-          BGDataEntry* currentBG =
-                  m_dataQueue->getFirstBGEntry();
-          QString bgString =
-                  QString::number(currentBG->getValue());
-          QString trendString =
-                  QString::number(currentBG->getTrend());
-          QString sampleTimeString =
-                  QString::number(currentBG->getSampleTime());
-          QString delayTimeString =
-                  QString::number(currentBG->getDelayTime());
-          //create new table item and fill fields
-          QTableWidgetItem *value = new QTableWidgetItem;
-          value->setText(bgString);
-          QTableWidgetItem *trend = new QTableWidgetItem;
-          trend->setText(trendString);
-          QTableWidgetItem *sample = new QTableWidgetItem;
-          sample->setText(sampleTimeString);
-          QTableWidgetItem *delay = new QTableWidgetItem;
-          delay->setText(delayTimeString);
-          //add to table
-          int insertIndex = (ui->bgTable->rowCount());
-          ui->bgTable->insertRow(insertIndex);
-          ui->bgTable->setItem(insertIndex,0, value);
-          ui->bgTable->setItem(insertIndex,1, trend);
-          ui->bgTable->setItem(insertIndex,2, sample);
-          ui->bgTable->setItem(insertIndex,3, delay);
+          //returns at once, a click during a fetch joins that fetch
+          m_controlWorker->requestFetch();
+    }
+}
 
+/*-----------------------------------------------------------------------------
+Name:     showCycle
+Purpose:  Shows what a control cycle published: new readings in the table
+          and chart, the predicted trajectory and the chosen doses, and
+          the cycle's recommendation in the status bar.
+Receive:  CycleSnapshotPtr snapshot
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void MainWindow::showCycle(CycleSnapshotPtr snapshot)
+{
+    if(snapshot->readings.size()){
+        m_bgTableModel->appendReadings(snapshot->readings);
+        m_bgTableView->scrollToBottom();
+    }
+    for(int i=0; i<snapshot->readings.size(); i++){
+        m_glucoseChart->addReading(snapshot->readings[i].sampleTime,
+                                   snapshot->readings[i].value);
+    }
+    if(snapshot->predictions.size()){
+        m_glucoseChart->addPrediction(snapshot->predictionTime,
+                                      snapshot->predictions);
+        QString recommendation = "Recommended bolus: "+
+                                 QString::number(snapshot->bolus, 'f', 1)+
+                                 " U";
+        if(snapshot->tempBasalMinutes>0){
+            recommendation = recommendation+", temp basal: "+
+                    QString::number(snapshot->tempBasalRate, 'f', 1)+
+                    " U/h for "+QString::number(snapshot->tempBasalMinutes)+
+                    " min";
+        }
+        statusBar()->showMessage(recommendation);
+    }
+    for(int i=0; i<snapshot->doses.size(); i++){
+        m_glucoseChart->addDose(snapshot->doses[i].sampleTime,
+                                snapshot->doses[i].units);
     }
 }
@@ -21,7 +21,10 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
-#include "DataQueue.h"
+#include <QTableView>
+#include "ControlWorker.h"
+#include "BGTableModel.h"
+#include "GlucoseChartWidget.h"
 
 namespace Ui {
 class MainWindow;
@@ -32,15 +35,20 @@ class MainWindow : public QMainWindow
     Q_OBJECT
 
 public:
-    explicit MainWindow(QWidget *parent = nullptr);
+    explicit MainWindow(ControlWorker* controlWorker,
+                        QWidget *parent = nullptr);
     ~MainWindow();
 
 private:
     Ui::MainWindow *ui;
-    DataQueue* m_dataQueue;
+    ControlWorker* m_controlWorker;
+    BGTableModel* m_bgTableModel;
+    QTableView* m_bgTableView;
+    GlucoseChartWidget* m_glucoseChart;
 
 private slots:
     void actOnChange(QObject*);
+    void showCycle(CycleSnapshotPtr snapshot);
 
 };
 
@@ -0,0 +1,400 @@
+/******************************************************************************
+** FILE: MetricsRegistry.cpp
+**
+** ABSTRACT:
+** Process wide registry of counters, gauges and histograms.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+**
+******************************************************************************/
+
+#include "MetricsRegistry.h"
+#include "Logger.h"
+#include <stdio.h>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    const char* const kTypeNames[] = {"counter", "gauge", "histogram"};
+
+    uint64_t toBits(double value)
+    {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    double fromBits(uint64_t bits)
+    {
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    string formatValue(double value)
+    {
+        char text[32];
+        snprintf(text, sizeof(text), "%.10g", value);
+        return text;
+    }
+
+    //name{labels} or name{labels,extra}, without braces when both are empty
+    string seriesName(const string& name, const string& labels,
+                      const string& extra = "")
+    {
+        string all = labels;
+        if(!extra.empty()){
+            all += (all.empty() ? "" : ",")+extra;
+        }
+        return all.empty() ? name : name+"{"+all+"}";
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     MetricCounter
+Purpose:  Constructor.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+MetricCounter::MetricCounter() :
+    m_value(0)
+{
+}
+
+/*-----------------------------------------------------------------------------
+Name:     add
+Purpose:  Increases the counter.
+Receive:  uint64_t amount
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void MetricCounter::add(uint64_t amount)
+{
+    m_value.fetch_add(amount, std::memory_order_relaxed);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     get
+Purpose:  Returns the count.
+Receive:  N/A
+Return:   uint64_t
+-----------------------------------------------------------------------------*/
+uint64_t MetricCounter::get() const
+{
+    return m_value.load(std::memory_order_relaxed);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     MetricGauge
+Purpose:  Constructor. Starts at 0.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+MetricGauge::MetricGauge() :
+    m_bits(toBits(0.0))
+{
+}
+
+/*-----------------------------------------------------------------------------
+Name:     set
+Purpose:  Sets the gauge.
+Receive:  double value
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void MetricGauge::set(double value)
+{
+    m_bits.store(toBits(value), std::memory_order_relaxed);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     add
+Purpose:  Adds to the gauge, retrying if another thread changed it first.
+Receive:  double amount
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void MetricGauge::add(double amount)
+{
+    uint64_t bits = m_bits.load(std::memory_order_relaxed);
+    while(!m_bits.compare_exchange_weak(bits, toBits(fromBits(bits)+amount),
+                                        std::memory_order_relaxed)){
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     get
+Purpose:  Returns the gauge's value.
+Receive:  N/A
+Return:   double
+-----------------------------------------------------------------------------*/
+double MetricGauge::get() const
+{
+    return fromBits(m_bits.load(std::memory_order_relaxed));
+}
+
+/*-----------------------------------------------------------------------------
+Name:     MetricHistogram
+Purpose:  Constructor.
+Receive:  const vector<double>& bounds, bucket upper bounds, sorted here
+Return:   N/A
+-----------------------------------------------------------------------------*/
+MetricHistogram::MetricHistogram(const vector<double> &bounds) :
+    m_bounds(bounds),
+    m_buckets(new std::atomic<uint64_t>[bounds.size()+1]),
+    m_count(0)
+{
+    std::sort(m_bounds.begin(), m_bounds.end());
+    for(int i=0; i<=m_bounds.size(); i++){
+        m_buckets[i] = 0;
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     observe
+Purpose:  Counts a value in the first bucket whose bound it doesn't exceed.
+Receive:  double value
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void MetricHistogram::observe(double value)
+{
+    int bucket = std::lower_bound(m_bounds.begin(), m_bounds.end(), value)-
+                 m_bounds.begin();
+    m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.add(value);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getBounds
+Purpose:  Returns the bucket upper bounds, without +Inf.
+Receive:  N/A
+Return:   const vector<double>&
+-----------------------------------------------------------------------------*/
+const vector<double>& MetricHistogram::getBounds() const
+{
+    return m_bounds;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getBucket
+Purpose:  Returns one bucket's count, not cumulative. Bucket
+          getBounds().size() is +Inf.
+Receive:  int bucket
+Return:   uint64_t
+-----------------------------------------------------------------------------*/
+uint64_t MetricHistogram::getBucket(int bucket) const
+{
+    return m_buckets[bucket].load(std::memory_order_relaxed);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getCount
+Purpose:  Returns how many values have been observed.
+Receive:  N/A
+Return:   uint64_t
+-----------------------------------------------------------------------------*/
+uint64_t MetricHistogram::getCount() const
+{
+    return m_count.load(std::memory_order_relaxed);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getSum
+Purpose:  Returns the sum of the observed values.
+Receive:  N/A
+Return:   double
+-----------------------------------------------------------------------------*/
+double MetricHistogram::getSum() const
+{
+    return m_sum.get();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     get
+Purpose:  Returns the process' registry.
+Receive:  N/A
+Return:   MetricsRegistry&
+-----------------------------------------------------------------------------*/
+MetricsRegistry& MetricsRegistry::get()
+{
+    static MetricsRegistry registry;
+    return registry;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     latencyBucketsMs
+Purpose:  Returns bucket bounds covering 1 ms to the 60 s stage budgets.
+Receive:  N/A
+Return:   vector<double>
+-----------------------------------------------------------------------------*/
+vector<double> MetricsRegistry::latencyBucketsMs()
+{
+    return {1.0, 2.5, 5.0, 10.0, 25.0, 50.0, 100.0, 250.0, 500.0, 1000.0,
+            2500.0, 5000.0, 10000.0, 30000.0, 60000.0};
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getSeries
+Purpose:  Finds or adds the metric for a name and label set. A name already
+          registered as another type gets a metric that works but is never
+          rendered.
+Receive:  const string& name, const string& help, const string& labels,
+          MetricType type
+Return:   Series&, with the metric for type not yet created if new
+-----------------------------------------------------------------------------*/
+MetricsRegistry::Series& MetricsRegistry::getSeries(const string &name,
+                                                    const string &help,
+                                                    const string &labels,
+                                                    MetricType type)
+{
+    auto found = m_families.find(name);
+    if(found==m_families.end()){
+        found = m_families.emplace(name, Family()).first;
+        found->second.type = type;
+        found->second.help = help;
+    }
+    else if(found->second.type!=type){
+        LOG_ERROR("Metric {} is already a {}", name,
+                  kTypeNames[found->second.type]);
+        m_orphans.emplace_back();
+        return m_orphans.back();
+    }
+    return found->second.series[labels];
+}
+
+/*-----------------------------------------------------------------------------
+Name:     counter
+Purpose:  Returns the counter for a name and label set, adding it if new.
+Receive:  const string& name, const string& help,
+          const string& labels formatted as name="value",...
+Return:   MetricCounter&
+-----------------------------------------------------------------------------*/
+MetricCounter& MetricsRegistry::counter(const string &name,
+                                        const string &help,
+                                        const string &labels)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Series& series = getSeries(name, help, labels, CounterMetric);
+    if(!series.counter){
+        series.counter.reset(new MetricCounter());
+    }
+    return *series.counter;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     gauge
+Purpose:  Returns the gauge for a name and label set, adding it if new.
+Receive:  const string& name, const string& help,
+          const string& labels formatted as name="value",...
+Return:   MetricGauge&
+-----------------------------------------------------------------------------*/
+MetricGauge& MetricsRegistry::gauge(const string &name, const string &help,
+                                    const string &labels)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Series& series = getSeries(name, help, labels, GaugeMetric);
+    if(!series.gauge){
+        series.gauge.reset(new MetricGauge());
+    }
+    return *series.gauge;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     histogram
+Purpose:  Returns the histogram for a name and label set, adding it with
+          the given buckets if new.
+Receive:  const string& name, const string& help,
+          const vector<double>& bounds, bucket upper bounds,
+          const string& labels formatted as name="value",...
+Return:   MetricHistogram&
+-----------------------------------------------------------------------------*/
+MetricHistogram& MetricsRegistry::histogram(const string &name,
+                                            const string &help,
+                                            const vector<double> &bounds,
+                                            const string &labels)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Series& series = getSeries(name, help, labels, HistogramMetric);
+    if(!series.histogram){
+        series.histogram.reset(new MetricHistogram(bounds));
+    }
+    return *series.histogram;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     countSubprocess
+Purpose:  Counts a run of a helper process (scraper, RF script) and whether
+          it failed to start or exited with an error. Looks the counters up
+          each time, which is nothing next to starting a process.
+Receive:  const string& command, label for the process
+          bool failed
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void MetricsRegistry::countSubprocess(const string &command, bool failed)
+{
+    string label = "command=\""+command+"\"";
+    counter("ags_subprocess_runs_total", "Helper processes started",
+            label).add();
+    if(failed){
+        counter("ags_subprocess_failures_total",
+                "Helper processes that failed to start or exited with an "
+                "error", label).add();
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     render
+Purpose:  Writes every metric in the Prometheus text exposition format,
+          families sorted by name. Values are read with relaxed loads, so a
+          histogram's buckets, sum and count can be a few observations
+          apart.
+Receive:  N/A
+Return:   string
+-----------------------------------------------------------------------------*/
+string MetricsRegistry::render() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    string text;
+    for(const auto& family : m_families){
+        const string& name = family.first;
+        text += "# HELP "+name+" "+family.second.help+"\n";
+        text += "# TYPE "+name+" "+kTypeNames[family.second.type]+"\n";
+        for(const auto& entry : family.second.series){
+            const string& labels = entry.first;
+            const Series& series = entry.second;
+            if(series.counter){
+                text += seriesName(name, labels)+" "+
+                        std::to_string(series.counter->get())+"\n";
+            }
+            else if(series.gauge){
+                text += seriesName(name, labels)+" "+
+                        formatValue(series.gauge->get())+"\n";
+            }
+            else if(series.histogram){
+                const MetricHistogram& histogram = *series.histogram;
+                const vector<double>& bounds = histogram.getBounds();
+                uint64_t cumulative = 0;
+                for(int i=0; i<=bounds.size(); i++){
+                    cumulative += histogram.getBucket(i);
+                    string bound = i<bounds.size() ?
+                                   formatValue(bounds[i]) : "+Inf";
+                    text += seriesName(name+"_bucket", labels,
+                                       "le=\""+bound+"\"")+" "+
+                            std::to_string(cumulative)+"\n";
+                }
+                text += seriesName(name+"_sum", labels)+" "+
+                        formatValue(histogram.getSum())+"\n";
+                text += seriesName(name+"_count", labels)+" "+
+                        std::to_string(cumulative)+"\n";
+            }
+        }
+    }
+    return text;
+}
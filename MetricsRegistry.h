@@ -0,0 +1,148 @@
+/******************************************************************************
+** FILE: MetricsRegistry.h
+**
+** ABSTRACT:
+** Process wide registry of counters, gauges and histograms
+** for runtime visibility into the controller: cycles and
+** stage latencies, model calls, cache hit rates, queue
+** sizes and subprocess failures. Updating a metric is a
+** relaxed atomic operation, so instrumented code on the
+** control and pool threads never takes a lock; render
+** writes every metric in the Prometheus text format for
+** MetricsServer.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** Metrics are looked up once, by name and label set, and
+** the returned reference is kept (usually in a function
+** local static); they live until the process exits. The
+** same name and labels always give the same metric.
+** Labels are passed already formatted, e.g. model="RF".
+** Histogram buckets are fixed when the histogram is first
+** registered; percentiles come from the buckets, e.g. with
+** Prometheus' histogram_quantile.
+**
+******************************************************************************/
+
+#ifndef METRICSREGISTRY_H
+#define METRICSREGISTRY_H
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+class MetricCounter
+{
+protected:
+    std::atomic<uint64_t> m_value;
+
+public:
+    MetricCounter();
+
+    void add(uint64_t amount = 1);
+    uint64_t get() const;
+};
+
+class MetricGauge
+{
+protected:
+    //the double's bits, atomic<double> has no fetch_add before C++20
+    std::atomic<uint64_t> m_bits;
+
+public:
+    MetricGauge();
+
+    void set(double value);
+    void add(double amount);
+    double get() const;
+};
+
+class MetricHistogram
+{
+protected:
+    //upper bounds in increasing order, +Inf is implied
+    vector<double> m_bounds;
+    //per bucket counts, not cumulative, the last one is +Inf
+    std::unique_ptr<std::atomic<uint64_t>[]> m_buckets;
+    std::atomic<uint64_t> m_count;
+    MetricGauge m_sum;
+
+public:
+    explicit MetricHistogram(const vector<double>& bounds);
+
+    void observe(double value);
+    const vector<double>& getBounds() const;
+    uint64_t getBucket(int bucket) const;
+    uint64_t getCount() const;
+    double getSum() const;
+};
+
+enum MetricType
+{
+    CounterMetric = 0,
+    GaugeMetric,
+    HistogramMetric
+};
+
+class MetricsRegistry
+{
+protected:
+    struct Series
+    {
+        std::unique_ptr<MetricCounter> counter;
+        std::unique_ptr<MetricGauge> gauge;
+        std::unique_ptr<MetricHistogram> histogram;
+    };
+
+    struct Family
+    {
+        MetricType type = CounterMetric;
+        string help;
+        //by label set
+        std::map<string, Series> series;
+    };
+
+    mutable std::mutex m_mutex;
+    std::map<string, Family> m_families;
+    //metrics whose name was already taken by another type, never rendered
+    vector<Series> m_orphans;
+
+    MetricsRegistry() = default;
+    Series& getSeries(const string& name, const string& help,
+                      const string& labels, MetricType type);
+
+public:
+    ~MetricsRegistry() = default;
+    MetricsRegistry(const MetricsRegistry&) = delete;
+    MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+    static MetricsRegistry& get();
+    static vector<double> latencyBucketsMs();
+
+    MetricCounter& counter(const string& name, const string& help,
+                           const string& labels = "");
+    MetricGauge& gauge(const string& name, const string& help,
+                       const string& labels = "");
+    MetricHistogram& histogram(const string& name, const string& help,
+                               const vector<double>& bounds,
+                               const string& labels = "");
+
+    void countSubprocess(const string& command, bool failed);
+    string render() const;
+};
+
+#endif // METRICSREGISTRY_H
@@ -0,0 +1,297 @@
+/******************************************************************************
+** FILE: MetricsServer.cpp
+**
+** ABSTRACT:
+** Serves the MetricsRegistry on a Unix domain socket and
+** dumps it to a file.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+**
+******************************************************************************/
+
+#include "MetricsServer.h"
+#include "MetricsRegistry.h"
+#include "Logger.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+
+namespace {
+    //how long stop can take while waiting on the socket
+    const int kPollMs = 250;
+    //how long a client gets to send its request before the bare text
+    const int kRequestWaitMs = 100;
+    const char* const kContentType = "text/plain; version=0.0.4";
+
+    bool sendAll(int socket, const string& text)
+    {
+        size_t sent = 0;
+        while(sent<text.size()){
+            ssize_t result = send(socket, text.data()+sent, text.size()-sent,
+                                  MSG_NOSIGNAL);
+            if(result<0){
+                return false;
+            }
+            sent += result;
+        }
+        return true;
+    }
+
+    //the registry's text, with the logger's own counts brought up to date
+    string renderMetrics()
+    {
+        static MetricGauge& written = MetricsRegistry::get().gauge(
+                "ags_log_records_written", "Log records written to file");
+        static MetricGauge& dropped = MetricsRegistry::get().gauge(
+                "ags_log_records_dropped", "Log records dropped, ring full");
+        written.set(Logger::get().getWrittenCount());
+        dropped.set(Logger::get().getDroppedCount());
+        return MetricsRegistry::get().render();
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     ~MetricsServer
+Purpose:  Destructor. Stops the server.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+MetricsServer::~MetricsServer()
+{
+    stop();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setSocketPath
+Purpose:  Sets the Unix domain socket to serve on, empty for none. Call
+          before start.
+Receive:  const string& socketPath
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void MetricsServer::setSocketPath(const string &socketPath)
+{
+    m_socketPath = socketPath;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setDumpPath
+Purpose:  Sets the file the metrics are dumped to, empty for none. Call
+          before start.
+Receive:  const string& dumpPath
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void MetricsServer::setDumpPath(const string &dumpPath)
+{
+    m_dumpPath = dumpPath;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setDumpIntervalMs
+Purpose:  Sets how often the dump file is rewritten. Call before start.
+Receive:  int dumpIntervalMs
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void MetricsServer::setDumpIntervalMs(int dumpIntervalMs)
+{
+    m_dumpIntervalMs = dumpIntervalMs;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     openSocket
+Purpose:  Creates the listening socket, replacing a stale one left by an
+          earlier run.
+Receive:  N/A
+Return:   bool
+-----------------------------------------------------------------------------*/
+bool MetricsServer::openSocket()
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(m_socketPath.size()>=sizeof(address.sun_path)){
+        LOG_ERROR("Metrics socket path too long: {}", m_socketPath);
+        return false;
+    }
+    strcpy(address.sun_path, m_socketPath.c_str());
+    m_listener = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+    if(m_listener<0){
+        LOG_ERROR("Couldn't create metrics socket: {}", strerror(errno));
+        return false;
+    }
+    unlink(m_socketPath.c_str());
+    //owner only, the socket is created with the umask's permissions
+    mode_t mask = umask(0077);
+    bool bound = bind(m_listener, (sockaddr*)&address, sizeof(address))==0;
+    umask(mask);
+    if(!bound || listen(m_listener, 4)!=0){
+        LOG_ERROR("Couldn't listen on metrics socket {}: {}", m_socketPath,
+                  strerror(errno));
+        close(m_listener);
+        m_listener = -1;
+        return false;
+    }
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     serveClient
+Purpose:  Answers one connection with the rendered metrics, as an HTTP
+          response if the client sent a GET.
+Receive:  int client, closed here
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void MetricsServer::serveClient(int client) const
+{
+    char request[4096];
+    ssize_t received = 0;
+    pollfd readable = {client, POLLIN, 0};
+    if(poll(&readable, 1, kRequestWaitMs)>0){
+        received = recv(client, request, sizeof(request), 0);
+    }
+    string body = renderMetrics();
+    if(received>=4 && strncmp(request, "GET ", 4)==0){
+        sendAll(client, "HTTP/1.0 200 OK\r\nContent-Type: "+
+                        string(kContentType)+"\r\nContent-Length: "+
+                        std::to_string(body.size())+
+                        "\r\nConnection: close\r\n\r\n");
+    }
+    sendAll(client, body);
+    close(client);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     dump
+Purpose:  Writes the rendered metrics beside the dump path and renames the
+          file over it.
+Receive:  N/A
+Return:   bool
+-----------------------------------------------------------------------------*/
+bool MetricsServer::dump() const
+{
+    string temporaryPath = m_dumpPath+".tmp";
+    FILE* file = fopen(temporaryPath.c_str(), "w");
+    if(!file){
+        LOG_ERROR("Couldn't write metrics {}", temporaryPath);
+        return false;
+    }
+    string text = renderMetrics();
+    bool written = fwrite(text.data(), 1, text.size(), file)==text.size();
+    if(fclose(file)!=0 || !written ||
+       rename(temporaryPath.c_str(), m_dumpPath.c_str())!=0){
+        LOG_ERROR("Couldn't write metrics {}", m_dumpPath);
+        unlink(temporaryPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     start
+Purpose:  Opens the socket, if one is set, and starts the server thread.
+Receive:  N/A
+Return:   bool false if the socket couldn't be opened, the dump still runs
+-----------------------------------------------------------------------------*/
+bool MetricsServer::start()
+{
+    if(m_server.joinable()){
+        return true;
+    }
+    bool listening = m_socketPath.empty() || openSocket();
+    if(m_listener<0 && m_dumpPath.empty()){
+        return false;
+    }
+    m_stopping = false;
+    m_server = std::thread(&MetricsServer::serverLoop, this);
+    return listening;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     stop
+Purpose:  Stops the server thread, writes a last dump and removes the
+          socket.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void MetricsServer::stop()
+{
+    if(m_server.joinable()){
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_one();
+        m_server.join();
+    }
+    if(m_listener>=0){
+        close(m_listener);
+        m_listener = -1;
+        unlink(m_socketPath.c_str());
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     serverLoop
+Purpose:  Body of the server thread. Answers connections as they arrive and
+          rewrites the dump file every interval, checking for stop at
+          least every kPollMs.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void MetricsServer::serverLoop()
+{
+    auto nextDump = std::chrono::steady_clock::now();
+    while(true){
+        auto now = std::chrono::steady_clock::now();
+        if(!m_dumpPath.empty() && now>=nextDump){
+            dump();
+            nextDump = now+std::chrono::milliseconds(m_dumpIntervalMs);
+        }
+        int waitMs = kPollMs;
+        if(!m_dumpPath.empty()){
+            waitMs = std::min<long long>(waitMs,
+                    std::chrono::duration_cast<std::chrono::milliseconds>(
+                        nextDump-now).count()+1);
+        }
+        if(m_listener>=0){
+            pollfd readable = {m_listener, POLLIN, 0};
+            if(poll(&readable, 1, waitMs)>0){
+                int client = accept4(m_listener, nullptr, nullptr,
+                                     SOCK_CLOEXEC);
+                if(client>=0){
+                    serveClient(client);
+                }
+            }
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if(m_stopping){
+                break;
+            }
+        }
+        else{
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if(m_wake.wait_for(lock, std::chrono::milliseconds(waitMs),
+                               [this](){ return m_stopping; })){
+                break;
+            }
+        }
+    }
+    if(!m_dumpPath.empty()){
+        dump();
+    }
+}
@@ -0,0 +1,71 @@
+/******************************************************************************
+** FILE: MetricsServer.h
+**
+** ABSTRACT:
+** Serves the MetricsRegistry in the Prometheus text format
+** on a local Unix domain socket and/or dumps it to a file
+** at a fixed interval, from its own thread so the control
+** thread never waits on a scrape.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** A client that sends an HTTP GET (curl --unix-socket) gets
+** an HTTP response; one that sends nothing within a short
+** wait (socat, nc -U) gets the bare text. The socket is
+** created owner only. The dump file is written beside its
+** path and renamed over it, for node_exporter's textfile
+** collector or anyone reading it, so it is never seen half
+** written.
+**
+******************************************************************************/
+
+#ifndef METRICSSERVER_H
+#define METRICSSERVER_H
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+using std::string;
+
+class MetricsServer
+{
+protected:
+    string m_socketPath;
+    int m_listener = -1;
+    string m_dumpPath;
+    int m_dumpIntervalMs = 60000;
+
+    std::thread m_server;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_stopping = false;
+
+    bool openSocket();
+    void serveClient(int client) const;
+    bool dump() const;
+    void serverLoop();
+
+public:
+    MetricsServer() = default;
+    ~MetricsServer();
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    void setSocketPath(const string& socketPath);
+    void setDumpPath(const string& dumpPath);
+    void setDumpIntervalMs(int dumpIntervalMs);
+
+    bool start();
+    void stop();
+};
+
+#endif // METRICSSERVER_H
@@ -0,0 +1,135 @@
+/******************************************************************************
+** FILE: MinMaxPyramid.cpp
+**
+** ABSTRACT:
+** Append-only series with a pyramid of min/max levels,
+** each level halving the one below. Any index range's
+** min and max come from O(log n) pyramid entries so a
+** chart can draw months of readings with one query per
+** pixel column.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+**
+******************************************************************************/
+
+#include "MinMaxPyramid.h"
+#include <algorithm>
+
+/*-----------------------------------------------------------------------------
+Name:     getSize
+Purpose:  Returns the number of values appended.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int MinMaxPyramid::getSize() const
+{
+    return m_minimums.size() ? m_minimums[0].size() : 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getValue
+Purpose:  Returns the i-th value appended.
+Receive:  int i
+Return:   float
+-----------------------------------------------------------------------------*/
+float MinMaxPyramid::getValue(int i) const
+{
+    return m_minimums[0][i];
+}
+
+/*-----------------------------------------------------------------------------
+Name:     append
+Purpose:  Adds a value and every pyramid entry it completes.
+Receive:  float value
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void MinMaxPyramid::append(float value)
+{
+    float minimum = value;
+    float maximum = value;
+    for(int level=0; ; level++){
+        if(level==m_minimums.size()){
+            m_minimums.push_back(vector<float>());
+            m_maximums.push_back(vector<float>());
+        }
+        vector<float>& minimums = m_minimums[level];
+        vector<float>& maximums = m_maximums[level];
+        minimums.push_back(minimum);
+        //level 0 keeps only the series, its max is the same value
+        if(level){
+            maximums.push_back(maximum);
+        }
+        int size = minimums.size();
+        if(size%2){
+            break;
+        }
+        minimum = std::min(minimums[size-2], minimums[size-1]);
+        maximum = level ? std::max(maximums[size-2], maximums[size-1]) :
+                          std::max(minimums[size-2], minimums[size-1]);
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     clear
+Purpose:  Removes every value.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void MinMaxPyramid::clear()
+{
+    m_minimums.clear();
+    m_maximums.clear();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     range
+Purpose:  Finds the min and max of values [begin, end) by climbing the
+          pyramid, taking an entry at each level only where the range edge
+          is not aligned to the level above.
+Receive:  int begin, int end
+          float& minimum, float& maximum filled in
+Return:   bool false if the range is empty
+-----------------------------------------------------------------------------*/
+bool MinMaxPyramid::range(int begin, int end, float &minimum,
+                          float &maximum) const
+{
+    begin = std::max(begin, 0);
+    end = std::min(end, getSize());
+    if(begin>=end){
+        return false;
+    }
+    bool found = false;
+    for(int level=0; begin<end; level++){
+        const vector<float>& minimums = m_minimums[level];
+        const vector<float>& maximums = level ? m_maximums[level] :
+                                                m_minimums[level];
+        if(begin%2){
+            minimum = found ? std::min(minimum, minimums[begin]) :
+                              minimums[begin];
+            maximum = found ? std::max(maximum, maximums[begin]) :
+                              maximums[begin];
+            found = true;
+            begin++;
+        }
+        if(end%2 && begin<end){
+            end--;
+            minimum = found ? std::min(minimum, minimums[end]) :
+                              minimums[end];
+            maximum = found ? std::max(maximum, maximums[end]) :
+                              maximums[end];
+            found = true;
+        }
+        begin /= 2;
+        end /= 2;
+    }
+    return found;
+}
@@ -0,0 +1,51 @@
+/******************************************************************************
+** FILE: MinMaxPyramid.h
+**
+** ABSTRACT:
+** Append-only series with a pyramid of min/max levels,
+** each level halving the one below. Any index range's
+** min and max come from O(log n) pyramid entries so a
+** chart can draw months of readings with one query per
+** pixel column.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** Entry i of level l covers values [i*2^l, (i+1)*2^l).
+** Only complete entries are stored, so appending one
+** value does amortized O(1) work.
+**
+******************************************************************************/
+
+#ifndef MINMAXPYRAMID_H
+#define MINMAXPYRAMID_H
+
+#include <vector>
+using std::vector;
+
+class MinMaxPyramid
+{
+protected:
+    //level 0 is the series itself, min and max are the same
+    vector<vector<float>> m_minimums;
+    vector<vector<float>> m_maximums;
+
+public:
+    MinMaxPyramid() = default;
+    ~MinMaxPyramid() = default;
+
+    int getSize() const;
+    float getValue(int i) const;
+    void append(float value);
+    void clear();
+    bool range(int begin, int end, float& minimum, float& maximum) const;
+};
+
+#endif // MINMAXPYRAMID_H
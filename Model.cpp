@@ -21,7 +21,7 @@
 ******************************************************************************/
 
 #include "Model.h"
-#include <iostream>
+#include "Logger.h"
 
 /*-----------------------------------------------------------------------------
 Name:     predict
@@ -35,7 +35,7 @@ vector<double> Model::predict(vector<int> bgInputs,
                               vector<float> insulinInputs,
                               bool saveFlag)
 {
-    std::cout<<"predicting base"<<std::endl;
+    LOG_DEBUG("predicting base");
 }
 
 /*-----------------------------------------------------------------------------
@@ -50,5 +50,43 @@ vector<double> Model::projectCorrection(vector<double> bgInputs,
                                         vector<float> insulinInputs,
                                         int sensitivity)
 {
-     std::cout<<"predicting base"<<std::endl;
+     LOG_DEBUG("predicting base");
+}
+
+/*-----------------------------------------------------------------------------
+Name:     projectCorrections
+Purpose:  Runs a batch of hypothetical insulin control inputs through the
+          model and gives the projected BG output for each of them. The base
+          implementation simply calls projectCorrection once per candidate,
+          models that can evaluate the whole batch in one pass override it.
+Receive:  bgInputs for the model, insulinInputs holds one future insulin
+          curve per control input candidate, sensitivity is constant
+          representing the impact of 1 unit of insulin on blood glucose.
+Return:   vector<vector<double>> predictions for future BG, one trajectory
+          per candidate aligned with insulinInputs by index
+-----------------------------------------------------------------------------*/
+vector<vector<double>> Model::projectCorrections(
+                                const vector<double>& bgInputs,
+                                const vector<vector<float>>& insulinInputs,
+                                int sensitivity)
+{
+    vector<vector<double>> results;
+    for(int i=0; i<insulinInputs.size(); i++){
+        results.push_back(projectCorrection(bgInputs, insulinInputs[i],
+                                            sensitivity));
+    }
+    return results;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     savePrediction
+Purpose:  Saves a prediction the way predict does with the save flag set,
+          without running the model, so a cached prediction can still be
+          saved. The base model saves nothing.
+Receive:  const vector<double>& bgPredictions
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void Model::savePrediction(const vector<double> &bgPredictions) const
+{
+    (void)bgPredictions;
 }
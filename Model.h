@@ -38,6 +38,11 @@ public:
     virtual vector<double> projectCorrection(vector<double> bgInputs,
                                              vector<float> insulinInputs,
                                              int sensitivity);
+    virtual vector<vector<double>> projectCorrections(
+                                const vector<double>& bgInputs,
+                                const vector<vector<float>>& insulinInputs,
+                                int sensitivity);
+    virtual void savePrediction(const vector<double>& bgPredictions) const;
 };
 
 #endif // MODEL_H
@@ -22,14 +22,172 @@
 ******************************************************************************/
 
 #include "ModelPredictiveController.h"
+#include "InsulinKinetics.h"
+#include "ThreadPool.h"
+#include "Logger.h"
+#include "MetricsRegistry.h"
 #include <QFile>
 #include <QTextStream>
 #include <string>
 using std::string;
 #include <QDir>
-#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <limits>
 #include <math.h>
 
+namespace
+{
+//branch and bound over the dose of each move of a control horizon plan
+struct PlanSearch
+{
+    const vector<vector<double>>* bg;
+    int candidates;
+    int moves;
+    int spacing;
+    int horizon;
+    double target;
+    double bestCost = std::numeric_limits<double>::infinity();
+    //best cost of any subtree, so subtrees prune each other
+    std::atomic<double>* sharedCost = nullptr;
+    //most any later move can raise BG at each step, usually 0
+    const vector<vector<double>>* riseAfter = nullptr;
+    vector<int> bestPlan;
+    vector<double> bestTrajectory;
+    //per move scratch so the search doesn't allocate
+    vector<vector<double>> trajectories;
+    vector<vector<double>> segmentCosts;
+    vector<vector<int>> orders;
+
+    double bound() const;
+    void improve(double cost);
+    void search(int move, const vector<double>& trajectory, double cost,
+                vector<int>& plan);
+};
+
+/*-----------------------------------------------------------------------------
+Name:     bound
+Purpose:  Returns the cost a plan has to beat, this subtree's best or any
+          other's.
+Receive:  N/A
+Return:   double
+-----------------------------------------------------------------------------*/
+double PlanSearch::bound() const
+{
+    return std::min(bestCost, sharedCost->load(std::memory_order_relaxed));
+}
+
+/*-----------------------------------------------------------------------------
+Name:     improve
+Purpose:  Records a new best cost for this subtree and publishes it to the
+          others.
+Receive:  double cost
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void PlanSearch::improve(double cost)
+{
+    bestCost = cost;
+    double shared = sharedCost->load(std::memory_order_relaxed);
+    while(cost<shared &&
+          !sharedCost->compare_exchange_weak(shared, cost,
+                                             std::memory_order_relaxed)){
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     search
+Purpose:  Tries every dose for one move on top of the trajectory the earlier
+          moves give. Later moves can't change BG before they start, so the
+          cost up to the next move is final: doses are tried cheapest
+          segment first and the loop stops once that cost alone reaches the
+          best whole plan found. A dose is also skipped when the steps it
+          has already pushed below target can't bring it under the best.
+          The last move only needs the cheapest dose.
+Receive:  int move, 0 is the dose now
+          const vector<double>& trajectory of the earlier moves
+          double cost of the steps before this move
+          vector<int>& plan, candidate index of every earlier move
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void PlanSearch::search(int move, const vector<double> &trajectory,
+                        double cost, vector<int> &plan)
+{
+    int start = move*spacing;
+    int end = move+1<moves ? std::min((move+1)*spacing, horizon) : horizon;
+    //candidates of move m start at m*candidates, the no dose curve is last
+    const vector<double>& zero = (*bg)[moves*candidates];
+    if(trajectories.empty()){
+        trajectories.assign(moves, vector<double>(horizon));
+        segmentCosts.assign(moves, vector<double>(candidates));
+        orders.assign(moves, vector<int>(candidates));
+    }
+    vector<double>& segmentCost = segmentCosts[move];
+    for(int i=0; i<candidates; i++){
+        const vector<double>& curve = (*bg)[move*candidates+i];
+        double total = 0.0;
+        for(int k=start; k<end; k++){
+            total += fabs(trajectory[k]+curve[k]-zero[k]-target);
+        }
+        segmentCost[i] = total;
+    }
+    if(move+1==moves){
+        //candidates run from the largest dose down, prefer less on ties
+        int best = -1;
+        double limit = bound();
+        for(int i=candidates-1; i>=0; i--){
+            if(cost+segmentCost[i]<limit){
+                limit = cost+segmentCost[i];
+                best = i;
+            }
+        }
+        if(best>=0){
+            improve(limit);
+            plan[move] = best;
+            bestPlan = plan;
+            bestTrajectory = trajectory;
+            const vector<double>& curve = (*bg)[move*candidates+best];
+            for(int k=start; k<horizon; k++){
+                bestTrajectory[k] += curve[k]-zero[k];
+            }
+        }
+        return;
+    }
+    vector<int>& order = orders[move];
+    for(int i=0; i<candidates; i++){
+        order[i] = candidates-1-i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b){
+        return segmentCost[a]<segmentCost[b];
+    });
+    vector<double>& next = trajectories[move];
+    for(int n=0; n<candidates; n++){
+        int i = order[n];
+        double total = cost+segmentCost[i];
+        if(total>=bound()){
+            break;
+        }
+        const vector<double>& curve = (*bg)[move*candidates+i];
+        //insulin only lowers BG, so steps already below target (less any
+        //rise a later move could give) cost at least their distance
+        double lowerBound = 0.0;
+        const vector<double>& rise = (*riseAfter)[move];
+        for(int k=0; k<horizon; k++){
+            next[k] = k<start ? trajectory[k] :
+                                trajectory[k]+curve[k]-zero[k];
+            if(k>=end){
+                lowerBound += std::max(0.0, target-next[k]-rise[k]);
+            }
+        }
+        if(total+lowerBound>=bound()){
+            continue;
+        }
+        plan[move] = i;
+        search(move+1, next, total, plan);
+    }
+}
+}
+
 /*-----------------------------------------------------------------------------
 Name:     getSensitivity
 Purpose:  Returns sensitivity which is a constant integer representing
@@ -174,6 +332,9 @@ Return:   N/A
 -----------------------------------------------------------------------------*/
 void ModelPredictiveController::runPredictionModel()
 {
+    static MetricCounter& runs = MetricsRegistry::get().counter(
+            "ags_model_predictions_total", "Prediction model runs");
+    runs.add();
     vector<double> predictions = m_model->predict(m_bgInputs, m_insulinInputs, true);
     for(int i=0; i<predictions.size();i++){
         m_bgPredictions.push_back(predictions[i]);
@@ -199,15 +360,9 @@ vector<float> ModelPredictiveController::getNInsulinValues(int n, float bolus){
     vector<float> results;
 
     while(minsAgo<=end){
-        float tau = m_peakInsulinTime*(1-m_peakInsulinTime/end)/
-                (1-2*m_peakInsulinTime/end);
-        float a = 2*tau/end;
-        float s = 1/(1-a+(1+a)*exp(-end/tau));
-        float activityContrib = float(bolus) * float((s / (pow(tau,2)))
-                           * minsAgo * (1 - minsAgo / end) * exp(-minsAgo/tau));
-        float iobContrib = bolus * (1 - s * (1 - a) * ((pow(minsAgo, 2)
-                           / (tau * end * (1 - a)) - minsAgo / tau - 1) *
-                           exp(-minsAgo / tau) + 1));
+        float iobContrib = InsulinKinetics::insulinOnBoard(bolus, minsAgo,
+                                                           m_peakInsulinTime,
+                                                           end);
         //adds the current insulin already on board
         results.push_back(iobContrib+m_insulinInputs[minsAgo/5]);
         minsAgo +=5;
@@ -219,33 +374,206 @@ vector<float> ModelPredictiveController::getNInsulinValues(int n, float bolus){
 Name:     calculateControlInput
 Purpose:  Runs the models using all possible insulin control inputs to be
           administered at the next time step starting with the maxBolus and
-          decrementing by 0.5 units to 0. It stores all the model projections
-          in containers and sends them to the optimizer to find the one with
-          the least error between the projection and the target BG value.
+          decrementing by 0.5 units to 0. Each candidate's future insulin
+          curve is scaled from one unit's curve, and all of them are built
+          first and handed to the model as one batch, so a model with a
+          batched forward pass (an insulin aware LSTM) runs only once per
+          cycle. Candidates whose projection dips below target, or ends
+          below it once the insulin still on board at the horizon acts,
+          are dropped before any optimizer sees them (see
+          dropUnsafeCandidates), so every mode chooses under the same
+          safety constraint.
+          The remaining projections are sent to the optimizer to find the
+          one with
+          the least error between the projection and the target BG value,
+          or in scenario mode to the Monte Carlo evaluator. With more than
+          one control move the same batch also holds every candidate dose
+          at each later move and the plan search picks the sequence. In
+          basal mode it holds every temporary basal instead and the joint
+          search picks the bolus and basal together.
 Receive:  N/A
 Return:   N/A
 -----------------------------------------------------------------------------*/
 void ModelPredictiveController::calculateControlInput()
 {
     double correction = m_maxBolus;
-    vector<vector<double>> results;
+    vector<vector<float>> futureInsulinSet;
     vector<double> correctionResults;
+    //IOB is linear in the bolus, so one unit's curve serves every candidate
+    vector<float> baseline = getNInsulinValues(18, 0.0f);
+    vector<float> unitCurve = getNInsulinValues(18, 1.0f);
     while(correction>=0){
-      vector<float> futureInsulin = getNInsulinValues(18,correction);
-      //predict
-      vector<double> nextBGSet =
-      m_model->projectCorrection(m_bgPredictions,futureInsulin, m_sensitivity);
+      vector<float> futureInsulin(baseline.size());
+      for(int k=0; k<baseline.size(); k++){
+          futureInsulin[k] = baseline[k]+
+                             correction*(unitCurve[k]-baseline[k]);
+      }
+      futureInsulinSet.push_back(futureInsulin);
 
-      results.push_back(nextBGSet);
-
-      //record results      
+      //record results
       correctionResults.push_back(correction);
 
       //decrement bolus
       correction -= 0.5;
-      //clear vector
     }
-    m_controlInput = optimizeControl(results,correctionResults);
+    //later moves of a control horizon plan, as pending insulin that counts
+    //as on board until it is given, then the no dose curve they are
+    //measured against
+    int moves = getPlanMoveCount(baseline.size());
+    for(int move=1; move<moves; move++){
+        vector<float> pending = getPendingInsulinValues(baseline.size(),
+                                                        move*m_moveSpacing);
+        for(int i=0; i<correctionResults.size(); i++){
+            vector<float> futureInsulin(baseline.size());
+            for(int k=0; k<baseline.size(); k++){
+                futureInsulin[k] = baseline[k]+
+                                   correctionResults[i]*pending[k];
+            }
+            futureInsulinSet.push_back(futureInsulin);
+        }
+    }
+    //temporary basal candidates as the insulin they deliver above (or
+    //below) the scheduled basal, each rate held for each duration
+    vector<double> basalRates;
+    vector<int> basalSteps;
+    vector<double> basalOnBoard;
+    if(moves==1 && m_basalMode && m_basalRateStep>0 &&
+       m_basalDurationStep>0){
+        for(int steps=m_basalDurationStep; steps<=baseline.size();
+            steps+=m_basalDurationStep){
+            vector<float> delivered = getBasalInsulinValues(baseline.size(),
+                                                            steps);
+            for(int r=0; r*m_basalRateStep<=m_maxBasalRate+1e-9; r++){
+                double rate = r*m_basalRateStep;
+                vector<float> futureInsulin(baseline.size());
+                for(int k=0; k<baseline.size(); k++){
+                    futureInsulin[k] = baseline[k]+
+                                       (rate-m_scheduledBasal)*delivered[k];
+                }
+                futureInsulinSet.push_back(futureInsulin);
+                basalRates.push_back(rate);
+                basalSteps.push_back(steps);
+                basalOnBoard.push_back((rate-m_scheduledBasal)*
+                                       delivered.back());
+            }
+        }
+    }
+    if(moves>1 || basalRates.size()){
+        futureInsulinSet.push_back(baseline);
+    }
+    //predict
+    static MetricCounter& candidates = MetricsRegistry::get().counter(
+            "ags_model_projections_total",
+            "Insulin curves projected by the model, one per candidate");
+    static MetricHistogram& projectionTime = MetricsRegistry::get().histogram(
+            "ags_model_projection_duration_ms",
+            "Time to project one cycle's batch of candidates",
+            MetricsRegistry::latencyBucketsMs());
+    auto projectionStart = std::chrono::steady_clock::now();
+    vector<vector<double>> results =
+    m_model->projectCorrections(m_bgPredictions,futureInsulinSet,
+                                m_sensitivity);
+    candidates.add(futureInsulinSet.size());
+    projectionTime.observe(std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now()-projectionStart).count());
+    dropUnsafeCandidates(results, correctionResults, futureInsulinSet, moves);
+    m_tempBasalRate = m_scheduledBasal;
+    m_tempBasalMinutes = 0;
+    if(correctionResults.empty()){
+        //the model projected nothing, not even for no bolus
+        m_controlInput = 0.0;
+    }
+    else if(moves>1){
+        m_controlInput = optimizePlan(results,correctionResults,moves);
+    }
+    else if(basalRates.size()){
+        //insulin still on board at the horizon, each kept bolus's then each
+        //basal's above the no dose curve
+        vector<double> onBoard;
+        for(int i=0; i<correctionResults.size(); i++){
+            onBoard.push_back(baseline.back()+correctionResults[i]*
+                              (unitCurve.back()-baseline.back()));
+        }
+        onBoard.insert(onBoard.end(), basalOnBoard.begin(),
+                       basalOnBoard.end());
+        m_controlInput = optimizeJoint(results,correctionResults,basalRates,
+                                       basalSteps,onBoard);
+    }
+    else if(m_scenarioMode){
+        m_controlInput = optimizeScenarios(results,correctionResults);
+    }
+    else{
+        m_controlInput = optimizeControl(results,correctionResults);
+    }
+    static MetricGauge& controlInput = MetricsRegistry::get().gauge(
+            "ags_mpc_control_input_units", "Last bolus chosen by the MPC");
+    controlInput.set(m_controlInput);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     dropUnsafeCandidates
+Purpose:  Removes the boluses whose projection falls below target within
+          the horizon, or whose eventual BG does: the projection's last
+          value less the sensitivity times the insulin still on board at
+          the horizon, which acts past it. The projection only covers 90
+          minutes of a longer insulin action, so without the eventual
+          check doses stack on insulin that acts after the horizon. The no
+          bolus candidate is always kept, only empty projections are
+          dropped there. A dropped bolus is removed from every move block
+          of a plan; the basal and no dose curves after the blocks are
+          kept as they are.
+Receive:  bg projections, moves blocks of one per candidate then the rest
+          correction the candidate boluses aligned with each block
+          insulin the future insulin curve of every projection
+          int moves in the plan
+Return:   N/A, bg and correction hold only the kept candidates
+-----------------------------------------------------------------------------*/
+void ModelPredictiveController::dropUnsafeCandidates(
+        vector<vector<double>> &bg, vector<double> &correction,
+        const vector<vector<float>> &insulin, int moves)
+{
+    int candidates = correction.size();
+    if(bg.size()<moves*candidates || insulin.size()<candidates){
+        return;
+    }
+    vector<int> kept;
+    for(int i=0; i<candidates; i++){
+        const vector<double>& trajectory = bg[i];
+        bool safe = trajectory.size()>0;
+        if(safe && correction[i]>0.0){
+            double nadir = *std::min_element(trajectory.begin(),
+                                             trajectory.end());
+            double eventual = trajectory.back()-
+                              m_sensitivity*insulin[i].back();
+            safe = nadir>=m_target && eventual>=m_target;
+        }
+        if(safe){
+            kept.push_back(i);
+        }
+    }
+    static MetricCounter& dropped = MetricsRegistry::get().counter(
+            "ags_mpc_unsafe_candidates_total",
+            "Boluses dropped for a projected nadir or eventual BG below "
+            "target");
+    dropped.add(candidates-kept.size());
+    if(kept.size()==candidates){
+        return;
+    }
+    vector<vector<double>> keptBG;
+    vector<double> keptCorrection;
+    for(int i=0; i<kept.size(); i++){
+        keptCorrection.push_back(correction[kept[i]]);
+    }
+    for(int move=0; move<moves; move++){
+        for(int i=0; i<kept.size(); i++){
+            keptBG.push_back(bg[move*candidates+kept[i]]);
+        }
+    }
+    for(int i=moves*candidates; i<bg.size(); i++){
+        keptBG.push_back(bg[i]);
+    }
+    bg.swap(keptBG);
+    correction.swap(keptCorrection);
 }
 
 /*-----------------------------------------------------------------------------
@@ -290,6 +618,28 @@ void ModelPredictiveController::setModel(Model *model)
     m_model = model;
 }
 
+/*-----------------------------------------------------------------------------
+Name:     configure
+Purpose:  Applies a whole set of controller settings. The live loop and the
+          closed loop trial both configure their MPCs through here.
+Receive:  const ControllerSettings& settings
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ModelPredictiveController::configure(const ControllerSettings &settings)
+{
+    setSensitivity(settings.sensitivity);
+    setPeakInsulinTime(settings.peakInsulinTime);
+    setActivityDurationMinutes(settings.activityDurationMinutes);
+    setTarget(settings.target);
+    setMaxBolus(settings.maxBolus);
+    setScenarioMode(settings.scenarioMode);
+    m_scenarioEvaluator.setScenarioCount(settings.scenarioCount);
+    setControlMoves(settings.controlMoves);
+    setBasalMode(settings.basalMode);
+    setScheduledBasal(settings.scheduledBasal);
+    setMaxBasalRate(settings.maxBasalRate);
+}
+
 /*-----------------------------------------------------------------------------
 Name:     optimizeControl
 Purpose:  Looks at all the possible future BG curves based on control input
@@ -299,45 +649,619 @@ Receive:  bg is a container holding the model output curves for all possible
           control inputs
           correction is the vector containing all the insulin control inputs
           aligned with each curve in bg by index
-Return:   double the insulin treatment recomended by the MPC
+Return:   double the insulin treatment recomended by the MPC, 0 when no
+          curve holds any values
 -----------------------------------------------------------------------------*/
 double ModelPredictiveController::optimizeControl(vector<vector<double>> bg,
                                                   vector<double> correction)
 {
-    int distance = 0;
+    double distance = 0.0;
     double treatment = 0.0;
-    int trajectoryIndex=0;
-    for(int i=0; i<correction.size(); i++){
-        std::cout<<correction[i]<<": ";
-        for(int y=0;y<bg[i].size();y++){
-            std::cout<<bg[i][y]<<", ";
+    int trajectoryIndex=-1;
+    for(int i=0; i<correction.size() && i<bg.size(); i++){
+        if(m_verbose){
+            LOG_TRACE("{}: {}", correction[i], bg[i]);
         }
-        std::cout<<'\n';
-        vector<int> errors;
-        for(int j=0;j<bg[i].size();j++){
-            int error = abs(bg[i][j]-m_target);
-            errors.push_back(error);
+        //a model with no projection for this candidate has nothing to score
+        if(!bg[i].size()){
+            continue;
         }
         //average out the error
-        double total=0;
-        for(int m=0;m<errors.size();m++){
-            total+=errors[m];
+        double total = 0.0;
+        for(int j=0; j<bg[i].size(); j++){
+            total += fabs(bg[i][j]-m_target);
         }
-        double avgError = total/errors.size();
-        if(!distance){
-            distance=avgError;
-        }
-        else if(avgError<distance){
+        double avgError = total/bg[i].size();
+        if(trajectoryIndex<0 || avgError<distance){
             distance = avgError;
             treatment = correction[i];
             trajectoryIndex = i;
             m_controlOutput = bg[i];
         }
     }
-std::cout<< "Chosen Bolus: " << treatment<<std::endl;
+    if(m_verbose){
+        LOG_INFO("Chosen Bolus: {}", treatment);
+    }
     return treatment;
 }
 
+/*-----------------------------------------------------------------------------
+Name:     optimizeScenarios
+Purpose:  Scores every candidate curve under the scenario evaluator's
+          sampled sensor noise, sensitivity error and unannounced carbs and
+          picks the one with the lowest expected error plus low risk.
+Receive:  bg is a container holding the model output curves for all possible
+          control inputs
+          correction is the vector containing all the insulin control inputs
+          aligned with each curve in bg by index
+Return:   double the insulin treatment recomended by the MPC
+-----------------------------------------------------------------------------*/
+double ModelPredictiveController::optimizeScenarios(
+        const vector<vector<double>> &bg, const vector<double> &correction)
+{
+    //the zero bolus curve is the reference the bolus effect is measured from
+    int referenceIndex = 0;
+    for(int i=0; i<correction.size(); i++){
+        if(correction[i]<correction[referenceIndex]){
+            referenceIndex = i;
+        }
+    }
+    int chosen = m_scenarioEvaluator.evaluate(bg, referenceIndex, m_target);
+    if(chosen<0){
+        m_hypoProbability = 0.0;
+        return 0.0;
+    }
+    m_hypoProbability = m_scenarioEvaluator.getHypoProbability()[chosen];
+    m_controlOutput = bg[chosen];
+    if(m_verbose){
+        LOG_INFO("Chosen Bolus: {} expected error {} P(<70) {}",
+                 correction[chosen],
+                 m_scenarioEvaluator.getExpectedCost()[chosen],
+                 m_hypoProbability);
+    }
+    return correction[chosen];
+}
+
+/*-----------------------------------------------------------------------------
+Name:     optimizePlan
+Purpose:  Picks the dose sequence with the least error between the projected
+          values and the target. A later move's curve minus the no dose
+          curve is its effect, added onto the trajectory of the moves before
+          it, so each partial trajectory is built once and shared by its
+          whole subtree (exact for the state space model, which is linear in
+          insulin). The subtrees of the first move run on the thread pool
+          when one is set. Only the first dose is given; the rest are
+          replanned next cycle.
+Receive:  bg is a container holding the model output curves, moves blocks
+          of one per control input then the no dose curve
+          correction is the vector containing all the insulin control inputs
+          int moves in the plan
+Return:   double the insulin treatment recomended by the MPC now
+-----------------------------------------------------------------------------*/
+double ModelPredictiveController::optimizePlan(
+        const vector<vector<double>> &bg, const vector<double> &correction,
+        int moves)
+{
+    int candidates = correction.size();
+    PlanSearch prototype;
+    prototype.bg = &bg;
+    prototype.candidates = candidates;
+    prototype.moves = moves;
+    prototype.spacing = m_moveSpacing;
+    prototype.horizon = bg.back().size();
+    prototype.target = m_target;
+    //the most each move after a given one can raise BG at each step
+    const vector<double>& zero = bg.back();
+    vector<vector<double>> riseAfter(moves,
+                                     vector<double>(prototype.horizon, 0.0));
+    for(int move=moves-2; move>=0; move--){
+        for(int k=0; k<prototype.horizon; k++){
+            double rise = 0.0;
+            for(int i=0; i<candidates; i++){
+                rise = std::max(rise, bg[(move+1)*candidates+i][k]-zero[k]);
+            }
+            riseAfter[move][k] = riseAfter[move+1][k]+rise;
+        }
+    }
+    std::atomic<double> sharedCost(std::numeric_limits<double>::infinity());
+    prototype.sharedCost = &sharedCost;
+    prototype.riseAfter = &riseAfter;
+
+    //first doses in order of their own segment's cost so a good plan is
+    //found early and bounds the rest
+    int firstEnd = std::min(m_moveSpacing, prototype.horizon);
+    vector<double> firstCost(candidates, 0.0);
+    vector<int> order(candidates);
+    for(int i=0; i<candidates; i++){
+        for(int k=0; k<firstEnd; k++){
+            firstCost[i] += fabs(bg[i][k]-m_target);
+        }
+        order[i] = candidates-1-i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b){
+        return firstCost[a]<firstCost[b];
+    });
+    vector<PlanSearch> subtrees(candidates, prototype);
+    auto searchSubtree = [&](int n){
+        //a one candidate first move, so each subtree is searched alone
+        int i = order[n];
+        if(firstCost[i]>=sharedCost.load(std::memory_order_relaxed)){
+            return;
+        }
+        vector<int> plan(moves, i);
+        subtrees[i].search(1, bg[i], firstCost[i], plan);
+    };
+    if(m_pool){
+        m_pool->parallelFor(candidates, searchSubtree);
+    }
+    else{
+        for(int i=0; i<candidates; i++){
+            searchSubtree(i);
+        }
+    }
+    //smallest first dose wins ties
+    int best = -1;
+    for(int i=candidates-1; i>=0; i--){
+        if(!subtrees[i].bestPlan.empty() &&
+           (best<0 || subtrees[i].bestCost<subtrees[best].bestCost)){
+            best = i;
+        }
+    }
+    m_plannedDoses.clear();
+    if(best<0){
+        return 0.0;
+    }
+    for(int move=0; move<moves; move++){
+        m_plannedDoses.push_back(correction[subtrees[best].bestPlan[move]]);
+    }
+    m_controlOutput = subtrees[best].bestTrajectory;
+    if(m_verbose){
+        LOG_INFO("Planned doses: {} error {}", m_plannedDoses,
+                 subtrees[best].bestCost/subtrees[best].horizon);
+    }
+    return m_plannedDoses[0];
+}
+
+/*-----------------------------------------------------------------------------
+Name:     optimizeJoint
+Purpose:  Picks the bolus and temporary basal with the least error between
+          the projected values and the target. The basal's effect is its
+          curve minus the no dose curve, added to the bolus curve (exact for
+          the state space model). Pairs are pruned with a bound that costs
+          one addition: the summed absolute error is at least the absolute
+          value of the summed error, so with the basals sorted by their
+          summed effect only a band of them can beat the best pair for each
+          bolus. Pairs in the band are scored over contiguous arrays, as in
+          the scenario evaluator, and given up once past the best. A pair
+          that would become the best must also pass the safety constraint
+          dropUnsafeCandidates puts on the boluses, unless it adds no
+          insulin at all.
+Receive:  bg is a container holding the model output curves, one per bolus,
+          one per temporary basal, then the no dose curve
+          correction is the vector containing all the bolus inputs
+          basalRates and basalSteps of every temporary basal
+          onBoard the insulin on board at the horizon of each bolus, then
+          of each basal above the no dose curve
+Return:   double the bolus recomended by the MPC, the basal is kept in
+          m_tempBasalRate and m_tempBasalMinutes
+-----------------------------------------------------------------------------*/
+double ModelPredictiveController::optimizeJoint(
+        const vector<vector<double>> &bg, const vector<double> &correction,
+        const vector<double> &basalRates, const vector<int> &basalSteps,
+        const vector<double> &onBoard)
+{
+    int boluses = correction.size();
+    int basals = basalRates.size();
+    const vector<double>& zero = bg.back();
+    int horizon = zero.size();
+    vector<double> residual(boluses*horizon);
+    vector<double> residualSum(boluses, 0.0);
+    vector<double> effect(basals*horizon);
+    vector<double> effectSum(basals, 0.0);
+    for(int i=0; i<boluses; i++){
+        for(int k=0; k<horizon; k++){
+            residual[i*horizon+k] = bg[i][k]-m_target;
+            residualSum[i] += residual[i*horizon+k];
+        }
+    }
+    for(int j=0; j<basals; j++){
+        for(int k=0; k<horizon; k++){
+            effect[j*horizon+k] = bg[boluses+j][k]-zero[k];
+            effectSum[j] += effect[j*horizon+k];
+        }
+    }
+    vector<int> order(basals);
+    for(int j=0; j<basals; j++){
+        order[j] = j;
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b){
+        return effectSum[a]<effectSum[b];
+    });
+    vector<double> sortedSum(basals);
+    for(int n=0; n<basals; n++){
+        sortedSum[n] = effectSum[order[n]];
+    }
+
+    //the bolus alone on the scheduled basal is the first best pair, the
+    //smallest bolus winning ties
+    double bestCost = std::numeric_limits<double>::infinity();
+    int bestBolus = 0;
+    int bestBasal = -1;
+    for(int i=boluses-1; i>=0; i--){
+        double error = 0.0;
+        for(int k=0; k<horizon; k++){
+            error += fabs(residual[i*horizon+k]);
+        }
+        if(error<bestCost){
+            bestCost = error;
+            bestBolus = i;
+        }
+    }
+    m_evaluatedPairs = boluses;
+    for(int i=boluses-1; i>=0; i--){
+        const double* r = residual.data()+i*horizon;
+        int first = std::upper_bound(sortedSum.begin(), sortedSum.end(),
+                                     -bestCost-residualSum[i])-
+                    sortedSum.begin();
+        int last = std::lower_bound(sortedSum.begin(), sortedSum.end(),
+                                    bestCost-residualSum[i])-
+                   sortedSum.begin();
+        for(int n=first; n<last; n++){
+            const double* e = effect.data()+order[n]*horizon;
+            double error = 0.0;
+            //a 6 step block at a time so the loop body stays branch free
+            for(int k=0; k<horizon && error<bestCost; k+=6){
+                int end = std::min(k+6, horizon);
+                for(int m=k; m<end; m++){
+                    error += fabs(r[m]+e[m]);
+                }
+            }
+            m_evaluatedPairs++;
+            if(error<bestCost && (correction[i]>0.0 ||
+               basalRates[order[n]]>m_scheduledBasal)){
+                //residuals are measured from the target
+                double nadir = 0.0;
+                for(int k=0; k<horizon; k++){
+                    nadir = std::min(nadir, r[k]+e[k]);
+                }
+                double eventual = r[horizon-1]+e[horizon-1]-m_sensitivity*
+                                  (onBoard[i]+onBoard[boluses+order[n]]);
+                if(nadir<0.0 || eventual<0.0){
+                    continue;
+                }
+            }
+            if(error<bestCost){
+                bestCost = error;
+                bestBolus = i;
+                bestBasal = order[n];
+            }
+        }
+    }
+
+    m_controlOutput = bg[bestBolus];
+    if(bestBasal>=0){
+        m_tempBasalRate = basalRates[bestBasal];
+        m_tempBasalMinutes = basalSteps[bestBasal]*5;
+        for(int k=0; k<horizon; k++){
+            m_controlOutput[k] += effect[bestBasal*horizon+k];
+        }
+    }
+    if(m_verbose){
+        LOG_INFO("Chosen Bolus: {} temp basal {} U/h for {} min, {} of {} "
+                 "pairs scored", correction[bestBolus], m_tempBasalRate,
+                 m_tempBasalMinutes, m_evaluatedPairs, boluses*(basals+1));
+    }
+    return correction[bestBolus];
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getBasalInsulinValues
+Purpose:  Future insulin values of 1 U/h above the scheduled basal held for
+          steps 5 minute steps, delivered as a micro bolus every step. Each
+          counts as on board until it is given, as the plan's pending doses
+          do.
+Receive:  int n values, int steps the basal runs for
+Return:   vector<float>
+-----------------------------------------------------------------------------*/
+vector<float> ModelPredictiveController::getBasalInsulinValues(
+        int n, int steps) const
+{
+    //value k of a unit given at step j is unit[k-j], or 1 before it's given
+    vector<float> unit = getPendingInsulinValues(n, 0);
+    vector<float> results(n, 0.0f);
+    for(int j=0; j<steps; j++){
+        for(int k=0; k<n; k++){
+            results[k] += (k<j ? 1.0f : unit[k-j])/12.0f;
+        }
+    }
+    return results;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getPlanMoveCount
+Purpose:  Returns the number of control moves that start inside the
+          prediction horizon.
+Receive:  int horizon in 5 minute steps
+Return:   int
+-----------------------------------------------------------------------------*/
+int ModelPredictiveController::getPlanMoveCount(int horizon) const
+{
+    if(m_controlMoves<=1 || m_moveSpacing<=0){
+        return 1;
+    }
+    return std::max(1, std::min(m_controlMoves,
+                                (horizon+m_moveSpacing-1)/m_moveSpacing));
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getPendingInsulinValues
+Purpose:  Future insulin values of one unit given startStep steps from now.
+          Until then it counts as fully on board so it lowers nothing, after
+          that it follows the same curve getNInsulinValues uses.
+Receive:  int n values, int startStep in 5 minute steps
+Return:   vector<float>
+-----------------------------------------------------------------------------*/
+vector<float> ModelPredictiveController::getPendingInsulinValues(
+        int n, int startStep) const
+{
+    vector<float> results;
+    for(int k=0; k<n; k++){
+        float minutes = (k+1-startStep)*5.0f;
+        results.push_back(minutes<=0 ? 1.0f :
+                          InsulinKinetics::insulinOnBoard(1.0f, minutes,
+                                                          m_peakInsulinTime,
+                                                          n*5));
+    }
+    return results;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getControlInput
+Purpose:  Returns the bolus chosen by the last call to calculateControlInput,
+          in units.
+Receive:  N/A
+Return:   double
+-----------------------------------------------------------------------------*/
+double ModelPredictiveController::getControlInput() const
+{
+    return m_controlInput;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getVerbose
+Purpose:  Returns true if the MPC prints every candidate curve and the chosen
+          bolus to the console.
+Receive:  N/A
+Return:   bool
+-----------------------------------------------------------------------------*/
+bool ModelPredictiveController::getVerbose() const
+{
+    return m_verbose;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setVerbose
+Purpose:  Turns the console output of the optimizers on or off. Simulated
+          trials run thousands of MPCs and turn it off.
+Receive:  bool verbose
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ModelPredictiveController::setVerbose(bool verbose)
+{
+    m_verbose = verbose;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getScenarioMode
+Purpose:  Returns true if the control input is chosen by Monte Carlo scenario
+          evaluation instead of the single deterministic projection.
+Receive:  N/A
+Return:   bool
+-----------------------------------------------------------------------------*/
+bool ModelPredictiveController::getScenarioMode() const
+{
+    return m_scenarioMode;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setScenarioMode
+Purpose:  Turns Monte Carlo scenario evaluation of the candidates on or off.
+Receive:  bool scenarioMode
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ModelPredictiveController::setScenarioMode(bool scenarioMode)
+{
+    m_scenarioMode = scenarioMode;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getScenarioEvaluator
+Purpose:  Returns the evaluator used in scenario mode so the caller can set
+          the scenario count, perturbation sizes and thread pool.
+Receive:  N/A
+Return:   ScenarioEvaluator*
+-----------------------------------------------------------------------------*/
+ScenarioEvaluator *ModelPredictiveController::getScenarioEvaluator()
+{
+    return &m_scenarioEvaluator;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getHypoProbability
+Purpose:  Returns the fraction of scenarios in which the chosen bolus went
+          below 70 mg/dl, 0 outside scenario mode.
+Receive:  N/A
+Return:   double
+-----------------------------------------------------------------------------*/
+double ModelPredictiveController::getHypoProbability() const
+{
+    return m_hypoProbability;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getControlMoves
+Purpose:  Returns the number of doses planned per cycle, 1 for the single
+          bolus sweep.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int ModelPredictiveController::getControlMoves() const
+{
+    return m_controlMoves;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setControlMoves
+Purpose:  Sets the number of doses planned per cycle. Above 1 the plan
+          search replaces the single bolus and scenario optimizers.
+Receive:  int controlMoves
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ModelPredictiveController::setControlMoves(int controlMoves)
+{
+    m_controlMoves = controlMoves;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getMoveSpacing
+Purpose:  Returns the 5 minute steps between planned doses.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int ModelPredictiveController::getMoveSpacing() const
+{
+    return m_moveSpacing;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setMoveSpacing
+Purpose:  Sets the 5 minute steps between planned doses, 6 for 0, 30 and
+          60 minutes.
+Receive:  int moveSpacing
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ModelPredictiveController::setMoveSpacing(int moveSpacing)
+{
+    m_moveSpacing = moveSpacing;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setThreadPool
+Purpose:  Sets the pool the plan search's subtrees run on. Leave unset when
+          the MPC itself runs on a pool's thread.
+Receive:  ThreadPool* pool, not owned
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ModelPredictiveController::setThreadPool(ThreadPool *pool)
+{
+    m_pool = pool;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getPlannedDoses
+Purpose:  Returns the dose of every move of the last plan, the first is the
+          control input.
+Receive:  N/A
+Return:   vector<double>
+-----------------------------------------------------------------------------*/
+vector<double> ModelPredictiveController::getPlannedDoses() const
+{
+    return m_plannedDoses;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getBasalMode
+Purpose:  Returns true if the MPC chooses a temporary basal with the bolus.
+Receive:  N/A
+Return:   bool
+-----------------------------------------------------------------------------*/
+bool ModelPredictiveController::getBasalMode() const
+{
+    return m_basalMode;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setBasalMode
+Purpose:  Turns the joint bolus and temporary basal search on or off. It
+          replaces the single bolus and scenario optimizers and is ignored
+          while planning more than one control move.
+Receive:  bool basalMode
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ModelPredictiveController::setBasalMode(bool basalMode)
+{
+    m_basalMode = basalMode;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setScheduledBasal
+Purpose:  Sets the basal the pump runs without a temporary one. Rates below
+          it take insulin away.
+Receive:  double scheduledBasal in U/h
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ModelPredictiveController::setScheduledBasal(double scheduledBasal)
+{
+    m_scheduledBasal = scheduledBasal;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setMaxBasalRate
+Purpose:  Sets the highest temporary basal the MPC may choose.
+Receive:  double maxBasalRate in U/h
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ModelPredictiveController::setMaxBasalRate(double maxBasalRate)
+{
+    m_maxBasalRate = maxBasalRate;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setBasalRateStep
+Purpose:  Sets the spacing of the temporary basal rates tried, from 0 up.
+Receive:  double basalRateStep in U/h
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ModelPredictiveController::setBasalRateStep(double basalRateStep)
+{
+    m_basalRateStep = basalRateStep;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getTempBasalRate
+Purpose:  Returns the basal rate chosen by the last call to
+          calculateControlInput, the scheduled one if none.
+Receive:  N/A
+Return:   double U/h
+-----------------------------------------------------------------------------*/
+double ModelPredictiveController::getTempBasalRate() const
+{
+    return m_tempBasalRate;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getTempBasalMinutes
+Purpose:  Returns how long the chosen temporary basal runs, 0 if none.
+Receive:  N/A
+Return:   int minutes
+-----------------------------------------------------------------------------*/
+int ModelPredictiveController::getTempBasalMinutes() const
+{
+    return m_tempBasalMinutes;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getEvaluatedPairs
+Purpose:  Returns how many bolus and basal pairs the last joint search
+          scored in full or in part, to check the pruning.
+Receive:  N/A
+Return:   long
+-----------------------------------------------------------------------------*/
+long ModelPredictiveController::getEvaluatedPairs() const
+{
+    return m_evaluatedPairs;
+}
+
 /*-----------------------------------------------------------------------------
 Name:     getControlOutput
 Purpose:  Returns the recomended control for the user to take at the next
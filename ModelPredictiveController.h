@@ -27,8 +27,12 @@
 #include <vector>
 using std::vector;
 #include "BGDataEntry.h"
+#include "ControllerSettings.h"
 #include "InsulinDataEntry.h"
 #include "Model.h"
+#include "ScenarioEvaluator.h"
+
+class ThreadPool;
 
 class ModelPredictiveController
 {
@@ -44,15 +48,51 @@ protected:
     double m_maxBolus;
     Model* m_model;
     double m_controlInput;
+    bool m_scenarioMode = false;
+    bool m_verbose = true;
+    double m_hypoProbability = 0.0;
+    ScenarioEvaluator m_scenarioEvaluator;
+    //control horizon: doses planned every m_moveSpacing 5 minute steps
+    int m_controlMoves = 1;
+    int m_moveSpacing = 6;
+    vector<double> m_plannedDoses;
+    ThreadPool* m_pool = nullptr;
+    //temporary basal: a rate in U/h held for a multiple of the duration
+    //step, searched jointly with the bolus
+    bool m_basalMode = false;
+    double m_scheduledBasal = 0.0;
+    double m_maxBasalRate = 3.0;
+    double m_basalRateStep = 0.1;
+    int m_basalDurationStep = 6;
+    double m_tempBasalRate = 0.0;
+    int m_tempBasalMinutes = 0;
+    long m_evaluatedPairs = 0;
 
+    int getPlanMoveCount(int horizon) const;
+    vector<float> getPendingInsulinValues(int n, int startStep) const;
+    vector<float> getBasalInsulinValues(int n, int steps) const;
+    void dropUnsafeCandidates(vector<vector<double>>& bg,
+                              vector<double>& correction,
+                              const vector<vector<float>>& insulin,
+                              int moves);
 
 public:
     ModelPredictiveController() = default;
     ~ModelPredictiveController() = default;
 
     void setModel(Model* model);
+    void configure(const ControllerSettings& settings);
     double optimizeControl(vector<vector<double>> bg,
                            vector<double> correction);
+    double optimizeScenarios(const vector<vector<double>>& bg,
+                             const vector<double>& correction);
+    double optimizePlan(const vector<vector<double>>& bg,
+                        const vector<double>& correction, int moves);
+    double optimizeJoint(const vector<vector<double>>& bg,
+                         const vector<double>& correction,
+                         const vector<double>& basalRates,
+                         const vector<int>& basalSteps,
+                         const vector<double>& onBoard);
     void addBGInput(int bg);
     vector<float> getNInsulinValues(int n, float bolus);
     void addInsulinInput(float iob);
@@ -60,6 +100,7 @@ public:
     void calculateControlInput();
     void calculateControlOutput();
     vector<double> getControlOutput() const;
+    double getControlInput() const;
     vector<double> getPredictions();
     int bgListSize();
     int getSensitivity() const;
@@ -72,6 +113,26 @@ public:
     void setTarget(int target);
     double getMaxBolus() const;
     void setMaxBolus(double maxBolus);
+    bool getVerbose() const;
+    void setVerbose(bool verbose);
+    bool getScenarioMode() const;
+    void setScenarioMode(bool scenarioMode);
+    ScenarioEvaluator* getScenarioEvaluator();
+    double getHypoProbability() const;
+    int getControlMoves() const;
+    void setControlMoves(int controlMoves);
+    int getMoveSpacing() const;
+    void setMoveSpacing(int moveSpacing);
+    void setThreadPool(ThreadPool* pool);
+    vector<double> getPlannedDoses() const;
+    bool getBasalMode() const;
+    void setBasalMode(bool basalMode);
+    void setScheduledBasal(double scheduledBasal);
+    void setMaxBasalRate(double maxBasalRate);
+    void setBasalRateStep(double basalRateStep);
+    double getTempBasalRate() const;
+    int getTempBasalMinutes() const;
+    long getEvaluatedPairs() const;
 };
 
 #endif // MODELPREDICTIVECONTROLLER_H
@@ -0,0 +1,453 @@
+/******************************************************************************
+** FILE: ModelRegistry.cpp
+**
+** ABSTRACT:
+** Swaps retrained RF and LSTM models in while the control
+** loop keeps running.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+**
+******************************************************************************/
+
+#include "ModelRegistry.h"
+#include "RegisteredModel.h"
+#include "RandomForestModel.h"
+#include "LSTMModel.h"
+#include "Logger.h"
+#include <sys/stat.h>
+#include <cmath>
+#include <iostream>
+
+namespace {
+    const int kBGInputs = 6;
+    const int kInsulinInputs = 19;
+    const int kOutputs = 18;
+    const int kProbeSensitivity = 30;
+    //a trajectory outside this range means a broken export, not a patient
+    const double kMinPlausibleBG = 10.0;
+    const double kMaxPlausibleBG = 1000.0;
+
+    bool isPlausibleTrajectory(const vector<double>& trajectory, int outputs)
+    {
+        if(trajectory.size()!=outputs){
+            return false;
+        }
+        for(double value : trajectory){
+            if(!std::isfinite(value) || value<kMinPlausibleBG ||
+               value>kMaxPlausibleBG){
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     ModelRegistry
+Purpose:  Constructor.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+ModelRegistry::ModelRegistry() :
+    m_reloads(0),
+    m_rejected(0)
+{
+}
+
+/*-----------------------------------------------------------------------------
+Name:     ~ModelRegistry
+Purpose:  Destructor. Stops the watcher.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+ModelRegistry::~ModelRegistry()
+{
+    stop();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setHistoryStore
+Purpose:  Sets the store the RF versions queue saved predictions to. Call
+          before adding models.
+Receive:  HistoryStore* historyStore, not owned
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ModelRegistry::setHistoryStore(HistoryStore *historyStore)
+{
+    m_historyStore = historyStore;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setCacheCapacity
+Purpose:  Sets the projection cache entries given to each version, 0 to run
+          versions uncached.
+Receive:  int cacheCapacity
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ModelRegistry::setCacheCapacity(int cacheCapacity)
+{
+    m_cacheCapacity = cacheCapacity;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setPollIntervalMs
+Purpose:  Sets how often the watcher checks the model files. A file has to
+          be unchanged for one whole interval before it is loaded.
+Receive:  int pollIntervalMs
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ModelRegistry::setPollIntervalMs(int pollIntervalMs)
+{
+    m_pollIntervalMs = pollIntervalMs;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     stampFile
+Purpose:  Reads the identity, size and modification time of a file.
+Receive:  const string& path
+Return:   FileStamp, exists false if the file can't be read
+-----------------------------------------------------------------------------*/
+ModelRegistry::FileStamp ModelRegistry::stampFile(const string &path)
+{
+    FileStamp stamp;
+    struct stat status;
+    if(stat(path.c_str(), &status)==0){
+        stamp.exists = true;
+        stamp.inode = status.st_ino;
+        stamp.size = status.st_size;
+        stamp.modifiedSec = status.st_mtim.tv_sec;
+        stamp.modifiedNsec = status.st_mtim.tv_nsec;
+    }
+    return stamp;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     isSameFile
+Purpose:  Whether two stamps describe the same write of a file.
+Receive:  const FileStamp& a, const FileStamp& b
+Return:   bool
+-----------------------------------------------------------------------------*/
+bool ModelRegistry::isSameFile(const FileStamp &a, const FileStamp &b)
+{
+    return a.exists==b.exists && a.inode==b.inode && a.size==b.size &&
+           a.modifiedSec==b.modifiedSec && a.modifiedNsec==b.modifiedNsec;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     isPlausible
+Purpose:  Runs a loaded model on a steady and a high, insulin covered
+          history and checks each prediction has the model's declared
+          number of finite, physiological values. A model that also
+          projects corrections must give the same from its projection.
+Receive:  Model& model, int outputs the model declares
+Return:   bool
+-----------------------------------------------------------------------------*/
+bool ModelRegistry::isPlausible(Model &model, int outputs)
+{
+    vector<vector<double>> bgProbes = {
+        vector<double>(kBGInputs, 120.0),
+        {180.0, 195.0, 210.0, 225.0, 240.0, 250.0}
+    };
+    vector<vector<float>> insulinProbes = {
+        vector<float>(kInsulinInputs, 0.0f),
+        vector<float>(kInsulinInputs, 0.0f)
+    };
+    insulinProbes[1][0] = 2.0f;
+    insulinProbes[1][1] = 1.0f;
+    if(outputs<=0 || outputs>kOutputs){
+        return false;
+    }
+    for(int i=0; i<bgProbes.size(); i++){
+        vector<int> bgInputs(bgProbes[i].begin(), bgProbes[i].end());
+        if(!isPlausibleTrajectory(model.predict(bgInputs, insulinProbes[i],
+                                                false), outputs)){
+            return false;
+        }
+        vector<double> projected = model.projectCorrection(
+                    bgProbes[i], insulinProbes[i], kProbeSensitivity);
+        if(projected.size() && !isPlausibleTrajectory(projected, outputs)){
+            return false;
+        }
+    }
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     loadVersion
+Purpose:  Loads and checks a new version of an entry's file. Runs on the
+          watcher thread, or the caller's before the watcher starts.
+Receive:  const Entry& entry
+Return:   std::shared_ptr<ModelVersion>, null if the file was rejected
+-----------------------------------------------------------------------------*/
+std::shared_ptr<ModelVersion> ModelRegistry::loadVersion(
+                                            const Entry &entry) const
+{
+    std::shared_ptr<ModelVersion> version(new ModelVersion());
+    bool loaded = false;
+    int outputs = kOutputs;
+    //BG values the model reads, so the cache keys on only those
+    int bgInputs = kBGInputs;
+    bool newestBGInputs = false;
+    if(entry.kind==ForestFile){
+        RandomForestModel* forest = new RandomForestModel();
+        version->model.reset(forest);
+        //loadForest checks the 25 input, 18 output shape
+        loaded = forest->loadForest(entry.path);
+        forest->setHistoryStore(m_historyStore);
+    }
+    else{
+        LSTMModel* network = new LSTMModel();
+        version->model.reset(network);
+        loaded = network->loadWeights(entry.path);
+        //LSTMTrain.py's networks predict fewer steps than the forest
+        outputs = network->getOutputCount();
+        bgInputs = network->getBGFeatureCount();
+        newestBGInputs = true;
+    }
+    if(!loaded || !isPlausible(*version->model, outputs)){
+        return nullptr;
+    }
+    if(m_cacheCapacity>0){
+        version->cachedModel.reset(new CachedModel(version->model.get(),
+                                                   m_cacheCapacity));
+        version->cachedModel->setBGInputWindow(bgInputs, newestBGInputs);
+        //every version counts into the same series
+        version->cachedModel->getCache().setMetricsName(entry.name);
+    }
+    return version;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     reload
+Purpose:  Loads the entry's file and publishes it as the newest version.
+          A rejected file leaves the current version in place.
+Receive:  Entry& entry, const FileStamp& stamp of the file being loaded
+Return:   bool true if a version was published
+-----------------------------------------------------------------------------*/
+bool ModelRegistry::reload(Entry &entry, const FileStamp &stamp)
+{
+    entry.loaded = stamp;
+    entry.seen = stamp;
+    std::shared_ptr<ModelVersion> version = loadVersion(entry);
+    if(!version){
+        m_rejected++;
+        LOG_WARNING("Rejected {} model {}, keeping version {}", entry.name,
+                    entry.path, entry.versions);
+        return false;
+    }
+    version->number = ++entry.versions;
+    std::atomic_store(&entry.current, version);
+    LOG_INFO("Loaded {} model version {} from {}", entry.name,
+             version->number, entry.path);
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     addModel
+Purpose:  Registers a model file and loads it straight away if it is
+          there. Call before start.
+Receive:  const string& name, for messages
+          const string& path, the file to watch
+          RegisteredKind kind, how to load it
+Return:   int, the slot
+-----------------------------------------------------------------------------*/
+int ModelRegistry::addModel(const string &name, const string &path,
+                            RegisteredKind kind)
+{
+    std::unique_ptr<Entry> entry(new Entry());
+    entry->name = name;
+    entry->path = path;
+    entry->kind = kind;
+    FileStamp stamp = stampFile(path);
+    if(stamp.exists){
+        reload(*entry, stamp);
+    }
+    else{
+        entry->loaded = stamp;
+        entry->seen = stamp;
+    }
+    int slot = m_entries.size();
+    m_entries.push_back(std::move(entry));
+    m_handles.emplace_back(new RegisteredModel(this, slot));
+    return slot;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     hasModel
+Purpose:  Whether a slot has a version the ensemble can run.
+Receive:  int slot
+Return:   bool
+-----------------------------------------------------------------------------*/
+bool ModelRegistry::hasModel(int slot) const
+{
+    return getVersion(slot)!=nullptr;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getHandle
+Purpose:  Returns the slot's ensemble member, owned by the registry.
+Receive:  int slot
+Return:   RegisteredModel*
+-----------------------------------------------------------------------------*/
+RegisteredModel* ModelRegistry::getHandle(int slot) const
+{
+    return m_handles[slot].get();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getVersion
+Purpose:  Returns the slot's newest published version. Safe from any
+          thread.
+Receive:  int slot
+Return:   std::shared_ptr<ModelVersion>, null if none has loaded
+-----------------------------------------------------------------------------*/
+std::shared_ptr<ModelVersion> ModelRegistry::getVersion(int slot) const
+{
+    if(slot<0 || slot>=m_entries.size()){
+        return nullptr;
+    }
+    return std::atomic_load(&m_entries[slot]->current);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     refreshHandles
+Purpose:  Moves every handle to its slot's newest version. Only call
+          between cycles, while nothing is running the handles.
+Receive:  N/A
+Return:   int, handles that changed version
+-----------------------------------------------------------------------------*/
+int ModelRegistry::refreshHandles()
+{
+    int refreshed = 0;
+    for(int i=0; i<m_handles.size(); i++){
+        if(m_handles[i]->refresh()){
+            refreshed++;
+            LOG_INFO("Switched {} to version {}", m_entries[i]->name,
+                     m_handles[i]->getVersionNumber());
+        }
+    }
+    return refreshed;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     start
+Purpose:  Starts the watcher thread.
+Receive:  N/A
+Return:   bool
+-----------------------------------------------------------------------------*/
+bool ModelRegistry::start()
+{
+    if(m_watcher.joinable()){
+        return true;
+    }
+    m_stopping = false;
+    m_watcher = std::thread(&ModelRegistry::watcherLoop, this);
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     stop
+Purpose:  Stops the watcher, waiting for any load in progress.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ModelRegistry::stop()
+{
+    if(m_watcher.joinable()){
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_one();
+        m_watcher.join();
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     watcherLoop
+Purpose:  Body of the watcher thread. Every interval checks each file and
+          reloads one that has changed since its last load but not since
+          the previous check, so a file still being written is left alone.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ModelRegistry::watcherLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(true){
+        m_wake.wait_for(lock, std::chrono::milliseconds(m_pollIntervalMs),
+                        [this](){ return m_stopping; });
+        if(m_stopping){
+            return;
+        }
+        lock.unlock();
+        for(std::unique_ptr<Entry>& entry : m_entries){
+            FileStamp stamp = stampFile(entry->path);
+            if(!stamp.exists || isSameFile(stamp, entry->loaded) ||
+               !isSameFile(stamp, entry->seen)){
+                entry->seen = stamp;
+                continue;
+            }
+            if(reload(*entry, stamp)){
+                m_reloads++;
+            }
+        }
+        lock.lock();
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getReloadCount
+Purpose:  Returns how many new versions the watcher has published.
+Receive:  N/A
+Return:   long
+-----------------------------------------------------------------------------*/
+long ModelRegistry::getReloadCount() const
+{
+    return m_reloads;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getRejectedCount
+Purpose:  Returns how many files failed to load or to pass the probes.
+Receive:  N/A
+Return:   long
+-----------------------------------------------------------------------------*/
+long ModelRegistry::getRejectedCount() const
+{
+    return m_rejected;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     printStatus
+Purpose:  Prints each slot's running version and its cache statistics.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ModelRegistry::printStatus() const
+{
+    std::cout << "Model registry: " << m_reloads << " reloads, "
+              << m_rejected << " rejected" << std::endl;
+    for(int i=0; i<m_entries.size(); i++){
+        std::shared_ptr<ModelVersion> version = getVersion(i);
+        if(!version){
+            std::cout << m_entries[i]->name << " not loaded" << std::endl;
+            continue;
+        }
+        std::cout << m_entries[i]->name << " version " << version->number
+                  << std::endl;
+        if(version->cachedModel){
+            version->cachedModel->getCache().printStats(
+                                        m_entries[i]->name.c_str());
+        }
+    }
+}
@@ -0,0 +1,142 @@
+/******************************************************************************
+** FILE: ModelRegistry.h
+**
+** ABSTRACT:
+** Swaps retrained RF and LSTM models in while the control
+** loop keeps running. A watcher thread polls the model
+** files, loads a changed file once it has stopped
+** changing, checks the new version's shape and a few
+** probe trajectories, and publishes it with an atomic
+** shared_ptr store. The ensemble holds RegisteredModel
+** handles that pin one version each and only move to the
+** newest between cycles, so a cycle in flight finishes on
+** the version it started with and the next one starts on
+** the new version without waiting for any load.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** A version is freed by whoever drops the last reference
+** to it, normally the handle when it moves on. Retrained
+** files should be written elsewhere and renamed over the
+** watched path; a mapped .qforest that is rewritten in
+** place can change under the version still running on it.
+** A rejected file is not retried until it changes again.
+** A slot with no loadable file at start up is still
+** watched but its handle only joins the ensemble on the
+** next start.
+**
+******************************************************************************/
+
+#ifndef MODELREGISTRY_H
+#define MODELREGISTRY_H
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Model.h"
+#include "CachedModel.h"
+#include "HistoryStore.h"
+using std::string;
+using std::vector;
+
+class RegisteredModel;
+
+enum RegisteredKind
+{
+    ForestFile = 0,
+    LSTMFile
+};
+
+//one loaded model file, immutable once published
+struct ModelVersion
+{
+    long number = 0;
+    std::unique_ptr<Model> model;
+    //each version starts with its own empty projection cache
+    std::unique_ptr<CachedModel> cachedModel;
+};
+
+class ModelRegistry
+{
+protected:
+    //identifies one write of a file, a rename over it changes the inode
+    struct FileStamp
+    {
+        bool exists = false;
+        long inode = 0;
+        long size = 0;
+        long modifiedSec = 0;
+        long modifiedNsec = 0;
+    };
+
+    struct Entry
+    {
+        string name;
+        string path;
+        RegisteredKind kind = ForestFile;
+        //only read and written with std::atomic_load/atomic_store
+        std::shared_ptr<ModelVersion> current;
+        //watcher thread only once started
+        FileStamp loaded;
+        FileStamp seen;
+        long versions = 0;
+    };
+
+    vector<std::unique_ptr<Entry>> m_entries;
+    vector<std::unique_ptr<RegisteredModel>> m_handles;
+    //not owned, saved RF predictions are queued here
+    HistoryStore* m_historyStore = nullptr;
+    int m_cacheCapacity = 4096;
+    int m_pollIntervalMs = 5000;
+
+    std::thread m_watcher;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_stopping = false;
+    std::atomic<long> m_reloads;
+    std::atomic<long> m_rejected;
+
+    static FileStamp stampFile(const string& path);
+    static bool isSameFile(const FileStamp& a, const FileStamp& b);
+    static bool isPlausible(Model& model, int outputs);
+    std::shared_ptr<ModelVersion> loadVersion(const Entry& entry) const;
+    bool reload(Entry& entry, const FileStamp& stamp);
+    void watcherLoop();
+
+public:
+    ModelRegistry();
+    ~ModelRegistry();
+    ModelRegistry(const ModelRegistry&) = delete;
+    ModelRegistry& operator=(const ModelRegistry&) = delete;
+
+    void setHistoryStore(HistoryStore* historyStore);
+    void setCacheCapacity(int cacheCapacity);
+    void setPollIntervalMs(int pollIntervalMs);
+
+    int addModel(const string& name, const string& path,
+                 RegisteredKind kind);
+    bool hasModel(int slot) const;
+    RegisteredModel* getHandle(int slot) const;
+    std::shared_ptr<ModelVersion> getVersion(int slot) const;
+    int refreshHandles();
+
+    bool start();
+    void stop();
+    long getReloadCount() const;
+    long getRejectedCount() const;
+    void printStatus() const;
+};
+
+#endif // MODELREGISTRY_H
@@ -0,0 +1,279 @@
+/******************************************************************************
+** FILE: PatientSimulator.cpp
+**
+** ABSTRACT:
+** Batch of virtual type 1 patients for closed-loop testing
+** without a Dexcom account. Each patient is a Bergman
+** minimal model with two compartment subcutaneous insulin
+** absorption and two compartment gut absorption, and all
+** patients are integrated together with a fixed-step
+** solver.
+**
+** DOCUMENTS:
+** Bergman RN et al. Quantitative estimation of insulin
+** sensitivity. Am J Physiol 1979.
+** Hovorka R et al. Nonlinear model predictive control of
+** glucose concentration in subjects with type 1 diabetes.
+** Physiol Meas 2004 (absorption compartments).
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** Per minute, for each patient:
+**   dS1 = -S1/tI                    (insulin depot, uU)
+**   dS2 = (S1-S2)/tI
+**   dI  = S2/(tI*VI) - n*I          (plasma insulin, uU/ml)
+**   dX  = -p2*X + p2*SI*I           (insulin action, 1/min)
+**   dQ1 = -Q1/tG                    (stomach, mg)
+**   dQ2 = (Q1-Q2)/tG                (intestine, mg)
+**   dG  = -(p1+X)*G + p1*Gb + Q2/(tG*VG)
+** The rates are all well under 1/min so forward Euler at
+** half a minute is stable and accurate enough for 5 min
+** CGM readings.
+**
+******************************************************************************/
+
+#include "PatientSimulator.h"
+#include <iostream>
+#include <math.h>
+#include <random>
+
+namespace
+{
+const double kMicroUnitsPerUnit = 1e6;
+const double kMilligramsPerGram = 1000.0;
+const double kCarbBioavailability = 0.8;
+const double kMinGlucose = 10.0;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getPatientCount
+Purpose:  Returns the number of virtual patients in the batch.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int PatientSimulator::getPatientCount() const
+{
+    return m_patientCount;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getStepMinutes
+Purpose:  Returns the fixed integration step in minutes.
+Receive:  N/A
+Return:   double
+-----------------------------------------------------------------------------*/
+double PatientSimulator::getStepMinutes() const
+{
+    return m_stepMinutes;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setStepMinutes
+Purpose:  Sets the fixed integration step in minutes.
+Receive:  double stepMinutes
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void PatientSimulator::setStepMinutes(double stepMinutes)
+{
+    if(stepMinutes>0.0){
+        m_stepMinutes = stepMinutes;
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     addPatients
+Purpose:  Samples count new patients around population values for adults
+          with type 1 diabetes and starts them at their basal glucose with no
+          insulin or carbs on board.
+Receive:  int count, unsigned int seed
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void PatientSimulator::addPatients(int count, unsigned int seed)
+{
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::normal_distribution<double> normal(0.0, 1.0);
+    for(int i=0; i<count; i++){
+        double bodyWeight = 50.0+50.0*unit(generator);
+        double basal = 100.0+40.0*unit(generator);
+        m_basalGlucose.push_back(basal);
+        m_glucoseEffectiveness.push_back(0.002*exp(0.3*normal(generator)));
+        m_insulinActionDecay.push_back(0.025);
+        m_insulinSensitivity.push_back(1.2e-3*exp(0.35*normal(generator)));
+        m_insulinClearance.push_back(0.138);
+        m_insulinVolume.push_back(120.0*bodyWeight);
+        m_glucoseVolume.push_back(1.6*bodyWeight);
+        m_insulinPeak.push_back(45.0+25.0*unit(generator));
+        m_mealPeak.push_back(30.0+30.0*unit(generator));
+
+        m_glucose.push_back(basal);
+        m_insulinAction.push_back(0.0);
+        m_plasmaInsulin.push_back(0.0);
+        m_insulinDepot.push_back(0.0);
+        m_insulinTransit.push_back(0.0);
+        m_gutStomach.push_back(0.0);
+        m_gutIntestine.push_back(0.0);
+    }
+    m_patientCount += count;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     addBolus
+Purpose:  Injects a subcutaneous bolus into one patient's insulin depot.
+Receive:  int patient, double units
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void PatientSimulator::addBolus(int patient, double units)
+{
+    if(patient<0 || patient>=m_patientCount || units<=0.0){
+        return;
+    }
+    m_insulinDepot[patient] += units*kMicroUnitsPerUnit;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     addMeal
+Purpose:  Puts a meal into one patient's stomach.
+Receive:  int patient, double grams of carbohydrate
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void PatientSimulator::addMeal(int patient, double grams)
+{
+    if(patient<0 || patient>=m_patientCount || grams<=0.0){
+        return;
+    }
+    m_gutStomach[patient] += grams*kMilligramsPerGram*kCarbBioavailability;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     step
+Purpose:  Advances every patient by one forward Euler step.
+Receive:  double dt in minutes
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void PatientSimulator::step(double dt)
+{
+    const double* __restrict gb = m_basalGlucose.data();
+    const double* __restrict p1 = m_glucoseEffectiveness.data();
+    const double* __restrict p2 = m_insulinActionDecay.data();
+    const double* __restrict si = m_insulinSensitivity.data();
+    const double* __restrict n = m_insulinClearance.data();
+    const double* __restrict vi = m_insulinVolume.data();
+    const double* __restrict vg = m_glucoseVolume.data();
+    const double* __restrict ti = m_insulinPeak.data();
+    const double* __restrict tg = m_mealPeak.data();
+    double* __restrict g = m_glucose.data();
+    double* __restrict x = m_insulinAction.data();
+    double* __restrict plasma = m_plasmaInsulin.data();
+    double* __restrict s1 = m_insulinDepot.data();
+    double* __restrict s2 = m_insulinTransit.data();
+    double* __restrict q1 = m_gutStomach.data();
+    double* __restrict q2 = m_gutIntestine.data();
+    for(int i=0; i<m_patientCount; i++){
+        double absorbed = s1[i]/ti[i];
+        double appearing = s2[i]/ti[i];
+        double emptied = q1[i]/tg[i];
+        double digested = q2[i]/tg[i];
+        double dG = -(p1[i]+x[i])*g[i]+p1[i]*gb[i]+digested/vg[i];
+        double dX = -p2[i]*x[i]+p2[i]*si[i]*plasma[i];
+        double dI = appearing/vi[i]-n[i]*plasma[i];
+        s1[i] -= dt*absorbed;
+        s2[i] += dt*(absorbed-appearing);
+        q1[i] -= dt*emptied;
+        q2[i] += dt*(emptied-digested);
+        plasma[i] += dt*dI;
+        x[i] += dt*dX;
+        double next = g[i]+dt*dG;
+        g[i] = next<kMinGlucose ? kMinGlucose : next;
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     advance
+Purpose:  Integrates every patient forward by the given time in fixed steps.
+Receive:  double minutes
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void PatientSimulator::advance(double minutes)
+{
+    int steps = (int)ceil(minutes/m_stepMinutes-1e-9);
+    if(steps<=0){
+        return;
+    }
+    double dt = minutes/steps;
+    for(int k=0; k<steps; k++){
+        step(dt);
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getGlucose
+Purpose:  Returns a patient's true plasma glucose in mg/dl.
+Receive:  int patient
+Return:   double
+-----------------------------------------------------------------------------*/
+double PatientSimulator::getGlucose(int patient) const
+{
+    return m_glucose[patient];
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getBasalGlucose
+Purpose:  Returns the glucose a patient settles at with no meal or bolus
+          acting.
+Receive:  int patient
+Return:   double
+-----------------------------------------------------------------------------*/
+double PatientSimulator::getBasalGlucose(int patient) const
+{
+    return m_basalGlucose[patient];
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getCorrectionFactor
+Purpose:  Returns how far one unit lowers a patient's glucose, the correction
+          factor a clinician would titrate for them. Two copies of the
+          patient start at rest from the given glucose, one gets a 1 U bolus,
+          and the difference between them after the given time is the drop.
+          Insulin action is proportional to glucose in this model, so the
+          factor depends on the glucose it is measured from.
+Receive:  int patient, double startGlucose in mg/dl, double minutes
+Return:   double mg/dl per unit, 0 for an unknown patient
+-----------------------------------------------------------------------------*/
+double PatientSimulator::getCorrectionFactor(int patient, double startGlucose,
+                                             double minutes) const
+{
+    if(patient<0 || patient>=m_patientCount){
+        return 0.0;
+    }
+    PatientSimulator pair;
+    pair.m_stepMinutes = m_stepMinutes;
+    for(int i=0; i<2; i++){
+        pair.m_basalGlucose.push_back(m_basalGlucose[patient]);
+        pair.m_glucoseEffectiveness.push_back(m_glucoseEffectiveness[patient]);
+        pair.m_insulinActionDecay.push_back(m_insulinActionDecay[patient]);
+        pair.m_insulinSensitivity.push_back(m_insulinSensitivity[patient]);
+        pair.m_insulinClearance.push_back(m_insulinClearance[patient]);
+        pair.m_insulinVolume.push_back(m_insulinVolume[patient]);
+        pair.m_glucoseVolume.push_back(m_glucoseVolume[patient]);
+        pair.m_insulinPeak.push_back(m_insulinPeak[patient]);
+        pair.m_mealPeak.push_back(m_mealPeak[patient]);
+
+        pair.m_glucose.push_back(startGlucose);
+        pair.m_insulinAction.push_back(0.0);
+        pair.m_plasmaInsulin.push_back(0.0);
+        pair.m_insulinDepot.push_back(0.0);
+        pair.m_insulinTransit.push_back(0.0);
+        pair.m_gutStomach.push_back(0.0);
+        pair.m_gutIntestine.push_back(0.0);
+    }
+    pair.m_patientCount = 2;
+    pair.addBolus(1, 1.0);
+    pair.advance(minutes);
+    return pair.m_glucose[0]-pair.m_glucose[1];
+}
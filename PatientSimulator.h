@@ -0,0 +1,85 @@
+/******************************************************************************
+** FILE: PatientSimulator.h
+**
+** ABSTRACT:
+** Batch of virtual type 1 patients for closed-loop testing
+** without a Dexcom account. Each patient is a Bergman
+** minimal model with two compartment subcutaneous insulin
+** absorption and two compartment gut absorption, and all
+** patients are integrated together with a fixed-step
+** solver.
+**
+** DOCUMENTS:
+** Bergman RN et al. Quantitative estimation of insulin
+** sensitivity. Am J Physiol 1979.
+** Hovorka R et al. Nonlinear model predictive control of
+** glucose concentration in subjects with type 1 diabetes.
+** Physiol Meas 2004 (absorption compartments).
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** State and parameters are stored one array per quantity
+** (structure of arrays) so the step loop runs over plain
+** contiguous doubles and vectorizes across patients.
+** Basal insulin is assumed to hold each patient at their
+** basal glucose; the state tracks insulin above basal.
+**
+******************************************************************************/
+
+#ifndef PATIENTSIMULATOR_H
+#define PATIENTSIMULATOR_H
+
+#include <vector>
+using std::vector;
+
+class PatientSimulator
+{
+protected:
+    int m_patientCount = 0;
+    double m_stepMinutes = 0.5;
+
+    //parameters
+    vector<double> m_basalGlucose;
+    vector<double> m_glucoseEffectiveness;
+    vector<double> m_insulinActionDecay;
+    vector<double> m_insulinSensitivity;
+    vector<double> m_insulinClearance;
+    vector<double> m_insulinVolume;
+    vector<double> m_glucoseVolume;
+    vector<double> m_insulinPeak;
+    vector<double> m_mealPeak;
+
+    //state
+    vector<double> m_glucose;
+    vector<double> m_insulinAction;
+    vector<double> m_plasmaInsulin;
+    vector<double> m_insulinDepot;
+    vector<double> m_insulinTransit;
+    vector<double> m_gutStomach;
+    vector<double> m_gutIntestine;
+
+    void step(double dt);
+
+public:
+    PatientSimulator() = default;
+    ~PatientSimulator() = default;
+
+    int getPatientCount() const;
+    double getStepMinutes() const;
+    void setStepMinutes(double stepMinutes);
+    void addPatients(int count, unsigned int seed);
+    void addBolus(int patient, double units);
+    void addMeal(int patient, double grams);
+    void advance(double minutes);
+    double getGlucose(int patient) const;
+    double getBasalGlucose(int patient) const;
+    double getCorrectionFactor(int patient, double startGlucose,
+                               double minutes) const;
+};
+
+#endif // PATIENTSIMULATOR_H
@@ -0,0 +1,275 @@
+/******************************************************************************
+** FILE: PredictionMetrics.cpp
+**
+** ABSTRACT:
+** Running per-horizon accuracy of the predicted
+** trajectories (MAE, RMSE, MARD and Clarke error grid
+** zones), updated as each BG reading arrives.
+**
+** DOCUMENTS:
+** Clarke WL et al. Evaluating clinical accuracy of systems
+** for self-monitoring of blood glucose. Diabetes Care 1987.
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+**
+******************************************************************************/
+
+#include "PredictionMetrics.h"
+#include "Logger.h"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+
+/*-----------------------------------------------------------------------------
+Name:     PredictionMetrics
+Purpose:  Constructor.
+Receive:  int horizon number of predictions per trajectory
+Return:   N/A
+-----------------------------------------------------------------------------*/
+PredictionMetrics::PredictionMetrics(int horizon) :
+    m_horizons(horizon)
+{
+}
+
+/*-----------------------------------------------------------------------------
+Name:     clarkeZone
+Purpose:  Classifies a prediction on the Clarke error grid. A is clinically
+          accurate, B benign, C would cause unnecessary treatment, D misses
+          a hypo or hyper and E would treat the opposite way.
+Receive:  double reference observed BG, double predicted BG, in mg/dl
+Return:   ClarkeZone
+-----------------------------------------------------------------------------*/
+PredictionMetrics::ClarkeZone PredictionMetrics::clarkeZone(double reference,
+                                                            double predicted)
+{
+    if((reference<=70 && predicted<=70) ||
+       (predicted<=1.2*reference && predicted>=0.8*reference)){
+        return ZoneA;
+    }
+    if((reference>=180 && predicted<=70) ||
+       (reference<=70 && predicted>=180)){
+        return ZoneE;
+    }
+    if((reference>=70 && reference<=290 && predicted>=reference+110) ||
+       (reference>=130 && reference<=180 &&
+        predicted<=(7.0/5.0)*reference-182)){
+        return ZoneC;
+    }
+    if((reference>=240 && predicted>=70 && predicted<=180) ||
+       (reference<=175.0/3.0 && predicted<=180 && predicted>=70) ||
+       (reference>=175.0/3.0 && reference<=70 &&
+        predicted>=(6.0/5.0)*reference)){
+        return ZoneD;
+    }
+    return ZoneB;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getHorizon
+Purpose:  Returns the number of horizons tracked.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int PredictionMetrics::getHorizon() const
+{
+    return m_horizons.size();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     update
+Purpose:  Scores every stored trajectory that predicted this reading. The
+          ring is walked back from the newest trajectory only as far as the
+          longest horizon, so the cost is O(horizon) whatever the ring's
+          size. A trajectory counts for horizon h when it was made
+          (h+1)*5 minutes, give or take half a step, before the reading.
+Receive:  const TrajectoryRing& trajectories
+          double sampleTime, double observedBG of the new reading
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void PredictionMetrics::update(const TrajectoryRing &trajectories,
+                               double sampleTime, double observedBG)
+{
+    int horizon = std::min((int)m_horizons.size(), trajectories.getWidth());
+    double oldest = sampleTime-(horizon+0.5)*m_stepSeconds;
+    for(int i=trajectories.getSize()-1; i>=0; i--){
+        double age = sampleTime-trajectories.getSampleTimeAt(i);
+        if(trajectories.getSampleTimeAt(i)<oldest){
+            break;
+        }
+        int h = (int)std::lround(age/m_stepSeconds)-1;
+        if(h<0 || h>=horizon ||
+           std::fabs(age-(h+1)*m_stepSeconds)>0.5*m_stepSeconds){
+            continue;
+        }
+        add(h, trajectories.getTrajectoryAt(i)[h], observedBG);
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     add
+Purpose:  Adds one prediction and the reading it predicted to a horizon.
+Receive:  int horizon, double predicted, double observedBG
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void PredictionMetrics::add(int horizon, double predicted, double observedBG)
+{
+    if(horizon<0 || horizon>=m_horizons.size() || observedBG<=0){
+        return;
+    }
+    HorizonSums& sums = m_horizons[horizon];
+    double error = predicted-observedBG;
+    sums.count++;
+    sums.absoluteError += std::fabs(error);
+    sums.squaredError += error*error;
+    sums.relativeError += std::fabs(error)/observedBG;
+    sums.zones[clarkeZone(observedBG, predicted)]++;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     merge
+Purpose:  Adds another set of metrics to this one, e.g. to pool patients.
+Receive:  const PredictionMetrics& other
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void PredictionMetrics::merge(const PredictionMetrics &other)
+{
+    int horizon = std::min(m_horizons.size(), other.m_horizons.size());
+    for(int h=0; h<horizon; h++){
+        HorizonSums& sums = m_horizons[h];
+        const HorizonSums& added = other.m_horizons[h];
+        sums.count += added.count;
+        sums.absoluteError += added.absoluteError;
+        sums.squaredError += added.squaredError;
+        sums.relativeError += added.relativeError;
+        for(int zone=0; zone<ZoneCount; zone++){
+            sums.zones[zone] += added.zones[zone];
+        }
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getCount
+Purpose:  Returns the number of predictions scored at a horizon.
+Receive:  int horizon
+Return:   long
+-----------------------------------------------------------------------------*/
+long PredictionMetrics::getCount(int horizon) const
+{
+    return m_horizons[horizon].count;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getMAE
+Purpose:  Returns the mean absolute error at a horizon.
+Receive:  int horizon
+Return:   double mg/dl, 0 before any prediction is scored
+-----------------------------------------------------------------------------*/
+double PredictionMetrics::getMAE(int horizon) const
+{
+    const HorizonSums& sums = m_horizons[horizon];
+    return sums.count ? sums.absoluteError/sums.count : 0.0;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getRMSE
+Purpose:  Returns the root mean squared error at a horizon.
+Receive:  int horizon
+Return:   double mg/dl, 0 before any prediction is scored
+-----------------------------------------------------------------------------*/
+double PredictionMetrics::getRMSE(int horizon) const
+{
+    const HorizonSums& sums = m_horizons[horizon];
+    return sums.count ? std::sqrt(sums.squaredError/sums.count) : 0.0;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getMARD
+Purpose:  Returns the mean absolute relative difference at a horizon.
+Receive:  int horizon
+Return:   double percent, 0 before any prediction is scored
+-----------------------------------------------------------------------------*/
+double PredictionMetrics::getMARD(int horizon) const
+{
+    const HorizonSums& sums = m_horizons[horizon];
+    return sums.count ? 100.0*sums.relativeError/sums.count : 0.0;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getZoneFraction
+Purpose:  Returns the fraction of predictions at a horizon in a Clarke zone.
+Receive:  int horizon, ClarkeZone zone
+Return:   double 0-1
+-----------------------------------------------------------------------------*/
+double PredictionMetrics::getZoneFraction(int horizon, ClarkeZone zone) const
+{
+    const HorizonSums& sums = m_horizons[horizon];
+    return sums.count ? (double)sums.zones[zone]/sums.count : 0.0;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     reset
+Purpose:  Clears every sum.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void PredictionMetrics::reset()
+{
+    m_horizons.assign(m_horizons.size(), HorizonSums());
+}
+
+/*-----------------------------------------------------------------------------
+Name:     print
+Purpose:  Sends one line per horizon to the console, for the offline tools.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void PredictionMetrics::print() const
+{
+    std::cout << std::setw(7) << "Minutes" << std::setw(7) << "N"
+              << std::setw(7) << "MAE" << std::setw(7) << "RMSE"
+              << std::setw(8) << "MARD%" << std::setw(8) << "A%"
+              << std::setw(8) << "B%" << std::setw(9) << "C+D+E%"
+              << std::endl;
+    for(int h=0; h<m_horizons.size(); h++){
+        double other = getZoneFraction(h, ZoneC)+getZoneFraction(h, ZoneD)+
+                       getZoneFraction(h, ZoneE);
+        std::cout << std::fixed << std::setprecision(1)
+                  << std::setw(7) << (h+1)*m_stepSeconds/60.0
+                  << std::setw(7) << getCount(h)
+                  << std::setw(7) << getMAE(h)
+                  << std::setw(7) << getRMSE(h)
+                  << std::setw(8) << getMARD(h)
+                  << std::setw(8) << 100.0*getZoneFraction(h, ZoneA)
+                  << std::setw(8) << 100.0*getZoneFraction(h, ZoneB)
+                  << std::setw(9) << 100.0*other << std::endl;
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     logAccuracy
+Purpose:  Sends the same line per horizon as print through the logger, so
+          the control thread only queues records and never writes to the
+          console itself. Values are rounded to a tenth.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void PredictionMetrics::logAccuracy() const
+{
+    auto tenth = [](double value){ return std::round(value*10.0)/10.0; };
+    for(int h=0; h<m_horizons.size(); h++){
+        double other = getZoneFraction(h, ZoneC)+getZoneFraction(h, ZoneD)+
+                       getZoneFraction(h, ZoneE);
+        LOG_INFO("Prediction accuracy {} min: N {} MAE {} RMSE {} MARD {}% "
+                 "A {}% B {}% C+D+E {}%", (h+1)*m_stepSeconds/60.0,
+                 getCount(h), tenth(getMAE(h)), tenth(getRMSE(h)),
+                 tenth(getMARD(h)), tenth(100.0*getZoneFraction(h, ZoneA)),
+                 tenth(100.0*getZoneFraction(h, ZoneB)), tenth(100.0*other));
+    }
+}
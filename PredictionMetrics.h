@@ -0,0 +1,78 @@
+/******************************************************************************
+** FILE: PredictionMetrics.h
+**
+** ABSTRACT:
+** Running per-horizon accuracy of the predicted
+** trajectories (MAE, RMSE, MARD and Clarke error grid
+** zones), updated as each BG reading arrives.
+**
+** DOCUMENTS:
+** Clarke WL et al. Evaluating clinical accuracy of systems
+** for self-monitoring of blood glucose. Diabetes Care 1987.
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** Horizon h (0 based) is the prediction (h+1)*5 minutes
+** after the cycle's sample time. Only sums are kept, so an
+** update is O(horizon) and memory does not grow.
+**
+******************************************************************************/
+
+#ifndef PREDICTIONMETRICS_H
+#define PREDICTIONMETRICS_H
+
+#include <vector>
+#include "TrajectoryRing.h"
+using std::vector;
+
+class PredictionMetrics
+{
+public:
+    enum ClarkeZone
+    {
+        ZoneA,
+        ZoneB,
+        ZoneC,
+        ZoneD,
+        ZoneE,
+        ZoneCount
+    };
+
+protected:
+    struct HorizonSums
+    {
+        long count = 0;
+        double absoluteError = 0.0;
+        double squaredError = 0.0;
+        double relativeError = 0.0;
+        long zones[ZoneCount] = {0, 0, 0, 0, 0};
+    };
+    vector<HorizonSums> m_horizons;
+    double m_stepSeconds = 300.0;
+
+public:
+    explicit PredictionMetrics(int horizon = 18);
+    ~PredictionMetrics() = default;
+
+    static ClarkeZone clarkeZone(double reference, double predicted);
+    int getHorizon() const;
+    void update(const TrajectoryRing& trajectories, double sampleTime,
+                double observedBG);
+    void add(int horizon, double predicted, double observedBG);
+    void merge(const PredictionMetrics& other);
+    long getCount(int horizon) const;
+    double getMAE(int horizon) const;
+    double getRMSE(int horizon) const;
+    double getMARD(int horizon) const;
+    double getZoneFraction(int horizon, ClarkeZone zone) const;
+    void reset();
+    void print() const;
+    void logAccuracy() const;
+};
+
+#endif // PREDICTIONMETRICS_H
@@ -0,0 +1,408 @@
+/******************************************************************************
+** FILE: ProjectionCache.cpp
+**
+** ABSTRACT:
+** Bounded lock-free hash table of model trajectories keyed
+** by quantised model inputs.
+**
+** DOCUMENTS:
+** Boehm, Can seqlocks get along with programming language
+** memory models? (the reader and writer fences used here)
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+**
+******************************************************************************/
+
+#include "ProjectionCache.h"
+#include "MetricsRegistry.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+namespace {
+    //Dexcom reports whole mg/dl, pumps deliver in 0.05 U steps
+    const double kBGResolution = 1.0;
+    const double kInsulinResolution = 0.05;
+    const int kGenerationIndex = 0;
+    const int kKindIndex = 1;
+    const int kSensitivityIndex = 2;
+    const int kBGCountIndex = 3;
+    const int kInsulinCountIndex = 4;
+    const int kFirstInput = 5;
+
+    int32_t quantise(double value, double resolution)
+    {
+        return (int32_t)std::lround(value/resolution);
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     set
+Purpose:  Fills the key from a model call's inputs, quantised to sensor and
+          pump resolution.
+Receive:  int32_t generation, from the cache the key is used with
+          int kind, which model entry point the inputs are for
+          int sensitivity, const vector<double>& bgInputs,
+          const vector<float>& insulinInputs
+Return:   bool false if there are more inputs than a key holds
+-----------------------------------------------------------------------------*/
+bool ProjectionKey::set(int32_t generation, int kind, int sensitivity,
+                        const vector<double> &bgInputs,
+                        const vector<float> &insulinInputs)
+{
+    if(bgInputs.size()>kMaxBGInputs ||
+       insulinInputs.size()>kMaxInsulinInputs){
+        return false;
+    }
+    std::fill(values, values+kValues, 0);
+    values[kGenerationIndex] = generation;
+    values[kKindIndex] = kind;
+    values[kSensitivityIndex] = sensitivity;
+    values[kBGCountIndex] = bgInputs.size();
+    values[kInsulinCountIndex] = insulinInputs.size();
+    int32_t* bg = values+kFirstInput;
+    int32_t* insulin = bg+kMaxBGInputs;
+    for(int i=0; i<bgInputs.size(); i++){
+        bg[i] = quantise(bgInputs[i], kBGResolution);
+    }
+    for(int k=0; k<insulinInputs.size(); k++){
+        insulin[k] = quantise(insulinInputs[k], kInsulinResolution);
+    }
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getBGInputs
+Purpose:  Returns the quantised BG inputs the key stands for.
+Receive:  N/A
+Return:   vector<double>
+-----------------------------------------------------------------------------*/
+vector<double> ProjectionKey::getBGInputs() const
+{
+    vector<double> bgInputs(values[kBGCountIndex]);
+    for(int i=0; i<bgInputs.size(); i++){
+        bgInputs[i] = values[kFirstInput+i]*kBGResolution;
+    }
+    return bgInputs;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getInsulinInputs
+Purpose:  Returns the quantised insulin inputs the key stands for.
+Receive:  N/A
+Return:   vector<float>
+-----------------------------------------------------------------------------*/
+vector<float> ProjectionKey::getInsulinInputs() const
+{
+    vector<float> insulinInputs(values[kInsulinCountIndex]);
+    for(int k=0; k<insulinInputs.size(); k++){
+        insulinInputs[k] = values[kFirstInput+kMaxBGInputs+k]*
+                           kInsulinResolution;
+    }
+    return insulinInputs;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     hash
+Purpose:  Mixes every key value into 64 bits (splitmix64 finaliser).
+Receive:  N/A
+Return:   uint64_t
+-----------------------------------------------------------------------------*/
+uint64_t ProjectionKey::hash() const
+{
+    uint64_t hash = 0x9E3779B97F4A7C15ull;
+    for(int i=0; i<kValues; i++){
+        hash ^= (uint32_t)values[i];
+        hash *= 0xBF58476D1CE4E5B9ull;
+        hash ^= hash>>31;
+    }
+    hash ^= hash>>30;
+    hash *= 0x94D049BB133111EBull;
+    return hash^(hash>>31);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     ProjectionCache
+Purpose:  Constructor. Rounds the capacity up to a power of two, at least
+          one pair of slots.
+Receive:  int capacity, entries
+Return:   N/A
+-----------------------------------------------------------------------------*/
+ProjectionCache::ProjectionCache(int capacity) :
+    m_hits(0),
+    m_misses(0),
+    m_stores(0),
+    m_contended(0),
+    m_generation(0)
+{
+    uint64_t slots = kWays;
+    while(slots<capacity){
+        slots <<= 1;
+    }
+    //value initialised, every sequence and word starts at zero
+    m_slots.reset(new Slot[slots]());
+    m_mask = slots-1;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getCapacity
+Purpose:  Returns the number of entries the cache holds.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int ProjectionCache::getCapacity() const
+{
+    return m_mask+1;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getGeneration
+Purpose:  Returns the generation keys must be set with to hit.
+Receive:  N/A
+Return:   int32_t
+-----------------------------------------------------------------------------*/
+int32_t ProjectionCache::getGeneration() const
+{
+    return m_generation.load(std::memory_order_acquire);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     lookup
+Purpose:  Copies out the trajectory stored for a key. Never waits, a slot
+          being written counts as a miss.
+Receive:  const ProjectionKey& key, vector<double>& outputs, filled on a hit
+Return:   bool true on a hit
+-----------------------------------------------------------------------------*/
+bool ProjectionCache::lookup(const ProjectionKey &key, vector<double> &outputs)
+{
+    uint64_t words[kSlotWords];
+    bool hit = false;
+    uint64_t keyWords[kKeyWords] = {};
+    std::memcpy(keyWords, key.values, sizeof(key.values));
+    uint64_t index = key.hash()&m_mask;
+    for(int way=0; !hit && way<kWays &&
+        key.values[kGenerationIndex]==getGeneration(); way++){
+        Slot& slot = m_slots[index^way];
+        uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if(sequence&1){
+            continue;
+        }
+        for(int i=0; i<kSlotWords; i++){
+            words[i] = slot.words[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        hit = slot.sequence.load(std::memory_order_relaxed)==sequence &&
+              std::equal(keyWords, keyWords+kKeyWords, words) &&
+              words[kKeyWords]<=kMaxOutputs;
+    }
+    if(!hit){
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        if(m_missMetric){
+            m_missMetric->add();
+        }
+        return false;
+    }
+    outputs.resize(words[kKeyWords]);
+    std::memcpy(outputs.data(), words+kKeyWords+1,
+                outputs.size()*sizeof(double));
+    m_hits.fetch_add(1, std::memory_order_relaxed);
+    if(m_hitMetric){
+        m_hitMetric->add();
+    }
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     chooseWay
+Purpose:  Picks which slot of a key's pair a store goes to: the one already
+          holding the key, else one holding nothing current, else one picked
+          by the hash. Reads the slots without their sequence, a wrong pick
+          only costs an entry.
+Receive:  uint64_t hash, const uint64_t* words, the key's words
+Return:   int way
+-----------------------------------------------------------------------------*/
+int ProjectionCache::chooseWay(uint64_t hash, const uint64_t *words) const
+{
+    uint64_t index = hash&m_mask;
+    int32_t generation = getGeneration();
+    for(int way=0; way<kWays; way++){
+        const Slot& slot = m_slots[index^way];
+        int i = 0;
+        while(i<kKeyWords && slot.words[i].load(std::memory_order_relaxed)==
+              words[i]){
+            i++;
+        }
+        if(i==kKeyWords){
+            return way;
+        }
+    }
+    for(int way=0; way<kWays; way++){
+        //generation in the low half of the first word, kind in the high
+        uint64_t first = m_slots[index^way].words[0].load(
+                    std::memory_order_relaxed);
+        if((int32_t)(uint32_t)first!=generation || !(first>>32)){
+            return way;
+        }
+    }
+    return (hash>>63)%kWays;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     store
+Purpose:  Stores a trajectory under a key, replacing the slot's entry.
+          Dropped if another thread is writing the slot or the cache was
+          cleared since the key was made.
+Receive:  const ProjectionKey& key, const vector<double>& outputs
+Return:   bool true if stored
+-----------------------------------------------------------------------------*/
+bool ProjectionCache::store(const ProjectionKey &key,
+                            const vector<double> &outputs)
+{
+    if(outputs.size()>kMaxOutputs ||
+       key.values[kGenerationIndex]!=getGeneration()){
+        return false;
+    }
+    uint64_t words[kSlotWords] = {};
+    std::memcpy(words, key.values, sizeof(key.values));
+    words[kKeyWords] = outputs.size();
+    std::memcpy(words+kKeyWords+1, outputs.data(),
+                outputs.size()*sizeof(double));
+
+    uint64_t hash = key.hash();
+    Slot& slot = m_slots[(hash&m_mask)^chooseWay(hash, words)];
+    uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+    if((sequence&1) || !slot.sequence.compare_exchange_strong(sequence,
+                                sequence+1, std::memory_order_relaxed)){
+        m_contended.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    for(int i=0; i<kSlotWords; i++){
+        slot.words[i].store(words[i], std::memory_order_relaxed);
+    }
+    slot.sequence.store(sequence+2, std::memory_order_release);
+    m_stores.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     clear
+Purpose:  Invalidates every entry, for when the model behind the cache
+          changes.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ProjectionCache::clear()
+{
+    m_generation.fetch_add(1, std::memory_order_acq_rel);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setMetricsName
+Purpose:  Also counts hits and misses in the metrics registry, labelled
+          with the cached model's name. Call before the cache is shared
+          between threads.
+Receive:  const string& name, of the cached model
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ProjectionCache::setMetricsName(const string &name)
+{
+    const char* help = "Projection cache lookups by result";
+    string label = "cache=\""+name+"\",result=";
+    m_hitMetric = &MetricsRegistry::get().counter("ags_cache_lookups_total",
+                                                  help, label+"\"hit\"");
+    m_missMetric = &MetricsRegistry::get().counter("ags_cache_lookups_total",
+                                                   help, label+"\"miss\"");
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getHits
+Purpose:  Returns the number of lookups that hit.
+Receive:  N/A
+Return:   long
+-----------------------------------------------------------------------------*/
+long ProjectionCache::getHits() const
+{
+    return m_hits.load(std::memory_order_relaxed);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getMisses
+Purpose:  Returns the number of lookups that missed.
+Receive:  N/A
+Return:   long
+-----------------------------------------------------------------------------*/
+long ProjectionCache::getMisses() const
+{
+    return m_misses.load(std::memory_order_relaxed);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getStores
+Purpose:  Returns the number of trajectories stored.
+Receive:  N/A
+Return:   long
+-----------------------------------------------------------------------------*/
+long ProjectionCache::getStores() const
+{
+    return m_stores.load(std::memory_order_relaxed);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getContended
+Purpose:  Returns the number of stores dropped because another thread was
+          writing the same slot.
+Receive:  N/A
+Return:   long
+-----------------------------------------------------------------------------*/
+long ProjectionCache::getContended() const
+{
+    return m_contended.load(std::memory_order_relaxed);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getHitRate
+Purpose:  Returns the fraction of lookups that hit.
+Receive:  N/A
+Return:   double
+-----------------------------------------------------------------------------*/
+double ProjectionCache::getHitRate() const
+{
+    long hits = getHits();
+    long lookups = hits+getMisses();
+    return lookups ? (double)hits/lookups : 0.0;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     resetStats
+Purpose:  Zeroes the hit, miss and store counters.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ProjectionCache::resetStats()
+{
+    m_hits = 0;
+    m_misses = 0;
+    m_stores = 0;
+    m_contended = 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     printStats
+Purpose:  Prints the hit rate and counters.
+Receive:  const char* name, of the cached model
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ProjectionCache::printStats(const char *name) const
+{
+    std::cout << name << " cache: " << getHits() << " hits, " << getMisses()
+              << " misses (" << 100.0*getHitRate() << "%), " << getStores()
+              << " stores, " << getContended() << " contended" << std::endl;
+}
@@ -0,0 +1,118 @@
+/******************************************************************************
+** FILE: ProjectionCache.h
+**
+** ABSTRACT:
+** Bounded lock-free hash table of model trajectories keyed
+** by the model's inputs quantised to sensor and pump
+** resolution (1 mg/dl, 0.05 U). Lets repeated model
+** evaluations across cycles and between neighbouring bolus
+** candidates become lookups.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** Two way set associative: a key lives in one of a pair of
+** slots, and a store replaces the pair's stale or hashed
+** slot.
+** Each slot is guarded by a sequence counter: a writer
+** makes it odd while it copies the entry in, a reader
+** retries nothing and simply misses if the counter was
+** odd or changed under it. A store that finds the slot
+** being written by another thread is dropped, so neither
+** side ever waits. Entries are kept as atomic words so
+** the racing copies are well defined.
+**
+******************************************************************************/
+
+#ifndef PROJECTIONCACHE_H
+#define PROJECTIONCACHE_H
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+class MetricCounter;
+
+//a quantised model input row, the cache key
+struct ProjectionKey
+{
+    static const int kMaxBGInputs = 6;
+    static const int kMaxInsulinInputs = 19;
+    //generation, kind, sensitivity, input counts, then the inputs
+    static const int kValues = 5+kMaxBGInputs+kMaxInsulinInputs;
+
+    int32_t values[kValues] = {};
+
+    bool set(int32_t generation, int kind, int sensitivity,
+             const vector<double>& bgInputs,
+             const vector<float>& insulinInputs);
+    vector<double> getBGInputs() const;
+    vector<float> getInsulinInputs() const;
+    uint64_t hash() const;
+};
+
+class ProjectionCache
+{
+public:
+    static const int kMaxOutputs = 18;
+
+protected:
+    static const int kKeyWords = (ProjectionKey::kValues+1)/2;
+    static const int kSlotWords = kKeyWords+1+kMaxOutputs;
+    static const int kWays = 2;
+
+    struct Slot
+    {
+        std::atomic<uint32_t> sequence;
+        //key, output count, outputs
+        std::atomic<uint64_t> words[kSlotWords];
+    };
+
+    std::unique_ptr<Slot[]> m_slots;
+    uint64_t m_mask = 0;
+    std::atomic<long> m_hits;
+    std::atomic<long> m_misses;
+    std::atomic<long> m_stores;
+    //stores dropped because another thread was writing the slot
+    std::atomic<long> m_contended;
+    std::atomic<int32_t> m_generation;
+    //registry counters, null until setMetricsName
+    MetricCounter* m_hitMetric = nullptr;
+    MetricCounter* m_missMetric = nullptr;
+
+    int chooseWay(uint64_t hash, const uint64_t* words) const;
+
+public:
+    explicit ProjectionCache(int capacity = 4096);
+    ~ProjectionCache() = default;
+    ProjectionCache(const ProjectionCache&) = delete;
+    ProjectionCache& operator=(const ProjectionCache&) = delete;
+
+    int getCapacity() const;
+    int32_t getGeneration() const;
+    bool lookup(const ProjectionKey& key, vector<double>& outputs);
+    bool store(const ProjectionKey& key, const vector<double>& outputs);
+    void clear();
+    void setMetricsName(const string& name);
+
+    long getHits() const;
+    long getMisses() const;
+    long getStores() const;
+    long getContended() const;
+    double getHitRate() const;
+    void resetStats();
+    void printStats(const char* name) const;
+};
+
+#endif // PROJECTIONCACHE_H
@@ -0,0 +1,581 @@
+/******************************************************************************
+** FILE: QuantizedForest.cpp
+**
+** ABSTRACT:
+** Compact read-only forest format, written from a
+** DecisionForest and evaluated straight from an mmapped
+** file.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+**
+******************************************************************************/
+
+#include "QuantizedForest.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+namespace {
+    const char kMagic[4] = {'A', 'G', 'S', 'Q'};
+    const uint32_t kVersion = 1;
+    //quantised values span -kQuantizedRange..kQuantizedRange
+    const double kQuantizedRange = 32767.0;
+    const int kMaxSlots = QuantizedForest::kLeafSlot;
+    const int kMaxOutputs = 256;
+    //margin around the thresholds sampled features are drawn from
+    const double kSampleMargin = 0.1;
+
+    //offset and scale mapping [min, max] onto the int16 range
+    void fitRange(double min, double max, float& offset, float& scale)
+    {
+        offset = (min+max)/2.0;
+        scale = max>min ? (max-min)/(2.0*kQuantizedRange) : 1.0;
+    }
+
+    int16_t quantize(double value, float offset, float scale)
+    {
+        double quantized = std::round((value-offset)/scale);
+        return (int16_t)std::max(-kQuantizedRange,
+                                 std::min(kQuantizedRange, quantized));
+    }
+
+    //rounded up in the same float arithmetic predict scales features with,
+    //so a feature equal to the threshold, common with histogram split
+    //edges, still goes left; only values less than one step above it move
+    int16_t quantizeThreshold(float threshold, float offset, float scale)
+    {
+        float scaled = (threshold-offset)/scale;
+        double quantized = std::ceil(scaled);
+        return (int16_t)std::max(-kQuantizedRange,
+                                 std::min(kQuantizedRange, quantized));
+    }
+
+    size_t slotFeatureWords(uint32_t slots)
+    {
+        return (slots+1)&~1u;
+    }
+
+    //writes one tree in preorder, renumbering nodes and leaves
+    struct PreorderWriter
+    {
+        const DecisionForest* forest;
+        const vector<int>* featureSlots;
+        const vector<float>* thresholdOffset;
+        const vector<float>* thresholdScale;
+        const vector<float>* leafOffset;
+        const vector<float>* leafScale;
+        vector<QuantizedNode> nodes;
+        vector<int16_t> leafValues;
+
+        uint32_t write(int index)
+        {
+            const ForestNode& node = forest->getNodes()[index];
+            uint32_t position = nodes.size();
+            nodes.push_back(QuantizedNode());
+            if(node.feature<0){
+                int outputs = forest->getOutputCount();
+                const float* leaf = forest->getLeafValues().data()+node.left;
+                nodes[position].slot = QuantizedForest::kLeafSlot;
+                nodes[position].reserved = 0;
+                nodes[position].threshold = 0;
+                nodes[position].right = leafValues.size()/outputs;
+                for(int k=0; k<outputs; k++){
+                    leafValues.push_back(quantize(leaf[k], (*leafOffset)[k],
+                                                  (*leafScale)[k]));
+                }
+                return position;
+            }
+            int slot = (*featureSlots)[node.feature];
+            nodes[position].slot = slot;
+            nodes[position].reserved = 0;
+            nodes[position].threshold = quantizeThreshold(node.threshold,
+                                                (*thresholdOffset)[slot],
+                                                (*thresholdScale)[slot]);
+            //left is always the next node
+            write(node.left);
+            uint32_t right = write(node.right);
+            nodes[position].right = right;
+            return position;
+        }
+    };
+}
+
+/*-----------------------------------------------------------------------------
+Name:     ~QuantizedForest
+Purpose:  Destructor. Unmaps the file.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+QuantizedForest::~QuantizedForest()
+{
+    close();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     isQuantizedFile
+Purpose:  Checks a file's magic, so loaders can take either forest format.
+Receive:  const string& path
+Return:   bool
+-----------------------------------------------------------------------------*/
+bool QuantizedForest::isQuantizedFile(const string &path)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if(!file){
+        return false;
+    }
+    char magic[4];
+    bool quantized = fread(magic, 1, 4, file)==4 &&
+                     memcmp(magic, kMagic, 4)==0;
+    fclose(file);
+    return quantized;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     write
+Purpose:  Quantises a full precision forest and writes it in this format.
+Receive:  const DecisionForest& forest, const string& path
+Return:   bool false if the forest is invalid, splits on more features than
+          the dictionary holds, or the file wasn't written
+-----------------------------------------------------------------------------*/
+bool QuantizedForest::write(const DecisionForest &forest, const string &path)
+{
+    if(!forest.isValid() || forest.getOutputCount()>kMaxOutputs){
+        std::cerr << "Can't quantise an invalid forest" << std::endl;
+        return false;
+    }
+    const vector<ForestNode>& nodes = forest.getNodes();
+    const vector<float>& leafValues = forest.getLeafValues();
+    int outputs = forest.getOutputCount();
+
+    //dictionary of the features the forest splits on, and their ranges
+    vector<int> featureSlots(forest.getFeatureCount(), -1);
+    vector<uint16_t> slotFeatures;
+    vector<double> thresholdMin;
+    vector<double> thresholdMax;
+    for(int i=0; i<nodes.size(); i++){
+        if(nodes[i].feature<0){
+            continue;
+        }
+        int& slot = featureSlots[nodes[i].feature];
+        if(slot<0){
+            slot = slotFeatures.size();
+            slotFeatures.push_back(nodes[i].feature);
+            thresholdMin.push_back(nodes[i].threshold);
+            thresholdMax.push_back(nodes[i].threshold);
+        }
+        thresholdMin[slot] = std::min<double>(thresholdMin[slot],
+                                              nodes[i].threshold);
+        thresholdMax[slot] = std::max<double>(thresholdMax[slot],
+                                              nodes[i].threshold);
+    }
+    if(slotFeatures.size()>kMaxSlots){
+        std::cerr << "Forest splits on " << slotFeatures.size()
+                  << " features, at most " << kMaxSlots << " fit"
+                  << std::endl;
+        return false;
+    }
+    uint32_t slots = slotFeatures.size();
+    vector<float> thresholdOffset(slots);
+    vector<float> thresholdScale(slots);
+    for(int s=0; s<slots; s++){
+        fitRange(thresholdMin[s], thresholdMax[s], thresholdOffset[s],
+                 thresholdScale[s]);
+    }
+    vector<double> leafMin(outputs, HUGE_VAL);
+    vector<double> leafMax(outputs, -HUGE_VAL);
+    for(int i=0; i<nodes.size(); i++){
+        if(nodes[i].feature>=0){
+            continue;
+        }
+        const float* leaf = leafValues.data()+nodes[i].left;
+        for(int k=0; k<outputs; k++){
+            leafMin[k] = std::min<double>(leafMin[k], leaf[k]);
+            leafMax[k] = std::max<double>(leafMax[k], leaf[k]);
+        }
+    }
+    vector<float> leafOffset(outputs);
+    vector<float> leafScale(outputs);
+    for(int k=0; k<outputs; k++){
+        fitRange(leafMin[k], leafMax[k], leafOffset[k], leafScale[k]);
+    }
+
+    PreorderWriter writer;
+    writer.forest = &forest;
+    writer.featureSlots = &featureSlots;
+    writer.thresholdOffset = &thresholdOffset;
+    writer.thresholdScale = &thresholdScale;
+    writer.leafOffset = &leafOffset;
+    writer.leafScale = &leafScale;
+    vector<uint32_t> roots;
+    for(int t=0; t<forest.getTreeCount(); t++){
+        roots.push_back(writer.write(forest.getTreeRoots()[t]));
+    }
+    slotFeatures.resize(slotFeatureWords(slots), 0);
+
+    QuantizedForestHeader header;
+    memcpy(header.magic, kMagic, 4);
+    header.version = kVersion;
+    header.features = forest.getFeatureCount();
+    header.outputs = outputs;
+    header.trees = roots.size();
+    header.nodes = writer.nodes.size();
+    header.leaves = writer.leafValues.size()/outputs;
+    header.featureSlots = slots;
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if(!file){
+        std::cerr << "Couldn't write forest " << path << std::endl;
+        return false;
+    }
+    bool written =
+        fwrite(&header, sizeof(header), 1, file)==1 &&
+        fwrite(slotFeatures.data(), sizeof(uint16_t), slotFeatures.size(),
+               file)==slotFeatures.size() &&
+        fwrite(thresholdOffset.data(), sizeof(float), slots, file)==slots &&
+        fwrite(thresholdScale.data(), sizeof(float), slots, file)==slots &&
+        fwrite(leafOffset.data(), sizeof(float), outputs, file)==outputs &&
+        fwrite(leafScale.data(), sizeof(float), outputs, file)==outputs &&
+        fwrite(roots.data(), sizeof(uint32_t), roots.size(),
+               file)==roots.size() &&
+        fwrite(writer.nodes.data(), sizeof(QuantizedNode),
+               writer.nodes.size(), file)==writer.nodes.size() &&
+        fwrite(writer.leafValues.data(), sizeof(int16_t),
+               writer.leafValues.size(), file)==writer.leafValues.size();
+    if(fclose(file)!=0){
+        written = false;
+    }
+    return written;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     sampleFeatures
+Purpose:  Draws feature rows uniformly from just around the range of each
+          feature's thresholds, for an accuracy report when no recorded
+          data is at hand.
+Receive:  const DecisionForest& forest, int count, unsigned int seed
+Return:   vector<float> count rows of getFeatureCount values, row major
+-----------------------------------------------------------------------------*/
+vector<float> QuantizedForest::sampleFeatures(const DecisionForest &forest,
+                                              int count, unsigned int seed)
+{
+    int features = forest.getFeatureCount();
+    vector<double> min(features, 0.0);
+    vector<double> max(features, 1.0);
+    vector<bool> seen(features, false);
+    const vector<ForestNode>& nodes = forest.getNodes();
+    for(int i=0; i<nodes.size(); i++){
+        int feature = nodes[i].feature;
+        if(feature<0){
+            continue;
+        }
+        if(!seen[feature]){
+            min[feature] = max[feature] = nodes[i].threshold;
+            seen[feature] = true;
+        }
+        min[feature] = std::min<double>(min[feature], nodes[i].threshold);
+        max[feature] = std::max<double>(max[feature], nodes[i].threshold);
+    }
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    vector<float> samples(count*features);
+    for(int i=0; i<count; i++){
+        for(int f=0; f<features; f++){
+            double margin = kSampleMargin*(max[f]-min[f]);
+            samples[i*features+f] = min[f]-margin+
+                    uniform(generator)*(max[f]-min[f]+2.0*margin);
+        }
+    }
+    return samples;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     compare
+Purpose:  Accuracy report of a quantised forest against the full precision
+          forest it was written from.
+Receive:  const DecisionForest& forest, const QuantizedForest& quantized,
+          const vector<float>& samples, row major feature rows
+Return:   ForestAccuracy
+-----------------------------------------------------------------------------*/
+ForestAccuracy QuantizedForest::compare(const DecisionForest &forest,
+                                        const QuantizedForest &quantized,
+                                        const vector<float> &samples)
+{
+    ForestAccuracy accuracy;
+    int features = forest.getFeatureCount();
+    int outputs = forest.getOutputCount();
+    accuracy.fullBytes = 4+6*sizeof(unsigned int)+
+            forest.getTreeCount()*sizeof(int)+
+            forest.getNodes().size()*sizeof(ForestNode)+
+            forest.getLeafValues().size()*sizeof(float);
+    accuracy.quantizedBytes = quantized.getFileSize();
+    if(!quantized.isOpen() || quantized.getFeatureCount()!=features ||
+       quantized.getOutputCount()!=outputs){
+        return accuracy;
+    }
+    vector<double> full(outputs);
+    vector<double> compact(outputs);
+    double absSum = 0.0;
+    double squareSum = 0.0;
+    accuracy.samples = samples.size()/features;
+    for(int i=0; i<accuracy.samples; i++){
+        forest.predict(&samples[i*features], full.data());
+        quantized.predict(&samples[i*features], compact.data());
+        for(int k=0; k<outputs; k++){
+            double error = std::fabs(full[k]-compact[k]);
+            absSum += error;
+            squareSum += error*error;
+            accuracy.maxAbsError = std::max(accuracy.maxAbsError, error);
+        }
+    }
+    long values = (long)accuracy.samples*outputs;
+    if(values){
+        accuracy.meanAbsError = absSum/values;
+        accuracy.rootMeanSquareError = std::sqrt(squareSum/values);
+    }
+    return accuracy;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     open
+Purpose:  Maps a forest file read-only and validates it. Pages are shared
+          with every other process that maps the same file.
+Receive:  const string& path
+Return:   bool true if the file was mapped and is valid
+-----------------------------------------------------------------------------*/
+bool QuantizedForest::open(const string &path)
+{
+    close();
+    int descriptor = ::open(path.c_str(), O_RDONLY);
+    if(descriptor<0){
+        std::cerr << "Couldn't open forest " << path << std::endl;
+        return false;
+    }
+    struct stat status;
+    if(fstat(descriptor, &status)==0 &&
+       status.st_size>=sizeof(QuantizedForestHeader)){
+        m_mappedBytes = status.st_size;
+        m_mapping = mmap(nullptr, m_mappedBytes, PROT_READ, MAP_SHARED,
+                         descriptor, 0);
+        if(m_mapping==MAP_FAILED){
+            m_mapping = nullptr;
+        }
+    }
+    //the mapping stays valid without the descriptor
+    ::close(descriptor);
+    if(!m_mapping || !mapSections() || !isValid()){
+        std::cerr << "Invalid forest " << path << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     close
+Purpose:  Unmaps the file.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void QuantizedForest::close()
+{
+    if(m_mapping){
+        munmap(m_mapping, m_mappedBytes);
+    }
+    m_mapping = nullptr;
+    m_mappedBytes = 0;
+    m_header = nullptr;
+    m_nodes = nullptr;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     mapSections
+Purpose:  Points every section at its place in the mapping. The file must
+          be exactly as long as its header says.
+Receive:  N/A
+Return:   bool
+-----------------------------------------------------------------------------*/
+bool QuantizedForest::mapSections()
+{
+    const char* base = static_cast<const char*>(m_mapping);
+    m_header = reinterpret_cast<const QuantizedForestHeader*>(base);
+    if(memcmp(m_header->magic, kMagic, 4)!=0 ||
+       m_header->version!=kVersion || m_header->featureSlots>kMaxSlots){
+        return false;
+    }
+    uint64_t slots = m_header->featureSlots;
+    uint64_t outputs = m_header->outputs;
+    uint64_t offset = sizeof(QuantizedForestHeader);
+    uint64_t sizes[] = {slotFeatureWords(slots)*sizeof(uint16_t),
+                        slots*sizeof(float), slots*sizeof(float),
+                        outputs*sizeof(float), outputs*sizeof(float),
+                        (uint64_t)m_header->trees*sizeof(uint32_t),
+                        (uint64_t)m_header->nodes*sizeof(QuantizedNode),
+                        (uint64_t)m_header->leaves*outputs*sizeof(int16_t)};
+    const void* sections[8];
+    for(int i=0; i<8; i++){
+        sections[i] = base+offset;
+        offset += sizes[i];
+    }
+    if(offset!=m_mappedBytes){
+        return false;
+    }
+    m_slotFeatures = static_cast<const uint16_t*>(sections[0]);
+    m_thresholdOffset = static_cast<const float*>(sections[1]);
+    m_thresholdScale = static_cast<const float*>(sections[2]);
+    m_leafOffset = static_cast<const float*>(sections[3]);
+    m_leafScale = static_cast<const float*>(sections[4]);
+    m_roots = static_cast<const uint32_t*>(sections[5]);
+    m_nodes = static_cast<const QuantizedNode*>(sections[6]);
+    m_leafValues = static_cast<const int16_t*>(sections[7]);
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     isValid
+Purpose:  Checks every index in the mapped tables so a corrupt or truncated
+          file can never send predict outside them.
+Receive:  N/A
+Return:   bool
+-----------------------------------------------------------------------------*/
+bool QuantizedForest::isValid() const
+{
+    const QuantizedForestHeader& header = *m_header;
+    if(!header.features || !header.outputs || header.outputs>kMaxOutputs ||
+       !header.trees){
+        return false;
+    }
+    for(int s=0; s<header.featureSlots; s++){
+        if(m_slotFeatures[s]>=header.features ||
+           !(m_thresholdScale[s]>0.0f)){
+            return false;
+        }
+    }
+    for(int t=0; t<header.trees; t++){
+        if(m_roots[t]>=header.nodes){
+            return false;
+        }
+    }
+    for(uint32_t i=0; i<header.nodes; i++){
+        const QuantizedNode& node = m_nodes[i];
+        if(node.slot==kLeafSlot){
+            if(node.right>=header.leaves){
+                return false;
+            }
+        }
+        else if(node.slot>=header.featureSlots || i+1>=header.nodes ||
+                node.right<=i || node.right>=header.nodes){
+            //children always follow their parent so there are no cycles
+            return false;
+        }
+    }
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     isOpen
+Purpose:  Returns whether a forest is mapped.
+Receive:  N/A
+Return:   bool
+-----------------------------------------------------------------------------*/
+bool QuantizedForest::isOpen() const
+{
+    return m_nodes!=nullptr;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getFeatureCount
+Purpose:  Returns the number of input features the forest takes.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int QuantizedForest::getFeatureCount() const
+{
+    return isOpen() ? m_header->features : 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getOutputCount
+Purpose:  Returns the number of values predicted per sample.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int QuantizedForest::getOutputCount() const
+{
+    return isOpen() ? m_header->outputs : 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getTreeCount
+Purpose:  Returns the number of trees.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int QuantizedForest::getTreeCount() const
+{
+    return isOpen() ? m_header->trees : 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getFileSize
+Purpose:  Returns the size of the mapped file.
+Receive:  N/A
+Return:   size_t bytes
+-----------------------------------------------------------------------------*/
+size_t QuantizedForest::getFileSize() const
+{
+    return m_mappedBytes;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     predict
+Purpose:  Averages the leaf reached in every tree. Each used feature is
+          moved onto its threshold scale once, the integer leaves are
+          summed and scaled back once per output.
+Receive:  const float* features of getFeatureCount values
+          double* outputs filled with getOutputCount values
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void QuantizedForest::predict(const float *features, double *outputs) const
+{
+    int outputCount = getOutputCount();
+    if(!isOpen()){
+        return;
+    }
+    float scaled[kMaxSlots];
+    for(int s=0; s<m_header->featureSlots; s++){
+        scaled[s] = (features[m_slotFeatures[s]]-m_thresholdOffset[s])/
+                    m_thresholdScale[s];
+    }
+    int32_t sum[kMaxOutputs] = {};
+    for(int t=0; t<m_header->trees; t++){
+        const QuantizedNode* node = m_nodes+m_roots[t];
+        while(node->slot!=kLeafSlot){
+            node = scaled[node->slot]<=node->threshold ?
+                        node+1 : m_nodes+node->right;
+        }
+        const int16_t* leaf = m_leafValues+(size_t)node->right*outputCount;
+        for(int k=0; k<outputCount; k++){
+            sum[k] += leaf[k];
+        }
+    }
+    double scale = 1.0/m_header->trees;
+    for(int k=0; k<outputCount; k++){
+        outputs[k] = m_leafOffset[k]+m_leafScale[k]*(sum[k]*scale);
+    }
+}
@@ -0,0 +1,134 @@
+/******************************************************************************
+** FILE: QuantizedForest.h
+**
+** ABSTRACT:
+** Compact read-only forest format for keeping many per
+** patient forests resident. Thresholds and leaf values
+** are int16 with a per feature (per output) offset and
+** scale, split features go through a dictionary of the
+** features the forest uses so a node fits in 8 bytes,
+** and nodes are in preorder so the left child is always
+** the next node. Files are mmapped read-only and
+** evaluated in place, so processes and sessions using the
+** same forest share its pages.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** File layout (little endian, version 1), every section
+** 4 byte aligned:
+**   QuantizedForestHeader,
+**   uint16 slotFeatures[featureSlots rounded up to even],
+**   float thresholdOffset[featureSlots],
+**   float thresholdScale[featureSlots],
+**   float leafOffset[outputs], float leafScale[outputs],
+**   uint32 roots[trees], QuantizedNode nodes[nodes],
+**   int16 leafValues[leaves*outputs]
+** A sample goes left when
+**   (x-thresholdOffset)/thresholdScale <= threshold
+** and a leaf value is leafOffset+leafScale*value, so the
+** forest average is the offset plus the scaled mean of
+** the integer leaves, summed without any conversion.
+**
+******************************************************************************/
+
+#ifndef QUANTIZEDFOREST_H
+#define QUANTIZEDFOREST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "DecisionForest.h"
+using std::string;
+using std::vector;
+
+struct QuantizedForestHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t features;
+    uint32_t outputs;
+    uint32_t trees;
+    uint32_t nodes;
+    uint32_t leaves;
+    uint32_t featureSlots;
+};
+
+struct QuantizedNode
+{
+    //dictionary slot of the split feature, kLeafSlot for a leaf
+    uint8_t slot;
+    uint8_t reserved;
+    int16_t threshold;
+    //right child for a split, leaf index for a leaf
+    uint32_t right;
+};
+
+static_assert(sizeof(QuantizedForestHeader)==32, "header layout changed");
+static_assert(sizeof(QuantizedNode)==8, "node layout changed");
+
+//quantised forest against the full precision one over a set of samples
+struct ForestAccuracy
+{
+    int samples = 0;
+    double meanAbsError = 0.0;
+    double rootMeanSquareError = 0.0;
+    double maxAbsError = 0.0;
+    long fullBytes = 0;
+    long quantizedBytes = 0;
+};
+
+class QuantizedForest
+{
+protected:
+    //the mapping and the sections inside it
+    void* m_mapping = nullptr;
+    size_t m_mappedBytes = 0;
+    const QuantizedForestHeader* m_header = nullptr;
+    const uint16_t* m_slotFeatures = nullptr;
+    const float* m_thresholdOffset = nullptr;
+    const float* m_thresholdScale = nullptr;
+    const float* m_leafOffset = nullptr;
+    const float* m_leafScale = nullptr;
+    const uint32_t* m_roots = nullptr;
+    const QuantizedNode* m_nodes = nullptr;
+    const int16_t* m_leafValues = nullptr;
+
+    bool mapSections();
+    bool isValid() const;
+
+public:
+    static const uint8_t kLeafSlot = 0xFF;
+
+    QuantizedForest() = default;
+    ~QuantizedForest();
+    QuantizedForest(const QuantizedForest&) = delete;
+    QuantizedForest& operator=(const QuantizedForest&) = delete;
+
+    static bool isQuantizedFile(const string& path);
+    static bool write(const DecisionForest& forest, const string& path);
+    static vector<float> sampleFeatures(const DecisionForest& forest,
+                                        int count, unsigned int seed);
+    static ForestAccuracy compare(const DecisionForest& forest,
+                                  const QuantizedForest& quantized,
+                                  const vector<float>& samples);
+
+    bool open(const string& path);
+    void close();
+    bool isOpen() const;
+    int getFeatureCount() const;
+    int getOutputCount() const;
+    int getTreeCount() const;
+    size_t getFileSize() const;
+    void predict(const float* features, double* outputs) const;
+};
+
+#endif // QUANTIZEDFOREST_H
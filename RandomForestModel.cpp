@@ -17,6 +17,9 @@
 ** 08/15/2019
 **
 ** NOTES:
+** When a native forest has been loaded with loadForest the
+** model is evaluated in process instead of through the
+** Python script.
 **
 ******************************************************************************/
 
@@ -26,10 +29,128 @@
 #include <string>
 #include <QDir>
 #include <QTextStream>
-#include <iostream>
+#include <time.h>
 #include "BGDataEntry.h"
+#include "Logger.h"
+#include "MetricsRegistry.h"
 using std::string;
 
+/*-----------------------------------------------------------------------------
+Name:     loadForest
+Purpose:  Loads a forest written by the native trainer, or maps a quantised
+          one. Once loaded, predict and projectCorrection run in process
+          instead of spawning the RandomForest script for every call.
+Receive:  const string& path to the .forest or .qforest file
+Return:   bool true if the forest was loaded and has the expected shape
+-----------------------------------------------------------------------------*/
+bool RandomForestModel::loadForest(const string &path)
+{
+    m_quantizedForest.close();
+    m_forest.setShape(0, 0);
+    if(QuantizedForest::isQuantizedFile(path)){
+        m_nativeForest = m_quantizedForest.open(path) &&
+                         m_quantizedForest.getFeatureCount()==25 &&
+                         m_quantizedForest.getOutputCount()==18;
+        return m_nativeForest;
+    }
+    m_nativeForest = m_forest.load(path) &&
+                     m_forest.getFeatureCount()==25 &&
+                     m_forest.getOutputCount()==18;
+    return m_nativeForest;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     hasNativeForest
+Purpose:  Returns whether the model runs the native forest.
+Receive:  N/A
+Return:   bool
+-----------------------------------------------------------------------------*/
+bool RandomForestModel::hasNativeForest() const
+{
+    return m_nativeForest;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     runForest
+Purpose:  Evaluates the native forest on the same 25 inputs the script
+          reads from test.txt: 6 BG values followed by 19 insulin values.
+Receive:  bgInputs and insulinInputs for the model
+Return:   vector<double> predictions for future BG (90 mins / 5 = 18 values)
+-----------------------------------------------------------------------------*/
+vector<double> RandomForestModel::runForest(const vector<double> &bgInputs,
+                                            const vector<float> &insulinInputs)
+                                            const
+{
+    float features[25];
+    for(int i=0; i<6; i++){
+        features[i] = i<bgInputs.size() ? bgInputs[i] : 0.0f;
+    }
+    for(int i=0; i<19; i++){
+        features[6+i] = i<insulinInputs.size() ? insulinInputs[i] : 0.0f;
+    }
+    vector<double> bgPredictions(18);
+    if(m_quantizedForest.isOpen()){
+        m_quantizedForest.predict(features, bgPredictions.data());
+    }
+    else{
+        m_forest.predict(features, bgPredictions.data());
+    }
+    return bgPredictions;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setHistoryStore
+Purpose:  Sets the store saved predictions are queued to. Without one they
+          go through the RF utility.
+Receive:  HistoryStore* historyStore, not owned
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void RandomForestModel::setHistoryStore(HistoryStore *historyStore)
+{
+    m_historyStore = historyStore;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     savePrediction
+Purpose:  Queues the prediction on the history store, which commits it in
+          the background. Without a store, writes it to RFResults.txt, the
+          file the RF utility reads, and runs it to store the prediction in
+          the database.
+Receive:  const vector<double>& bgPredictions
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void RandomForestModel::savePrediction(const vector<double> &bgPredictions)
+                                       const
+{
+    if(m_historyStore){
+        m_historyStore->addPrediction(time(nullptr), "RF", bgPredictions);
+        return;
+    }
+    QFile results(QDir::currentPath()+"/RandomForest/RFResults.txt");
+    if (results.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        QTextStream out(&results);
+        for(int i=0; i<bgPredictions.size(); i++){
+            if(i){
+                out << ",";
+            }
+            out << bgPredictions[i];
+        }
+    }
+    string RFRP = "/RF/RF";
+    string RFFQP = QDir::currentPath().toStdString()+RFRP;
+
+    LOG_DEBUG("Opening RF Database pipe");
+    FILE* pipe = popen(RFFQP.c_str(), "r");
+    if (!pipe)
+    {
+      LOG_ERROR("Couldn't start command.");
+      MetricsRegistry::get().countSubprocess("rf_database", true);
+      return;
+    }
+    int status = pclose(pipe);
+    MetricsRegistry::get().countSubprocess("rf_database", status!=0);
+}
+
 /*-----------------------------------------------------------------------------
 Name:     predict
 Purpose:  Runs the prediction model once using input bg and insulin
@@ -44,6 +165,17 @@ vector<double> RandomForestModel::predict(vector<int> bgInputs,
 {
     vector<double> bgPredictions;
 
+    //native forest, no script or temporary files involved
+    if(m_nativeForest){
+        bgPredictions = runForest(vector<double>(bgInputs.begin(),
+                                                 bgInputs.end()),
+                                  insulinInputs);
+        if(saveFlag){
+            savePrediction(bgPredictions);
+        }
+        return bgPredictions;
+    }
+
     //first write out new BG /insulin values
    QFile data(QDir::currentPath()+"/RandomForest/test.txt");
    if (data.open(QIODevice::WriteOnly | QIODevice::Text)) {
@@ -73,18 +205,19 @@ vector<double> RandomForestModel::predict(vector<int> bgInputs,
      //string RFRP = "/RandomForestTest/RandomForestTest";
      string RFFQP = "python3 " + QDir::currentPath().toStdString()+RFRP;
 
-     std::cout << "Opening RF Prediction reading pipe" << std::endl;
+     LOG_DEBUG("Opening RF Prediction reading pipe");
      FILE* pipe = popen(RFFQP.c_str(), "r");
      if (!pipe)
      {
-       std::cerr << "Couldn't start command." << std::endl;
-
+       LOG_ERROR("Couldn't start command.");
+       MetricsRegistry::get().countSubprocess("rf_predict", true);
      }
      char line[1024];
      //script output is collected into list
      while (fgets(line, 1024, pipe))
           bgData += line;
      auto returnCode = pclose(pipe);
+     MetricsRegistry::get().countSubprocess("rf_predict", returnCode!=0);
      //get predictions and push back to prediction container
      QString stringData = QString::fromUtf8(bgData.c_str());
      QStringList formattedData = stringData.split('\n');
@@ -109,17 +242,7 @@ vector<double> RandomForestModel::predict(vector<int> bgInputs,
      bgPredictions.push_back(formattedData[17].toDouble());
      //if we want to save this prediction result to database
      if(saveFlag){
-         string RFRP = "/RF/RF";
-         string RFFQP = QDir::currentPath().toStdString()+RFRP;
-
-         std::cout << "Opening RF Database pipe" << std::endl;
-         FILE* pipe = popen(RFFQP.c_str(), "r");
-         if (!pipe)
-         {
-           std::cerr << "Couldn't start command." << std::endl;
-
-         }
-         auto returnCode = pclose(pipe);
+         savePrediction(bgPredictions);
      }
      return bgPredictions;
    }
@@ -139,6 +262,11 @@ vector<double> RandomForestModel::projectCorrection(vector<double> bgInputs,
 {
     vector<double> bgPredictions;
 
+    //native forest, no script or temporary files involved
+    if(m_nativeForest){
+        return runForest(bgInputs, insulinInputs);
+    }
+
     //first write out new BG/insulin values
    QFile data(QDir::currentPath()+"/RandomForest/test.txt");
    if (data.open(QIODevice::WriteOnly | QIODevice::Text)) {
@@ -168,18 +296,19 @@ vector<double> RandomForestModel::projectCorrection(vector<double> bgInputs,
      //string RFRP = "/RandomForestTest/RandomForestTest";
      string RFFQP = "python3 " + QDir::currentPath().toStdString()+RFRP;
 
-     std::cout << "Opening RF Projection reading pipe" << std::endl;
+     LOG_DEBUG("Opening RF Projection reading pipe");
      FILE* pipe = popen(RFFQP.c_str(), "r");
      if (!pipe)
      {
-       std::cerr << "Couldn't start command." << std::endl;
-
+       LOG_ERROR("Couldn't start command.");
+       MetricsRegistry::get().countSubprocess("rf_project", true);
      }
      char line[1024];
      //add raw output to list
      while (fgets(line, 1024, pipe))
           bgData += line;
      auto returnCode = pclose(pipe);
+     MetricsRegistry::get().countSubprocess("rf_project", returnCode!=0);
      //get predictions and push back to prediction container
      QString stringData = QString::fromUtf8(bgData.c_str());
      QStringList formattedData = stringData.split('\n');
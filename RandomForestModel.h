@@ -17,6 +17,10 @@
 ** 08/15/2019
 **
 ** NOTES:
+** When a native forest has been loaded with loadForest the
+** model is evaluated in process instead of through the
+** Python script. loadForest takes either the full
+** precision format or a mmapped QuantizedForest.
 **
 ******************************************************************************/
 
@@ -24,20 +28,40 @@
 #define RANDOMFORESTMODEL_H
 
 #include "Model.h"
+#include "DecisionForest.h"
+#include "QuantizedForest.h"
+#include "HistoryStore.h"
+#include <string>
 #include <vector>
+using std::string;
 using std::vector;
 
 class RandomForestModel : public Model
 {
+protected:
+    DecisionForest m_forest;
+    QuantizedForest m_quantizedForest;
+    bool m_nativeForest = false;
+    //not owned, saved predictions go here instead of the RF utility
+    HistoryStore* m_historyStore = nullptr;
+
+    vector<double> runForest(const vector<double>& bgInputs,
+                             const vector<float>& insulinInputs) const;
+
 public:
     RandomForestModel() = default;
     virtual ~RandomForestModel() = default;
 
+    bool loadForest(const string& path);
+    bool hasNativeForest() const;
+    void setHistoryStore(HistoryStore* historyStore);
+
     vector<double> predict(vector<int> bgInputs, vector<float> insulinInputs,
                            bool saveFlag);
     vector<double> projectCorrection(vector<double> bgInputs,
                                      vector<float> insulinInputs,
                                      int sensitivity);
+    void savePrediction(const vector<double>& bgPredictions) const;
 };
 
 
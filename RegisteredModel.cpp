@@ -0,0 +1,153 @@
+/******************************************************************************
+** FILE: RegisteredModel.cpp
+**
+** ABSTRACT:
+** Ensemble member standing in for one ModelRegistry slot.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+**
+******************************************************************************/
+
+#include "RegisteredModel.h"
+
+/*-----------------------------------------------------------------------------
+Name:     RegisteredModel
+Purpose:  Constructor. Starts on the slot's current version.
+Receive:  const ModelRegistry* registry, not owned
+          int slot, the registry slot
+Return:   N/A
+-----------------------------------------------------------------------------*/
+RegisteredModel::RegisteredModel(const ModelRegistry *registry, int slot) :
+    m_registry(registry),
+    m_slot(slot),
+    m_version(registry->getVersion(slot))
+{
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getRunnable
+Purpose:  Returns the pinned version's cached model, or the model itself
+          when it has no cache.
+Receive:  N/A
+Return:   Model*, the fallback (or nullptr without one) before any version
+          has loaded
+-----------------------------------------------------------------------------*/
+Model* RegisteredModel::getRunnable() const
+{
+    if(!m_version){
+        return m_fallback;
+    }
+    if(m_version->cachedModel){
+        return m_version->cachedModel.get();
+    }
+    return m_version->model.get();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     refresh
+Purpose:  Moves to the slot's newest published version. The old version is
+          freed here if nothing else holds it.
+Receive:  N/A
+Return:   bool true if the version changed
+-----------------------------------------------------------------------------*/
+bool RegisteredModel::refresh()
+{
+    std::shared_ptr<ModelVersion> latest = m_registry->getVersion(m_slot);
+    if(latest==m_version){
+        return false;
+    }
+    m_version = latest;
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getVersionNumber
+Purpose:  Returns the number of the pinned version.
+Receive:  N/A
+Return:   long, 0 before any version has loaded
+-----------------------------------------------------------------------------*/
+long RegisteredModel::getVersionNumber() const
+{
+    return m_version ? m_version->number : 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setFallback
+Purpose:  Sets a model that answers for the slot until its first version
+          loads, after which it is never run again. Without one the handle
+          returns empty trajectories until then. Call before the ensemble
+          runs.
+Receive:  Model* fallback, not owned
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void RegisteredModel::setFallback(Model *fallback)
+{
+    m_fallback = fallback;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     predict
+Purpose:  Runs the pinned version once using input bg and insulin data at
+          t=0.
+Receive:  bgInputs and insulin inputs for the model, saveFlag to save the
+          prediction
+Return:   vector<double> predictions for future BG (90 mins / 5 = 18 values)
+-----------------------------------------------------------------------------*/
+vector<double> RegisteredModel::predict(vector<int> bgInputs,
+                                        vector<float> insulinInputs,
+                                        bool saveFlag)
+{
+    Model* model = getRunnable();
+    if(!model){
+        return vector<double>();
+    }
+    return model->predict(bgInputs, insulinInputs, saveFlag);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     projectCorrection
+Purpose:  Projects BG under a hypothetical insulin input with the pinned
+          version.
+Receive:  bgInputs and insulin inputs for the model, sensitivity is constant
+          representing the impact of 1 unit of insulin on blood glucose.
+Return:   vector<double> predictions for future BG (90 mins / 5 = 18 values)
+-----------------------------------------------------------------------------*/
+vector<double> RegisteredModel::projectCorrection(vector<double> bgInputs,
+                                                  vector<float> insulinInputs,
+                                                  int sensitivity)
+{
+    Model* model = getRunnable();
+    if(!model){
+        return vector<double>();
+    }
+    return model->projectCorrection(bgInputs, insulinInputs, sensitivity);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     projectCorrections
+Purpose:  Projects BG under several hypothetical insulin inputs with the
+          pinned version.
+Receive:  bgInputs shared by every candidate, insulinInputs one per
+          candidate, sensitivity
+Return:   vector<vector<double>> one trajectory per candidate
+-----------------------------------------------------------------------------*/
+vector<vector<double>> RegisteredModel::projectCorrections(
+                                const vector<double> &bgInputs,
+                                const vector<vector<float>> &insulinInputs,
+                                int sensitivity)
+{
+    Model* model = getRunnable();
+    if(!model){
+        return vector<vector<double>>(insulinInputs.size());
+    }
+    return model->projectCorrections(bgInputs, insulinInputs, sensitivity);
+}
@@ -0,0 +1,64 @@
+/******************************************************************************
+** FILE: RegisteredModel.h
+**
+** ABSTRACT:
+** Ensemble member standing in for one ModelRegistry slot.
+** Runs the version it last picked up and only moves to a
+** newer one when refresh is called.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** refresh must not be called while a cycle may be running
+** the model; CycleExecutor calls it when the ensemble is
+** idle.
+**
+******************************************************************************/
+
+#ifndef REGISTEREDMODEL_H
+#define REGISTEREDMODEL_H
+
+#include <memory>
+#include "Model.h"
+#include "ModelRegistry.h"
+
+class RegisteredModel : public Model
+{
+protected:
+    //not owned
+    const ModelRegistry* m_registry;
+    int m_slot;
+    //pinned until the next refresh
+    std::shared_ptr<ModelVersion> m_version;
+    //answers until the first version loads, not owned
+    Model* m_fallback = nullptr;
+
+    Model* getRunnable() const;
+
+public:
+    RegisteredModel(const ModelRegistry* registry, int slot);
+    virtual ~RegisteredModel() = default;
+
+    bool refresh();
+    long getVersionNumber() const;
+    void setFallback(Model* fallback);
+
+    vector<double> predict(vector<int> bgInputs, vector<float> insulinInputs,
+                           bool saveFlag);
+    vector<double> projectCorrection(vector<double> bgInputs,
+                                     vector<float> insulinInputs,
+                                     int sensitivity);
+    vector<vector<double>> projectCorrections(
+                                const vector<double>& bgInputs,
+                                const vector<vector<float>>& insulinInputs,
+                                int sensitivity);
+};
+
+#endif // REGISTEREDMODEL_H
@@ -0,0 +1,314 @@
+/******************************************************************************
+** FILE: ScenarioEvaluator.cpp
+**
+** ABSTRACT:
+** Monte Carlo evaluation of the MPC's bolus candidates.
+** Samples thousands of perturbed scenarios per cycle
+** (sensor noise on the BG window, error in sensitivity,
+** unannounced carbs), applies each one to every candidate
+** trajectory and scores candidates on expected error from
+** target plus the probability of going below 70 mg/dl.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** Scenarios are drawn in fixed size chunks, each with its
+** own generator seeded from the chunk index, so results
+** only depend on the seed and not on the thread count.
+** 10k scenarios x 33 candidates x 18 values is about six
+** million multiply-adds, a few milliseconds per cycle.
+**
+******************************************************************************/
+
+#include "ScenarioEvaluator.h"
+#include "ThreadPool.h"
+#include "Logger.h"
+#include <algorithm>
+#include <math.h>
+#include <random>
+
+namespace
+{
+const int kChunkSize = 256;
+const double kMinutesPerStep = 5.0;
+const double kMinCarbFraction = 0.25;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getScenarioCount
+Purpose:  Returns the number of scenarios sampled per evaluation.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int ScenarioEvaluator::getScenarioCount() const
+{
+    return m_scenarioCount;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setScenarioCount
+Purpose:  Sets the number of scenarios sampled per evaluation.
+Receive:  int scenarioCount
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ScenarioEvaluator::setScenarioCount(int scenarioCount)
+{
+    m_scenarioCount = scenarioCount;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setSensorNoise
+Purpose:  Sets the standard deviation of the CGM error in mg/dl. The error
+          on the latest reading shifts the whole projected trajectory.
+Receive:  double sensorNoise
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ScenarioEvaluator::setSensorNoise(double sensorNoise)
+{
+    m_sensorNoise = sensorNoise;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setSensitivitySpread
+Purpose:  Sets the log standard deviation of the multiplier applied to the
+          modelled effect of the candidate bolus.
+Receive:  double sensitivitySpread
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ScenarioEvaluator::setSensitivitySpread(double sensitivitySpread)
+{
+    m_sensitivitySpread = sensitivitySpread;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setCarbProbability
+Purpose:  Sets the chance that a scenario contains an unannounced meal
+          within the prediction horizon.
+Receive:  double carbProbability between 0 and 1
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ScenarioEvaluator::setCarbProbability(double carbProbability)
+{
+    m_carbProbability = carbProbability;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setMaxCarbs
+Purpose:  Sets the largest unannounced meal sampled, in grams.
+Receive:  double maxCarbs
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ScenarioEvaluator::setMaxCarbs(double maxCarbs)
+{
+    m_maxCarbs = maxCarbs;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setCarbFactor
+Purpose:  Sets the rise in BG per gram of carbohydrate once fully absorbed,
+          in mg/dl.
+Receive:  double carbFactor
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ScenarioEvaluator::setCarbFactor(double carbFactor)
+{
+    m_carbFactor = carbFactor;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setHypoThreshold
+Purpose:  Sets the BG value below which a scenario counts as a low.
+Receive:  double hypoThreshold
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ScenarioEvaluator::setHypoThreshold(double hypoThreshold)
+{
+    m_hypoThreshold = hypoThreshold;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setRiskWeight
+Purpose:  Sets the cost, in mg/dl of average error, charged for a certain
+          low. A candidate's score is its expected error plus the risk
+          weight times its probability of going low.
+Receive:  double riskWeight
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ScenarioEvaluator::setRiskWeight(double riskWeight)
+{
+    m_riskWeight = riskWeight;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setSeed
+Purpose:  Sets the seed of the scenario generators.
+Receive:  unsigned int seed
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ScenarioEvaluator::setSeed(unsigned int seed)
+{
+    m_seed = seed;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setThreadPool
+Purpose:  Gives the evaluator a pool to spread scenario chunks over. With
+          no pool the chunks run on the caller's thread.
+Receive:  ThreadPool* pool, not owned
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ScenarioEvaluator::setThreadPool(ThreadPool *pool)
+{
+    m_pool = pool;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getExpectedCost
+Purpose:  Returns the mean absolute error from target of each candidate over
+          all scenarios of the last evaluation.
+Receive:  N/A
+Return:   const vector<double>&
+-----------------------------------------------------------------------------*/
+const vector<double> &ScenarioEvaluator::getExpectedCost() const
+{
+    return m_expectedCost;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getHypoProbability
+Purpose:  Returns the fraction of scenarios of the last evaluation in which
+          each candidate went below the hypo threshold.
+Receive:  N/A
+Return:   const vector<double>&
+-----------------------------------------------------------------------------*/
+const vector<double> &ScenarioEvaluator::getHypoProbability() const
+{
+    return m_hypoProbability;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     evaluate
+Purpose:  Scores every candidate trajectory under m_scenarioCount sampled
+          scenarios and returns the one with the lowest expected error plus
+          weighted low risk.
+Receive:  trajectories, one projected BG curve per candidate bolus
+          referenceIndex, the candidate with no bolus
+          target, the target BG
+Return:   int index of the chosen candidate, -1 if there is nothing to score
+-----------------------------------------------------------------------------*/
+int ScenarioEvaluator::evaluate(const vector<vector<double>> &trajectories,
+                                int referenceIndex, double target)
+{
+    int candidates = trajectories.size();
+    m_expectedCost.assign(candidates, 0.0);
+    m_hypoProbability.assign(candidates, 0.0);
+    if(!candidates || referenceIndex<0 || referenceIndex>=candidates ||
+       m_scenarioCount<=0){
+        return -1;
+    }
+    int horizon = trajectories[0].size();
+    for(int c=1; c<candidates; c++){
+        horizon = std::min(horizon, (int)trajectories[c].size());
+    }
+    if(!horizon){
+        LOG_ERROR("Scenario evaluation given empty trajectories");
+        return -1;
+    }
+
+    //candidate trajectories and their bolus effect laid out contiguously
+    //so the inner loop runs over plain arrays
+    vector<double> base(candidates*horizon);
+    vector<double> effect(candidates*horizon);
+    const vector<double>& reference = trajectories[referenceIndex];
+    for(int c=0; c<candidates; c++){
+        for(int k=0; k<horizon; k++){
+            base[c*horizon+k] = trajectories[c][k];
+            effect[c*horizon+k] = trajectories[c][k]-reference[k];
+        }
+    }
+
+    int chunks = (m_scenarioCount+kChunkSize-1)/kChunkSize;
+    vector<double> chunkCost(chunks*candidates, 0.0);
+    vector<int> chunkLows(chunks*candidates, 0);
+    double horizonMinutes = horizon*kMinutesPerStep;
+    std::function<void(int)> runChunk = [&](int chunk){
+        std::mt19937 generator(m_seed*7919u+chunk);
+        std::normal_distribution<double> noise(0.0, m_sensorNoise);
+        std::normal_distribution<double> logSensitivity(0.0,
+                                                        m_sensitivitySpread);
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+        vector<double> offset(horizon);
+        double* cost = chunkCost.data()+chunk*candidates;
+        int* lows = chunkLows.data()+chunk*candidates;
+        int first = chunk*kChunkSize;
+        int last = std::min(m_scenarioCount, first+kChunkSize);
+        for(int s=first; s<last; s++){
+            double sensorError = noise(generator);
+            double gain = exp(logSensitivity(generator))-1.0;
+            double carbs = 0.0;
+            double onset = 0.0;
+            if(unit(generator)<m_carbProbability){
+                carbs = m_maxCarbs*(kMinCarbFraction+(1.0-kMinCarbFraction)*
+                                    unit(generator));
+                onset = 0.5*horizonMinutes*unit(generator);
+            }
+            for(int k=0; k<horizon; k++){
+                double absorbed = 0.0;
+                if(carbs>0.0){
+                    double minutes = (k+1)*kMinutesPerStep-onset;
+                    absorbed = std::min(1.0, std::max(0.0, minutes/
+                                        m_carbAbsorptionMinutes));
+                }
+                offset[k] = sensorError+carbs*m_carbFactor*absorbed;
+            }
+            for(int c=0; c<candidates; c++){
+                const double* b = base.data()+c*horizon;
+                const double* e = effect.data()+c*horizon;
+                double error = 0.0;
+                double lowest = b[0]+offset[0]+gain*e[0];
+                for(int k=0; k<horizon; k++){
+                    double bg = b[k]+offset[k]+gain*e[k];
+                    error += fabs(bg-target);
+                    lowest = bg<lowest ? bg : lowest;
+                }
+                cost[c] += error/horizon;
+                lows[c] += lowest<m_hypoThreshold;
+            }
+        }
+    };
+    if(m_pool){
+        m_pool->parallelFor(chunks, runChunk);
+    }
+    else{
+        for(int chunk=0; chunk<chunks; chunk++){
+            runChunk(chunk);
+        }
+    }
+
+    //reduce in chunk order so the result doesn't depend on scheduling
+    int chosen = 0;
+    double bestScore = 0.0;
+    for(int c=0; c<candidates; c++){
+        double cost = 0.0;
+        int lows = 0;
+        for(int chunk=0; chunk<chunks; chunk++){
+            cost += chunkCost[chunk*candidates+c];
+            lows += chunkLows[chunk*candidates+c];
+        }
+        m_expectedCost[c] = cost/m_scenarioCount;
+        m_hypoProbability[c] = (double)lows/m_scenarioCount;
+        double score = m_expectedCost[c]+m_riskWeight*m_hypoProbability[c];
+        if(!c || score<bestScore){
+            bestScore = score;
+            chosen = c;
+        }
+    }
+    return chosen;
+}
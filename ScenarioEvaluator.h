@@ -0,0 +1,79 @@
+/******************************************************************************
+** FILE: ScenarioEvaluator.h
+**
+** ABSTRACT:
+** Monte Carlo evaluation of the MPC's bolus candidates.
+** Samples thousands of perturbed scenarios per cycle
+** (sensor noise on the BG window, error in sensitivity,
+** unannounced carbs), applies each one to every candidate
+** trajectory and scores candidates on expected error from
+** target plus the probability of going below 70 mg/dl.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** Scenarios perturb the model's trajectories rather than
+** re-running the model, so the cost per scenario is one
+** pass over candidates x horizon values:
+**   bg = projected + noise + (m-1)*bolusEffect + carbs
+** where bolusEffect is the candidate's trajectory minus
+** the zero bolus trajectory and m the sampled sensitivity
+** multiplier.
+**
+******************************************************************************/
+
+#ifndef SCENARIOEVALUATOR_H
+#define SCENARIOEVALUATOR_H
+
+#include <vector>
+using std::vector;
+
+class ThreadPool;
+
+class ScenarioEvaluator
+{
+protected:
+    int m_scenarioCount = 10000;
+    double m_sensorNoise = 10.0;
+    double m_sensitivitySpread = 0.25;
+    double m_carbProbability = 0.1;
+    double m_maxCarbs = 40.0;
+    double m_carbFactor = 4.0;
+    double m_carbAbsorptionMinutes = 120.0;
+    double m_hypoThreshold = 70.0;
+    double m_riskWeight = 200.0;
+    unsigned int m_seed = 1;
+    ThreadPool* m_pool = nullptr;
+    vector<double> m_expectedCost;
+    vector<double> m_hypoProbability;
+
+public:
+    ScenarioEvaluator() = default;
+    ~ScenarioEvaluator() = default;
+
+    int getScenarioCount() const;
+    void setScenarioCount(int scenarioCount);
+    void setSensorNoise(double sensorNoise);
+    void setSensitivitySpread(double sensitivitySpread);
+    void setCarbProbability(double carbProbability);
+    void setMaxCarbs(double maxCarbs);
+    void setCarbFactor(double carbFactor);
+    void setHypoThreshold(double hypoThreshold);
+    void setRiskWeight(double riskWeight);
+    void setSeed(unsigned int seed);
+    void setThreadPool(ThreadPool* pool);
+    const vector<double>& getExpectedCost() const;
+    const vector<double>& getHypoProbability() const;
+
+    int evaluate(const vector<vector<double>>& trajectories,
+                 int referenceIndex, double target);
+};
+
+#endif // SCENARIOEVALUATOR_H
@@ -0,0 +1,91 @@
+/******************************************************************************
+** FILE: ScraperRecord.h
+**
+** ABSTRACT:
+** Binary record protocol between DataScraper and the
+** DataQueue. A batch is a ScraperBatchHeader followed by
+** count fixed size ScraperRecords, so the queue can read
+** readings and doses straight from a pipe or a mapped
+** buffer without parsing any text.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** Little endian, no padding between records. Must match
+** RECORD_HEADER/RECORD_FORMAT in DataScraper.py. The
+** checksum is 32 bit FNV-1a over the records only. Readers
+** reject any other version or record size.
+**
+******************************************************************************/
+
+#ifndef SCRAPERRECORD_H
+#define SCRAPERRECORD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+const char kScraperMagic[4] = {'A', 'G', 'S', 'R'};
+const uint16_t kScraperVersion = 1;
+//IOB now and every 5 minutes for 90 minutes
+const int kScraperInsulinValues = 19;
+//most records in one batch, writers split longer sequences
+const uint32_t kScraperMaxRecords = 65536;
+
+struct ScraperBatchHeader
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t recordSize;
+    uint32_t count;
+    uint32_t checksum;
+};
+
+struct ScraperRecord
+{
+    enum Kind
+    {
+        Reading = 0,
+        Dose = 1
+    };
+
+    double sampleTime;
+    //seconds between the reading and the query
+    double lag;
+    //dose records only
+    double units;
+    int32_t kind;
+    int32_t value;
+    int32_t trend;
+    //valid entries of insulin, 0 to work IOB out from the doses
+    int32_t insulinCount;
+    float insulin[kScraperInsulinValues];
+    uint32_t reserved;
+};
+
+static_assert(sizeof(ScraperBatchHeader)==16, "header layout changed");
+static_assert(sizeof(ScraperRecord)==120, "record layout changed");
+
+/*-----------------------------------------------------------------------------
+Name:     scraperChecksum
+Purpose:  32 bit FNV-1a of a batch's records.
+Receive:  const void* data, size_t bytes
+Return:   uint32_t
+-----------------------------------------------------------------------------*/
+inline uint32_t scraperChecksum(const void* data, size_t bytes)
+{
+    const unsigned char* byte = static_cast<const unsigned char*>(data);
+    uint32_t hash = 2166136261u;
+    for(size_t i=0; i<bytes; i++){
+        hash = (hash^byte[i])*16777619u;
+    }
+    return hash;
+}
+
+#endif // SCRAPERRECORD_H
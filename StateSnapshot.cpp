@@ -0,0 +1,521 @@
+/******************************************************************************
+** FILE: StateSnapshot.cpp
+**
+** ABSTRACT:
+** Saves the DataQueue (BG and insulin rings, future IOB,
+** prediction and dose history) and the learned controller
+** state (state space estimator, ensemble errors) to one
+** binary file every cycle, and restores it at startup so
+** a restarted controller is warm immediately instead of
+** after 288 cycles.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** A full day of data is about 20 KB so the per cycle cost
+** is dominated by the two fsync calls.
+**
+******************************************************************************/
+
+#include "StateSnapshot.h"
+#include "DataQueue.h"
+#include "EnsembleModel.h"
+#include "StateSpaceModel.h"
+#include "Logger.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace
+{
+const char kMagic[4] = {'A', 'G', 'S', 'S'};
+const unsigned int kVersion = 3;
+const int kHeaderBytes = 20;
+const int kSectionHeaderBytes = 8;
+
+struct BGRecord
+{
+    double sampleTime;
+    double scrapeTime;
+    double delayTime;
+    int value;
+    int trend;
+};
+
+struct InsulinRecord
+{
+    double sampleTime;
+    double insulinOnBoard;
+};
+
+unsigned int checksum(const char* data, int bytes)
+{
+    //FNV-1a
+    unsigned int hash = 2166136261u;
+    for(int i=0; i<bytes; i++){
+        hash = (hash^(unsigned char)data[i])*16777619u;
+    }
+    return hash;
+}
+
+unsigned int readCount(const char* data)
+{
+    unsigned int count;
+    memcpy(&count, data, sizeof(count));
+    return count;
+}
+
+bool writeAll(int file, const char* data, int bytes)
+{
+    while(bytes>0){
+        ssize_t written = write(file, data, bytes);
+        if(written<=0){
+            return false;
+        }
+        data += written;
+        bytes -= written;
+    }
+    return true;
+}
+}
+
+/*-----------------------------------------------------------------------------
+Name:     StateSnapshot
+Purpose:  Creates a snapshot bound to a file path. Nothing is read or
+          written until load or save is called.
+Receive:  const string& path
+Return:   N/A
+-----------------------------------------------------------------------------*/
+StateSnapshot::StateSnapshot(const string &path)
+    : m_path(path)
+{
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setDataQueue
+Purpose:  Sets the queue whose rings and histories are saved and restored.
+Receive:  DataQueue*, not owned
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void StateSnapshot::setDataQueue(DataQueue *dataQueue)
+{
+    m_dataQueue = dataQueue;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setStateSpaceModel
+Purpose:  Sets the model whose sensitivity estimator is saved and restored.
+Receive:  StateSpaceModel*, not owned
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void StateSnapshot::setStateSpaceModel(StateSpaceModel *stateSpaceModel)
+{
+    m_stateSpaceModel = stateSpaceModel;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setEnsembleModel
+Purpose:  Sets the ensemble whose member errors are saved and restored.
+Receive:  EnsembleModel*, not owned
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void StateSnapshot::setEnsembleModel(EnsembleModel *ensembleModel)
+{
+    m_ensembleModel = ensembleModel;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setMaxAgeSeconds
+Purpose:  Sets how old the newest saved reading may be for the BG and
+          insulin rings to be restored. Older rings would hand the MPC a BG
+          window with a hole in it, so they are left empty and refilled
+          from the database instead. Learned state is always restored.
+Receive:  double maxAgeSeconds
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void StateSnapshot::setMaxAgeSeconds(double maxAgeSeconds)
+{
+    m_maxAgeSeconds = maxAgeSeconds;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     append
+Purpose:  Appends raw bytes to the snapshot being built.
+Receive:  const void* data, int bytes
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void StateSnapshot::append(const void *data, int bytes)
+{
+    const char* begin = static_cast<const char*>(data);
+    m_buffer.insert(m_buffer.end(), begin, begin+bytes);
+}
+
+/*-----------------------------------------------------------------------------
+Name:     beginSection
+Purpose:  Starts a tagged section, its length is filled in by endSection.
+Receive:  const char* tag of 4 characters
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void StateSnapshot::beginSection(const char *tag)
+{
+    unsigned int bytes = 0;
+    append(tag, 4);
+    m_sectionStart = m_buffer.size();
+    append(&bytes, sizeof(bytes));
+}
+
+/*-----------------------------------------------------------------------------
+Name:     endSection
+Purpose:  Writes the length of the current section into its header.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void StateSnapshot::endSection()
+{
+    unsigned int bytes = m_buffer.size()-m_sectionStart-sizeof(unsigned int);
+    memcpy(m_buffer.data()+m_sectionStart, &bytes, sizeof(bytes));
+    m_sectionCount++;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     save
+Purpose:  Writes the current state to a temporary file next to the snapshot,
+          syncs it and renames it over the previous snapshot.
+Receive:  N/A
+Return:   bool true if the new snapshot is on disk
+-----------------------------------------------------------------------------*/
+bool StateSnapshot::save()
+{
+    m_buffer.clear();
+    m_sectionCount = 0;
+    m_buffer.resize(kHeaderBytes);
+    if(m_dataQueue){
+        unsigned int count = m_dataQueue->getQueueSize();
+        beginSection("BGEN");
+        append(&count, sizeof(count));
+        for(int i=0; i<count; i++){
+            BGDataEntry* entry = m_dataQueue->getBGEntryAt(i);
+            BGRecord record = {entry->getSampleTime(), entry->getScrapeTime(),
+                               entry->getDelayTime(), entry->getValue(),
+                               entry->getTrend()};
+            append(&record, sizeof(record));
+        }
+        endSection();
+
+        count = m_dataQueue->getInsulinQueueSize();
+        beginSection("IOBE");
+        append(&count, sizeof(count));
+        for(int i=0; i<count; i++){
+            InsulinDataEntry* entry = m_dataQueue->getInsulinEntryAt(i);
+            InsulinRecord record = {entry->getSampleTime(),
+                                    entry->insulinOnBoard()};
+            append(&record, sizeof(record));
+        }
+        endSection();
+
+        //one curve per reading, laid out like the predictions
+        count = m_dataQueue->getFutureInsulinQueueSize();
+        unsigned int insulinWidth = m_dataQueue->getFutureInsulinWidth();
+        beginSection("FINS");
+        append(&count, sizeof(count));
+        append(&insulinWidth, sizeof(insulinWidth));
+        for(int i=0; i<count; i++){
+            double sampleTime = m_dataQueue->getFutureInsulinTimeAt(i);
+            append(&sampleTime, sizeof(double));
+            append(m_dataQueue->getFutureInsulinAt(i),
+                   insulinWidth*sizeof(double));
+        }
+        endSection();
+
+        //each trajectory is its sample time then width values
+        count = m_dataQueue->getPredictionQueueSize();
+        unsigned int width = m_dataQueue->getPredictionWidth();
+        beginSection("PRED");
+        append(&count, sizeof(count));
+        append(&width, sizeof(width));
+        for(int i=0; i<count; i++){
+            double sampleTime = m_dataQueue->getPredictionTimeAt(i);
+            append(&sampleTime, sizeof(double));
+            append(m_dataQueue->getPredictionAt(i), width*sizeof(double));
+        }
+        endSection();
+
+        const vector<DoseRecord>& doses = m_dataQueue->getDoseHistory();
+        count = doses.size();
+        beginSection("DOSE");
+        append(&count, sizeof(count));
+        append(doses.data(), count*sizeof(DoseRecord));
+        endSection();
+    }
+    if(m_stateSpaceModel){
+        vector<double> state = m_stateSpaceModel->getEstimatorState();
+        unsigned int count = state.size();
+        beginSection("SSRL");
+        append(&count, sizeof(count));
+        append(state.data(), count*sizeof(double));
+        endSection();
+    }
+    if(m_ensembleModel){
+        vector<double> errors = m_ensembleModel->getSquaredErrors();
+        unsigned int count = errors.size();
+        beginSection("ENSE");
+        append(&count, sizeof(count));
+        append(errors.data(), count*sizeof(double));
+        endSection();
+    }
+
+    unsigned int header[4] = {kVersion, m_sectionCount,
+                              (unsigned int)(m_buffer.size()-kHeaderBytes),
+                              checksum(m_buffer.data()+kHeaderBytes,
+                                       m_buffer.size()-kHeaderBytes)};
+    memcpy(m_buffer.data(), kMagic, 4);
+    memcpy(m_buffer.data()+4, header, sizeof(header));
+
+    string temporaryPath = m_path+".tmp";
+    int file = open(temporaryPath.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(file<0){
+        LOG_ERROR("Couldn't write snapshot {}", temporaryPath);
+        return false;
+    }
+    bool written = writeAll(file, m_buffer.data(), m_buffer.size()) &&
+                   fsync(file)==0;
+    if(close(file)!=0 || !written ||
+       rename(temporaryPath.c_str(), m_path.c_str())!=0){
+        LOG_ERROR("Couldn't write snapshot {}", m_path);
+        unlink(temporaryPath.c_str());
+        return false;
+    }
+    //sync the directory so the rename itself survives a power loss
+    size_t slash = m_path.rfind('/');
+    string directory = slash==string::npos ? "." : m_path.substr(0, slash+1);
+    int directoryFile = open(directory.c_str(), O_RDONLY);
+    if(directoryFile>=0){
+        fsync(directoryFile);
+        close(directoryFile);
+    }
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     restoreSection
+Purpose:  Checks one section of a snapshot and, when apply is set, restores
+          it. load checks every section with apply off before it restores
+          any, so a malformed section never leaves the queue or models
+          half restored.
+Receive:  const char* tag, section data and length
+          bool restoreReadings, false if the rings are too old to use
+          bool apply, false to only check the section's sizes
+Return:   bool false if the section is malformed
+-----------------------------------------------------------------------------*/
+bool StateSnapshot::restoreSection(const char *tag, const char *data,
+                                   int bytes, bool restoreReadings,
+                                   bool apply)
+{
+    if(bytes<sizeof(unsigned int)){
+        return false;
+    }
+    unsigned int count = readCount(data);
+    data += sizeof(unsigned int);
+    bytes -= sizeof(unsigned int);
+    if(!memcmp(tag, "BGEN", 4)){
+        if(bytes!=count*sizeof(BGRecord)){
+            return false;
+        }
+        if(!apply || !m_dataQueue || !restoreReadings){
+            return true;
+        }
+        for(int i=0; i<count; i++){
+            BGRecord record;
+            memcpy(&record, data+i*sizeof(BGRecord), sizeof(BGRecord));
+            BGDataEntry* entry = new BGDataEntry();
+            entry->setValue(record.value);
+            entry->setTrend(record.trend);
+            entry->setSampleTime(record.sampleTime);
+            entry->setScrapeTime(record.scrapeTime);
+            entry->setDelayTime(record.delayTime);
+            m_dataQueue->enqueueBGEntry(entry);
+        }
+    }
+    else if(!memcmp(tag, "IOBE", 4)){
+        if(bytes!=count*sizeof(InsulinRecord)){
+            return false;
+        }
+        if(!apply || !m_dataQueue || !restoreReadings){
+            return true;
+        }
+        for(int i=0; i<count; i++){
+            InsulinRecord record;
+            memcpy(&record, data+i*sizeof(InsulinRecord),
+                   sizeof(InsulinRecord));
+            InsulinDataEntry* entry = new InsulinDataEntry();
+            entry->setSampleTime(record.sampleTime);
+            entry->setInsulinOnBoard(record.insulinOnBoard);
+            m_dataQueue->enqueueInsulinEntry(entry);
+        }
+    }
+    else if(!memcmp(tag, "FINS", 4)){
+        if(bytes<sizeof(unsigned int)){
+            return false;
+        }
+        unsigned int width = readCount(data);
+        data += sizeof(unsigned int);
+        bytes -= sizeof(unsigned int);
+        if(!width || bytes!=count*(width+1)*sizeof(double)){
+            return false;
+        }
+        if(!apply || !m_dataQueue || !restoreReadings){
+            return true;
+        }
+        vector<double> values(width);
+        for(int i=0; i<count; i++){
+            double sampleTime;
+            memcpy(&sampleTime, data, sizeof(double));
+            memcpy(values.data(), data+sizeof(double), width*sizeof(double));
+            m_dataQueue->enqueueFutureInsulin(sampleTime, values.data(),
+                                              width);
+            data += (width+1)*sizeof(double);
+        }
+    }
+    else if(!memcmp(tag, "PRED", 4)){
+        if(bytes<sizeof(unsigned int)){
+            return false;
+        }
+        unsigned int width = readCount(data);
+        data += sizeof(unsigned int);
+        bytes -= sizeof(unsigned int);
+        if(!width || bytes!=count*(width+1)*sizeof(double)){
+            return false;
+        }
+        if(!apply || !m_dataQueue || !restoreReadings){
+            return true;
+        }
+        vector<double> trajectory(width);
+        for(int i=0; i<count; i++){
+            double sampleTime;
+            memcpy(&sampleTime, data, sizeof(double));
+            memcpy(trajectory.data(), data+sizeof(double),
+                   width*sizeof(double));
+            m_dataQueue->enqueueBGPrediction(sampleTime, trajectory);
+            data += (width+1)*sizeof(double);
+        }
+    }
+    else if(!memcmp(tag, "DOSE", 4)){
+        if(bytes!=count*sizeof(DoseRecord)){
+            return false;
+        }
+        for(int i=0; apply && m_dataQueue && i<count; i++){
+            DoseRecord dose;
+            memcpy(&dose, data+i*sizeof(DoseRecord), sizeof(DoseRecord));
+            m_dataQueue->recordDose(dose.sampleTime, dose.units);
+        }
+    }
+    else if(!memcmp(tag, "SSRL", 4) || !memcmp(tag, "ENSE", 4)){
+        if(bytes!=count*sizeof(double)){
+            return false;
+        }
+        if(!apply){
+            return true;
+        }
+        vector<double> values(count);
+        memcpy(values.data(), data, bytes);
+        if(tag[0]=='S' && m_stateSpaceModel &&
+           !m_stateSpaceModel->setEstimatorState(values)){
+            LOG_WARNING("Snapshot estimator state doesn't match");
+        }
+        else if(tag[0]=='E' && m_ensembleModel &&
+                !m_ensembleModel->setSquaredErrors(values)){
+            //the members changed (e.g. the LSTM was added), relearn
+            LOG_WARNING("Snapshot ensemble doesn't match");
+        }
+    }
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     load
+Purpose:  Maps the snapshot file, checks the header, the payload checksum
+          and every section's bounds and sizes, and only then restores the
+          sections, so a bad snapshot changes nothing. Meant to be called
+          once at startup before the first scrape.
+Receive:  N/A
+Return:   bool true if a valid snapshot was restored
+-----------------------------------------------------------------------------*/
+bool StateSnapshot::load()
+{
+    int file = open(m_path.c_str(), O_RDONLY);
+    if(file<0){
+        return false;
+    }
+    struct stat status;
+    if(fstat(file, &status)!=0 || status.st_size<kHeaderBytes){
+        close(file);
+        LOG_ERROR("Invalid snapshot {}", m_path);
+        return false;
+    }
+    int size = status.st_size;
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if(mapping==MAP_FAILED){
+        LOG_ERROR("Couldn't map snapshot {}", m_path);
+        return false;
+    }
+    const char* data = static_cast<const char*>(mapping);
+    unsigned int header[4];
+    memcpy(header, data+4, sizeof(header));
+    bool valid = !memcmp(data, kMagic, 4) && header[0]==kVersion &&
+                 header[2]==size-kHeaderBytes &&
+                 header[3]==checksum(data+kHeaderBytes, size-kHeaderBytes);
+
+    //walk the sections once to check their bounds and sizes and find how
+    //old the newest reading is before anything is restored
+    double newestSampleTime = 0.0;
+    int offset = kHeaderBytes;
+    for(int s=0; valid && s<header[1]; s++){
+        if(size-offset<kSectionHeaderBytes){
+            valid = false;
+            break;
+        }
+        int bytes = readCount(data+offset+4);
+        if(bytes<0 || bytes>size-offset-kSectionHeaderBytes){
+            valid = false;
+            break;
+        }
+        const char* section = data+offset+kSectionHeaderBytes;
+        if(!memcmp(data+offset, "BGEN", 4) && bytes>=sizeof(unsigned int)+
+           sizeof(BGRecord)){
+            BGRecord record;
+            memcpy(&record, section+bytes-sizeof(BGRecord), sizeof(BGRecord));
+            newestSampleTime = record.sampleTime;
+        }
+        valid = restoreSection(data+offset, section, bytes, false, false);
+        offset += kSectionHeaderBytes+bytes;
+    }
+    bool restoreReadings = m_dataQueue && !m_dataQueue->getQueueSize() &&
+                           time(nullptr)-newestSampleTime<=m_maxAgeSeconds;
+    offset = kHeaderBytes;
+    for(int s=0; valid && s<header[1]; s++){
+        int bytes = readCount(data+offset+4);
+        restoreSection(data+offset, data+offset+kSectionHeaderBytes, bytes,
+                       restoreReadings, true);
+        offset += kSectionHeaderBytes+bytes;
+    }
+    munmap(mapping, size);
+    if(!valid){
+        LOG_ERROR("Invalid snapshot {}", m_path);
+        return false;
+    }
+    if(!restoreReadings){
+        LOG_INFO("Snapshot readings are stale, refilling from database");
+    }
+    return true;
+}
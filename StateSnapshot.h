@@ -0,0 +1,77 @@
+/******************************************************************************
+** FILE: StateSnapshot.h
+**
+** ABSTRACT:
+** Saves the DataQueue (BG and insulin rings, future IOB,
+** prediction and dose history) and the learned controller
+** state (state space estimator, ensemble errors) to one
+** binary file every cycle, and restores it at startup so
+** a restarted controller is warm immediately instead of
+** after 288 cycles.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** File layout (little endian, version 3):
+**   char[4] "AGSS", uint32 version, uint32 sections,
+**   uint32 payload bytes, uint32 FNV-1a of the payload,
+**   then per section char[4] tag, uint32 bytes, data.
+** Unknown tags are skipped so sections can be added
+** without breaking older readers. The file is written to
+** a temporary name, synced and renamed over the old one
+** so a crash never leaves a torn snapshot, and is read
+** back with mmap.
+**
+******************************************************************************/
+
+#ifndef STATESNAPSHOT_H
+#define STATESNAPSHOT_H
+
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+class DataQueue;
+class StateSpaceModel;
+class EnsembleModel;
+
+class StateSnapshot
+{
+protected:
+    string m_path;
+    DataQueue* m_dataQueue = nullptr;
+    StateSpaceModel* m_stateSpaceModel = nullptr;
+    EnsembleModel* m_ensembleModel = nullptr;
+    double m_maxAgeSeconds = 3600.0;
+    //reused between saves so a cycle doesn't allocate
+    vector<char> m_buffer;
+    int m_sectionStart = 0;
+    unsigned int m_sectionCount = 0;
+
+    void beginSection(const char* tag);
+    void endSection();
+    void append(const void* data, int bytes);
+    bool restoreSection(const char* tag, const char* data, int bytes,
+                        bool restoreReadings, bool apply);
+
+public:
+    explicit StateSnapshot(const string& path);
+    ~StateSnapshot() = default;
+
+    void setDataQueue(DataQueue* dataQueue);
+    void setStateSpaceModel(StateSpaceModel* stateSpaceModel);
+    void setEnsembleModel(EnsembleModel* ensembleModel);
+    void setMaxAgeSeconds(double maxAgeSeconds);
+    bool save();
+    bool load();
+};
+
+#endif // STATESNAPSHOT_H
@@ -16,6 +16,24 @@
 ** 08/10/2019
 **
 ** NOTES:
+** With adaptation enabled, observe() runs one recursive
+** least squares step per new reading on
+**   dBG(t) = S*-A(t) + a1*dBG(t-1) + a2*dBG(t-2) + c
+** where A(t) is the insulin absorbed since the last reading
+** so the sensitivity S and the ARX residual terms follow
+** the patient without offline retraining.
+** Only the trend terms reach the controller: once adapted
+** they carry the projection of every bolus candidate
+** forward, which makes the eventual BG check drop doses
+** while BG is falling. S is reported and used by the
+** tuner but dosing and predict keep the configured
+** sensitivity. The simulated plant's insulin action
+** scales with glucose, so S fitted in closed loop comes
+** out well under the correction factor measured at 200
+** mg/dl and dosing on it overdoses (41% of the time below
+** 70 in the trial without rescue). Carried over 18 steps
+** the trend's constant term biases predictions upwards,
+** so predict doesn't use it.
 **
 ******************************************************************************/
 
@@ -26,23 +44,351 @@
 #include <QDir>
 #include <QTextStream>
 #include <iostream>
+#include <math.h>
 #include "BGDataEntry.h"
 using std::string;
 
+namespace
+{
+//readings further apart than this restart the regressor history
+const double kMaxGapSeconds = 900.0;
+//initial variance of the sensitivity and of the ARX terms
+const double kSensitivityVariance = 100.0;
+const double kResidualVariance = 1.0;
+//largest combined ARX feedback allowed, keeps projections stable
+const double kMaxFeedback = 0.9;
+//rise in insulin on board beyond the reported doses that is still rounding
+const double kDoseTolerance = 0.05;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getAdaptive
+Purpose:  Returns whether observe() adapts the model parameters.
+Receive:  N/A
+Return:   bool
+-----------------------------------------------------------------------------*/
+bool StateSpaceModel::getAdaptive() const
+{
+    return m_adaptive;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setAdaptive
+Purpose:  Turns online adaptation of sensitivity and the ARX residual on or
+          off. While off, or until enough readings have been observed, the
+          model behaves exactly as the fixed sensitivity model.
+Receive:  bool adaptive
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void StateSpaceModel::setAdaptive(bool adaptive)
+{
+    m_adaptive = adaptive;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getInitialSensitivity
+Purpose:  Returns the sensitivity the estimator starts from in mg/dl per unit.
+Receive:  N/A
+Return:   double
+-----------------------------------------------------------------------------*/
+double StateSpaceModel::getInitialSensitivity() const
+{
+    return m_initialSensitivity;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setInitialSensitivity
+Purpose:  Sets the sensitivity the estimator starts from in mg/dl per unit
+          and restarts the estimator.
+Receive:  double sensitivity
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void StateSpaceModel::setInitialSensitivity(double sensitivity)
+{
+    m_initialSensitivity = sensitivity;
+    resetEstimator();
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getForgettingFactor
+Purpose:  Returns the RLS forgetting factor.
+Receive:  N/A
+Return:   double
+-----------------------------------------------------------------------------*/
+double StateSpaceModel::getForgettingFactor() const
+{
+    return m_forgettingFactor;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setForgettingFactor
+Purpose:  Sets the RLS forgetting factor, just below 1. 0.995 weighs the
+          last ~200 readings (about 17 hours), lower values track faster
+          but are noisier.
+Receive:  double forgettingFactor
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void StateSpaceModel::setForgettingFactor(double forgettingFactor)
+{
+    m_forgettingFactor = forgettingFactor;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getEstimatedSensitivity
+Purpose:  Returns the current estimate of the impact of 1 unit of insulin on
+          blood glucose in mg/dl.
+Receive:  N/A
+Return:   double
+-----------------------------------------------------------------------------*/
+double StateSpaceModel::getEstimatedSensitivity() const
+{
+    return m_theta[0];
+}
+
+/*-----------------------------------------------------------------------------
+Name:     isAdapted
+Purpose:  Returns whether adaptation is on and has seen enough readings for
+          the trend terms to enter projections and the estimated
+          sensitivity to be trusted.
+Receive:  N/A
+Return:   bool
+-----------------------------------------------------------------------------*/
+bool StateSpaceModel::isAdapted() const
+{
+    return m_adaptive && m_updates>=m_minUpdates;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getEstimatorState
+Purpose:  Returns everything observe has learned as one flat list so it can
+          be saved and restored across restarts: the parameters, the
+          covariance, the update count and the last readings seen.
+Receive:  N/A
+Return:   vector<double>
+-----------------------------------------------------------------------------*/
+vector<double> StateSpaceModel::getEstimatorState() const
+{
+    vector<double> state;
+    for(int i=0; i<kParameters; i++){
+        state.push_back(m_theta[i]);
+    }
+    for(int i=0; i<kParameters; i++){
+        for(int j=0; j<kParameters; j++){
+            state.push_back(m_covariance[i][j]);
+        }
+    }
+    state.push_back(m_updates);
+    state.push_back(m_initialized);
+    state.push_back(m_observed);
+    state.push_back(m_lastBG);
+    state.push_back(m_lastIOB);
+    state.push_back(m_lastSampleTime);
+    state.push_back(m_lastDelta);
+    state.push_back(m_previousDelta);
+    return state;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setEstimatorState
+Purpose:  Restores a list returned by getEstimatorState.
+Receive:  const vector<double>& state
+Return:   bool false if the list is not the expected length
+-----------------------------------------------------------------------------*/
+bool StateSpaceModel::setEstimatorState(const vector<double> &state)
+{
+    if(state.size()!=kEstimatorStateSize){
+        return false;
+    }
+    int k = 0;
+    for(int i=0; i<kParameters; i++){
+        m_theta[i] = state[k++];
+    }
+    for(int i=0; i<kParameters; i++){
+        for(int j=0; j<kParameters; j++){
+            m_covariance[i][j] = state[k++];
+        }
+    }
+    m_updates = state[k++];
+    m_initialized = state[k++]!=0.0;
+    m_observed = state[k++];
+    m_lastBG = state[k++];
+    m_lastIOB = state[k++];
+    m_lastSampleTime = state[k++];
+    m_lastDelta = state[k++];
+    m_previousDelta = state[k++];
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     resetEstimator
+Purpose:  Puts the parameters back to the initial sensitivity with no ARX
+          residual and a diagonal covariance.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void StateSpaceModel::resetEstimator()
+{
+    for(int i=0; i<kParameters; i++){
+        m_theta[i] = 0.0;
+        for(int j=0; j<kParameters; j++){
+            m_covariance[i][j] = 0.0;
+        }
+        m_covariance[i][i] = kResidualVariance;
+    }
+    m_theta[0] = m_initialSensitivity;
+    m_covariance[0][0] = kSensitivityVariance;
+    m_updates = 0;
+    m_initialized = true;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     observe
+Purpose:  Feeds one new reading from the DataQueue to the estimator. Once
+          three consecutive readings are known this is one recursive least
+          squares step on a 4 parameter regressor, a fixed amount of work
+          per reading. The sensitivity is kept inside a plausible range.
+          The regressor is the insulin absorbed since the last reading, the
+          doses delivered in between less the rise in insulin on board. If
+          insulin on board rose by more than the known doses, a bolus the
+          caller did not report landed in between and the step is skipped
+          rather than read as insulin that raised glucose.
+Receive:  int bg in mg/dl, double insulinOnBoard in units,
+          double sampleTime in seconds since epoch,
+          double dosed units delivered since the last reading
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void StateSpaceModel::observe(int bg, double insulinOnBoard,
+                              double sampleTime, double dosed)
+{
+    if(!m_initialized){
+        resetEstimator();
+    }
+    if(m_observed && (sampleTime<=m_lastSampleTime ||
+                      sampleTime-m_lastSampleTime>kMaxGapSeconds)){
+        //missed readings break the difference equation, start over
+        m_observed = 0;
+    }
+    double delta = bg-m_lastBG;
+    double absorbed = dosed-(insulinOnBoard-m_lastIOB);
+    if(m_adaptive && m_observed>=3 && absorbed>=-kDoseTolerance){
+        double phi[kParameters] = {-absorbed, m_lastDelta,
+                                   m_previousDelta, 1.0};
+        double covariancePhi[kParameters];
+        double denominator = m_forgettingFactor;
+        for(int i=0; i<kParameters; i++){
+            covariancePhi[i] = 0.0;
+            for(int j=0; j<kParameters; j++){
+                covariancePhi[i] += m_covariance[i][j]*phi[j];
+            }
+            denominator += phi[i]*covariancePhi[i];
+        }
+        double error = delta;
+        for(int i=0; i<kParameters; i++){
+            error -= m_theta[i]*phi[i];
+        }
+        for(int i=0; i<kParameters; i++){
+            m_theta[i] += covariancePhi[i]/denominator*error;
+        }
+        //P = (P - K phi' P) / lambda, P symmetric so phi' P = (P phi)'
+        for(int i=0; i<kParameters; i++){
+            for(int j=0; j<kParameters; j++){
+                m_covariance[i][j] = (m_covariance[i][j] -
+                        covariancePhi[i]*covariancePhi[j]/denominator)/
+                        m_forgettingFactor;
+            }
+        }
+        if(m_theta[0]<m_minSensitivity){
+            m_theta[0] = m_minSensitivity;
+        }
+        else if(m_theta[0]>m_maxSensitivity){
+            m_theta[0] = m_maxSensitivity;
+        }
+        double feedback = fabs(m_theta[1])+fabs(m_theta[2]);
+        if(feedback>kMaxFeedback){
+            m_theta[1] *= kMaxFeedback/feedback;
+            m_theta[2] *= kMaxFeedback/feedback;
+        }
+        m_updates++;
+    }
+    if(m_observed){
+        m_previousDelta = m_lastDelta;
+        m_lastDelta = delta;
+    }
+    else{
+        m_previousDelta = 0.0;
+        m_lastDelta = 0.0;
+    }
+    m_lastBG = bg;
+    m_lastIOB = insulinOnBoard;
+    m_lastSampleTime = sampleTime;
+    m_observed++;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     project
+Purpose:  Steps the model forward once per insulin value. At each step the
+          change in plasma insulin concentration is multiplied by the
+          sensitivity and subtracted from BG. With carryTrend set and the
+          estimator adapted, the ARX residual carries the recent BG trend
+          forward as well.
+Receive:  double bg at t=0, insulinInputs plasma insulin curve,
+          double sensitivity in mg/dl per unit, bool carryTrend
+Return:   vector<double> one BG value per insulin value
+-----------------------------------------------------------------------------*/
+vector<double> StateSpaceModel::project(double bg,
+                                        const vector<float> &insulinInputs,
+                                        double sensitivity, bool carryTrend)
+                                        const
+{
+    vector<double> results;
+    bool adapted = carryTrend && isAdapted();
+    double lastDelta = adapted ? m_lastDelta : 0.0;
+    double previousDelta = adapted ? m_previousDelta : 0.0;
+    for(int i = 0;i<insulinInputs.size();i++){
+        //change in plasma insulin concentration, none past the curve's end
+        double delta = 0.0;
+        if(i+1<insulinInputs.size()){
+            delta = insulinInputs[i]-insulinInputs[i+1];
+        }
+        //multiply by sensititivity
+        double change = sensitivity*-1.0*delta;
+        if(adapted){
+            change += m_theta[1]*lastDelta + m_theta[2]*previousDelta +
+                      m_theta[3];
+        }
+        //subtract impact of insulin from bg at t=0 to get bg at t=1
+        bg += change;
+        previousDelta = lastDelta;
+        lastDelta = change;
+        results.push_back(bg);
+    }
+    return results;
+}
+
 /*-----------------------------------------------------------------------------
 Name:     predict
 Purpose:  Runs the prediction model once using input bg and insulin
-          data at t=0.
-Receive:  bgInputs and insulin inputs for the model, sensitivity is constant
-          representing the impact of 1 unit of insulin on blood glucose.
-Return:   vector<double> predictions for future (1 in this case)
+          data at t=0. Projects from the most recent BG with the current
+          plasma insulin curve (t=0 to 90 mins, 19 values) so the result
+          holds one value per 5 minutes of the horizon. Uses the
+          configured sensitivity and no trend, see the notes above.
+Receive:  bgInputs oldest first and insulin inputs for the model
+Return:   vector<double> predictions for future BG (90 mins / 5 = 18 values)
 -----------------------------------------------------------------------------*/
 vector<double> StateSpaceModel::predict(vector<int> bgInputs,
                                         vector<float> insulinInputs,
                                         bool saveFlag){
     vector<double> bgPredictions;
-     bgPredictions.push_back(bgInputs[0]);
-     return bgPredictions;
+    if(!bgInputs.size()){
+        return bgPredictions;
+    }
+    bgPredictions = project(bgInputs[bgInputs.size()-1], insulinInputs,
+                            m_initialSensitivity, false);
+    //the last value of a 19 value curve has no step after it
+    if(bgPredictions.size()>1){
+        bgPredictions.pop_back();
+    }
+    return bgPredictions;
 }
 
 /*-----------------------------------------------------------------------------
@@ -51,9 +397,9 @@ Purpose:  Runs the hypothetical insulin control input supplied to the model
           and gives the projected BG output based on this input. In this case
           we take the change in plasma insulin concentration at each time
           step, multiply by the sensitivity, and subtract it from the
-          current time step to get projected BG. This is how the state space
-          model works, it is recursive. This is not a recursive function but
-          will be in the future.
+          current time step to get projected BG. Once the estimator has
+          adapted, its trend terms are carried forward too; the
+          sensitivity stays the one passed in.
 Receive:  bgInputs and insulin inputs for the model, sensitivity is constant
           representing the impact of 1 unit of insulin on blood glucose.
 Return:   vector<double> predictions for future BG (90 mins / 5 = 18 values)
@@ -62,24 +408,8 @@ vector<double> StateSpaceModel::projectCorrection(vector<double> bgInputs,
                                                   vector<float> insulinInputs,
                                                   int sensitivity)
 {
-    //predict
-    vector<double> results;
-    for(int i = 0;i<insulinInputs.size();i++){
-        //change in plasma insulin concentration
-        double delta = insulinInputs[i]-insulinInputs[i+1];
-        //multiply by sensititivity
-        double multiplicand = sensitivity*-1.0*delta;
-        //current bg t=0
-        double bg;
-        if(results.size()){
-            bg= results[results.size()-1];
-        }
-        else{
-            bg=bgInputs[i];
-        }
-        //subtract impact of insulin from bg at t=0 to get bg at t=1
-        double nextBG = bg + multiplicand;
-        results.push_back(nextBG);
+    if(!bgInputs.size()){
+        return vector<double>();
     }
-    return results;
+    return project(bgInputs[0], insulinInputs, sensitivity, true);
 }
@@ -16,6 +16,24 @@
 ** 08/10/2019
 **
 ** NOTES:
+** With adaptation enabled, observe() runs one recursive
+** least squares step per new reading on
+**   dBG(t) = S*-A(t) + a1*dBG(t-1) + a2*dBG(t-2) + c
+** where A(t) is the insulin absorbed since the last reading
+** so the sensitivity S and the ARX residual terms follow
+** the patient without offline retraining.
+** Only the trend terms reach the controller: once adapted
+** they carry the projection of every bolus candidate
+** forward, which makes the eventual BG check drop doses
+** while BG is falling. S is reported and used by the
+** tuner but dosing and predict keep the configured
+** sensitivity. The simulated plant's insulin action
+** scales with glucose, so S fitted in closed loop comes
+** out well under the correction factor measured at 200
+** mg/dl and dosing on it overdoses (41% of the time below
+** 70 in the trial without rescue). Carried over 18 steps
+** the trend's constant term biases predictions upwards,
+** so predict doesn't use it.
 **
 ******************************************************************************/
 
@@ -26,10 +44,51 @@
 
 class StateSpaceModel : public Model
 {
+protected:
+    static const int kParameters = 4;
+    //parameters, covariance and the 8 counters and readings observe keeps
+    static const int kEstimatorStateSize =
+            kParameters+kParameters*kParameters+8;
+    bool m_adaptive = false;
+    double m_initialSensitivity = 30.0;
+    double m_minSensitivity = 5.0;
+    double m_maxSensitivity = 200.0;
+    double m_forgettingFactor = 0.995;
+    int m_minUpdates = 12;
+    //estimated parameters: sensitivity, a1, a2, c
+    double m_theta[kParameters] = {30.0, 0.0, 0.0, 0.0};
+    double m_covariance[kParameters][kParameters] = {};
+    int m_updates = 0;
+    bool m_initialized = false;
+    //last readings seen by observe
+    int m_observed = 0;
+    double m_lastBG = 0.0;
+    double m_lastIOB = 0.0;
+    double m_lastSampleTime = 0.0;
+    double m_lastDelta = 0.0;
+    double m_previousDelta = 0.0;
+
+    void resetEstimator();
+    vector<double> project(double bg, const vector<float>& insulinInputs,
+                           double sensitivity, bool carryTrend) const;
+
 public:
     StateSpaceModel() = default;
     virtual ~StateSpaceModel() = default;
 
+    bool getAdaptive() const;
+    void setAdaptive(bool adaptive);
+    double getInitialSensitivity() const;
+    void setInitialSensitivity(double sensitivity);
+    double getForgettingFactor() const;
+    void setForgettingFactor(double forgettingFactor);
+    double getEstimatedSensitivity() const;
+    bool isAdapted() const;
+    void observe(int bg, double insulinOnBoard, double sampleTime,
+                 double dosed = 0.0);
+    vector<double> getEstimatorState() const;
+    bool setEstimatorState(const vector<double>& state);
+
     vector<double> predict(vector<int> bgInputs, vector<float> insulinInputs,
                            bool saveFlag);
     vector<double> projectCorrection(vector<double> bgInputs,
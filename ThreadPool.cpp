@@ -0,0 +1,144 @@
+/******************************************************************************
+** FILE: ThreadPool.cpp
+**
+** ABSTRACT:
+** Fixed set of worker threads used to spread independent
+** pieces of work (trees of a forest, scenarios, patients)
+** across every core. The calling thread takes part in the
+** work and parallelFor returns once every index has run.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** Only one parallelFor runs at a time per pool.
+**
+******************************************************************************/
+
+#include "ThreadPool.h"
+
+/*-----------------------------------------------------------------------------
+Name:     ThreadPool
+Purpose:  Constructor. Starts threadCount-1 workers since the thread calling
+          parallelFor does its share of the work.
+Receive:  int threadCount, 0 uses every hardware thread
+Return:   N/A
+-----------------------------------------------------------------------------*/
+ThreadPool::ThreadPool(int threadCount)
+    : m_nextIndex(0)
+{
+    if(threadCount<=0){
+        threadCount = std::thread::hardware_concurrency();
+    }
+    if(threadCount<=0){
+        threadCount = 1;
+    }
+    for(int i=1; i<threadCount; i++){
+        m_workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     ~ThreadPool
+Purpose:  Destructor. Wakes every worker so it can exit and joins them.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    for(int i=0; i<m_workers.size(); i++){
+        m_workers[i].join();
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getThreadCount
+Purpose:  Returns the number of threads that take part in parallelFor,
+          including the caller.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int ThreadPool::getThreadCount() const
+{
+    return m_workers.size()+1;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     parallelFor
+Purpose:  Runs task(i) for every i in [0, count) across the pool. Indices are
+          handed out one at a time from an atomic counter so uneven tasks
+          (deep and shallow trees) still keep every thread busy.
+Receive:  int count, const std::function<void(int)>& task
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ThreadPool::parallelFor(int count, const std::function<void(int)> &task)
+{
+    std::lock_guard<std::mutex> run(m_runMutex);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_task = &task;
+        m_count = count;
+        m_nextIndex = 0;
+        m_activeWorkers = m_workers.size();
+        m_generation++;
+    }
+    m_wake.notify_all();
+    runTasks();
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this](){ return m_activeWorkers==0; });
+    m_task = nullptr;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     runTasks
+Purpose:  Claims indices until the current parallelFor is exhausted.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ThreadPool::runTasks()
+{
+    int index;
+    while((index = m_nextIndex++) < m_count){
+        (*m_task)(index);
+    }
+}
+
+/*-----------------------------------------------------------------------------
+Name:     workerLoop
+Purpose:  Body of each worker thread. Sleeps until a new parallelFor starts,
+          joins in, then reports back when no indices are left.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void ThreadPool::workerLoop()
+{
+    unsigned long seenGeneration = 0;
+    while(true){
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&](){
+                return m_stopping || m_generation!=seenGeneration;
+            });
+            if(m_stopping){
+                return;
+            }
+            seenGeneration = m_generation;
+        }
+        runTasks();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(--m_activeWorkers==0){
+            m_done.notify_one();
+        }
+    }
+}
@@ -0,0 +1,63 @@
+/******************************************************************************
+** FILE: ThreadPool.h
+**
+** ABSTRACT:
+** Fixed set of worker threads used to spread independent
+** pieces of work (trees of a forest, scenarios, patients)
+** across every core. The calling thread takes part in the
+** work and parallelFor returns once every index has run.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** Only one parallelFor runs at a time per pool.
+**
+******************************************************************************/
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+using std::vector;
+
+class ThreadPool
+{
+protected:
+    vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::mutex m_runMutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    const std::function<void(int)>* m_task = nullptr;
+    std::atomic<int> m_nextIndex;
+    int m_count = 0;
+    int m_activeWorkers = 0;
+    unsigned long m_generation = 0;
+    bool m_stopping = false;
+
+    void workerLoop();
+    void runTasks();
+
+public:
+    explicit ThreadPool(int threadCount = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int getThreadCount() const;
+    void parallelFor(int count, const std::function<void(int)>& task);
+};
+
+#endif // THREADPOOL_H
@@ -0,0 +1,208 @@
+/******************************************************************************
+** FILE: TrajectoryRing.cpp
+**
+** ABSTRACT:
+** Fixed-size ring of whole trajectories (one per control
+** cycle) stored back to back in one contiguous buffer,
+** each tagged with the sample time it was made at.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+**
+******************************************************************************/
+
+#include "TrajectoryRing.h"
+#include <algorithm>
+
+/*-----------------------------------------------------------------------------
+Name:     TrajectoryRing
+Purpose:  Constructor. Allocates the whole ring up front.
+Receive:  int width values per trajectory
+          int capacity trajectories kept
+Return:   N/A
+-----------------------------------------------------------------------------*/
+TrajectoryRing::TrajectoryRing(int width, int capacity) :
+    m_width(std::max(width, 1)),
+    m_capacity(std::max(capacity, 1)),
+    m_values(m_width*m_capacity),
+    m_sampleTimes(m_capacity)
+{
+}
+
+/*-----------------------------------------------------------------------------
+Name:     slotOf
+Purpose:  Maps a logical index to its slot in the buffer.
+Receive:  int i, 0 for the oldest
+Return:   int
+-----------------------------------------------------------------------------*/
+int TrajectoryRing::slotOf(int i) const
+{
+    return (m_headIndex+i)%m_capacity;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getWidth
+Purpose:  Returns the number of values per trajectory.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int TrajectoryRing::getWidth() const
+{
+    return m_width;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getCapacity
+Purpose:  Returns the number of trajectories kept.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int TrajectoryRing::getCapacity() const
+{
+    return m_capacity;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     setCapacity
+Purpose:  Resizes the ring, keeping the newest trajectories that fit, oldest
+          first at the start of the new buffer.
+Receive:  int capacity
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void TrajectoryRing::setCapacity(int capacity)
+{
+    capacity = std::max(capacity, 1);
+    int kept = std::min(m_size, capacity);
+    vector<double> values(m_width*capacity);
+    vector<double> sampleTimes(capacity);
+    for(int i=0; i<kept; i++){
+        int slot = slotOf(m_size-kept+i);
+        std::copy(m_values.begin()+slot*m_width,
+                  m_values.begin()+(slot+1)*m_width,
+                  values.begin()+i*m_width);
+        sampleTimes[i] = m_sampleTimes[slot];
+    }
+    m_values.swap(values);
+    m_sampleTimes.swap(sampleTimes);
+    m_capacity = capacity;
+    m_size = kept;
+    m_headIndex = 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getSize
+Purpose:  Returns the number of trajectories held.
+Receive:  N/A
+Return:   int
+-----------------------------------------------------------------------------*/
+int TrajectoryRing::getSize() const
+{
+    return m_size;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     isEmpty
+Purpose:  Returns whether the ring holds no trajectories.
+Receive:  N/A
+Return:   bool
+-----------------------------------------------------------------------------*/
+bool TrajectoryRing::isEmpty() const
+{
+    return !m_size;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     append
+Purpose:  Copies a trajectory into the next slot, overwriting the oldest
+          when full. Short trajectories are padded with their last value
+          and long ones truncated to the width.
+Receive:  double sampleTime the trajectory was made at
+          const double* values, int count
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void TrajectoryRing::append(double sampleTime, const double *values,
+                            int count)
+{
+    if(count<=0){
+        return;
+    }
+    int slot;
+    if(m_size<m_capacity){
+        slot = slotOf(m_size);
+        m_size++;
+    }
+    else{
+        slot = m_headIndex;
+        m_headIndex = (m_headIndex+1)%m_capacity;
+    }
+    double* trajectory = &m_values[slot*m_width];
+    for(int k=0; k<m_width; k++){
+        trajectory[k] = values[std::min(k, count-1)];
+    }
+    m_sampleTimes[slot] = sampleTime;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     append
+Purpose:  Copies a trajectory into the next slot.
+Receive:  double sampleTime, const vector<double>& values
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void TrajectoryRing::append(double sampleTime, const vector<double>& values)
+{
+    append(sampleTime, values.data(), values.size());
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getTrajectoryAt
+Purpose:  Returns the i-th oldest trajectory, getWidth() values long. The
+          pointer is valid until the slot is overwritten.
+Receive:  int i, 0 for the oldest
+Return:   const double*
+-----------------------------------------------------------------------------*/
+const double *TrajectoryRing::getTrajectoryAt(int i) const
+{
+    return &m_values[slotOf(i)*m_width];
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getSampleTimeAt
+Purpose:  Returns the sample time the i-th oldest trajectory was made at.
+Receive:  int i, 0 for the oldest
+Return:   double
+-----------------------------------------------------------------------------*/
+double TrajectoryRing::getSampleTimeAt(int i) const
+{
+    return m_sampleTimes[slotOf(i)];
+}
+
+/*-----------------------------------------------------------------------------
+Name:     getLastTrajectory
+Purpose:  Returns the newest trajectory.
+Receive:  N/A
+Return:   const double*, nullptr when empty
+-----------------------------------------------------------------------------*/
+const double *TrajectoryRing::getLastTrajectory() const
+{
+    return m_size ? getTrajectoryAt(m_size-1) : nullptr;
+}
+
+/*-----------------------------------------------------------------------------
+Name:     clear
+Purpose:  Removes every trajectory. The buffer is kept.
+Receive:  N/A
+Return:   N/A
+-----------------------------------------------------------------------------*/
+void TrajectoryRing::clear()
+{
+    m_size = 0;
+    m_headIndex = 0;
+}
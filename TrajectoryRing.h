@@ -0,0 +1,61 @@
+/******************************************************************************
+** FILE: TrajectoryRing.h
+**
+** ABSTRACT:
+** Fixed-size ring of whole trajectories (one per control
+** cycle) stored back to back in one contiguous buffer,
+** each tagged with the sample time it was made at.
+**
+** DOCUMENTS:
+**
+**
+** AUTHOR:
+** Daniel Webb
+**
+** CREATION DATE:
+** 10/19/2026
+**
+** NOTES:
+** Trajectory i (0 oldest) starts at
+** m_values[((m_headIndex+i)%m_capacity)*m_width]. The
+** buffer is allocated once; appending to a full ring
+** overwrites the oldest trajectory in place.
+**
+******************************************************************************/
+
+#ifndef TRAJECTORYRING_H
+#define TRAJECTORYRING_H
+
+#include <vector>
+using std::vector;
+
+class TrajectoryRing
+{
+protected:
+    int m_width;
+    int m_capacity;
+    int m_size = 0;
+    int m_headIndex = 0;
+    vector<double> m_values;
+    vector<double> m_sampleTimes;
+
+    int slotOf(int i) const;
+
+public:
+    explicit TrajectoryRing(int width = 18, int capacity = 288);
+    ~TrajectoryRing() = default;
+
+    int getWidth() const;
+    int getCapacity() const;
+    void setCapacity(int capacity);
+    int getSize() const;
+    bool isEmpty() const;
+    void append(double sampleTime, const double* values, int count);
+    void append(double sampleTime, const vector<double>& values);
+    const double* getTrajectoryAt(int i) const;
+    double getSampleTimeAt(int i) const;
+    const double* getLastTrajectory() const;
+    void clear();
+};
+
+#endif // TRAJECTORYRING_H